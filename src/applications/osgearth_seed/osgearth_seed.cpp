@@ -80,6 +80,8 @@ usage( const std::string& msg )
         << "        [--bounds xmin ymin xmax ymax]  ; Geospatial bounding box to seed" << std::endl
         << "        [--cache-path path]             ; Overrides the cache path in the .earth file" << std::endl
         << "        [--cache-type type]             ; Overrides the cache type in the .earth file" << std::endl
+        << "        [--threads num]                 ; Number of threads to seed with (default=1)" << std::endl
+        << "        [--checkpoint file]             ; Records progress in a file, and resumes from it if it exists" << std::endl
         //<< std::endl
         //<< "    --purge file.earth                  ; Purges cached data from the cache in a .earth file" << std::endl
         //<< "        [--layer name]                  ; Named layer for which to purge the cache" << std::endl
@@ -123,6 +125,14 @@ seed( osg::ArgumentParser& args )
     std::string cacheType;
     while (args.read("--cache-type", cacheType));
 
+    //Read the number of threads
+    unsigned int numThreads = 1;
+    while (args.read("--threads", numThreads));
+
+    //Read the checkpoint file
+    std::string checkpointFile;
+    while (args.read("--checkpoint", checkpointFile));
+
     bool quiet = args.read("--quiet");
 
     //Read in the earth file.
@@ -138,6 +148,8 @@ seed( osg::ArgumentParser& args )
     seeder.setMinLevel( minLevel );
     seeder.setMaxLevel( maxLevel );
     seeder.setBounds( bounds );
+    seeder.setNumThreads( numThreads );
+    seeder.setCheckpointFile( checkpointFile );
     if (!quiet)
     {
         seeder.setProgressCallback(new ConsoleProgressCallback);
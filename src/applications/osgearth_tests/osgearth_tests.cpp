@@ -22,102 +22,3819 @@
 
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
 
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+
+#include <osgEarth/Containers>
+#include <osgEarth/HTTPClient>
+#include <osgEarth/ImageUtils>
 #include <osgEarth/Map>
 #include <osgEarth/Registry>
+#include <osgEarth/SpatialReference>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <osgEarth/TileSource>
+
+#include <osgEarthFeatures/ExtrudeGeometryFilter>
+#include <osgEarthFeatures/FeatureSource>
+#include <osgEarthFeatures/FeatureCursor>
 
 #include <osgEarthDrivers/gdal/GDALOptions>
 #include <osgEarthDrivers/arcgis/ArcGISOptions>
 #include <osgEarthDrivers/tms/TMSOptions>
+#include <osgEarthDrivers/cache_pack/PackCacheOptions>
+#include <osgEarthDrivers/cache_sqlite3/Sqlite3CacheOptions>
+#include <osgEarthDrivers/feature_wfs/WFSFeatureOptions>
+
+#include <gdal.h>
+#include <ogr_srs_api.h>
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+
+#ifdef WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  define NOMINMAX
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#  include <sys/types.h>
+#  include <sys/resource.h>
+#  include <sys/socket.h>
+#  include <sys/select.h>
+#  include <netinet/in.h>
+#  include <arpa/inet.h>
+#  include <unistd.h>
+#endif
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <set>
+#include <sstream>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
 
 using namespace osg;
 using namespace osgDB;
 using namespace osgEarth;
 using namespace osgEarth::Drivers;
 
-int main(int argc, char** argv)
+// Usage: osgearth_tests [--test <name>]... [--offline] [--list]
+//
+// Runs every test, or just the named ones. --offline skips the tests that need
+// a network connection. Tests that read local data expect to run from a
+// directory next to the "data" folder (e.g. bin/). The exit code is non-zero
+// if any check failed.
+
+namespace
 {
-  osg::ArgumentParser arguments(&argc,argv);
-
-  //One to one test.  Read a single 1 to 1 tile out of a MapLayer
-  {
-      GDALOptions driverOpt;
-      driverOpt.url() = "../data/world.tif";
-
-      ImageLayerOptions layerOpt;
-      layerOpt.driver() = driverOpt;
-      layerOpt.name() = "test_simple";
-
-      osg::ref_ptr<ImageLayer> layer = new ImageLayer( layerOpt );
-
-      TileKey key(0, 0, 0, layer->getProfile());
-	  GeoImage image = layer->createImage( key );
-	  osgDB::writeImageFile(*image.getImage(), layer->getName()+key.str() + std::string(".png"));
-  }
-
-  //Mosaic test.  Request a tile in the global geodetic profile from a layer with a geographic SRS but a different tiling scheme.
-  {
-      ArcGISOptions driverOpt;
-      driverOpt.url() = "http://server.arcgisonline.com/ArcGIS/rest/services/ESRI_Imagery_World_2D/MapServer";
-
-      ImageLayerOptions layerOpt;
-      layerOpt.driver() = driverOpt;
-      layerOpt.name() = "test_mosaic";
-
-      osg::ref_ptr<ImageLayer> layer = new ImageLayer( layerOpt );
-
-      TileKey key(0, 0, 0, osgEarth::Registry::instance()->getGlobalGeodeticProfile());
-	  GeoImage image = layer->createImage( key );
-	  osgDB::writeImageFile(*image.getImage(), layer->getName()+key.str() + std::string(".png"));
-  }
-
-  //Reprojection.  Request a UTM image from a global geodetic profile
-  {
-      ArcGISOptions driverOpt;
-      driverOpt.url() = "http://server.arcgisonline.com/ArcGIS/rest/services/ESRI_Imagery_World_2D/MapServer";
-
-      ImageLayerOptions layerOpt;
-      layerOpt.name() = "test_reprojected_utm";
-      layerOpt.driver() = driverOpt;
-      layerOpt.reprojectedTileSize() = 512;
-
-      osg::ref_ptr<ImageLayer> layer = new ImageLayer( layerOpt );
-
-      TileKey key(0, 0, 0, Profile::create("epsg:26917", 560725, 4385762, 573866, 4400705));
-	  GeoImage image = layer->createImage( key );
-	  osgDB::writeImageFile(*image.getImage(), layer->getName()+key.str() + std::string(".png"));
-  }
-
-
-  //Mercator.  Request a geodetic reprojected image from a mercator source
-  {
-      TMSOptions driverOpt;
-      driverOpt.url() = "http://tile.openstreetmap.org";
-      driverOpt.format() = "png";
-      driverOpt.tileSize() = 256;
-      driverOpt.tmsType() = "google";
-
-      ImageLayerOptions layerOpt;
-      layerOpt.driver() = driverOpt;
-      layerOpt.name() = "test_mercator_reprojected";
-      layerOpt.reprojectedTileSize() = 256;
-      layerOpt.exactCropping() = true;
-      layerOpt.profile() = ProfileOptions( "global-mercator" );
-
-      osg::ref_ptr<ImageLayer> layer = new ImageLayer( layerOpt );
-
-	  //Request an image from the mercator source.  Should be reprojected to geodetic
-	  TileKey key(0, 0, 0, osgEarth::Registry::instance()->getGlobalGeodeticProfile());
-	  GeoImage image = layer->createImage( key );
-	  if (!image.getSRS()->isGeographic())
-	  {
-		  OE_NOTICE << "Error:  Should have reprojected image to geodetic but returned SRS is  " << image.getSRS()->getWKT() << std::endl;
-	  }
-	  osgDB::writeImageFile(*image.getImage(), layer->getName()+key.str() + std::string(".png"));
-  }
-
-  return 0;
+    int s_failures = 0;
+
+    // records a failed check.
+    bool check( bool ok, const std::string& what )
+    {
+        if ( !ok )
+        {
+            OE_WARN << "  FAILED: " << what << std::endl;
+            ++s_failures;
+        }
+        return ok;
+    }
+
+    void writeImage( const GeoImage& image, const std::string& name )
+    {
+        if ( check( image.valid(), "got an image for " + name ) )
+            osgDB::writeImageFile( *image.getImage(), name + std::string(".png") );
+    }
+
+    /** Runs a copy of a job on its own thread. */
+    template<typename JOB>
+    struct JobThread : public OpenThreads::Thread
+    {
+        JOB _job;
+        void run() { _job(); }
+    };
+
+    /** Runs each job on its own thread, waits for them all, and copies the jobs back. */
+    template<typename JOB>
+    void runOnThreads( std::vector<JOB>& jobs )
+    {
+        std::vector< JobThread<JOB>* > threads;
+        for( unsigned i = 0; i < jobs.size(); ++i )
+        {
+            threads.push_back( new JobThread<JOB>() );
+            threads.back()->_job = jobs[i];
+        }
+        for( unsigned i = 0; i < threads.size(); ++i )
+            threads[i]->start();
+        for( unsigned i = 0; i < threads.size(); ++i )
+        {
+            threads[i]->join();
+            jobs[i] = threads[i]->_job;
+            delete threads[i];
+        }
+    }
+
+    //------------------------------------------------------------------------
+
+    //One to one test.  Read a single 1 to 1 tile out of a MapLayer
+    void testSimple()
+    {
+        GDALOptions driverOpt;
+        driverOpt.url() = "../data/world.tif";
+
+        ImageLayerOptions layerOpt;
+        layerOpt.driver() = driverOpt;
+        layerOpt.name() = "test_simple";
+
+        osg::ref_ptr<ImageLayer> layer = new ImageLayer( layerOpt );
+
+        TileKey key(0, 0, 0, layer->getProfile());
+        GeoImage image = layer->createImage( key );
+        writeImage( image, layer->getName()+key.str() );
+    }
+
+    //Mosaic test.  Request a tile in the global geodetic profile from a layer with a geographic SRS but a different tiling scheme.
+    void testMosaic()
+    {
+        ArcGISOptions driverOpt;
+        driverOpt.url() = "http://server.arcgisonline.com/ArcGIS/rest/services/ESRI_Imagery_World_2D/MapServer";
+
+        ImageLayerOptions layerOpt;
+        layerOpt.driver() = driverOpt;
+        layerOpt.name() = "test_mosaic";
+
+        osg::ref_ptr<ImageLayer> layer = new ImageLayer( layerOpt );
+
+        TileKey key(0, 0, 0, osgEarth::Registry::instance()->getGlobalGeodeticProfile());
+        GeoImage image = layer->createImage( key );
+        writeImage( image, layer->getName()+key.str() );
+    }
+
+    //Reprojection.  Request a UTM image from a global geodetic profile
+    void testReprojectedUTM()
+    {
+        ArcGISOptions driverOpt;
+        driverOpt.url() = "http://server.arcgisonline.com/ArcGIS/rest/services/ESRI_Imagery_World_2D/MapServer";
+
+        ImageLayerOptions layerOpt;
+        layerOpt.name() = "test_reprojected_utm";
+        layerOpt.driver() = driverOpt;
+        layerOpt.reprojectedTileSize() = 512;
+
+        osg::ref_ptr<ImageLayer> layer = new ImageLayer( layerOpt );
+
+        TileKey key(0, 0, 0, Profile::create("epsg:26917", 560725, 4385762, 573866, 4400705));
+        GeoImage image = layer->createImage( key );
+        writeImage( image, layer->getName()+key.str() );
+    }
+
+    //Mercator.  Request a geodetic reprojected image from a mercator source
+    void testMercator()
+    {
+        TMSOptions driverOpt;
+        driverOpt.url() = "http://tile.openstreetmap.org";
+        driverOpt.format() = "png";
+        driverOpt.tileSize() = 256;
+        driverOpt.tmsType() = "google";
+
+        ImageLayerOptions layerOpt;
+        layerOpt.driver() = driverOpt;
+        layerOpt.name() = "test_mercator_reprojected";
+        layerOpt.reprojectedTileSize() = 256;
+        layerOpt.exactCropping() = true;
+        layerOpt.profile() = ProfileOptions( "global-mercator" );
+
+        osg::ref_ptr<ImageLayer> layer = new ImageLayer( layerOpt );
+
+        //Request an image from the mercator source.  Should be reprojected to geodetic
+        TileKey key(0, 0, 0, osgEarth::Registry::instance()->getGlobalGeodeticProfile());
+        GeoImage image = layer->createImage( key );
+        if ( check( image.valid(), "got a mercator image" ) )
+        {
+            if ( !check( image.getSRS()->isGeographic(), "mercator image was reprojected to geodetic" ) )
+            {
+                OE_NOTICE << "Error:  Should have reprojected image to geodetic but returned SRS is  " << image.getSRS()->getWKT() << std::endl;
+            }
+        }
+        writeImage( image, layer->getName()+key.str() );
+    }
+
+    //------------------------------------------------------------------------
+
+    // reads a share of the keys (every _step'th, from _first) from a layer.
+    struct ReadTiles
+    {
+        ImageLayer*                 _layer;
+        const std::vector<TileKey>* _keys;
+        unsigned                    _first, _step, _valid;
+
+        void operator()()
+        {
+            for( unsigned i = _first; i < _keys->size(); i += _step )
+            {
+                if ( _layer->createImage( (*_keys)[i] ).valid() )
+                    ++_valid;
+            }
+        }
+    };
+
+    ImageLayer* createWorldLayer( unsigned readerPoolSize )
+    {
+        GDALOptions driverOpt;
+        driverOpt.url() = "../data/world.tif";
+        if ( readerPoolSize > 0 )
+            driverOpt.readerPoolSize() = readerPoolSize;
+
+        ImageLayerOptions layerOpt;
+        layerOpt.driver() = driverOpt;
+        layerOpt.name() = "test_gdal_threads";
+        return new ImageLayer( layerOpt );
+    }
+
+    // reads the keys on "numThreads" threads from a fresh layer (so nothing is cached)
+    // and returns the elapsed time in seconds.
+    double timeTileReads( unsigned readerPoolSize, unsigned numThreads, const std::vector<TileKey>& keys )
+    {
+        osg::ref_ptr<ImageLayer> layer = createWorldLayer( readerPoolSize );
+
+        std::vector<ReadTiles> jobs( numThreads );
+        for( unsigned i = 0; i < numThreads; ++i )
+        {
+            jobs[i]._layer = layer.get();
+            jobs[i]._keys  = &keys;
+            jobs[i]._first = i;
+            jobs[i]._step  = numThreads;
+            jobs[i]._valid = 0;
+        }
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        runOnThreads( jobs );
+        double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        unsigned valid = 0;
+        for( unsigned i = 0; i < jobs.size(); ++i )
+            valid += jobs[i]._valid;
+        check( valid == keys.size(), "read every world.tif tile" );
+
+        return seconds;
+    }
+
+    // Reading world.tif from many threads, with and without the GDAL driver's reader pool.
+    // Checks that pooled reads return the same pixels and reports how each mode scales.
+    void testGDALThreads()
+    {
+        osg::ref_ptr<ImageLayer> probe = createWorldLayer( 0 );
+        if ( !check( probe->getProfile() != 0L, "opened ../data/world.tif" ) )
+            return;
+
+        std::vector<TileKey> keys;
+        unsigned lod = 3, tilesWide, tilesHigh;
+        probe->getProfile()->getNumTiles( lod, tilesWide, tilesHigh );
+        for( unsigned y = 0; y < tilesHigh; ++y )
+            for( unsigned x = 0; x < tilesWide; ++x )
+                keys.push_back( TileKey(lod, x, y, probe->getProfile()) );
+
+        // the pool must not change the result.
+        {
+            osg::ref_ptr<ImageLayer> pooled = createWorldLayer( 4 );
+            unsigned step = osg::maximum( (unsigned)keys.size()/4, 1u );
+            for( unsigned i = 0; i < keys.size(); i += step )
+            {
+                GeoImage a = probe->createImage( keys[i] );
+                GeoImage b = pooled->createImage( keys[i] );
+                bool same =
+                    a.valid() && b.valid() &&
+                    a.getImage()->getTotalSizeInBytes() == b.getImage()->getTotalSizeInBytes() &&
+                    ::memcmp( a.getImage()->data(), b.getImage()->data(), a.getImage()->getTotalSizeInBytes() ) == 0;
+                check( same, "pooled read of " + keys[i].str() + " matches the locked read" );
+            }
+        }
+
+        unsigned threadCounts[] = { 1, 2, 4, 8 };
+        for( unsigned i = 0; i < sizeof(threadCounts)/sizeof(threadCounts[0]); ++i )
+        {
+            unsigned n = threadCounts[i];
+            double locked = timeTileReads( 0, n, keys );
+            double pooled = timeTileReads( n, n, keys );
+            OE_NOTICE << "  " << keys.size() << " tiles on " << n << " thread(s): "
+                << "locked " << locked << "s, pooled " << pooled << "s" << std::endl;
+        }
+    }
+
+    // a surface that bilinear (and "average") interpolation reproduces exactly,
+    // in pixel coordinates.
+    double heightSurface( double col, double row )
+    {
+        return 100.0 + 2.0*col + 3.0*row + 0.01*col*row;
+    }
+
+    // writes a global, float32 WGS84 GeoTIFF holding heightSurface().
+    bool writeHeightSurface( const std::string& filename, int width, int height )
+    {
+        GDALAllRegister();
+        GDALDriverH driver = GDALGetDriverByName( "GTiff" );
+        if ( !driver )
+            return false;
+
+        GDALDatasetH ds = GDALCreate( driver, filename.c_str(), width, height, 1, GDT_Float32, 0L );
+        if ( !ds )
+            return false;
+
+        double geotransform[6] = { -180.0, 360.0/(double)width, 0.0, 90.0, 0.0, -180.0/(double)height };
+        GDALSetGeoTransform( ds, geotransform );
+        GDALSetProjection( ds, SRS_WKT_WGS84 );
+
+        std::vector<float> row( width );
+        bool ok = true;
+        for( int r = 0; r < height && ok; ++r )
+        {
+            for( int c = 0; c < width; ++c )
+                row[c] = (float)heightSurface( c, r );
+            ok = GDALRasterIO( GDALGetRasterBand(ds, 1), GF_Write, 0, r, width, 1, &row[0], width, 1, GDT_Float32, 0, 0 ) == CE_None;
+        }
+        GDALClose( ds );
+        return ok;
+    }
+
+    // compares a heightfield tile with heightSurface() at every interior sample;
+    // returns the number of samples that differ.
+    unsigned checkHeightSurface( const osg::HeightField* hf, const TileKey& key, int width, int height )
+    {
+        double xmin, ymin, xmax, ymax;
+        key.getExtent().getBounds( xmin, ymin, xmax, ymax );
+        unsigned cols = hf->getNumColumns(), rows = hf->getNumRows();
+        double dx = (xmax - xmin) / (cols-1), dy = (ymax - ymin) / (rows-1);
+
+        unsigned errors = 0;
+        for( unsigned r = 0; r < rows; ++r )
+        {
+            for( unsigned c = 0; c < cols; ++c )
+            {
+                // pixel position, where 0 is the center of the first pixel.
+                double pc = (xmin + dx*c + 180.0) / (360.0/(double)width) - 0.5;
+                double pr = (90.0 - (ymin + dy*r)) / (180.0/(double)height) - 0.5;
+                if ( pc < 0.01 || pr < 0.01 || pc > width-1.01 || pr > height-1.01 )
+                    continue;
+
+                double expected = heightSurface( pc, pr );
+                if ( fabs(hf->getHeight(c, r) - expected) > 1e-5 * expected + 0.01 )
+                    ++errors;
+            }
+        }
+        return errors;
+    }
+
+    // GDAL heightfield sampling: tiles read through the single windowed RasterIO
+    // (small windows) and through per-sample reads (low LODs, where the window would be
+    // too big) must both reproduce the source surface, so they agree with each other.
+    void testGDALHeightField()
+    {
+        const std::string filename = "osgearth_tests_heights.tif";
+        const int width = 1024, height = 512;
+        if ( !check( writeHeightSurface(filename, width, height), "wrote the test GeoTIFF" ) )
+            return;
+
+        GDALOptions options;
+        options.url() = filename;
+        options.tileSize() = 17;
+        osg::ref_ptr<TileSource> source = TileSourceFactory::create( options );
+        if ( !check( source.valid(), "created the GDAL tile source" ) )
+            return;
+        source->initialize( "" );
+        if ( !check( source->getProfile() != 0L, "opened the test GeoTIFF" ) )
+            return;
+
+        // With 17x17 samples, the windowed read is used up to 16 * 17 * 17 pixels:
+        // a 64-pixel tile (LOD 3) qualifies, a 128-pixel tile (LOD 2) doesn't.
+        struct Case { unsigned lod; const char* path; } cases[] = { { 3, "windowed" }, { 2, "per-sample" } };
+        for( unsigned i = 0; i < 2; ++i )
+        {
+            unsigned tilesWide, tilesHigh;
+            source->getProfile()->getNumTiles( cases[i].lod, tilesWide, tilesHigh );
+
+            unsigned errors = 0, tiles = 0;
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            for( unsigned y = 0; y < tilesHigh; ++y )
+            {
+                for( unsigned x = 0; x < tilesWide; ++x )
+                {
+                    TileKey key( cases[i].lod, x, y, source->getProfile() );
+                    osg::ref_ptr<osg::HeightField> hf = source->createHeightField( key );
+                    if ( hf.valid() )
+                        errors += checkHeightSurface( hf.get(), key, width, height );
+                    else
+                        ++errors;
+                    ++tiles;
+                }
+            }
+            double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            check( errors == 0, std::string(cases[i].path) + " tiles match the source surface" );
+
+            std::stringstream buf;
+            buf << cases[i].path << ": " << tiles << " tiles at LOD " << cases[i].lod << ", "
+                << (ms * 1000.0 / tiles) << "us per 17x17 tile";
+            OE_NOTICE << "  " << buf.str() << std::endl;
+        }
+
+        source = 0L;
+        ::remove( filename.c_str() );
+    }
+
+    //------------------------------------------------------------------------
+
+    // transforms a share of the points, a chunk at a time, like a feature or
+    // terrain builder would.
+    struct TransformPoints
+    {
+        const SpatialReference* _from;
+        const SpatialReference* _to;
+        const SpatialReference* _then;   // optional second leg, from _to
+        double                  _west, _south, _step;
+        unsigned                _cols, _rows;
+        unsigned                _numPoints;
+        unsigned                _failures;
+        std::vector<double>     _firstX, _firstY; // the first chunk's results
+
+        void operator()()
+        {
+            const unsigned chunk = 10000;
+            std::vector<double> x( chunk ), y( chunk );
+            _failures = 0;
+
+            for( unsigned start = 0; start < _numPoints; start += chunk )
+            {
+                unsigned n = osg::minimum( chunk, _numPoints - start );
+                for( unsigned i = 0; i < n; ++i )
+                {
+                    // a grid of points, the same for every thread:
+                    unsigned k = (start + i) % (_cols * _rows);
+                    x[i] = _west  + _step * (double)(k % _cols);
+                    y[i] = _south + _step * (double)(k / _cols);
+                }
+                if ( !_from->transformPoints( _to, &x[0], &y[0], n ) ||
+                     (_then && !_to->transformPoints( _then, &x[0], &y[0], n )) )
+                    ++_failures;
+
+                if ( start == 0 )
+                {
+                    _firstX.assign( x.begin(), x.begin()+n );
+                    _firstY.assign( y.begin(), y.begin()+n );
+                }
+            }
+        }
+    };
+
+    // Transforms 10M points on one thread and then on several, checking that every
+    // thread gets the single-threaded result and reporting the throughput.
+    void runTransformThreads( const std::string& what, const TransformPoints& proto )
+    {
+        const unsigned numPoints = 10000000;
+
+        unsigned cores = osg::maximum( OpenThreads::GetNumberOfProcessors(), 2 );
+        unsigned threadCounts[] = { 1, cores };
+        std::vector<double> refX, refY;
+        double single = 0.0;
+
+        for( unsigned t = 0; t < 2; ++t )
+        {
+            unsigned n = threadCounts[t];
+            std::vector<TransformPoints> jobs( n, proto );
+            for( unsigned i = 0; i < n; ++i )
+            {
+                jobs[i]._numPoints = numPoints / n + (i < numPoints % n ? 1 : 0);
+                jobs[i]._failures  = 0;
+            }
+
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            runOnThreads( jobs );
+            double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+            for( unsigned i = 0; i < n; ++i )
+            {
+                check( jobs[i]._failures == 0, what + ": every chunk transformed" );
+                if ( refX.empty() )
+                {
+                    refX = jobs[i]._firstX;
+                    refY = jobs[i]._firstY;
+                }
+                else
+                {
+                    check( jobs[i]._firstX == refX && jobs[i]._firstY == refY,
+                           what + ": a thread's results match the single-threaded results" );
+                }
+            }
+
+            if ( n == 1 )
+                single = seconds;
+
+            std::stringstream buf;
+            buf << what << ": " << numPoints << " points on " << n << " thread(s): " << seconds << "s ("
+                << (unsigned)((double)numPoints / seconds) << " points/s";
+            if ( n > 1 )
+                buf << ", speedup " << (single / seconds);
+            buf << ")";
+            OE_NOTICE << "  " << buf.str() << std::endl;
+        }
+    }
+
+    // Multithreaded transforms through OGR: geographic to ellipsoidal mercator (which
+    // has no closed-form kernel) over most of the world, and then on to UTM zone 33N
+    // for points around that zone.
+    void testTransformThreads()
+    {
+        osg::ref_ptr<SpatialReference> geo  = SpatialReference::create( "+proj=longlat +datum=WGS84 +no_defs" );
+        osg::ref_ptr<SpatialReference> merc = SpatialReference::create( "+proj=merc +lon_0=0 +k=1 +x_0=0 +y_0=0 +datum=WGS84 +units=m +no_defs" );
+        osg::ref_ptr<SpatialReference> utm  = SpatialReference::create( "+proj=utm +zone=33 +datum=WGS84 +units=m +no_defs" );
+        if ( !check( geo.valid() && merc.valid() && utm.valid(), "created the SRS's" ) )
+            return;
+
+        TransformPoints job;
+        job._from  = geo.get();
+        job._to    = merc.get();
+        job._then  = 0L;
+        job._west  = -179.5;
+        job._south = -79.5;
+        job._step  = 1.0;
+        job._cols  = 360;
+        job._rows  = 160;
+        job._numPoints = 0;
+        job._failures  = 0;
+        runTransformThreads( "geographic -> mercator", job );
+
+        job._then  = utm.get();
+        job._west  = 9.05;
+        job._south = -79.95;
+        job._step  = 0.1;
+        job._cols  = 120;
+        job._rows  = 1600;
+        runTransformThreads( "geographic -> mercator -> UTM 33N", job );
+    }
+
+    //------------------------------------------------------------------------
+
+    // transforms points with OGR directly, as the reference for the closed-form kernels.
+    bool ogrTransform( const std::string& from, const std::string& to, std::vector<double>& x, std::vector<double>& y )
+    {
+        GDAL_SCOPED_LOCK;
+        void* fromHandle = OSRNewSpatialReference( 0L );
+        void* toHandle   = OSRNewSpatialReference( 0L );
+        bool ok = false;
+        if ( OSRImportFromProj4( fromHandle, from.c_str() ) == OGRERR_NONE &&
+             OSRImportFromProj4( toHandle,   to.c_str()   ) == OGRERR_NONE )
+        {
+            void* xform = OCTNewCoordinateTransformation( fromHandle, toHandle );
+            if ( xform )
+            {
+                std::vector<double> z( x.size(), 0.0 );
+                ok = OCTTransform( xform, x.size(), &x[0], &y[0], &z[0] ) != 0;
+                OCTDestroyCoordinateTransformation( xform );
+            }
+        }
+        OSRDestroySpatialReference( fromHandle );
+        OSRDestroySpatialReference( toHandle );
+        return ok;
+    }
+
+    void makeGrid( double x0, double y0, double dx, double dy, unsigned cols, unsigned rows,
+                   std::vector<double>& x, std::vector<double>& y )
+    {
+        for( unsigned r = 0; r < rows; ++r )
+        {
+            for( unsigned c = 0; c < cols; ++c )
+            {
+                x.push_back( x0 + dx*(double)c );
+                y.push_back( y0 + dy*(double)r );
+            }
+        }
+    }
+
+    // compares osgEarth's transform of some points between two SRS's to OGR's.
+    void checkAgainstOGR( const std::string& from, const std::string& to,
+                          const std::vector<double>& points_x, const std::vector<double>& points_y,
+                          double tolerance, const std::string& what )
+    {
+        std::vector<double> x = points_x, y = points_y;
+        std::vector<double> ox = points_x, oy = points_y;
+
+        osg::ref_ptr<SpatialReference> fromSRS = SpatialReference::create( from );
+        osg::ref_ptr<SpatialReference> toSRS   = SpatialReference::create( to );
+        if ( !check( fromSRS.valid() && toSRS.valid(), what + ": created the SRS's" ) )
+            return;
+
+        check( fromSRS->transformPoints( toSRS.get(), &x[0], &y[0], x.size() ), what + ": osgEarth transform" );
+        if ( !check( ogrTransform( from, to, ox, oy ), what + ": OGR transform" ) )
+            return;
+
+        double maxErr = 0.0;
+        for( unsigned i = 0; i < x.size(); ++i )
+            maxErr = osg::maximum( maxErr, osg::maximum( fabs(x[i]-ox[i]), fabs(y[i]-oy[i]) ) );
+
+        std::stringstream buf;
+        buf << what << ": max difference from OGR " << maxErr << " (tolerance " << tolerance << ")";
+        OE_NOTICE << "  " << buf.str() << std::endl;
+        check( maxErr <= tolerance, buf.str() );
+    }
+
+    // The UTM kernel against OGR, both ways, across a northern and a southern zone.
+    // The kernel should stay within a millimeter of PROJ inside the zone (1e-8
+    // degrees is about a millimeter).
+    void testUTMKernel()
+    {
+        const std::string geo    = "+proj=longlat +datum=WGS84 +no_defs";
+        const std::string utm17n = "+proj=utm +zone=17 +datum=WGS84 +units=m +no_defs";
+        const std::string utm33s = "+proj=utm +zone=33 +south +datum=WGS84 +units=m +no_defs";
+
+        // zone 17 spans -84..-78 longitude, zone 33 spans 12..18:
+        std::vector<double> nx, ny, sx, sy;
+        makeGrid( -83.9,   0.5, 0.2, 2.0, 30, 42, nx, ny );
+        makeGrid(  12.1, -79.5, 0.2, 2.0, 30, 40, sx, sy );
+
+        checkAgainstOGR( geo, utm17n, nx, ny, 0.001, "geographic to UTM 17N" );
+        checkAgainstOGR( geo, utm33s, sx, sy, 0.001, "geographic to UTM 33S" );
+
+        // and back, from the same points (so they stay inside the zones):
+        if ( check( ogrTransform( geo, utm17n, nx, ny ) && ogrTransform( geo, utm33s, sx, sy ), "OGR transform to UTM" ) )
+        {
+            checkAgainstOGR( utm17n, geo, nx, ny, 1e-8, "UTM 17N to geographic" );
+            checkAgainstOGR( utm33s, geo, sx, sy, 1e-8, "UTM 33S to geographic" );
+        }
+    }
+
+    //------------------------------------------------------------------------
+
+    typedef LRUCache<unsigned, int> IntCache;
+
+    // hammers a shared cache with inserts and lookups.
+    struct UseCache
+    {
+        IntCache* _cache;
+        unsigned  _seed;
+        unsigned  _ops;
+        unsigned  _errors; // lookups that returned the wrong value
+
+        void operator()()
+        {
+            unsigned r = _seed;
+            for( unsigned i = 0; i < _ops; ++i )
+            {
+                r = r * 1664525u + 1013904223u;
+                unsigned key = (r >> 8) % 5000;
+                if ( r & 1 )
+                    _cache->insert( key, (int)key, 1 + key % 7 );
+                else
+                {
+                    IntCache::Record rec = _cache->get( key );
+                    if ( rec.valid() && rec.value() != (int)key )
+                        ++_errors;
+                }
+            }
+        }
+    };
+
+    // LRUCache eviction order, entry and byte limits, and statistics; then the limits
+    // again under concurrent use of a sharded cache.
+    void testLRUCache()
+    {
+        // eviction by entry count, least recently used first:
+        {
+            IntCache cache( 3 );
+            cache.insert( 1, 1 );
+            cache.insert( 2, 2 );
+            cache.insert( 3, 3 );
+            check( cache.get( 1 ).valid(), "entry 1 is cached" ); // now 2 is the oldest
+            cache.insert( 4, 4 );
+            check( cache.contains(1) && !cache.contains(2) && cache.contains(3) && cache.contains(4),
+                   "the least recently used entry is evicted" );
+            check( cache.getSize() == 3 && cache.getEvictions() == 1, "entry limit holds" );
+
+            cache.insert( 3, 30 );
+            IntCache::Record rec = cache.get( 3 );
+            check( rec.valid() && rec.value() == 30 && cache.getSize() == 3, "insert replaces an existing entry" );
+
+            check( !cache.get( 2 ).valid(), "evicted entry is gone" );
+            check( cache.getHits() == 2 && cache.getMisses() == 1, "hits and misses are counted" );
+
+            cache.setMaxSize( 1 );
+            check( cache.getSize() == 1 && cache.contains(3), "shrinking the limit keeps the newest entry" );
+
+            cache.erase( 3 );
+            check( cache.getSize() == 0 && cache.getBytes() == 0, "erase removes the entry" );
+        }
+
+        // eviction by size:
+        {
+            IntCache cache( 0, 1, 100 );
+            cache.insert( 1, 1, 40 );
+            cache.insert( 2, 2, 40 );
+            cache.insert( 3, 3, 40 );
+            check( !cache.contains(1) && cache.getBytes() == 80, "byte limit evicts the oldest entry" );
+
+            cache.insert( 2, 2, 90 );
+            check( !cache.contains(3) && cache.contains(2) && cache.getBytes() == 90,
+                   "growing an entry evicts others" );
+
+            cache.insert( 4, 4, 500 );
+            check( cache.getSize() == 1 && cache.contains(4) && cache.getBytes() == 500,
+                   "an oversized entry replaces everything but is kept" );
+
+            cache.clear();
+            check( cache.getSize() == 0 && cache.getBytes() == 0, "clear empties the cache" );
+        }
+
+        // sharded, from many threads:
+        {
+            IntCache cache( 800, 8, 2000 );
+
+            std::vector<UseCache> jobs( 8 );
+            for( unsigned i = 0; i < jobs.size(); ++i )
+            {
+                jobs[i]._cache  = &cache;
+                jobs[i]._seed   = i;
+                jobs[i]._ops    = 200000;
+                jobs[i]._errors = 0;
+            }
+            runOnThreads( jobs );
+
+            for( unsigned i = 0; i < jobs.size(); ++i )
+                check( jobs[i]._errors == 0, "concurrent lookups return the inserted values" );
+
+            check( cache.getSize() <= 800, "entry limit holds across shards" );
+            check( cache.getBytes() <= 2000, "byte limit holds across shards" );
+            check( cache.getEvictions() > 0 && cache.getHits() > 0, "the cache was exercised" );
+        }
+    }
+
+    // runs a fixed number of cache operations split across the threads; returns
+    // the elapsed milliseconds.
+    double timeCacheUse( IntCache& cache, unsigned threads, unsigned totalOps, unsigned& errors )
+    {
+        std::vector<UseCache> jobs( threads );
+        for( unsigned i = 0; i < jobs.size(); ++i )
+        {
+            jobs[i]._cache  = &cache;
+            jobs[i]._seed   = i;
+            jobs[i]._ops    = totalOps / threads;
+            jobs[i]._errors = 0;
+        }
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        runOnThreads( jobs );
+        double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+        for( unsigned i = 0; i < jobs.size(); ++i )
+            errors += jobs[i]._errors;
+        return ms;
+    }
+
+    // LRUCache contention: the same workload from 1 to 32 threads against one
+    // shard (a single lock, like the old cache) and against 16 shards. Reports the
+    // throughput of each; the timings depend on the core count, so only the
+    // results are checked.
+    void testLRUContention()
+    {
+        const unsigned totalOps = 1600000;
+        unsigned errors = 0;
+
+        for( unsigned threads = 1; threads <= 32; threads *= 2 )
+        {
+            IntCache single( 800, 1 ), sharded( 800, 16 );
+            double singleMS  = timeCacheUse( single,  threads, totalOps, errors );
+            double shardedMS = timeCacheUse( sharded, threads, totalOps, errors );
+
+            std::stringstream buf;
+            buf << threads << " threads: 1 shard "
+                << (unsigned)(totalOps / osg::maximum(singleMS, 1.0)) << " ops/ms, 16 shards "
+                << (unsigned)(totalOps / osg::maximum(shardedMS, 1.0)) << " ops/ms";
+            OE_NOTICE << "  " << buf.str() << std::endl;
+
+            check( single.getSize() <= 800 && sharded.getSize() <= 800,
+                   "entry limit holds under contention" );
+        }
+
+        check( errors == 0, "contended lookups return the inserted values" );
+    }
+
+    //------------------------------------------------------------------------
+
+    // a small RGBA tile whose pixels are a function of the value.
+    osg::Image* makePackTile( unsigned value )
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage( 16, 16, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+        for( int t = 0; t < 16; ++t )
+        {
+            for( int s = 0; s < 16; ++s )
+            {
+                unsigned char* p = image->data( s, t );
+                p[0] = (unsigned char)(value & 0xFF);
+                p[1] = (unsigned char)(value >> 8);
+                p[2] = (unsigned char)(s * 16 + t);
+                p[3] = 255;
+            }
+        }
+        return image;
+    }
+
+    TileKey packTileKey( unsigned i )
+    {
+        return TileKey( 4, i % 32, i / 32, Registry::instance()->getGlobalGeodeticProfile() );
+    }
+
+    unsigned long long packFileSize( const std::string& filename )
+    {
+        std::ifstream in( filename.c_str(), std::ios::binary );
+        if ( !in.is_open() )
+            return 0;
+        in.seekg( 0, std::ios::end );
+        return (unsigned long long)in.tellg();
+    }
+
+    void removePackFiles( const std::string& path )
+    {
+        osgDB::DirectoryContents files = osgDB::getDirectoryContents( path );
+        for( unsigned i = 0; i < files.size(); ++i )
+        {
+            if ( files[i] != "." && files[i] != ".." )
+                ::remove( (path + "/" + files[i]).c_str() );
+        }
+    }
+
+    // reads back every tile and compares it with the value it should hold
+    // (0 = not cached); returns the number of mismatches.
+    unsigned checkPackTiles( Cache* cache, const CacheSpec& spec, const std::vector<unsigned>& expected )
+    {
+        unsigned errors = 0;
+        for( unsigned i = 0; i < expected.size(); ++i )
+        {
+            TileKey key = packTileKey( i );
+            osg::ref_ptr<const osg::Image> image;
+            bool found = cache->getImage( key, spec, image );
+            if ( expected[i] == 0 )
+            {
+                if ( found || cache->isCached(key, spec) )
+                    ++errors;
+                continue;
+            }
+
+            osg::ref_ptr<osg::Image> reference = makePackTile( expected[i] );
+            if ( !found || !image.valid() || !cache->isCached(key, spec) ||
+                 image->s() != 16 || image->t() != 16 ||
+                 image->getPixelFormat() != GL_RGBA || image->getDataType() != GL_UNSIGNED_BYTE ||
+                 ::memcmp( image->data(), reference->data(), reference->getTotalSizeInBytes() ) != 0 )
+            {
+                ++errors;
+            }
+        }
+        return errors;
+    }
+
+    // PackCache: tiles written to the journal survive a reopen (including a torn
+    // trailing journal record), compaction folds the journal into the index and
+    // drops replaced tiles, and purged tiles (even those of a layer not yet opened
+    // in the session) are gone after compaction.
+    void testPackCache()
+    {
+        const std::string path = "osgearth_tests_pack_cache";
+        const std::string layerPath = path + "/test";
+        removePackFiles( layerPath );
+
+        PackCacheOptions options;
+        options.path() = path;
+        CacheSpec spec( "test", "png" );
+
+        std::vector<unsigned> expected( 64, 0 );
+
+        // first session: 48 tiles, then replace 16 of them.
+        {
+            osg::ref_ptr<Cache> cache = CacheFactory::create( options );
+            if ( !check( cache.valid(), "created the pack cache" ) )
+                return;
+
+            osg::ref_ptr<const Profile> profile = Profile::create( "global-geodetic" );
+            cache->storeProperties( spec, profile.get(), 16 );
+
+            for( unsigned i = 0; i < 48; ++i )
+            {
+                expected[i] = i + 1;
+                osg::ref_ptr<osg::Image> image = makePackTile( expected[i] );
+                cache->setImage( packTileKey(i), spec, image.get() );
+            }
+            for( unsigned i = 0; i < 16; ++i )
+            {
+                expected[i] = 1000 + i;
+                osg::ref_ptr<osg::Image> image = makePackTile( expected[i] );
+                cache->setImage( packTileKey(i), spec, image.get() );
+            }
+            check( checkPackTiles(cache.get(), spec, expected) == 0, "read back tiles from the journal" );
+        }
+
+        check( !osgDB::fileExists(layerPath + "/tiles.idx"), "no index before compaction" );
+        unsigned long long packSize0 = packFileSize( layerPath + "/tiles.0.pack" );
+
+        // simulate a crash in the middle of a journal write.
+        {
+            std::ofstream log( (layerPath + "/tiles.0.log").c_str(), std::ios::out | std::ios::binary | std::ios::app );
+            log.write( "\x7f\x7f\x7f\x7f\x7f", 5 );
+        }
+
+        // second session: replay the journal, compact, then add more tiles.
+        {
+            osg::ref_ptr<Cache> cache = CacheFactory::create( options );
+            check( checkPackTiles(cache.get(), spec, expected) == 0, "replayed the journal" );
+
+            check( cache->compact(false), "compacted" );
+            check( osgDB::fileExists(layerPath + "/tiles.idx"), "compaction wrote the index" );
+            check( osgDB::fileExists(layerPath + "/tiles.1.pack"), "compaction wrote a new pack" );
+            check( !osgDB::fileExists(layerPath + "/tiles.0.pack"), "compaction removed the old pack" );
+            check( !osgDB::fileExists(layerPath + "/tiles.0.log"), "compaction removed the old journal" );
+
+            unsigned long long packSize1 = packFileSize( layerPath + "/tiles.1.pack" );
+            std::stringstream buf;
+            buf << "compaction dropped replaced tiles (pack went from " << packSize0 << " to " << packSize1 << " bytes)";
+            check( packSize1 > 0 && packSize1 < packSize0, buf.str() );
+
+            check( checkPackTiles(cache.get(), spec, expected) == 0, "read back tiles after compaction" );
+
+            for( unsigned i = 48; i < 64; ++i )
+            {
+                expected[i] = i + 1;
+                osg::ref_ptr<osg::Image> image = makePackTile( expected[i] );
+                cache->setImage( packTileKey(i), spec, image.get() );
+            }
+            expected[20] = 2000;
+            osg::ref_ptr<osg::Image> image = makePackTile( expected[20] );
+            cache->setImage( packTileKey(20), spec, image.get() );
+
+            check( checkPackTiles(cache.get(), spec, expected) == 0, "journal overrides the index" );
+        }
+
+        // third session: index plus journal.
+        {
+            osg::ref_ptr<Cache> cache = CacheFactory::create( options );
+            check( checkPackTiles(cache.get(), spec, expected) == 0, "reopened the index and the journal" );
+            check( !cache->purge("nonesuch", (int)::time(0L) + 1, false), "can't purge a layer that doesn't exist" );
+        }
+
+        // fourth session: purge everything before touching the layer, so the
+        // purge has to open it from its stored properties.
+        {
+            osg::ref_ptr<Cache> cache = CacheFactory::create( options );
+            check( cache->purge("test", (int)::time(0L) + 1, false), "purged a layer not yet opened" );
+            std::fill( expected.begin(), expected.end(), 0u );
+            check( checkPackTiles(cache.get(), spec, expected) == 0, "purged tiles are gone" );
+
+            check( cache->compact(false), "compacted after the purge" );
+            check( packFileSize(layerPath + "/tiles.2.pack") == 0, "compaction reclaimed the purged tiles" );
+        }
+
+        // fifth session: still empty.
+        {
+            osg::ref_ptr<Cache> cache = CacheFactory::create( options );
+            check( checkPackTiles(cache.get(), spec, expected) == 0, "purged tiles stay gone" );
+        }
+
+        removePackFiles( layerPath );
+    }
+
+    //------------------------------------------------------------------------
+
+    const GLenum s_byteFormats[4] = { GL_LUMINANCE, GL_LUMINANCE_ALPHA, GL_RGB, GL_RGBA };
+    const char*  s_byteFormatNames[4] = { "L8", "LA8", "RGB8", "RGBA8" };
+
+    // an 8-bit image filled with pseudo-random bytes.
+    osg::Image* makeByteImage( int s, int t, GLenum pixelFormat, unsigned seed )
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage( s, t, 1, pixelFormat, GL_UNSIGNED_BYTE );
+        unsigned char* data = image->data();
+        for( unsigned i = 0; i < image->getTotalSizeInBytes(); ++i )
+        {
+            seed = seed * 1664525u + 1013904223u;
+            data[i] = (unsigned char)(seed >> 24);
+        }
+        return image;
+    }
+
+    // largest per-byte difference between two images of the same size and format,
+    // or 256 if they don't match up.
+    int maxByteDiff( const osg::Image* a, const osg::Image* b )
+    {
+        if ( !a || !b || a->s() != b->s() || a->t() != b->t() ||
+             a->getPixelFormat() != b->getPixelFormat() || a->getDataType() != b->getDataType() )
+            return 256;
+
+        int result = 0;
+        unsigned rowBytes = osg::Image::computeRowWidthInBytes( a->s(), a->getPixelFormat(), a->getDataType(), 1 );
+        for( int t = 0; t < a->t(); ++t )
+        {
+            const unsigned char* pa = a->data( 0, t );
+            const unsigned char* pb = b->data( 0, t );
+            for( unsigned i = 0; i < rowBytes; ++i )
+                result = osg::maximum( result, ::abs( (int)pa[i] - (int)pb[i] ) );
+        }
+        return result;
+    }
+
+    // The reference versions below use PixelReader/PixelWriter for every pixel,
+    // which is what ImageUtils did for all formats before the byte kernels.
+
+    osg::Image* referenceConvert( const osg::Image* image, GLenum pixelFormat )
+    {
+        osg::Image* result = new osg::Image();
+        result->allocateImage( image->s(), image->t(), 1, pixelFormat, GL_UNSIGNED_BYTE );
+        ImageUtils::PixelReader read( image );
+        ImageUtils::PixelWriter write( result );
+        for( int t = 0; t < image->t(); ++t )
+            for( int s = 0; s < image->s(); ++s )
+                write( read(s, t), s, t );
+        return result;
+    }
+
+    osg::Image* referenceResize( const osg::Image* input, unsigned out_s, unsigned out_t )
+    {
+        osg::Image* result = new osg::Image();
+        result->allocateImage( out_s, out_t, 1, input->getPixelFormat(), GL_UNSIGNED_BYTE );
+        ImageUtils::PixelReader read( input );
+        ImageUtils::PixelWriter write( result );
+        for( unsigned t = 0; t < out_t; ++t )
+        {
+            int in_t = osg::minimum( (int)(((float)t / (float)out_t) * (float)input->t()), input->t()-1 );
+            for( unsigned s = 0; s < out_s; ++s )
+            {
+                int in_s = osg::minimum( (int)(((float)s / (float)out_s) * (float)input->s()), input->s()-1 );
+                write( read(in_s, in_t), s, t );
+            }
+        }
+        return result;
+    }
+
+    void referenceCopyAsSubImage( const osg::Image* src, osg::Image* dst, int dst_start_col, int dst_start_row )
+    {
+        ImageUtils::PixelReader read( src );
+        ImageUtils::PixelWriter write( dst );
+        for( int t = 0; t < src->t(); ++t )
+            for( int s = 0; s < src->s(); ++s )
+                write( read(s, t), dst_start_col + s, dst_start_row + t );
+    }
+
+    osg::Image* referenceCrop( const osg::Image* image, int x, int y, int width, int height )
+    {
+        osg::Image* result = new osg::Image();
+        result->allocateImage( width, height, 1, image->getPixelFormat(), image->getDataType() );
+        ImageUtils::PixelReader read( image );
+        ImageUtils::PixelWriter write( result );
+        for( int t = 0; t < height; ++t )
+            for( int s = 0; s < width; ++s )
+                write( read(x + s, y + t), s, t );
+        return result;
+    }
+
+    void referenceMix( osg::Image* dest, const osg::Image* src, float a )
+    {
+        bool srcHasAlpha = src->getPixelFormat() == GL_RGBA;
+        ImageUtils::PixelReader readSrc( src );
+        ImageUtils::PixelReader readDest( dest );
+        ImageUtils::PixelWriter write( dest );
+        for( int t = 0; t < src->t(); ++t )
+        {
+            for( int s = 0; s < src->s(); ++s )
+            {
+                osg::Vec4 sc = readSrc( s, t );
+                osg::Vec4 dc = readDest( s, t );
+                float sa = srcHasAlpha ? a * sc.a() : a;
+                dc.set(
+                    dc.r()*(1.0f-sa) + sc.r()*sa,
+                    dc.g()*(1.0f-sa) + sc.g()*sa,
+                    dc.b()*(1.0f-sa) + sc.b()*sa,
+                    dc.a() );
+                write( dc, s, t );
+            }
+        }
+    }
+
+    // ImageUtils' 8-bit fast paths (convert, copyAsSubImage, resizeImage, mix) against
+    // the generic per-pixel path. The generic path truncates after its float round
+    // trip, so it may come out one lower.
+    void testImageKernels()
+    {
+        unsigned seed = 1;
+
+        // convert() and copyAsSubImage() between every pair of L, LA, RGB and RGBA.
+        for( int i = 0; i < 4; ++i )
+        {
+            for( int j = 0; j < 4; ++j )
+            {
+                std::string what = std::string(s_byteFormatNames[i]) + " -> " + s_byteFormatNames[j];
+
+                osg::ref_ptr<osg::Image> src = makeByteImage( 37, 23, s_byteFormats[i], seed++ );
+                osg::ref_ptr<osg::Image> fast = ImageUtils::convert( src.get(), s_byteFormats[j], GL_UNSIGNED_BYTE );
+                osg::ref_ptr<osg::Image> reference = referenceConvert( src.get(), s_byteFormats[j] );
+                check( maxByteDiff(fast.get(), reference.get()) <= 1, "convert " + what );
+
+                osg::ref_ptr<osg::Image> dst = makeByteImage( 64, 48, s_byteFormats[j], seed++ );
+                osg::ref_ptr<osg::Image> dstReference = new osg::Image( *dst.get(), osg::CopyOp::DEEP_COPY_ALL );
+                check( ImageUtils::copyAsSubImage( src.get(), dst.get(), 11, 17 ), "copyAsSubImage " + what );
+                referenceCopyAsSubImage( src.get(), dstReference.get(), 11, 17 );
+                check( maxByteDiff(dst.get(), dstReference.get()) <= 1, "copyAsSubImage " + what + " matches" );
+            }
+        }
+
+        // resizeImage(), up and down, including sizes that don't divide evenly.
+        const unsigned sizes[3][2] = { {64, 64}, {19, 45}, {256, 131} };
+        for( int i = 0; i < 4; ++i )
+        {
+            osg::ref_ptr<osg::Image> src = makeByteImage( 61, 53, s_byteFormats[i], seed++ );
+            for( int k = 0; k < 3; ++k )
+            {
+                std::stringstream what;
+                what << "resizeImage " << s_byteFormatNames[i] << " to " << sizes[k][0] << "x" << sizes[k][1];
+
+                osg::ref_ptr<osg::Image> fast;
+                check( ImageUtils::resizeImage( src.get(), sizes[k][0], sizes[k][1], fast ), what.str() );
+                osg::ref_ptr<osg::Image> reference = referenceResize( src.get(), sizes[k][0], sizes[k][1] );
+                check( maxByteDiff(fast.get(), reference.get()) <= 1, what.str() + " matches" );
+            }
+        }
+
+        // mix() between RGB and RGBA.
+        for( int i = 2; i < 4; ++i )
+        {
+            for( int j = 2; j < 4; ++j )
+            {
+                std::string what = std::string("mix ") + s_byteFormatNames[i] + " into " + s_byteFormatNames[j];
+
+                osg::ref_ptr<osg::Image> src  = makeByteImage( 33, 29, s_byteFormats[i], seed++ );
+                osg::ref_ptr<osg::Image> fast = makeByteImage( 33, 29, s_byteFormats[j], seed++ );
+                osg::ref_ptr<osg::Image> reference = new osg::Image( *fast.get(), osg::CopyOp::DEEP_COPY_ALL );
+
+                check( ImageUtils::mix( fast.get(), src.get(), 0.6f ), what );
+                referenceMix( reference.get(), src.get(), 0.6f );
+                check( maxByteDiff(fast.get(), reference.get()) <= 1, what + " matches" );
+            }
+        }
+
+        // cropImage() against the same window read pixel by pixel.
+        for( int i = 0; i < 4; ++i )
+        {
+            osg::ref_ptr<osg::Image> src = makeByteImage( 40, 30, s_byteFormats[i], seed++ );
+            double minx = 10.0, miny = 5.0, maxx = 33.0, maxy = 25.0;
+            osg::ref_ptr<osg::Image> fast = ImageUtils::cropImage( src.get(), 0.0, 0.0, 40.0, 30.0, minx, miny, maxx, maxy );
+            osg::ref_ptr<osg::Image> reference = referenceCrop( src.get(), 10, 5, 23, 20 );
+            check( maxByteDiff(fast.get(), reference.get()) == 0, std::string("cropImage ") + s_byteFormatNames[i] );
+        }
+
+        // report the speedup on typical tile-sized jobs.
+        {
+            osg::ref_ptr<osg::Image> src = makeByteImage( 256, 256, GL_RGB, seed++ );
+            const int passes = 20;
+
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            for( int i = 0; i < passes; ++i )
+                osg::ref_ptr<osg::Image> result = ImageUtils::convert( src.get(), GL_RGBA, GL_UNSIGNED_BYTE );
+            double fastConvert = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            start = osg::Timer::instance()->tick();
+            for( int i = 0; i < passes; ++i )
+                osg::ref_ptr<osg::Image> result = referenceConvert( src.get(), GL_RGBA );
+            double slowConvert = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            start = osg::Timer::instance()->tick();
+            for( int i = 0; i < passes; ++i )
+            {
+                osg::ref_ptr<osg::Image> result;
+                ImageUtils::resizeImage( src.get(), 512, 512, result );
+            }
+            double fastResize = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            start = osg::Timer::instance()->tick();
+            for( int i = 0; i < passes; ++i )
+                osg::ref_ptr<osg::Image> result = referenceResize( src.get(), 512, 512 );
+            double slowResize = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            // the middle 128x128 of the tile:
+            start = osg::Timer::instance()->tick();
+            for( int i = 0; i < passes; ++i )
+            {
+                double minx = 64.0, miny = 64.0, maxx = 192.0, maxy = 192.0;
+                osg::ref_ptr<osg::Image> result = ImageUtils::cropImage( src.get(), 0.0, 0.0, 256.0, 256.0, minx, miny, maxx, maxy );
+            }
+            double fastCrop = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            start = osg::Timer::instance()->tick();
+            for( int i = 0; i < passes; ++i )
+                osg::ref_ptr<osg::Image> result = referenceCrop( src.get(), 64, 64, 128, 128 );
+            double slowCrop = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            // the tile into a quarter of a 512x512 mosaic:
+            osg::ref_ptr<osg::Image> mosaic = makeByteImage( 512, 512, GL_RGBA, seed++ );
+            start = osg::Timer::instance()->tick();
+            for( int i = 0; i < passes; ++i )
+                ImageUtils::copyAsSubImage( src.get(), mosaic.get(), 256, 0 );
+            double fastCopy = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            start = osg::Timer::instance()->tick();
+            for( int i = 0; i < passes; ++i )
+                referenceCopyAsSubImage( src.get(), mosaic.get(), 256, 0 );
+            double slowCopy = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            // an RGBA layer over the tile:
+            osg::ref_ptr<osg::Image> layer = makeByteImage( 256, 256, GL_RGBA, seed++ );
+            start = osg::Timer::instance()->tick();
+            for( int i = 0; i < passes; ++i )
+                ImageUtils::mix( src.get(), layer.get(), 0.6f );
+            double fastMix = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            start = osg::Timer::instance()->tick();
+            for( int i = 0; i < passes; ++i )
+                referenceMix( src.get(), layer.get(), 0.6f );
+            double slowMix = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            OE_NOTICE << "  convert RGB8 256x256 -> RGBA8: " << fastConvert/passes << "ms (generic "
+                << slowConvert/passes << "ms)" << std::endl;
+            OE_NOTICE << "  resize RGB8 256x256 -> 512x512: " << fastResize/passes << "ms (generic "
+                << slowResize/passes << "ms)" << std::endl;
+            OE_NOTICE << "  crop RGB8 256x256 -> 128x128: " << fastCrop/passes << "ms (generic "
+                << slowCrop/passes << "ms)" << std::endl;
+            OE_NOTICE << "  copyAsSubImage RGB8 256x256 into RGBA8 512x512: " << fastCopy/passes << "ms (generic "
+                << slowCopy/passes << "ms)" << std::endl;
+            OE_NOTICE << "  mix RGBA8 into RGB8 256x256: " << fastMix/passes << "ms (generic "
+                << slowMix/passes << "ms)" << std::endl;
+        }
+    }
+
+    // the 2x2 box filter (rounded, clamped at odd edges) of one mip level into the next.
+    std::vector<unsigned char> referenceMipLevel( const unsigned char* src, int src_s, int src_t, unsigned srcRowBytes,
+                                                  int channels, int dst_s, int dst_t )
+    {
+        std::vector<unsigned char> out( dst_s * dst_t * channels );
+        for( int t = 0; t < dst_t; ++t )
+        {
+            int t0 = 2*t, t1 = osg::minimum( 2*t+1, src_t-1 );
+            for( int s = 0; s < dst_s; ++s )
+            {
+                int s0 = 2*s, s1 = osg::minimum( 2*s+1, src_s-1 );
+                for( int c = 0; c < channels; ++c )
+                {
+                    unsigned sum =
+                        src[t0*srcRowBytes + s0*channels + c] + src[t0*srcRowBytes + s1*channels + c] +
+                        src[t1*srcRowBytes + s0*channels + c] + src[t1*srcRowBytes + s1*channels + c];
+                    out[(t*dst_s + s)*channels + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+        return out;
+    }
+
+    // checks levels [1..n-1] of a mipmapped image, each against the box filter of the
+    // level above it (or of "first" in place of level 0); returns the number of bad levels.
+    unsigned checkMipChain( const osg::Image* mip, const osg::Image* first )
+    {
+        int channels = osg::Image::computeNumComponents( mip->getPixelFormat() );
+        unsigned bad = 0;
+        for( unsigned level = 1; level < mip->getNumMipmapLevels(); ++level )
+        {
+            int src_s = osg::maximum( mip->s() >> (level-1), 1 ), src_t = osg::maximum( mip->t() >> (level-1), 1 );
+            int dst_s = osg::maximum( mip->s() >> level, 1 ),     dst_t = osg::maximum( mip->t() >> level, 1 );
+            const unsigned char* src = level == 1 ? first->data() : mip->getMipmapData( level-1 );
+            unsigned srcRowBytes = osg::Image::computeRowWidthInBytes( src_s, mip->getPixelFormat(), mip->getDataType(), mip->getPacking() );
+            unsigned dstRowBytes = osg::Image::computeRowWidthInBytes( dst_s, mip->getPixelFormat(), mip->getDataType(), mip->getPacking() );
+
+            std::vector<unsigned char> expected = referenceMipLevel( src, src_s, src_t, srcRowBytes, channels, dst_s, dst_t );
+            const unsigned char* actual = mip->getMipmapData( level );
+            for( int t = 0; t < dst_t; ++t )
+            {
+                if ( ::memcmp( actual + t*dstRowBytes, &expected[t*dst_s*channels], dst_s*channels ) != 0 )
+                {
+                    ++bad;
+                    break;
+                }
+            }
+        }
+        return bad;
+    }
+
+    // ImageUtils mipmap chains: every level down to 1x1 is the box filter of the level
+    // above it, for square, odd and one-pixel-wide sizes; the blended chain starts
+    // from the secondary image; unsupported formats are refused.
+    void testMipmaps()
+    {
+        unsigned seed = 7;
+        const int sizes[3][2] = { {64, 64}, {37, 19}, {1, 9} };
+
+        for( int i = 0; i < 4; ++i )
+        {
+            for( int k = 0; k < 3; ++k )
+            {
+                std::stringstream what;
+                what << s_byteFormatNames[i] << " " << sizes[k][0] << "x" << sizes[k][1];
+
+                osg::ref_ptr<osg::Image> image = makeByteImage( sizes[k][0], sizes[k][1], s_byteFormats[i], seed++ );
+                check( ImageUtils::canGenerateMipmaps(image.get()), "can mipmap " + what.str() );
+
+                osg::ref_ptr<osg::Image> mip = ImageUtils::createMipmappedImage( image.get() );
+                if ( !check( mip.valid(), "createMipmappedImage " + what.str() ) )
+                    continue;
+
+                unsigned numLevels = osg::Image::computeNumberOfMipmapLevels( image->s(), image->t() );
+                check( mip->getNumMipmapLevels() == numLevels, "full chain for " + what.str() );
+                check( maxByteDiff(mip.get(), image.get()) == 0, "level 0 is the image for " + what.str() );
+                check( checkMipChain(mip.get(), image.get()) == 0, "every level is the box filter of the one above for " + what.str() );
+
+                osg::ref_ptr<osg::Image> secondary = makeByteImage( sizes[k][0], sizes[k][1], s_byteFormats[i], seed++ );
+                osg::ref_ptr<osg::Image> blended = ImageUtils::createMipmapBlendedImage( image.get(), secondary.get() );
+                check( blended.valid() && blended->getNumMipmapLevels() == numLevels &&
+                       maxByteDiff(blended.get(), image.get()) == 0 &&
+                       checkMipChain(blended.get(), secondary.get()) == 0,
+                       "the blended chain filters down from the secondary for " + what.str() );
+            }
+        }
+
+        osg::ref_ptr<osg::Image> floats = new osg::Image();
+        floats->allocateImage( 16, 16, 1, GL_LUMINANCE, GL_FLOAT );
+        check( !ImageUtils::canGenerateMipmaps(floats.get()) && !ImageUtils::createMipmappedImage(floats.get()),
+               "float images are refused" );
+
+        // a large tile, against resizing every level from the original.
+        {
+            osg::ref_ptr<osg::Image> image = makeByteImage( 1024, 1024, GL_RGBA, seed++ );
+            const int passes = 5;
+
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            for( int i = 0; i < passes; ++i )
+                osg::ref_ptr<osg::Image> mip = ImageUtils::createMipmappedImage( image.get() );
+            double chain = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            start = osg::Timer::instance()->tick();
+            for( int i = 0; i < passes; ++i )
+            {
+                for( int s = 512; s >= 1; s >>= 1 )
+                {
+                    osg::ref_ptr<osg::Image> level;
+                    ImageUtils::resizeImage( image.get(), s, s, level );
+                }
+            }
+            double resized = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            OE_NOTICE << "  mipmap chain RGBA8 1024x1024: " << chain/passes << "ms (resizing each level "
+                << resized/passes << "ms)" << std::endl;
+        }
+    }
+
+    //------------------------------------------------------------------------
+
+#ifndef WIN32
+
+    /**
+     * Minimal HTTP server on a loopback port, for testing HTTPClient without the
+     * network. Every request is answered on its own thread after a fixed delay,
+     * with its path as the body.
+     */
+    class MockHTTPServer : public OpenThreads::Thread
+    {
+    public:
+        MockHTTPServer( unsigned latency_ms ) : _latency_ms(latency_ms), _socket(-1), _port(0), _done(false), _numRequests(0) { }
+
+        ~MockHTTPServer() { stop(); }
+
+        // binds to an ephemeral port and starts serving; returns false on failure.
+        bool listen()
+        {
+            _socket = ::socket( AF_INET, SOCK_STREAM, 0 );
+            if ( _socket < 0 )
+                return false;
+
+            sockaddr_in addr;
+            ::memset( &addr, 0, sizeof(addr) );
+            addr.sin_family      = AF_INET;
+            addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+            addr.sin_port        = 0;
+            socklen_t len = sizeof(addr);
+            if ( ::bind( _socket, (sockaddr*)&addr, sizeof(addr) ) != 0 ||
+                 ::listen( _socket, 64 ) != 0 ||
+                 ::getsockname( _socket, (sockaddr*)&addr, &len ) != 0 )
+            {
+                ::close( _socket );
+                _socket = -1;
+                return false;
+            }
+            _port = ntohs( addr.sin_port );
+            start();
+            return true;
+        }
+
+        void stop()
+        {
+            if ( _socket < 0 )
+                return;
+            _done = true;
+            join();
+            ::close( _socket );
+            _socket = -1;
+            for( unsigned i = 0; i < _handlers.size(); ++i )
+            {
+                _handlers[i]->join();
+                delete _handlers[i];
+            }
+            _handlers.clear();
+        }
+
+        // number of connections accepted so far (one request per connection).
+        unsigned getNumRequests() const { return _numRequests; }
+
+        // serves this body for every request instead of echoing the path. Call
+        // before listen().
+        void setBody( const std::string& contentType, const std::string& body )
+        {
+            _contentType = contentType;
+            _body        = body;
+        }
+
+        // adds response header lines (each ending in "\r\n"), and an ETag that a
+        // matching If-None-Match gets a 304 for. Call before listen().
+        void setHeaders( const std::string& headers, const std::string& etag ="" )
+        {
+            _headers = headers;
+            _etag    = etag;
+        }
+
+        std::string url( const std::string& path ) const
+        {
+            std::stringstream buf;
+            buf << "http://127.0.0.1:" << _port << path;
+            return buf.str();
+        }
+
+        void run()
+        {
+            while( !_done )
+            {
+                // wake up now and then to notice stop().
+                fd_set fds;
+                FD_ZERO( &fds );
+                FD_SET( _socket, &fds );
+                timeval tv;
+                tv.tv_sec  = 0;
+                tv.tv_usec = 50000;
+                if ( ::select( _socket+1, &fds, 0L, 0L, &tv ) <= 0 )
+                    continue;
+
+                int client = ::accept( _socket, 0L, 0L );
+                if ( client >= 0 )
+                {
+                    ++_numRequests;
+                    _handlers.push_back( new Handler(client, _latency_ms, _contentType, _body, _headers, _etag) );
+                    _handlers.back()->start();
+                }
+            }
+        }
+
+    private:
+        struct Handler : public OpenThreads::Thread
+        {
+            Handler( int socket, unsigned latency_ms, const std::string& contentType, const std::string& body,
+                     const std::string& headers, const std::string& etag ) :
+                _socket(socket), _latency_ms(latency_ms), _contentType(contentType), _body(body),
+                _headers(headers), _etag(etag) { }
+
+            void run()
+            {
+                // read the request header:
+                std::string request;
+                char buf[1024];
+                while( request.find("\r\n\r\n") == std::string::npos )
+                {
+                    ssize_t n = ::recv( _socket, buf, sizeof(buf), 0 );
+                    if ( n <= 0 )
+                        break;
+                    request.append( buf, n );
+                }
+
+                // "GET <path> HTTP/1.1"
+                std::string path;
+                std::string::size_type p0 = request.find( ' ' );
+                std::string::size_type p1 = p0 != std::string::npos ? request.find( ' ', p0+1 ) : std::string::npos;
+                if ( p1 != std::string::npos )
+                    path = request.substr( p0+1, p1-p0-1 );
+
+                OpenThreads::Thread::microSleep( 1000 * _latency_ms );
+
+                bool notModified = !_etag.empty() && request.find("If-None-Match: " + _etag + "\r\n") != std::string::npos;
+
+                const std::string& body = _body.empty() ? path : _body;
+                std::stringstream response;
+                if ( notModified )
+                {
+                    response
+                        << "HTTP/1.1 304 Not Modified\r\n"
+                        << "ETag: " << _etag << "\r\n"
+                        << _headers
+                        << "Connection: close\r\n"
+                        << "\r\n";
+                }
+                else
+                {
+                    response
+                        << "HTTP/1.1 200 OK\r\n"
+                        << "Content-Type: " << (_body.empty() ? "text/plain" : _contentType) << "\r\n"
+                        << "Content-Length: " << body.size() << "\r\n"
+                        << (_etag.empty() ? std::string() : "ETag: " + _etag + "\r\n")
+                        << _headers
+                        << "Connection: close\r\n"
+                        << "\r\n"
+                        << body;
+                }
+                std::string out = response.str();
+                for( std::string::size_type sent = 0; sent < out.size(); )
+                {
+                    ssize_t n = ::send( _socket, out.data() + sent, out.size() - sent, 0 );
+                    if ( n <= 0 )
+                        break;
+                    sent += n;
+                }
+                ::close( _socket );
+            }
+
+            int         _socket;
+            unsigned    _latency_ms;
+            std::string _contentType;
+            std::string _body;
+            std::string _headers;
+            std::string _etag;
+        };
+
+        unsigned               _latency_ms;
+        int                    _socket;
+        unsigned short         _port;
+        volatile bool          _done;
+        volatile unsigned      _numRequests;
+        std::string            _contentType;
+        std::string            _body;
+        std::string            _headers;
+        std::string            _etag;
+        std::vector<Handler*>  _handlers;
+    };
+
+    // fetches one URL and records whether the response was right.
+    struct FetchURL
+    {
+        const MockHTTPServer* _server;
+        std::string           _path;
+        bool                  _ok;
+
+        void operator()()
+        {
+            HTTPResponse response = HTTPClient::get( _server->url(_path) );
+            _ok = response.isOK() && response.getNumParts() > 0 && response.getPartAsString(0) == _path;
+        }
+    };
+
+    // HTTPClient against a local server with injected latency: a request submitted to
+    // an idle engine must start right away, and concurrent requests must overlap
+    // instead of running one after another.
+    void testHTTPEngine()
+    {
+        const unsigned latency_ms = 200;
+        MockHTTPServer server( latency_ms );
+        if ( !check( server.listen(), "started the mock HTTP server" ) )
+            return;
+
+        // one at a time. The engine sleeps in its poll between transfers; a new
+        // request has to wake it rather than wait out the poll timeout (1s).
+        for( unsigned i = 0; i < 5; ++i )
+        {
+            std::stringstream path;
+            path << "/single/" << i;
+
+            FetchURL job;
+            job._server = &server;
+            job._path   = path.str();
+            job._ok     = false;
+
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            job();
+            double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            check( job._ok, "got " + job._path );
+
+            std::stringstream buf;
+            buf << "request " << job._path << " took " << ms << "ms with " << latency_ms << "ms of server latency";
+            OE_NOTICE << "  " << buf.str() << std::endl;
+            check( ms < latency_ms + 250.0, buf.str() );
+        }
+
+        // many at once:
+        {
+            unsigned oldMax = HTTPClient::getMaxConnectionsPerHost();
+            const unsigned num = 16;
+            HTTPClient::setMaxConnectionsPerHost( num );
+
+            std::vector<FetchURL> jobs( num );
+            for( unsigned i = 0; i < num; ++i )
+            {
+                std::stringstream path;
+                path << "/concurrent/" << i;
+                jobs[i]._server = &server;
+                jobs[i]._path   = path.str();
+                jobs[i]._ok     = false;
+            }
+
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            runOnThreads( jobs );
+            double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            HTTPClient::setMaxConnectionsPerHost( oldMax );
+
+            for( unsigned i = 0; i < num; ++i )
+                check( jobs[i]._ok, "got " + jobs[i]._path );
+
+            std::stringstream buf;
+            buf << num << " concurrent requests took " << ms << "ms with " << latency_ms << "ms of server latency each";
+            OE_NOTICE << "  " << buf.str() << std::endl;
+            check( ms < (double)(num * latency_ms) / 4.0, buf.str() );
+        }
+
+        server.stop();
+    }
+
+#endif // !WIN32
+
+    //------------------------------------------------------------------------
+
+    // Warm memory-cache hits in ImageLayer: a hit hands out the cached image itself
+    // instead of a copy, and copy-on-write keeps anyone from changing it. Reports
+    // the cost of a hit next to what the per-hit clone used to cost.
+    void testMemCacheHits()
+    {
+        GDALOptions driverOpt;
+        driverOpt.url() = "../data/world.tif";
+        driverOpt.L2CacheSize() = 64;
+
+        ImageLayerOptions layerOpt;
+        layerOpt.driver() = driverOpt;
+        layerOpt.name() = "test_memcache_hits";
+
+        osg::ref_ptr<ImageLayer> layer = new ImageLayer( layerOpt );
+        if ( !check( layer->getProfile() != 0L, "opened ../data/world.tif" ) )
+            return;
+
+        std::vector<TileKey> keys;
+        unsigned lod = 2, tilesWide, tilesHigh;
+        layer->getProfile()->getNumTiles( lod, tilesWide, tilesHigh );
+        for( unsigned y = 0; y < tilesHigh; ++y )
+            for( unsigned x = 0; x < tilesWide; ++x )
+                keys.push_back( TileKey(lod, x, y, layer->getProfile()) );
+
+        // cold: fills the memory cache.
+        std::vector<GeoImage> cold;
+        for( unsigned i = 0; i < keys.size(); ++i )
+            cold.push_back( layer->createImage(keys[i]) );
+
+        // warm:
+        const unsigned passes = 50;
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for( unsigned p = 0; p < passes; ++p )
+            for( unsigned i = 0; i < keys.size(); ++i )
+                layer->createImage( keys[i] );
+        double warm = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+        unsigned shared = 0, same = 0;
+        std::vector< osg::ref_ptr<osg::Image> > hits;
+        for( unsigned i = 0; i < keys.size(); ++i )
+        {
+            GeoImage a = layer->createImage( keys[i] );
+            GeoImage b = layer->createImage( keys[i] );
+            if ( a.valid() && b.valid() && a.getImage() == b.getImage() )
+                ++shared;
+            if ( a.valid() && cold[i].valid() &&
+                 a.getImage()->getTotalSizeInBytes() == cold[i].getImage()->getTotalSizeInBytes() &&
+                 ::memcmp( a.getImage()->data(), cold[i].getImage()->data(), a.getImage()->getTotalSizeInBytes() ) == 0 )
+                ++same;
+            if ( a.valid() )
+                hits.push_back( a.getImage() );
+        }
+        check( same == keys.size(), "warm hits return the same pixels as cold reads" );
+        check( shared == keys.size(), "warm hits share the cached image instead of copying it" );
+        check( hits.empty() || ImageUtils::isNormalized(hits[0].get()), "cached images are normalized" );
+
+        // what each hit used to pay for:
+        start = osg::Timer::instance()->tick();
+        for( unsigned p = 0; p < passes; ++p )
+            for( unsigned i = 0; i < hits.size(); ++i )
+                osg::ref_ptr<osg::Image> copy = ImageUtils::cloneImage( hits[i].get() );
+        double clones = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+        unsigned count = passes * keys.size();
+        OE_NOTICE << "  " << count << " warm hits: " << (warm * 1000.0 / count) << "us per hit; "
+            << "a clone per hit would add " << (clones * 1000.0 / count) << "us" << std::endl;
+
+        // copy-on-write: a shared image is copied, a private one is not.
+        if ( !hits.empty() )
+        {
+            osg::ref_ptr<osg::Image> cached = hits[0].get();
+            osg::ref_ptr<osg::Image> writable = ImageUtils::cloneIfShared( cached.get() );
+            check( writable.get() != cached.get(), "a shared image is copied before writing" );
+
+            osg::ref_ptr<osg::Image> own = ImageUtils::cloneImage( cached.get() );
+            check( ImageUtils::cloneIfShared( own.get() ) == own.get(), "a private image is not copied" );
+
+            // scribble on the copy; the cache must not see it.
+            ::memset( writable->data(), 0x5A, writable->getTotalSizeInBytes() );
+            GeoImage again = layer->createImage( keys[0] );
+            check( again.valid() && again.getImage() == cached.get() &&
+                   ::memcmp( again.getImage()->data(), cold[0].getImage()->data(), cold[0].getImage()->getTotalSizeInBytes() ) == 0,
+                   "writing to the copy leaves the cached tile alone" );
+
+            // an un-normalized shared image: normalizing must not touch the original.
+            osg::ref_ptr<osg::Image> odd = ImageUtils::cloneImage( cached.get() );
+            odd->setInternalTextureFormat( odd->getPixelFormat() );
+            osg::ref_ptr<osg::Image> holder = odd.get();
+            osg::ref_ptr<osg::Image> normalized = ImageUtils::cloneIfShared( odd.get() );
+            ImageUtils::normalizeImage( normalized.get() );
+            check( normalized.get() != odd.get() && !ImageUtils::isNormalized(odd.get()) &&
+                   ImageUtils::isNormalized(normalized.get()), "normalizing a shared image copies it" );
+        }
+    }
+
+    //------------------------------------------------------------------------
+
+    typedef Threading::SingleFlight<int, int> IntFlights;
+
+    // enters a flight; the leader "works" for a while and then publishes _result.
+    struct FlyOnce
+    {
+        IntFlights*       _flights;
+        int               _key;
+        int               _result;
+        unsigned          _work_ms;
+        bool              _share;
+        ProgressCallback* _progress;
+        bool              _leader;
+        int               _value;
+        double            _ms;
+
+        void operator()()
+        {
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            _value  = 0;
+            _leader = _flights->enter( _key, _value, _progress );
+            if ( _leader )
+            {
+                OpenThreads::Thread::microSleep( 1000 * _work_ms );
+                _value = _result;
+                _flights->leave( _key, _value, _share );
+            }
+            _ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+        }
+    };
+
+    FlyOnce makeFlyOnce( IntFlights* flights, int key, int result, unsigned work_ms )
+    {
+        FlyOnce job;
+        job._flights  = flights;
+        job._key      = key;
+        job._result   = result;
+        job._work_ms  = work_ms;
+        job._share    = true;
+        job._progress = 0L;
+        job._leader   = false;
+        job._value    = 0;
+        job._ms       = 0.0;
+        return job;
+    }
+
+    // a tile source that takes a while to create a tile and counts how often it does.
+    class SlowTileSource : public TileSource
+    {
+    public:
+        SlowTileSource( const TileSourceOptions& options, const Profile* profile =0L, unsigned latencyMS =200 ) :
+            TileSource(options), _calls(0), _latencyMS(latencyMS)
+        {
+            setProfile( profile ? profile : Registry::instance()->getGlobalGeodeticProfile() );
+        }
+
+        void initialize( const std::string& referenceURI, const Profile* overrideProfile ) { }
+
+        osg::Image* createImage( const TileKey& key, ProgressCallback* progress )
+        {
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+                ++_calls;
+            }
+            OpenThreads::Thread::microSleep( _latencyMS * 1000 );
+            osg::Image* image = new osg::Image();
+            image->allocateImage( 4, 4, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+            ::memset( image->data(), 0, image->getTotalSizeInBytes() );
+            return image;
+        }
+
+        unsigned getNumCalls()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            return _calls;
+        }
+
+    private:
+        OpenThreads::Mutex _mutex;
+        unsigned           _calls;
+        unsigned           _latencyMS;
+    };
+
+    // marks the first byte of every image it processes.
+    struct MarkImage : public TileSource::ImageOperation
+    {
+        MarkImage( unsigned char mark ) : _mark(mark) { }
+        void operator()( osg::ref_ptr<osg::Image>& image ) { image->data()[0] = _mark; }
+        unsigned char _mark;
+    };
+
+    struct CreateTile
+    {
+        TileSource*                 _source;
+        TileKey                     _key;
+        TileSource::ImageOperation* _op;
+        osg::ref_ptr<osg::Image>    _image;
+
+        void operator()() { _image = _source->createImage( _key, _op, 0L ); }
+    };
+
+    // Request coalescing: the SingleFlight hit/miss/cancel counters, a leader that
+    // declines to share, a canceled waiter, and TileSource keying its in-flight
+    // requests on both the tile and the pre-cache operation.
+    void testRequestCoalescing()
+    {
+        // 8 callers for one key: one does the work, the rest share it.
+        {
+            IntFlights flights;
+            std::vector<FlyOnce> jobs( 8, makeFlyOnce(&flights, 1, 42, 200) );
+            runOnThreads( jobs );
+
+            unsigned leaders = 0, right = 0;
+            for( unsigned i = 0; i < jobs.size(); ++i )
+            {
+                if ( jobs[i]._leader ) ++leaders;
+                if ( jobs[i]._value == 42 ) ++right;
+            }
+            check( leaders == 1, "one leader for one key" );
+            check( right == jobs.size(), "every caller got the leader's result" );
+            check( flights.getNumLeaders() == 1, "miss counter is 1" );
+            check( flights.getNumShared() == jobs.size()-1, "hit counter counts the waiters" );
+        }
+
+        // different keys never wait on each other.
+        {
+            IntFlights flights;
+            std::vector<FlyOnce> jobs;
+            for( int i = 0; i < 8; ++i )
+                jobs.push_back( makeFlyOnce(&flights, i, i+100, 50) );
+            runOnThreads( jobs );
+
+            unsigned right = 0;
+            for( unsigned i = 0; i < jobs.size(); ++i )
+                if ( jobs[i]._leader && jobs[i]._value == (int)i+100 ) ++right;
+            check( right == jobs.size(), "every key got its own leader" );
+            check( flights.getNumLeaders() == 8 && flights.getNumShared() == 0, "8 misses, no hits for 8 keys" );
+        }
+
+        // a leader that won't share hands the work to a waiter.
+        {
+            IntFlights flights;
+            std::vector<FlyOnce> jobs( 2, makeFlyOnce(&flights, 1, 7, 200) );
+            jobs[0]._share = false;
+            jobs[1]._share = false;
+            runOnThreads( jobs );
+            check( jobs[0]._leader && jobs[1]._leader, "an unshared result makes the waiter lead" );
+            check( flights.getNumLeaders() == 2 && flights.getNumShared() == 0, "2 misses after declining to share" );
+        }
+
+        // a canceled waiter stops waiting for the leader.
+        {
+            IntFlights flights;
+            osg::ref_ptr<ProgressCallback> canceled = new ProgressCallback();
+            std::vector<FlyOnce> jobs( 2, makeFlyOnce(&flights, 1, 9, 500) );
+
+            JobThread<FlyOnce> leader;
+            leader._job = jobs[0];
+            leader.start();
+            OpenThreads::Thread::microSleep( 100000 ); // let it take the lead
+
+            jobs[1]._progress = canceled.get();
+            JobThread<FlyOnce> waiter;
+            waiter._job = jobs[1];
+            waiter.start();
+            OpenThreads::Thread::microSleep( 100000 );
+            canceled->cancel();
+            waiter.join();
+            leader.join();
+
+            std::stringstream buf;
+            buf << "a canceled waiter returns early (" << waiter._job._ms << "ms, leader took " << leader._job._ms << "ms)";
+            check( leader._job._leader && !waiter._job._leader && waiter._job._value == 0 &&
+                   waiter._job._ms < 350.0, buf.str() );
+            check( flights.getNumCanceled() == 1 && flights.getNumShared() == 0, "the cancel is counted" );
+        }
+
+        // TileSource: same tile and operation share, different operations don't.
+        {
+            TileSourceOptions options;
+            options.L2CacheSize() = 0; // no memory cache, so only coalescing can save work
+            osg::ref_ptr<SlowTileSource> source = new SlowTileSource( options );
+            TileKey key( 1, 0, 0, source->getProfile() );
+
+            osg::ref_ptr<MarkImage> opA = new MarkImage( 1 );
+            osg::ref_ptr<MarkImage> opB = new MarkImage( 2 );
+
+            std::vector<CreateTile> jobs( 8 );
+            for( unsigned i = 0; i < jobs.size(); ++i )
+            {
+                jobs[i]._source = source.get();
+                jobs[i]._key    = key;
+                jobs[i]._op     = i % 2 == 0 ? opA.get() : opB.get();
+            }
+            runOnThreads( jobs );
+
+            unsigned right = 0;
+            for( unsigned i = 0; i < jobs.size(); ++i )
+            {
+                unsigned char mark = i % 2 == 0 ? 1 : 2;
+                if ( jobs[i]._image.valid() && jobs[i]._image->data()[0] == mark )
+                    ++right;
+            }
+
+            std::stringstream buf;
+            buf << source->getNumCalls() << " tiles created, " << source->getNumUncoalescedRequests()
+                << " misses, " << source->getNumCoalescedRequests() << " hits";
+            OE_NOTICE << "  " << buf.str() << std::endl;
+
+            check( right == jobs.size(), "every request got the result of its own operation" );
+            check( source->getNumCalls() == 2, "one tile created per operation: " + buf.str() );
+            check( source->getNumUncoalescedRequests() == 2 && source->getNumCoalescedRequests() == 6,
+                   "TileSource counters: " + buf.str() );
+        }
+    }
+
+    //------------------------------------------------------------------------
+
+    // Mosaic fetches against a slow source: a map tile that spans several source
+    // tiles should cost about one round trip with mosaic_threads, not one per tile.
+    double timeMosaic( unsigned threads, unsigned latencyMS, unsigned& calls, bool& valid )
+    {
+        TileSourceOptions sourceOpt;
+        sourceOpt.L2CacheSize() = 0;
+        osg::ref_ptr<SlowTileSource> source = new SlowTileSource(
+            sourceOpt, Profile::create("epsg:4326", -180.0, -90.0, 180.0, 90.0, "", 4, 2), latencyMS );
+
+        ImageLayerOptions layerOpt;
+        layerOpt.name() = "test_mosaic_latency";
+        layerOpt.cacheEnabled() = false;
+        layerOpt.mosaicThreads() = threads;
+        osg::ref_ptr<ImageLayer> layer = new ImageLayer( layerOpt, source.get() );
+
+        TileKey key( 0, 0, 0, Registry::instance()->getGlobalGeodeticProfile() );
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        GeoImage image = layer->createImage( key );
+        double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+        calls = source->getNumCalls();
+        valid = image.valid();
+        return ms;
+    }
+
+    void testMosaicLatency()
+    {
+        const unsigned latencyMS = 100;
+
+        unsigned serialCalls, parallelCalls;
+        bool     serialValid, parallelValid;
+        double serial   = timeMosaic( 1, latencyMS, serialCalls, serialValid );
+        double parallel = timeMosaic( 8, latencyMS, parallelCalls, parallelValid );
+
+        std::stringstream buf;
+        buf << serialCalls << " source tiles at " << latencyMS << "ms: 1 thread " << serial
+            << "ms, 8 threads " << parallel << "ms";
+        OE_NOTICE << "  " << buf.str() << std::endl;
+
+        check( serialValid && parallelValid, "mosaicked a tile from the slow source" );
+        check( serialCalls > 1 && parallelCalls == serialCalls, "the tile spans several source tiles: " + buf.str() );
+        check( serial >= 0.9 * serialCalls * latencyMS, "serial fetches add up: " + buf.str() );
+        check( parallel < 0.6 * parallelCalls * latencyMS && parallel < serial,
+               "parallel fetches overlap: " + buf.str() );
+    }
+
+    // a global-geodetic elevation source that takes a while to return a flat tile.
+    class SlowHeightSource : public TileSource
+    {
+    public:
+        SlowHeightSource( const TileSourceOptions& options, float height, unsigned size, unsigned latencyMS ) :
+            TileSource(options), _height(height), _size(size), _latencyMS(latencyMS)
+        {
+            setProfile( Registry::instance()->getGlobalGeodeticProfile() );
+        }
+
+        void initialize( const std::string& referenceURI, const Profile* overrideProfile ) { }
+
+        osg::Image* createImage( const TileKey& key, ProgressCallback* progress ) { return 0L; }
+
+        osg::HeightField* createHeightField( const TileKey& key, ProgressCallback* progress )
+        {
+            if ( _latencyMS > 0 )
+                OpenThreads::Thread::microSleep( _latencyMS * 1000 );
+            osg::HeightField* hf = new osg::HeightField();
+            hf->allocate( _size, _size );
+            for( unsigned i = 0; i < hf->getHeightList().size(); ++i )
+                hf->getHeightList()[i] = _height;
+            return hf;
+        }
+
+    private:
+        float    _height;
+        unsigned _size, _latencyMS;
+    };
+
+    // a map with one slow elevation layer per height.
+    Map* makeElevationMap( unsigned numLayers, unsigned size, unsigned latencyMS )
+    {
+        Map* map = new Map();
+        for( unsigned i = 0; i < numLayers; ++i )
+        {
+            TileSourceOptions sourceOpt;
+            sourceOpt.L2CacheSize() = 0;
+
+            std::stringstream name;
+            name << "test_elevation_" << i;
+
+            ElevationLayerOptions layerOpt;
+            layerOpt.name() = name.str();
+            layerOpt.cacheEnabled() = false;
+
+            map->addElevationLayer( new ElevationLayer(
+                layerOpt, new SlowHeightSource(sourceOpt, 10.0f*(float)(i+1), size, latencyMS) ) );
+        }
+        return map;
+    }
+
+    // true if every sample of the heightfield is the value.
+    bool isFlat( const osg::HeightField* hf, float value )
+    {
+        for( unsigned i = 0; i < hf->getHeightList().size(); ++i )
+            if ( !osg::equivalent(hf->getHeightList()[i], value) )
+                return false;
+        return true;
+    }
+
+    // Map::getHeightField with 1 to 4 elevation layers. The layers are fetched
+    // concurrently, so against a slow source the time should stay near one round
+    // trip as layers are added; the compositing cost alone is timed with sources
+    // that return at once.
+    void testElevationLayers()
+    {
+        const unsigned latencyMS = 100;
+        TileKey key( 2, 3, 1, Registry::instance()->getGlobalGeodeticProfile() );
+
+        for( unsigned layers = 1; layers <= 4; ++layers )
+        {
+            osg::ref_ptr<Map> slow = makeElevationMap( layers, 17, latencyMS );
+            osg::ref_ptr<osg::HeightField> hf;
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            bool ok = slow->getHeightField( key, false, hf );
+            double fetchMS = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            check( ok && hf.valid() && isFlat(hf.get(), 10.0f), "the first layer wins with SAMPLE_FIRST_VALID" );
+
+            osg::ref_ptr<osg::HeightField> avg;
+            if ( slow->getHeightField( key, false, avg, 0L, INTERP_AVERAGE, SAMPLE_AVERAGE ) )
+                check( isFlat(avg.get(), 5.0f*(float)(layers+1)), "SAMPLE_AVERAGE averages the layers" );
+
+            // compositing only:
+            const unsigned reps = 20;
+            osg::ref_ptr<Map> fast = makeElevationMap( layers, 257, 0 );
+            start = osg::Timer::instance()->tick();
+            for( unsigned i = 0; i < reps; ++i )
+            {
+                osg::ref_ptr<osg::HeightField> out;
+                fast->getHeightField( key, false, out );
+            }
+            double compositeMS = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() ) / (double)reps;
+
+            std::stringstream buf;
+            buf << layers << " layers: " << fetchMS << "ms at " << latencyMS << "ms per layer, "
+                << compositeMS << "ms per 257x257 tile with no latency";
+            OE_NOTICE << "  " << buf.str() << std::endl;
+
+            if ( layers > 1 )
+                check( fetchMS < 0.5 * (double)((layers+1) * latencyMS), "the layers are fetched concurrently: " + buf.str() );
+        }
+    }
+
+    //------------------------------------------------------------------------
+
+#ifndef WIN32
+
+    // HTTP request coalescing: concurrent fetches of one URL reach the server once
+    // and the rest are counted as coalesced; distinct URLs are not coalesced.
+    void testHTTPCoalescing()
+    {
+        MockHTTPServer server( 300 );
+        if ( !check( server.listen(), "started the mock HTTP server" ) )
+            return;
+
+        unsigned oldMax = HTTPClient::getMaxConnectionsPerHost();
+        HTTPClient::setMaxConnectionsPerHost( 16 );
+
+        const unsigned num = 8;
+        std::vector<FetchURL> jobs( num );
+        for( unsigned i = 0; i < num; ++i )
+        {
+            jobs[i]._server = &server;
+            jobs[i]._path   = "/same";
+            jobs[i]._ok     = false;
+        }
+
+        unsigned coalesced0 = HTTPClient::getNumCoalescedRequests();
+        runOnThreads( jobs );
+        unsigned coalesced1 = HTTPClient::getNumCoalescedRequests();
+        unsigned requests1  = server.getNumRequests();
+
+        for( unsigned i = 0; i < num; ++i )
+            check( jobs[i]._ok, "got " + jobs[i]._path );
+
+        for( unsigned i = 0; i < num; ++i )
+        {
+            std::stringstream path;
+            path << "/distinct/" << i;
+            jobs[i]._path = path.str();
+            jobs[i]._ok   = false;
+        }
+        runOnThreads( jobs );
+        unsigned coalesced2 = HTTPClient::getNumCoalescedRequests();
+        unsigned requests2  = server.getNumRequests();
+
+        HTTPClient::setMaxConnectionsPerHost( oldMax );
+        server.stop();
+
+        std::stringstream buf;
+        buf << num << " identical requests: " << requests1 << " reached the server, "
+            << (coalesced1 - coalesced0) << " coalesced; " << num << " distinct requests: "
+            << (requests2 - requests1) << " reached the server, " << (coalesced2 - coalesced1) << " coalesced";
+        OE_NOTICE << "  " << buf.str() << std::endl;
+
+        check( requests1 == 1 && coalesced1 - coalesced0 == num-1, "identical requests coalesced: " + buf.str() );
+        check( requests2 - requests1 == num && coalesced2 == coalesced1, "distinct requests not coalesced: " + buf.str() );
+    }
+
+    // records which threads report progress, and cancels on the first report if asked to.
+    struct RecordingProgress : public ProgressCallback
+    {
+        OpenThreads::Thread* _caller;
+        bool                 _cancelOnReport;
+        volatile unsigned    _reports, _wrongThread;
+
+        RecordingProgress( bool cancelOnReport ) :
+            _caller( OpenThreads::Thread::CurrentThread() ), _cancelOnReport( cancelOnReport ),
+            _reports( 0 ), _wrongThread( 0 ) { }
+
+        bool reportProgress( double current, double total, const std::string& msg )
+        {
+            ++_reports;
+            if ( OpenThreads::Thread::CurrentThread() != _caller )
+                ++_wrongThread;
+            return _cancelOnReport;
+        }
+    };
+
+    struct ProgressFetch
+    {
+        const MockHTTPServer* _server;
+        bool                  _cancel;
+        unsigned              _delay_ms;
+        bool                  _ok, _canceled;
+        unsigned              _reports, _wrongThread;
+        double                _ms;
+
+        void operator()()
+        {
+            OpenThreads::Thread::microSleep( 1000 * _delay_ms );
+            osg::ref_ptr<RecordingProgress> progress = new RecordingProgress( _cancel );
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            HTTPResponse response = HTTPClient::get( _server->url("/progress"), 0L, progress.get() );
+            _ms          = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+            _ok          = response.isOK() && response.getNumParts() > 0 && response.getPartAsString(0) == "/progress";
+            _canceled    = response.isCancelled();
+            _reports     = progress->_reports;
+            _wrongThread = progress->_wrongThread;
+        }
+    };
+
+    // HTTP progress: the engine downloads in its own thread, but a blocking get()
+    // reports progress on the caller's thread; and a coalesced request whose caller
+    // cancels detaches from the download it was waiting on instead of sitting it out.
+    void testHTTPProgress()
+    {
+        const unsigned latency_ms = 600;
+        MockHTTPServer server( latency_ms );
+        if ( !check( server.listen(), "started the mock HTTP server" ) )
+            return;
+
+        std::vector<ProgressFetch> jobs( 2 );
+        for( unsigned i = 0; i < jobs.size(); ++i )
+        {
+            jobs[i]._server   = &server;
+            jobs[i]._cancel   = i == 1;
+            jobs[i]._delay_ms = i == 1 ? 100 : 0; // the second one joins the first's download
+            jobs[i]._ok = jobs[i]._canceled = false;
+            jobs[i]._reports = jobs[i]._wrongThread = 0;
+            jobs[i]._ms = 0.0;
+        }
+        runOnThreads( jobs );
+        server.stop();
+
+        std::stringstream buf;
+        buf << "leader " << jobs[0]._ms << "ms with " << jobs[0]._reports << " reports; canceled follower "
+            << jobs[1]._ms << "ms with " << jobs[1]._reports << " reports";
+        OE_NOTICE << "  " << buf.str() << std::endl;
+
+        check( jobs[0]._ok && jobs[0]._reports > 0, "the request completed and reported progress" );
+        check( jobs[0]._wrongThread == 0 && jobs[1]._wrongThread == 0, "progress was reported on the calling thread" );
+        check( jobs[1]._canceled && !jobs[1]._ok, "the canceled request says so" );
+        check( jobs[1]._ms < latency_ms / 2, "the canceled follower didn't wait for the download: " + buf.str() );
+        check( server.getNumRequests() == 1, "the follower never reached the server" );
+    }
+
+    // the number of response bodies in an HTTP response cache folder.
+    unsigned countCachedResponses( const std::string& path )
+    {
+        unsigned count = 0;
+        osgDB::DirectoryContents files = osgDB::getDirectoryContents( path );
+        for( unsigned i = 0; i < files.size(); ++i )
+            if ( osgDB::getLowerCaseFileExtension(files[i]) == "body" )
+                ++count;
+        return count;
+    }
+
+    // the response cache writes on its own thread; waits (up to a second) for the
+    // folder to hold this many responses.
+    bool waitForCachedResponses( const std::string& path, unsigned count )
+    {
+        for( unsigned i = 0; i < 20 && countCachedResponses(path) < count; ++i )
+            OpenThreads::Thread::microSleep( 50000 );
+        return countCachedResponses( path ) >= count;
+    }
+
+    // fetches a path from a mock server twice (waiting for the cache writer in
+    // between) and returns the number of requests that reached the server. Each
+    // case uses its own path, since a new server may get an old one's port.
+    unsigned fetchTwice( MockHTTPServer& server, const std::string& urlPath, const std::string& cachePath,
+                         const std::string& body, const osgDB::ReaderWriter::Options* options, bool& ok )
+    {
+        unsigned before = countCachedResponses( cachePath );
+        ok = true;
+        for( unsigned i = 0; i < 2; ++i )
+        {
+            HTTPResponse response = HTTPClient::get( server.url(urlPath), options );
+            ok = ok && response.isOK() && response.getNumParts() > 0 && response.getPartAsString(0) == body;
+            if ( i == 0 )
+                waitForCachedResponses( cachePath, before+1 ); // times out if it isn't cached
+        }
+        return server.getNumRequests();
+    }
+
+    // The persistent HTTP response cache: a fresh response is served from disk, a
+    // stale one with an ETag is revalidated with If-None-Match and served from disk
+    // on a 304, and private responses and credentialed requests stay out of it.
+    void testHTTPResponseCache()
+    {
+        const std::string path = "osgearth_tests_http_cache";
+        const std::string body = "<Capabilities/>";
+
+        std::string oldPath = HTTPClient::getResponseCachePath();
+        osgDB::makeDirectory( path );
+        removePackFiles( path );
+        HTTPClient::setResponseCachePath( path );
+
+        // fresh for an hour: the second fetch never reaches the server.
+        {
+            MockHTTPServer server( 0 );
+            server.setBody( "text/xml", body );
+            server.setHeaders( "Cache-Control: max-age=3600\r\n" );
+            if ( check( server.listen(), "started the mock HTTP server" ) )
+            {
+                HTTPClient::ResponseCacheStats s0 = HTTPClient::getResponseCacheStats();
+                bool ok;
+                unsigned requests = fetchTwice( server, "/fresh", path, body, 0L, ok );
+                HTTPClient::ResponseCacheStats s1 = HTTPClient::getResponseCacheStats();
+                check( ok, "fresh: both fetches got the body" );
+                check( requests == 1 && s1._hits == s0._hits+1, "a fresh response is served from the cache" );
+            }
+        }
+
+        // must revalidate: the second fetch is conditional and the server says 304.
+        {
+            MockHTTPServer server( 0 );
+            server.setBody( "text/xml", body );
+            server.setHeaders( "Cache-Control: no-cache\r\n", "\"v1\"" );
+            if ( check( server.listen(), "started the mock HTTP server" ) )
+            {
+                HTTPClient::ResponseCacheStats s0 = HTTPClient::getResponseCacheStats();
+                bool ok;
+                unsigned requests = fetchTwice( server, "/revalidated", path, body, 0L, ok );
+                HTTPClient::ResponseCacheStats s1 = HTTPClient::getResponseCacheStats();
+                check( ok, "revalidated: both fetches got the body" );
+                check( requests == 2 && s1._revalidations == s0._revalidations+1 && s1._hits == s0._hits,
+                       "a stale response is revalidated and the 304 is served from the cache" );
+            }
+        }
+
+        // private, and personalized with a cookie: never stored.
+        const char* privateHeaders[] = {
+            "Cache-Control: private, max-age=3600\r\n",
+            "Cache-Control: max-age=3600\r\nSet-Cookie: session=1\r\n" };
+        for( unsigned i = 0; i < 2; ++i )
+        {
+            MockHTTPServer server( 0 );
+            server.setBody( "text/xml", body );
+            server.setHeaders( privateHeaders[i] );
+            if ( check( server.listen(), "started the mock HTTP server" ) )
+            {
+                unsigned stored = countCachedResponses( path );
+                bool ok;
+                unsigned requests = fetchTwice( server, i == 0 ? "/private" : "/cookie", path, body, 0L, ok );
+                check( ok, "private: both fetches got the body" );
+                check( requests == 2 && countCachedResponses(path) == stored,
+                       i == 0 ? "a private response is not cached" : "a response that sets a cookie is not cached" );
+            }
+        }
+
+        // credentialed requests neither use nor feed the cache.
+        {
+            MockHTTPServer server( 0 );
+            server.setBody( "text/xml", body );
+            server.setHeaders( "Cache-Control: max-age=3600\r\n" );
+            if ( check( server.listen(), "started the mock HTTP server" ) )
+            {
+                osg::ref_ptr<osgDB::AuthenticationMap> auth = new osgDB::AuthenticationMap();
+                auth->addAuthenticationDetails( server.url("/"), new osgDB::AuthenticationDetails("user", "secret") );
+                osg::ref_ptr<osgDB::ReaderWriter::Options> options = new osgDB::ReaderWriter::Options();
+                options->setAuthenticationMap( auth.get() );
+
+                unsigned stored = countCachedResponses( path );
+                bool ok;
+                unsigned requests = fetchTwice( server, "/credentialed", path, body, options.get(), ok );
+                check( ok, "credentialed: both fetches got the body" );
+                check( requests == 2 && countCachedResponses(path) == stored,
+                       "a credentialed request is not cached" );
+            }
+        }
+
+        HTTPClient::setResponseCachePath( oldPath );
+        removePackFiles( path );
+    }
+
+    unsigned readFeatureCursor( Features::FeatureSource* source, const Symbology::Query& query, Features::FeatureList& out )
+    {
+        out.clear();
+        osg::ref_ptr<Features::FeatureCursor> cursor = source->createFeatureCursor( query );
+        while( cursor.valid() && cursor->hasMore() )
+            out.push_back( cursor->nextFeature() );
+        return out.size();
+    }
+
+    // counts GDAL in-memory files left behind by the WFS driver.
+    int countWFSMemFiles()
+    {
+        int count = 0;
+        char** names = VSIReadDir( "/vsimem/" );
+        for( int i = 0; names && names[i]; ++i )
+            if ( std::string(names[i]).find("osgearth_wfs_") == 0 )
+                ++count;
+        CSLDestroy( names );
+        return count;
+    }
+
+    // WFS feature source against a local server that answers with GeoJSON: the
+    // response is parsed in memory, and a repeated query is answered from the
+    // parsed-tile cache without another request.
+    void testWFSFeatures()
+    {
+        MockHTTPServer server( 0 );
+        server.setBody( "application/json",
+            "{\"type\":\"FeatureCollection\",\"features\":["
+            "{\"type\":\"Feature\",\"id\":1,\"properties\":{\"Name\":\"a\",\"height\":\"12\"},"
+            "\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[[[0,0],[1,0],[1,1],[0,1],[0,0]]]}},"
+            "{\"type\":\"Feature\",\"id\":2,\"properties\":{\"Name\":\"b\",\"height\":\"30\"},"
+            "\"geometry\":{\"type\":\"Point\",\"coordinates\":[2,3]}}]}" );
+        if ( !check( server.listen(), "started the mock HTTP server" ) )
+            return;
+
+        WFSFeatureOptions options;
+        options.url() = server.url( "/wfs" );
+        options.typeName() = "buildings";
+        osg::ref_ptr<Features::FeatureSource> source = Features::FeatureSourceFactory::create( options );
+        if ( !check( source.valid(), "created the WFS feature source" ) )
+            return;
+
+        // the capabilities request gets JSON back; the source carries on without them.
+        source->initialize( "" );
+        unsigned base = server.getNumRequests();
+        int memFiles = countWFSMemFiles();
+
+        Symbology::Query query;
+        query.bounds() = Bounds( -10.0, -10.0, 10.0, 10.0 );
+
+        Features::FeatureList first;
+        check( readFeatureCursor(source.get(), query, first) == 2, "parsed both features" );
+        check( server.getNumRequests() == base + 1, "the first query went to the server" );
+        check( countWFSMemFiles() == memFiles, "the in-memory response was unlinked" );
+        if ( first.size() == 2 )
+        {
+            Features::Feature* f = first.front().get();
+            check( f->getAttr("name") == "a" && f->getAttr("height") == "12", "attributes came through, lower-cased" );
+            check( f->getGeometry() && f->getGeometry()->getType() == Symbology::Geometry::TYPE_POLYGON, "polygon geometry came through" );
+
+            // callers own what they get; the cached copy must not change.
+            f->setAttr( "name", "changed" );
+        }
+
+        Features::FeatureList second;
+        check( readFeatureCursor(source.get(), query, second) == 2, "the cached query returned both features" );
+        check( server.getNumRequests() == base + 1, "the repeated query was a cache hit" );
+        check( !second.empty() && second.front()->getAttr("name") == "a", "the cache hands out copies" );
+
+        Symbology::Query other;
+        other.bounds() = Bounds( 0.0, 0.0, 5.0, 5.0 );
+        Features::FeatureList third;
+        readFeatureCursor( source.get(), other, third );
+        check( server.getNumRequests() == base + 2, "a different query went to the server" );
+
+        server.stop();
+    }
+
+#endif // !WIN32
+
+    //------------------------------------------------------------------------
+
+#ifdef WIN32
+    template<typename JOB>
+    DWORD WINAPI runForeignJob( LPVOID job ) { (*static_cast<JOB*>(job))(); return 0; }
+#else
+    template<typename JOB>
+    void* runForeignJob( void* job ) { (*static_cast<JOB*>(job))(); return 0L; }
+#endif
+
+    /**
+     * Like runOnThreads, but on native threads that OpenThreads did not create
+     * (Thread::CurrentThread() is NULL on them, as it is on GDAL or curl workers).
+     */
+    template<typename JOB>
+    void runOnForeignThreads( std::vector<JOB>& jobs )
+    {
+#ifdef WIN32
+        std::vector<HANDLE> threads;
+        for( unsigned i = 0; i < jobs.size(); ++i )
+            threads.push_back( ::CreateThread( 0L, 0, &runForeignJob<JOB>, &jobs[i], 0, 0L ) );
+        for( unsigned i = 0; i < threads.size(); ++i )
+        {
+            ::WaitForSingleObject( threads[i], INFINITE );
+            ::CloseHandle( threads[i] );
+        }
+#else
+        std::vector<pthread_t> threads( jobs.size() );
+        for( unsigned i = 0; i < jobs.size(); ++i )
+            ::pthread_create( &threads[i], 0L, &runForeignJob<JOB>, &jobs[i] );
+        for( unsigned i = 0; i < threads.size(); ++i )
+            ::pthread_join( threads[i], 0L );
+#endif
+    }
+
+    /** Repeatedly checks which of a set of tiles are cached; only the even ones should be. */
+    struct CacheQueries
+    {
+        osg::ref_ptr<Cache> _cache;
+        CacheSpec           _spec;
+        unsigned            _numTiles;
+        unsigned            _errors;
+
+        void operator()()
+        {
+            std::vector<TileKey> keys;
+            for( unsigned i = 0; i < _numTiles; ++i )
+                keys.push_back( packTileKey(i) );
+
+            for( unsigned pass = 0; pass < 20; ++pass )
+            {
+                std::vector<bool> cached;
+                if ( _cache->areCached(keys, _spec, cached) != (_numTiles+1)/2 )
+                    ++_errors;
+
+                for( unsigned i = 0; i < _numTiles; ++i )
+                {
+                    bool expected = (i % 2) == 0;
+                    if ( cached[i] != expected || _cache->isCached(keys[i], _spec) != expected )
+                        ++_errors;
+                }
+            }
+        }
+    };
+
+    // Sqlite3Cache: isCached and areCached give the right answers when called
+    // concurrently from threads OpenThreads doesn't know about, each of which
+    // must get its own connection.
+    void testSqliteThreads()
+    {
+        const std::string dbPath = "osgearth_tests_sqlite_cache/cache.db";
+        ::remove( dbPath.c_str() );
+        ::remove( (dbPath + "-wal").c_str() );
+        ::remove( (dbPath + "-shm").c_str() );
+
+        Sqlite3CacheOptions options;
+        options.path()        = dbPath;
+        options.asyncWrites() = false;
+        options.maxSize()     = 0;
+        CacheSpec spec( "test", "png" );
+        const unsigned numTiles = 64;
+
+        // first session: cache the even tiles.
+        {
+            osg::ref_ptr<Cache> cache = CacheFactory::create( options );
+            if ( !cache.valid() )
+            {
+                OE_NOTICE << "  sqlite3 cache driver not available; skipping" << std::endl;
+                return;
+            }
+
+            cache->storeProperties( spec, Registry::instance()->getGlobalGeodeticProfile(), 16 );
+            for( unsigned i = 0; i < numTiles; i += 2 )
+            {
+                osg::ref_ptr<osg::Image> image = makePackTile( i + 1 );
+                cache->setImage( packTileKey(i), spec, image.get() );
+            }
+        }
+
+        // second session: a fresh cache, so every query goes to the database.
+        {
+            osg::ref_ptr<Cache> cache = CacheFactory::create( options );
+            if ( !check( cache.valid(), "reopened the sqlite3 cache" ) )
+                return;
+
+            CacheQueries proto;
+            proto._cache    = cache.get();
+            proto._spec     = spec;
+            proto._numTiles = numTiles;
+            proto._errors   = 0;
+
+            // the main thread is itself a thread OpenThreads did not create.
+            CacheQueries mainJob = proto;
+            mainJob();
+            check( mainJob._errors == 0, "isCached/areCached on the main thread" );
+
+            std::vector<CacheQueries> jobs( 8, proto );
+            runOnForeignThreads( jobs );
+
+            unsigned errors = 0;
+            for( unsigned i = 0; i < jobs.size(); ++i )
+                errors += jobs[i]._errors;
+
+            std::stringstream buf;
+            buf << "isCached/areCached on 8 foreign threads (" << errors << " wrong answers)";
+            check( errors == 0, buf.str() );
+        }
+
+        ::remove( dbPath.c_str() );
+        ::remove( (dbPath + "-wal").c_str() );
+        ::remove( (dbPath + "-shm").c_str() );
+    }
+
+    //------------------------------------------------------------------------
+
+    TileKey stressTileKey( unsigned lod, unsigned i )
+    {
+        unsigned cols = 2u << lod;
+        return TileKey( lod, i % cols, i / cols, Registry::instance()->getGlobalGeodeticProfile() );
+    }
+
+    /**
+     * One thread of the sqlite3 stress benchmark. Readers fetch random tiles
+     * until told to stop; the writer stores new tiles, waits, then stops everyone;
+     * the timer just waits, then stops everyone.
+     */
+    struct CacheStressJob
+    {
+        enum Role { READER, WRITER, TIMER };
+
+        Role                _role;
+        osg::ref_ptr<Cache> _cache;
+        CacheSpec           _spec;
+        unsigned            _numTiles;   // tiles readers choose from (lod 5)
+        unsigned            _numWrites;  // tiles the writer stores (lod 6)
+        volatile bool*      _stop;
+        unsigned            _seed;
+        unsigned            _count;
+        unsigned            _errors;
+        double              _totalMs;
+        double              _maxMs;
+
+        void operator()()
+        {
+            if ( _role == READER )
+            {
+                while( !*_stop )
+                {
+                    _seed = _seed * 1664525u + 1013904223u;
+                    unsigned i = (_seed >> 8) % _numTiles;
+
+                    osg::Timer_t start = osg::Timer::instance()->tick();
+                    osg::ref_ptr<const osg::Image> image;
+                    bool found = _cache->getImage( stressTileKey(5, i), _spec, image );
+                    double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+                    // makePackTile stores the low and high bytes of its value in R and G.
+                    if ( !found || !image.valid() || image->s() != 16 ||
+                         image->data()[0] != (unsigned char)((i+1) & 0xFF) ||
+                         image->data()[1] != (unsigned char)((i+1) >> 8) )
+                    {
+                        ++_errors;
+                    }
+
+                    ++_count;
+                    _totalMs += ms;
+                    _maxMs = osg::maximum( _maxMs, ms );
+                }
+            }
+            else
+            {
+                if ( _role == WRITER )
+                {
+                    for( unsigned i = 0; i < _numWrites; ++i )
+                    {
+                        osg::ref_ptr<osg::Image> image = makePackTile( i + 1 );
+                        _cache->setImage( stressTileKey(6, i), _spec, image.get() );
+                        ++_count;
+                    }
+                }
+                // give the write service time to commit while the readers run.
+                OpenThreads::Thread::microSleep( 1000000 );
+                *_stop = true;
+            }
+        }
+    };
+
+    // runs 16 readers plus a writer or a timer; returns the number of wrong reads.
+    unsigned runCacheStress( const CacheStressJob& proto, CacheStressJob::Role role, const std::string& what )
+    {
+        volatile bool stop = false;
+
+        std::vector<CacheStressJob> jobs( 17, proto );
+        for( unsigned i = 0; i < jobs.size(); ++i )
+        {
+            jobs[i]._role = i == 0 ? role : CacheStressJob::READER;
+            jobs[i]._stop = &stop;
+            jobs[i]._seed = i * 7919u + 1u;
+        }
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        runOnThreads( jobs );
+        double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        unsigned reads = 0, errors = 0;
+        double totalMs = 0.0, maxMs = 0.0;
+        for( unsigned i = 1; i < jobs.size(); ++i )
+        {
+            reads   += jobs[i]._count;
+            errors  += jobs[i]._errors;
+            totalMs += jobs[i]._totalMs;
+            maxMs    = osg::maximum( maxMs, jobs[i]._maxMs );
+        }
+
+        std::stringstream buf;
+        buf << what << ": " << reads << " reads in " << seconds << "s ("
+            << (int)(reads / seconds) << "/s), mean " << (reads ? totalMs / reads : 0.0)
+            << "ms, max " << maxMs << "ms";
+        if ( role == CacheStressJob::WRITER )
+            buf << ", " << jobs[0]._count << " tiles written";
+        OE_NOTICE << "  " << buf.str() << std::endl;
+
+        check( reads > 0, what + ": readers made progress" );
+        return errors;
+    }
+
+    // Sqlite3Cache benchmark: 16 reader threads fetch tiles at random, alone and
+    // then alongside a writer whose tiles commit through the async write service.
+    // Reads should keep flowing (and stay correct) while the writer commits.
+    void testSqliteStress()
+    {
+        const std::string dbPath = "osgearth_tests_sqlite_stress/cache.db";
+        ::remove( dbPath.c_str() );
+        ::remove( (dbPath + "-wal").c_str() );
+        ::remove( (dbPath + "-shm").c_str() );
+
+        Sqlite3CacheOptions options;
+        options.path()    = dbPath;
+        options.maxSize() = 0;
+        CacheSpec spec( "stress", "png" );
+
+        CacheStressJob proto;
+        proto._spec      = spec;
+        proto._numTiles  = 1024;
+        proto._numWrites = 4096;
+        proto._stop      = 0L;
+        proto._seed      = 0;
+        proto._count     = 0;
+        proto._errors    = 0;
+        proto._totalMs   = 0.0;
+        proto._maxMs     = 0.0;
+
+        // populate the tiles the readers fetch.
+        {
+            Sqlite3CacheOptions syncOptions = options;
+            syncOptions.asyncWrites() = false;
+            osg::ref_ptr<Cache> cache = CacheFactory::create( syncOptions );
+            if ( !cache.valid() )
+            {
+                OE_NOTICE << "  sqlite3 cache driver not available; skipping" << std::endl;
+                return;
+            }
+
+            cache->storeProperties( spec, Registry::instance()->getGlobalGeodeticProfile(), 16 );
+            for( unsigned i = 0; i < proto._numTiles; ++i )
+            {
+                osg::ref_ptr<osg::Image> image = makePackTile( i + 1 );
+                cache->setImage( stressTileKey(5, i), spec, image.get() );
+            }
+        }
+
+        {
+            osg::ref_ptr<Cache> cache = CacheFactory::create( options );
+            if ( !check( cache.valid(), "reopened the sqlite3 cache" ) )
+                return;
+            proto._cache = cache.get();
+
+            unsigned errors = 0;
+            errors += runCacheStress( proto, CacheStressJob::TIMER,  "16 readers" );
+            errors += runCacheStress( proto, CacheStressJob::WRITER, "16 readers + 1 writer" );
+
+            std::stringstream buf;
+            buf << "every read returned the right tile (" << errors << " wrong)";
+            check( errors == 0, buf.str() );
+
+            unsigned written = 0;
+            for( unsigned i = 0; i < proto._numWrites; ++i )
+            {
+                if ( cache->isCached(stressTileKey(6, i), spec) )
+                    ++written;
+            }
+            check( written == proto._numWrites, "the writer's tiles are all cached" );
+        }
+
+        ::remove( dbPath.c_str() );
+        ::remove( (dbPath + "-wal").c_str() );
+        ::remove( (dbPath + "-shm").c_str() );
+    }
+
+    //------------------------------------------------------------------------
+
+    // GeoImage::reproject between UTM and geographic, which now goes through the
+    // RGBA8 kernel (GDAL used to do it). The source is a gradient whose red and
+    // green bytes equal the pixel's column and row, so every output pixel can be
+    // checked against an OGR transform of its center. Pixels the source doesn't
+    // cover must come out transparent. Also compares against GDAL (which still
+    // handles RGB8 sources) and times both.
+    void testReprojectKernelUTM()
+    {
+        osg::ref_ptr<SpatialReference> geo = SpatialReference::create( "wgs84" );
+        osg::ref_ptr<SpatialReference> utm = SpatialReference::create( "+proj=utm +zone=33 +datum=WGS84 +units=m +no_defs" );
+        if ( !check( geo.valid() && utm.valid(), "created the SRS's" ) )
+            return;
+
+        const int size = 256;
+        osg::ref_ptr<osg::Image> rgba = new osg::Image();
+        rgba->allocateImage( size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+        osg::ref_ptr<osg::Image> rgb = new osg::Image();
+        rgb->allocateImage( size, size, 1, GL_RGB, GL_UNSIGNED_BYTE );
+        for( int t = 0; t < size; ++t )
+        {
+            for( int s = 0; s < size; ++s )
+            {
+                unsigned char* p = rgba->data( s, t );
+                unsigned char* q = rgb->data( s, t );
+                p[0] = q[0] = (unsigned char)s;
+                p[1] = q[1] = (unsigned char)t;
+                p[2] = q[2] = 128;
+                p[3] = 255;
+            }
+        }
+
+        GeoExtent srcExtent( utm.get(), 400000.0, 4500000.0, 600000.0, 4700000.0 );
+        GeoExtent dstExtent( geo.get(), 14.5, 41.0, 16.5, 43.0 ); // runs off the east and north edges
+        const int out = 128;
+
+        GeoImage source( rgba.get(), srcExtent );
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        GeoImage result = source.reproject( geo.get(), &dstExtent, out, out );
+        double kernelMs = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+        if ( !check( result.valid() && result.getImage()->s() == out && result.getImage()->t() == out, "reprojected UTM -> geographic" ) )
+            return;
+
+        const osg::Image* image = result.getImage();
+        const double dx = dstExtent.width() / out;
+        const double dy = dstExtent.height() / out;
+        const double xfac = (size - 1) / srcExtent.width();
+        const double yfac = (size - 1) / srcExtent.height();
+
+        unsigned inside = 0, outside = 0, errors = 0;
+        for( int r = 0; r < out; ++r )
+        {
+            for( int c = 0; c < out; ++c )
+            {
+                double x, y;
+                geo->transform( dstExtent.xMin() + (c + 0.5) * dx, dstExtent.yMin() + (r + 0.5) * dy, utm.get(), x, y );
+                double px = (x - srcExtent.xMin()) * xfac;
+                double py = (y - srcExtent.yMin()) * yfac;
+                const unsigned char* p = image->data( c, r );
+
+                if ( px >= 1.0 && px <= size - 2.0 && py >= 1.0 && py <= size - 2.0 )
+                {
+                    ++inside;
+                    if ( p[3] != 255 || ::fabs(p[0] - px) > 2.0 || ::fabs(p[1] - py) > 2.0 || p[2] != 128 )
+                        ++errors;
+                }
+                else if ( px < -1.0 || px > size || py < -1.0 || py > size )
+                {
+                    ++outside;
+                    if ( p[3] != 0 )
+                        ++errors;
+                }
+            }
+        }
+
+        std::stringstream buf;
+        buf << inside << " covered and " << outside << " uncovered pixels checked, " << errors << " wrong";
+        check( inside > 0 && outside > 0 && errors == 0, buf.str() );
+
+        // splitting the rows across threads must not change a single byte.
+        GeoImage threaded = source.reproject( geo.get(), &dstExtent, out, out, 4 );
+        check( threaded.valid() && maxByteDiff(threaded.getImage(), image) == 0, "4 threads match 1 thread" );
+
+        // GDAL puts pixel centers half a pixel in from the extent edges, where the kernel
+        // puts them on the edges, so allow for that on the gradient.
+        start = osg::Timer::instance()->tick();
+        GeoImage gdal = GeoImage( rgb.get(), srcExtent ).reproject( geo.get(), &dstExtent, out, out );
+        double gdalMs = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+        if ( check( gdal.valid(), "GDAL reprojected the RGB8 source" ) &&
+             gdal.getImage()->getPixelFormat() == GL_RGBA && gdal.getImage()->s() == out && gdal.getImage()->t() == out )
+        {
+            int maxDiff = 0;
+            for( int r = 0; r < out; ++r )
+            {
+                for( int c = 0; c < out; ++c )
+                {
+                    const unsigned char* p = image->data( c, r );
+                    const unsigned char* q = gdal.getImage()->data( c, r );
+                    if ( p[3] == 255 && q[3] == 255 && p[0] > 2 && p[0] < size-3 && p[1] > 2 && p[1] < size-3 )
+                    {
+                        maxDiff = osg::maximum( maxDiff, ::abs((int)p[0] - (int)q[0]) );
+                        maxDiff = osg::maximum( maxDiff, ::abs((int)p[1] - (int)q[1]) );
+                    }
+                }
+            }
+            std::stringstream buf2;
+            buf2 << "kernel within 3 of GDAL where both have data (max difference " << maxDiff << ")";
+            check( maxDiff <= 3, buf2.str() );
+        }
+
+        OE_NOTICE << "  UTM -> geographic " << size << "x" << size << " -> " << out << "x" << out
+            << ": kernel " << kernelMs << "ms, GDAL " << gdalMs << "ms" << std::endl;
+    }
+
+    //------------------------------------------------------------------------
+
+    // transformToECEF/transformFromECEF on a Vec3dArray against the one-point
+    // versions, from UTM 33N and from geographic, and the round trip; also times
+    // the batch against a point at a time.
+    void testECEFBatch()
+    {
+        osg::ref_ptr<SpatialReference> geo = SpatialReference::create( "wgs84" );
+        osg::ref_ptr<SpatialReference> utm = SpatialReference::create( "+proj=utm +zone=33 +datum=WGS84 +units=m +no_defs" );
+        if ( !check( geo.valid() && utm.valid(), "created the SRS's" ) )
+            return;
+
+        const SpatialReference* srs[2] = { utm.get(), geo.get() };
+        const char* names[2] = { "UTM 33N", "geographic" };
+
+        for( unsigned k = 0; k < 2; ++k )
+        {
+            std::vector<double> x, y;
+            if ( srs[k] == utm.get() )
+                makeGrid( 300000.0, 1000000.0, 2000.0, 20000.0, 200, 300, x, y );
+            else
+                makeGrid( 12.1, -70.0, 0.02, 0.5, 300, 300, x, y );
+
+            osg::ref_ptr<osg::Vec3dArray> input = new osg::Vec3dArray();
+            for( unsigned i = 0; i < x.size(); ++i )
+                input->push_back( osg::Vec3d( x[i], y[i], (double)(i % 1000) ) );
+
+            osg::ref_ptr<osg::Vec3dArray> ecef = new osg::Vec3dArray( *input );
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            bool ok = srs[k]->transformToECEF( ecef.get(), false );
+            double batchMs = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            osg::ref_ptr<osg::Vec3dArray> single = new osg::Vec3dArray( input->size() );
+            start = osg::Timer::instance()->tick();
+            for( unsigned i = 0; i < input->size(); ++i )
+                srs[k]->transformToECEF( (*input)[i], (*single)[i] );
+            double singleMs = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            double maxErr = 0.0;
+            for( unsigned i = 0; ok && i < input->size(); ++i )
+                maxErr = osg::maximum( maxErr, ((*ecef)[i] - (*single)[i]).length() );
+
+            std::stringstream buf;
+            buf << names[k] << " to ECEF: batch matches single points (max difference " << maxErr << "m)";
+            check( ok && maxErr <= 1e-6, buf.str() );
+            OE_NOTICE << "  " << input->size() << " points " << names[k] << " to ECEF: batch "
+                << batchMs << "ms, one at a time " << singleMs << "ms" << std::endl;
+
+            osg::ref_ptr<osg::Vec3dArray> back = new osg::Vec3dArray( *ecef );
+            start = osg::Timer::instance()->tick();
+            ok = srs[k]->transformFromECEF( back.get(), false );
+            batchMs = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            start = osg::Timer::instance()->tick();
+            for( unsigned i = 0; i < ecef->size(); ++i )
+                srs[k]->transformFromECEF( (*ecef)[i], (*single)[i] );
+            singleMs = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+            // horizontal tolerance in the SRS's own units (about a millimeter either way):
+            double tolerance = srs[k] == utm.get() ? 1e-3 : 1e-8;
+            double maxBatch = 0.0, maxRoundTrip = 0.0, maxHeight = 0.0;
+            for( unsigned i = 0; ok && i < ecef->size(); ++i )
+            {
+                const osg::Vec3d& b = (*back)[i];
+                const osg::Vec3d& s = (*single)[i];
+                const osg::Vec3d& in = (*input)[i];
+                maxBatch     = osg::maximum( maxBatch, osg::maximum( fabs(b.x()-s.x()), fabs(b.y()-s.y()) ) );
+                maxRoundTrip = osg::maximum( maxRoundTrip, osg::maximum( fabs(b.x()-in.x()), fabs(b.y()-in.y()) ) );
+                maxHeight    = osg::maximum( maxHeight, osg::maximum( fabs(b.z()-s.z()), fabs(b.z()-in.z()) ) );
+            }
+
+            std::stringstream buf2;
+            buf2 << "ECEF to " << names[k] << ": batch matches single points (max difference " << maxBatch
+                 << "), round trip within " << maxRoundTrip << ", heights within " << maxHeight << "m";
+            check( ok && maxBatch <= tolerance && maxRoundTrip <= tolerance && maxHeight <= 1e-3, buf2.str() );
+            OE_NOTICE << "  " << input->size() << " points ECEF to " << names[k] << ": batch "
+                << batchMs << "ms, one at a time " << singleMs << "ms" << std::endl;
+        }
+    }
+
+    //------------------------------------------------------------------------
+
+    // Profile hashes: equivalent profiles share one, others never do, even after
+    // more distinct profiles than the identity table holds. TileKey::str() is
+    // built once per key.
+    void testProfileHash()
+    {
+        osg::ref_ptr<SpatialReference> geo = SpatialReference::create( "wgs84" );
+        if ( !check( geo.valid(), "created the SRS" ) )
+            return;
+
+        osg::ref_ptr<const Profile> a = Profile::create( geo.get(), -10.0, -10.0, 10.0, 10.0 );
+        osg::ref_ptr<const Profile> b = Profile::create( "epsg:4326", -10.0, -10.0, 10.0, 10.0 );
+        osg::ref_ptr<const Profile> c = Profile::create( geo.get(), -10.0, -10.0, 10.0, 10.0, 0L, 2, 2 );
+        check( a->isEquivalentTo(b.get()) && a->getHash() == b->getHash(), "equivalent profiles share a hash" );
+        check( !a->isEquivalentTo(c.get()) && a->getHash() != c->getHash(), "a different tile grid gets a different hash" );
+
+        // many more distinct profiles than the table holds, re-checking "a" as we go:
+        std::set<unsigned> hashes;
+        hashes.insert( a->getHash() );
+        hashes.insert( c->getHash() );
+        unsigned sameAsA = 0;
+        for( unsigned i = 0; i < 1000; ++i )
+        {
+            osg::ref_ptr<const Profile> p = Profile::create( geo.get(), -10.0, -10.0, 10.0 + 0.01*(i+1), 10.0 );
+            hashes.insert( p->getHash() );
+
+            osg::ref_ptr<const Profile> again = Profile::create( geo.get(), -10.0, -10.0, 10.0, 10.0 );
+            if ( again->getHash() == a->getHash() )
+                ++sameAsA;
+        }
+        check( hashes.size() == 1002, "1000 distinct profiles get 1000 distinct hashes" );
+        check( sameAsA == 1000, "a profile in steady use keeps its hash" );
+
+        TileKey key( 12, 3456, 789, a.get() );
+        const std::string& s1 = key.str();
+        const std::string& s2 = key.str();
+        TileKey copy( key );
+        check( s1 == "12_3456_789" && &s1 == &s2 && copy.str() == s1, "TileKey::str() is lod_x_y and built once" );
+        check( TileKey().str() == "invalid" && TileKey::INVALID.str() == "invalid", "invalid keys say so" );
+
+        const unsigned num = 1000000;
+        unsigned length = 0;
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for( unsigned i = 0; i < num; ++i )
+            length += key.str().size();
+        double strMs = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+        start = osg::Timer::instance()->tick();
+        for( unsigned i = 0; i < num; ++i )
+        {
+            std::stringstream buf;
+            buf << key.getLevelOfDetail() << "_" << key.getTileX() << "_" << key.getTileY();
+            length += buf.str().size();
+        }
+        double streamMs = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+        OE_NOTICE << "  " << num << " x TileKey::str(): " << strMs << "ms (a stringstream each time: "
+            << streamMs << "ms, " << length << " chars)" << std::endl;
+    }
+
+    //------------------------------------------------------------------------
+
+    struct TinyTask : public TaskRequest
+    {
+        osg::Timer_t _queued;
+        volatile unsigned _sum;
+
+        TinyTask( float priority ) : TaskRequest( priority ), _sum( 0 ) { }
+
+        void operator()( ProgressCallback* )
+        {
+            unsigned sum = 0;
+            for( unsigned i = 0; i < 100; ++i )
+                sum += i * i;
+            _sum = sum;
+        }
+    };
+
+    struct BlockerTask : public TaskRequest
+    {
+        volatile bool _release;
+
+        BlockerTask() : _release( false ) { }
+
+        void operator()( ProgressCallback* )
+        {
+            for( int wait = 0; wait < 5000 && !_release; ++wait )
+                OpenThreads::Thread::microSleep( 1000 );
+        }
+    };
+
+    // pushes 10k tiny tasks through a 32-thread service and reports the enqueue cost
+    // and the queue latency (add to start) distribution.
+    void runTaskBenchmark( TaskService* service, const std::string& what )
+    {
+        const unsigned num = 10000;
+        std::vector< osg::ref_ptr<TinyTask> > tasks( num );
+        for( unsigned i = 0; i < num; ++i )
+            tasks[i] = new TinyTask( (float)(i % 16) );
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for( unsigned i = 0; i < num; ++i )
+        {
+            tasks[i]->_queued = osg::Timer::instance()->tick();
+            service->add( tasks[i].get() );
+        }
+        double enqueueMs = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+        unsigned completed = 0;
+        for( int wait = 0; wait < 30000 && completed < num; ++wait )
+        {
+            completed = 0;
+            for( unsigned i = 0; i < num; ++i )
+                if ( tasks[i]->isCompleted() )
+                    ++completed;
+            if ( completed < num )
+                OpenThreads::Thread::microSleep( 1000 );
+        }
+        double totalMs = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+        check( completed == num, what + ": every task ran" );
+        if ( completed < num )
+            return;
+
+        std::vector<double> latency( num );
+        for( unsigned i = 0; i < num; ++i )
+            latency[i] = osg::Timer::instance()->delta_m( tasks[i]->_queued, tasks[i]->startTime() );
+        std::sort( latency.begin(), latency.end() );
+
+        std::stringstream buf;
+        buf << what << ": enqueue " << (enqueueMs * 1000.0 / num) << "us per task, latency p50 "
+            << latency[num/2] << "ms p99 " << latency[(num*99)/100] << "ms max " << latency[num-1]
+            << "ms, " << num << " tasks in " << totalMs << "ms";
+        OE_NOTICE << "  " << buf.str() << std::endl;
+    }
+
+    // TaskService microbenchmark: 10k tiny tasks on 32 threads, first through the
+    // single shared priority queue, then with one lane per thread (work group).
+    void testTaskService()
+    {
+        {
+            osg::ref_ptr<TaskService> service = new TaskService( "bench", 32 );
+            runTaskBenchmark( service.get(), "32 threads, 1 lane" );
+        }
+        {
+            osg::ref_ptr<TaskWorkGroup> group = new TaskWorkGroup();
+            osg::ref_ptr<TaskService> service = new TaskService( "bench", 32 );
+            service->setWorkGroup( group.get() );
+            runTaskBenchmark( service.get(), "32 threads, 32 lanes" );
+            service->setWorkGroup( 0L );
+        }
+
+        // a single lane keeps strict priority order: hold the only thread on a blocker
+        // while the requests queue up, then check they start lowest value first.
+        osg::ref_ptr<TaskService> service = new TaskService( "order", 1 );
+        osg::ref_ptr<BlockerTask> blocker = new BlockerTask();
+        service->add( blocker.get() );
+        for( int wait = 0; wait < 5000 && !blocker->isInProgress(); ++wait )
+            OpenThreads::Thread::microSleep( 1000 );
+
+        std::vector< osg::ref_ptr<TinyTask> > tasks;
+        for( unsigned i = 0; i < 64; ++i )
+        {
+            tasks.push_back( new TinyTask( (float)(63 - i) ) );
+            service->add( tasks.back().get() );
+        }
+        service->reprioritize( tasks[0].get(), -1.0f );
+        blocker->_release = true;
+
+        for( int wait = 0; wait < 5000 && !tasks[1]->isCompleted(); ++wait )
+            OpenThreads::Thread::microSleep( 1000 );
+
+        // tasks[0] was bumped to the front; the rest run in reverse order of adding.
+        bool ordered = tasks[0]->isCompleted() && tasks[0]->startTime() <= tasks[63]->startTime();
+        for( unsigned i = 2; i < tasks.size(); ++i )
+            if ( !tasks[i]->isCompleted() || tasks[i]->startTime() > tasks[i-1]->startTime() )
+                ordered = false;
+        check( ordered, "one lane runs requests in priority order, honoring reprioritize" );
+    }
+
+    // TaskRequestQueue::reprioritize moves a waiting request, and says so; and the
+    // stale-request cancel that StreamingTile::cancelStaleRequests() does: a canceled
+    // request is dropped without running, and runs once it's reset and queued again.
+    void testTaskRequests()
+    {
+        {
+            osg::ref_ptr<TaskRequestQueue> queue = new TaskRequestQueue();
+            osg::ref_ptr<TinyTask> a = new TinyTask( 1.0f );
+            osg::ref_ptr<TinyTask> b = new TinyTask( 2.0f );
+            osg::ref_ptr<TinyTask> c = new TinyTask( 3.0f );
+            queue->add( a.get() );
+            queue->add( b.get() );
+            queue->add( c.get() );
+
+            check( queue->reprioritize( c.get(), 0.0f ) && c->getPriority() == 0.0f, "reprioritized a waiting request" );
+            check( queue->reprioritize( b.get(), 2.0f ), "reprioritized a request to its own priority" );
+
+            osg::ref_ptr<TaskRequest> first  = queue->tryGet();
+            osg::ref_ptr<TaskRequest> second = queue->tryGet();
+            osg::ref_ptr<TaskRequest> third  = queue->tryGet();
+            check( first == c.get() && second == a.get() && third == b.get(), "the reprioritized request moved to the front" );
+            check( !queue->reprioritize( c.get(), 5.0f ), "reprioritizing a request no longer queued reports false" );
+            check( !queue->tryGet(), "the queue is empty" );
+        }
+
+        osg::ref_ptr<TaskService> service = new TaskService( "stale", 1 );
+        osg::ref_ptr<BlockerTask> blocker = new BlockerTask();
+        service->add( blocker.get() );
+        for( int wait = 0; wait < 5000 && !blocker->isInProgress(); ++wait )
+            OpenThreads::Thread::microSleep( 1000 );
+
+        // odd requests belong to tiles that left the view at frame 5; the rest were
+        // seen at frame 10, the current one.
+        const int frame = 10;
+        std::vector< osg::ref_ptr<TinyTask> > tasks;
+        for( unsigned i = 0; i < 16; ++i )
+        {
+            tasks.push_back( new TinyTask( (float)i ) );
+            tasks.back()->setStamp( i % 2 ? 5 : frame );
+            service->add( tasks.back().get() );
+        }
+        for( unsigned i = 0; i < tasks.size(); ++i )
+        {
+            TaskRequest* r = tasks[i].get();
+            if ( r->isPending() && !r->wasCanceled() && frame - r->getStamp() > 2 )
+                r->cancel();
+        }
+        blocker->_release = true;
+
+        bool allDone = false;
+        for( int wait = 0; wait < 5000 && !allDone; ++wait )
+        {
+            allDone = true;
+            for( unsigned i = 0; i < tasks.size(); ++i )
+                if ( !tasks[i]->isCompleted() )
+                    allDone = false;
+            if ( !allDone )
+                OpenThreads::Thread::microSleep( 1000 );
+        }
+        check( allDone, "every request came off the queue" );
+
+        bool staleSkipped = true, freshRan = true;
+        for( unsigned i = 0; i < tasks.size(); ++i )
+        {
+            if ( i % 2 )
+                staleSkipped = staleSkipped && tasks[i]->wasCanceled() && tasks[i]->_sum == 0;
+            else
+                freshRan = freshRan && !tasks[i]->wasCanceled() && tasks[i]->_sum != 0;
+        }
+        check( staleSkipped, "stale requests were dropped without running" );
+        check( freshRan, "current requests ran" );
+
+        // the tile resets a canceled request when it comes back into view.
+        TinyTask* again = tasks[1].get();
+        again->setState( TaskRequest::STATE_IDLE );
+        again->setProgressCallback( new ProgressCallback() );
+        again->setStamp( frame + 1 );
+        service->add( again );
+        for( int wait = 0; wait < 5000 && !again->isCompleted(); ++wait )
+            OpenThreads::Thread::microSleep( 1000 );
+        check( again->isCompleted() && !again->wasCanceled() && again->_sum != 0, "a reset request runs when queued again" );
+    }
+
+    //------------------------------------------------------------------------
+
+    void putLE( std::string& out, unsigned long long value, unsigned bytes )
+    {
+        for( unsigned i = 0; i < bytes; ++i )
+            out.push_back( (char)((value >> (8*i)) & 0xFF) );
+    }
+
+    unsigned zipCrc32( const std::string& data )
+    {
+        unsigned table[256];
+        for( unsigned i = 0; i < 256; ++i )
+        {
+            unsigned c = i;
+            for( int k = 0; k < 8; ++k )
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        unsigned crc = 0xFFFFFFFFu;
+        for( std::string::const_iterator c = data.begin(); c != data.end(); ++c )
+            crc = table[(crc ^ (unsigned char)*c) & 0xFF] ^ (crc >> 8);
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    std::string zipEntryName( unsigned i )
+    {
+        std::stringstream buf;
+        buf << "tiles/" << i << ".png";
+        return buf.str();
+    }
+
+    // writes an uncompressed zip of "num" entries that all hold "data". Uses the
+    // ZIP64 end records when there are more than 65535 entries.
+    bool writeStoredZip( const std::string& filename, unsigned num, const std::string& data )
+    {
+        unsigned crc = zipCrc32( data );
+        std::string local, central;
+        for( unsigned i = 0; i < num; ++i )
+        {
+            std::string name = zipEntryName( i );
+            unsigned long long offset = local.size();
+
+            putLE( local, 0x04034b50, 4 );
+            putLE( local, 10, 2 );               // version needed
+            putLE( local, 0, 2 );                // flags
+            putLE( local, 0, 2 );                // stored
+            putLE( local, 0, 2 );                // time
+            putLE( local, 0x21, 2 );             // date: 1980-01-01
+            putLE( local, crc, 4 );
+            putLE( local, data.size(), 4 );
+            putLE( local, data.size(), 4 );
+            putLE( local, name.size(), 2 );
+            putLE( local, 0, 2 );
+            local += name;
+            local += data;
+
+            putLE( central, 0x02014b50, 4 );
+            putLE( central, 20, 2 );             // version made by
+            putLE( central, 10, 2 );
+            putLE( central, 0, 2 );
+            putLE( central, 0, 2 );
+            putLE( central, 0, 2 );
+            putLE( central, 0x21, 2 );
+            putLE( central, crc, 4 );
+            putLE( central, data.size(), 4 );
+            putLE( central, data.size(), 4 );
+            putLE( central, name.size(), 2 );
+            putLE( central, 0, 2 );              // extra
+            putLE( central, 0, 2 );              // comment
+            putLE( central, 0, 2 );              // disk
+            putLE( central, 0, 2 );              // internal attributes
+            putLE( central, 0, 4 );              // external attributes
+            putLE( central, offset, 4 );
+            central += name;
+        }
+
+        std::string end;
+        bool zip64 = num > 0xFFFF;
+        if ( zip64 )
+        {
+            unsigned long long eocd64 = local.size() + central.size();
+            putLE( end, 0x06064b50, 4 );
+            putLE( end, 44, 8 );
+            putLE( end, 45, 2 );
+            putLE( end, 45, 2 );
+            putLE( end, 0, 4 );
+            putLE( end, 0, 4 );
+            putLE( end, num, 8 );
+            putLE( end, num, 8 );
+            putLE( end, central.size(), 8 );
+            putLE( end, local.size(), 8 );
+
+            putLE( end, 0x07064b50, 4 );
+            putLE( end, 0, 4 );
+            putLE( end, eocd64, 8 );
+            putLE( end, 1, 4 );
+        }
+        putLE( end, 0x06054b50, 4 );
+        putLE( end, 0, 2 );
+        putLE( end, 0, 2 );
+        putLE( end, zip64 ? 0xFFFF : num, 2 );
+        putLE( end, zip64 ? 0xFFFF : num, 2 );
+        putLE( end, central.size(), 4 );
+        putLE( end, local.size(), 4 );
+        putLE( end, 0, 2 );
+
+        std::ofstream out( filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+        out.write( local.data(), local.size() );
+        out.write( central.data(), central.size() );
+        out.write( end.data(), end.size() );
+        out.close();
+        return !out.fail();
+    }
+
+    struct ZipReadJob
+    {
+        osgDB::ReaderWriter* _zipfs;
+        std::string          _zip;
+        unsigned             _numEntries;
+        unsigned             _numReads;   // 0 = keep reading until *_stop
+        volatile bool*       _stop;
+        unsigned             _seed;
+        unsigned             _count, _errors;
+        double               _totalMs, _maxMs;
+
+        ZipReadJob() : _zipfs(0L), _numEntries(0), _numReads(0), _stop(0L), _seed(1),
+            _count(0), _errors(0), _totalMs(0.0), _maxMs(0.0) { }
+
+        void operator()()
+        {
+            while( _numReads ? _count < _numReads : !*_stop )
+            {
+                _seed = _seed * 1103515245u + 12345u;
+                unsigned i = (_seed >> 8) % _numEntries;
+
+                osg::Timer_t start = osg::Timer::instance()->tick();
+                osgDB::ReaderWriter::ReadResult rr = _zipfs->readImage( _zip + "/" + zipEntryName(i), 0L );
+                double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+                if ( !rr.validImage() || rr.getImage()->s() != 16 )
+                    ++_errors;
+                ++_count;
+                _totalMs += ms;
+                _maxMs = osg::maximum( _maxMs, ms );
+            }
+            if ( _numReads && _stop )
+                *_stop = true;
+        }
+    };
+
+    // ZipFS benchmark: cold open (index build) of a 100k-entry archive, the read
+    // latency of an already open archive while that happens (the pool lock must
+    // not be held across the open), then warm random reads from 8 threads.
+    void testZipArchive()
+    {
+        osgDB::ReaderWriter* zipfs = osgDB::Registry::instance()->getReaderWriterForExtension( "zipfs" );
+        osgDB::ReaderWriter* png   = osgDB::Registry::instance()->getReaderWriterForExtension( "png" );
+        if ( !zipfs || !png )
+        {
+            OE_NOTICE << "  zipfs or png plugin not available; skipping" << std::endl;
+            return;
+        }
+
+        osg::ref_ptr<osg::Image> tile = makePackTile( 7 );
+        std::stringstream encoded;
+        png->writeImage( *tile.get(), encoded );
+
+        const std::string dir = "osgearth_tests_zip";
+        osgDB::makeDirectory( dir );
+        const std::string bigZip = dir + "/big.zip", classicZip = dir + "/classic.zip", smallZip = dir + "/small.zip";
+
+        unsigned numEntries = 100000;
+        check( writeStoredZip( smallZip, 16, encoded.str() ), "wrote the small archive" );
+        check( writeStoredZip( bigZip, numEntries, encoded.str() ), "wrote the 100k-entry archive" );
+
+        // open the small archive first so it's in the pool.
+        ZipReadJob warmup;
+        warmup._zipfs = zipfs; warmup._zip = smallZip; warmup._numEntries = 16; warmup._numReads = 1;
+        warmup();
+        check( warmup._errors == 0, "read from the small archive" );
+
+        // one cold read of the big archive, alongside 4 readers of the small one.
+        volatile bool stop = false;
+        std::vector<ZipReadJob> jobs( 5 );
+        for( unsigned i = 0; i < jobs.size(); ++i )
+        {
+            jobs[i]._zipfs = zipfs;
+            jobs[i]._stop  = &stop;
+            jobs[i]._seed  = i * 7919u + 1u;
+            jobs[i]._zip   = i == 0 ? bigZip : smallZip;
+            jobs[i]._numEntries = i == 0 ? numEntries : 16;
+            jobs[i]._numReads   = i == 0 ? 1 : 0;
+        }
+        runOnThreads( jobs );
+
+        if ( jobs[0]._errors > 0 )
+        {
+            // libzip builds without ZIP64 can't open it; fall back to a classic archive.
+            OE_NOTICE << "  couldn't read the ZIP64 archive; retrying with 65535 entries" << std::endl;
+            numEntries = 0xFFFF;
+            check( writeStoredZip( classicZip, numEntries, encoded.str() ), "wrote the 65535-entry archive" );
+            stop = false;
+            for( unsigned i = 0; i < jobs.size(); ++i )
+            {
+                jobs[i]._count = jobs[i]._errors = 0;
+                jobs[i]._totalMs = jobs[i]._maxMs = 0.0;
+                if ( i == 0 ) { jobs[i]._zip = classicZip; jobs[i]._numEntries = numEntries; }
+            }
+            runOnThreads( jobs );
+        }
+
+        unsigned smallReads = 0, errors = 0;
+        double smallMax = 0.0;
+        for( unsigned i = 1; i < jobs.size(); ++i )
+        {
+            smallReads += jobs[i]._count;
+            errors     += jobs[i]._errors;
+            smallMax    = osg::maximum( smallMax, jobs[i]._maxMs );
+        }
+        check( jobs[0]._errors == 0, "cold read from the big archive" );
+        check( errors == 0, "reads from the small archive during the open" );
+
+        // warm random reads of the big archive.
+        std::vector<ZipReadJob> warm( 8, jobs[0] );
+        for( unsigned i = 0; i < warm.size(); ++i )
+        {
+            warm[i]._numReads = 10000;
+            warm[i]._stop = 0L;
+            warm[i]._seed = i * 104729u + 3u;
+            warm[i]._count = warm[i]._errors = 0;
+            warm[i]._totalMs = warm[i]._maxMs = 0.0;
+        }
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        runOnThreads( warm );
+        double warmMs = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+
+        unsigned warmReads = 0, warmErrors = 0;
+        for( unsigned i = 0; i < warm.size(); ++i )
+        {
+            warmReads  += warm[i]._count;
+            warmErrors += warm[i]._errors;
+        }
+        check( warmErrors == 0, "warm reads from the big archive" );
+
+        std::stringstream buf;
+        buf << numEntries << "-entry archive: cold open + read " << jobs[0]._totalMs << "ms; meanwhile "
+            << smallReads << " reads of an open archive, max " << smallMax << "ms; warm: "
+            << warmReads << " reads on 8 threads in " << warmMs << "ms ("
+            << (warmMs * 1000.0 / warmReads) << "us each)";
+        OE_NOTICE << "  " << buf.str() << std::endl;
+
+        ::remove( bigZip.c_str() );
+        ::remove( classicZip.c_str() );
+        ::remove( smallZip.c_str() );
+    }
+
+    //------------------------------------------------------------------------
+
+    // process peak resident set size, in MB (0 where we can't tell).
+    double peakRSSMB()
+    {
+#ifdef WIN32
+        return 0.0;
+#else
+        struct rusage usage;
+        if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+            return 0.0;
+#  ifdef __APPLE__
+        return (double)usage.ru_maxrss / (1024.0 * 1024.0);
+#  else
+        return (double)usage.ru_maxrss / 1024.0;
+#  endif
+#endif
+    }
+
+    Features::Feature* makeFootprint( const double* xy, unsigned num, const double* hole =0L, unsigned numHole =0 )
+    {
+        Symbology::Polygon* poly = new Symbology::Polygon();
+        for( unsigned i = 0; i < num; ++i )
+            poly->push_back( osg::Vec3d(xy[2*i], xy[2*i+1], 0.0) );
+        if ( hole )
+        {
+            Symbology::Ring* ring = new Symbology::Ring();
+            for( unsigned i = 0; i < numHole; ++i )
+                ring->push_back( osg::Vec3d(hole[2*i], hole[2*i+1], 0.0) );
+            poly->getHoles().push_back( ring );
+        }
+        Features::Feature* f = new Features::Feature();
+        f->setGeometry( poly );
+        return f;
+    }
+
+    struct ExtrudeTotals
+    {
+        ExtrudeTotals() : _drawables(0), _verts(0), _wallTris(0), _roofTris(0), _roofArea(0.0), _maxVerts(0), _ok(true) { }
+        unsigned _drawables, _verts, _wallTris, _roofTris;
+        double   _roofArea;
+        unsigned _maxVerts;
+        bool     _ok;
+    };
+
+    // walks the geode push() returned: counts verts and triangles, sums the roof area,
+    // and checks that arrays line up, roofs face up and walls face sideways.
+    ExtrudeTotals countExtruded( osg::Node* node )
+    {
+        ExtrudeTotals t;
+        osg::Geode* geode = node ? node->asGeode() : 0L;
+        if ( !geode )
+        {
+            t._ok = false;
+            return t;
+        }
+        for( unsigned d = 0; d < geode->getNumDrawables(); ++d )
+        {
+            osg::Geometry* geom = geode->getDrawable(d)->asGeometry();
+            osg::Vec3Array* verts = geom ? dynamic_cast<osg::Vec3Array*>( geom->getVertexArray() ) : 0L;
+            osg::Vec3Array* normals = geom ? dynamic_cast<osg::Vec3Array*>( geom->getNormalArray() ) : 0L;
+            if ( !verts || !normals || normals->size() != verts->size() || geom->getNumPrimitiveSets() != 1 )
+            {
+                t._ok = false;
+                continue;
+            }
+            bool isWall = geom->getStateSet() != 0L;
+            const osg::PrimitiveSet* tris = geom->getPrimitiveSet(0);
+            for( unsigned k = 0; k + 2 < tris->getNumIndices(); k += 3 )
+            {
+                const osg::Vec3& a = (*verts)[tris->index(k)];
+                osg::Vec3 n = ((*verts)[tris->index(k+1)] - a) ^ ((*verts)[tris->index(k+2)] - a);
+                if ( isWall )
+                {
+                    ++t._wallTris;
+                    if ( fabs(n.z()) > 1e-3 * n.length() )
+                        t._ok = false;
+                }
+                else
+                {
+                    ++t._roofTris;
+                    t._roofArea += 0.5 * n.z();
+                    if ( n.z() < 0.0f || (*normals)[tris->index(k)].z() < 0.99f )
+                        t._ok = false;
+                }
+            }
+            ++t._drawables;
+            t._verts += verts->size();
+            t._maxVerts = std::max( t._maxVerts, (unsigned)verts->size() );
+        }
+        return t;
+    }
+
+    // ExtrudeGeometryFilter: a few hand-checked footprints (concave, with a hole), then
+    // 20k box buildings, reporting build time and peak RSS.
+    void testExtrudeBatch()
+    {
+        Features::FilterContext cx;
+
+        // an L (concave, ear-clipped) and a square with a square hole (tessellated).
+        const double ell[]    = { 0,0, 10,0, 10,4, 4,4, 4,10, 0,10 };
+        const double square[] = { 20,0, 30,0, 30,10, 20,10 };
+        const double hole[]   = { 24,4, 24,6, 26,6, 26,4 };
+        {
+            Features::FeatureList features;
+            features.push_back( makeFootprint(ell, 6) );
+            features.push_back( makeFootprint(square, 4, hole, 4) );
+
+            Features::ExtrudeGeometryFilter extrude;
+            extrude.setExtrusionHeight( 15.0f );
+            osg::ref_ptr<osg::Node> node = extrude.push( features, cx );
+            ExtrudeTotals t = countExtruded( node.get() );
+
+            check( t._ok, "extruded arrays line up, roofs face up, walls face out" );
+            check( t._drawables == 2, "one wall batch and one roof batch" );
+            check( t._wallTris == 2 * (6 + 4 + 4), "two triangles per wall face, holes included" );
+            check( t._roofTris >= 4 + 8, "both roofs are triangulated" );
+            check( fabs(t._roofArea - (64.0 + 96.0)) < 1e-3, "roofs cover the footprints, minus the hole" );
+        }
+
+        // a grid of box buildings.
+        const unsigned num = 20000;
+        Features::FeatureList features;
+        for( unsigned i = 0; i < num; ++i )
+        {
+            double x = (double)(i % 200) * 20.0, y = (double)(i / 200) * 20.0;
+            const double box[] = { x,y, x+10,y, x+10,y+10, x,y+10 };
+            features.push_back( makeFootprint(box, 4) );
+        }
+
+        double rssBefore = peakRSSMB();
+        osg::Timer_t start = osg::Timer::instance()->tick();
+
+        Features::ExtrudeGeometryFilter extrude;
+        extrude.setExtrusionHeight( 15.0f );
+        osg::ref_ptr<osg::Node> node = extrude.push( features, cx );
+
+        double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+        double rssAfter = peakRSSMB();
+
+        ExtrudeTotals t = countExtruded( node.get() );
+        check( t._ok, "box buildings extrude cleanly" );
+        check( t._verts == num * (16 + 4), "16 wall verts and 4 roof verts per box" );
+        check( t._wallTris == num * 8 && t._roofTris == num * 2, "8 wall and 2 roof triangles per box" );
+        check( t._maxVerts <= 10000, "no batch grows past the batch limit" );
+        check( fabs(t._roofArea - num * 100.0) < num * 1e-3, "box roofs cover the footprints" );
+
+        std::stringstream buf;
+        buf << num << " buildings: " << ms << "ms (" << (ms * 1000.0 / num) << "us per building), "
+            << t._drawables << " drawables, " << t._verts << " verts, peak RSS "
+            << rssBefore << "MB -> " << rssAfter << "MB";
+        OE_NOTICE << "  " << buf.str() << std::endl;
+    }
+
+    //------------------------------------------------------------------------
+
+    std::string readWholeFile( const std::string& filename )
+    {
+        std::ifstream in( filename.c_str(), std::ios::in | std::ios::binary );
+        std::stringstream buf;
+        buf << in.rdbuf();
+        return buf.str();
+    }
+
+    // ImageUtils encoded data: bytes recorded with an image go through DiskCache
+    // verbatim, and stop being used once the image is modified in place.
+    void testEncodedData()
+    {
+        osgDB::ReaderWriter* png = osgDB::Registry::instance()->getReaderWriterForExtension( "png" );
+        if ( !check( png != 0L, "found the png plugin" ) )
+            return;
+
+        // encode a tile, then decode it the way HTTPClient does.
+        osg::ref_ptr<osg::Image> source = makePackTile( 42 );
+        std::stringstream encodedStream;
+        png->writeImage( *source.get(), encodedStream );
+        std::string encoded = encodedStream.str();
+
+        std::stringstream decodeStream( encoded );
+        osg::ref_ptr<osg::Image> image = png->readImage( decodeStream ).takeImage();
+        if ( !check( image.valid(), "decoded the png" ) )
+            return;
+        ImageUtils::setEncodedData( image.get(), encoded );
+
+        std::string out;
+        check( ImageUtils::getEncodedData(image.get(), "image/png", out) && out == encoded, "got the bytes back" );
+        check( !ImageUtils::getEncodedData(image.get(), "jpg", out), "no bytes for a different format" );
+
+        osg::ref_ptr<osg::Image> copy = ImageUtils::cloneImage( image.get() );
+        check( !ImageUtils::getEncodedData(copy.get(), "png", out), "copies don't carry the bytes" );
+
+        // DiskCache writes the recorded bytes as the tile file.
+        const std::string path = "osgearth_tests_disk_cache";
+        DiskCacheOptions options;
+        options.setPath( path );
+        osg::ref_ptr<DiskCache> cache = new DiskCache( options );
+        CacheSpec spec( "encoded", "png" );
+        TileKey key = packTileKey( 3 );
+        std::string filename = cache->getFilename( key, spec );
+        ::remove( filename.c_str() );
+
+        cache->setImage( key, spec, image.get() );
+        check( readWholeFile(filename) == encoded, "disk cache stored the bytes verbatim" );
+
+        osg::ref_ptr<const osg::Image> cached;
+        check( cache->getImage(key, spec, cached) && ImageUtils::areEquivalent(cached.get(), image.get()),
+               "disk cache reads the tile back" );
+
+        // a change in place dirties the image, so the old bytes are no longer used.
+        osg::ref_ptr<osg::Image> other = makePackTile( 7 );
+        ImageUtils::mix( image.get(), other.get(), 1.0f );
+        check( !ImageUtils::getEncodedData(image.get(), "png", out), "stale bytes aren't used" );
+
+        cache->setImage( key, spec, image.get() );
+        check( readWholeFile(filename) != encoded, "disk cache re-encoded the modified tile" );
+        check( cache->getImage(key, spec, cached) && ImageUtils::areEquivalent(cached.get(), image.get()),
+               "disk cache reads the modified tile back" );
+
+        // the lookup no longer reads the pixels, so it costs the same for any tile size.
+        osg::ref_ptr<osg::Image> big = new osg::Image();
+        big->allocateImage( 1024, 1024, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+        ImageUtils::setEncodedData( big.get(), encoded );
+        const unsigned num = 10000;
+        unsigned hits = 0;
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for( unsigned i = 0; i < num; ++i )
+            if ( ImageUtils::getEncodedData(big.get(), "png", out) )
+                ++hits;
+        double ms = osg::Timer::instance()->delta_m( start, osg::Timer::instance()->tick() );
+        check( hits == num, "1024x1024 lookups hit" );
+
+        ImageUtils::releaseEncodedData( big.get() );
+        check( !ImageUtils::getEncodedData(big.get(), "png", out), "released bytes are gone" );
+
+        std::stringstream buf;
+        buf << "getEncodedData on a 1024x1024 image: " << (ms * 1000.0 / num) << "us per call";
+        OE_NOTICE << "  " << buf.str() << std::endl;
+
+        ::remove( filename.c_str() );
+    }
+
+    //------------------------------------------------------------------------
+
+    struct Test
+    {
+        const char* _name;
+        void (*_run)();
+        bool _online; // needs a network connection
+    };
+
+    Test s_tests[] =
+    {
+        { "simple",             testSimple,             false },
+        { "mosaic",             testMosaic,             true  },
+        { "reprojected_utm",    testReprojectedUTM,     true  },
+        { "mercator",           testMercator,           true  },
+        { "gdal_threads",       testGDALThreads,        false },
+        { "gdal_heightfield",   testGDALHeightField,    false },
+        { "transform_threads",  testTransformThreads,   false },
+        { "utm_kernel",         testUTMKernel,          false },
+        { "lru_cache",          testLRUCache,           false },
+        { "lru_contention",     testLRUContention,      false },
+        { "pack_cache",         testPackCache,          false },
+        { "image_kernels",      testImageKernels,       false },
+        { "mipmaps",            testMipmaps,            false },
+#ifndef WIN32
+        { "http_engine",        testHTTPEngine,         false },
+        { "http_coalescing",    testHTTPCoalescing,     false },
+        { "http_progress",      testHTTPProgress,       false },
+        { "http_cache",         testHTTPResponseCache,  false },
+        { "wfs_features",       testWFSFeatures,        false },
+#endif
+        { "memcache_hits",      testMemCacheHits,       false },
+        { "request_coalescing", testRequestCoalescing,  false },
+        { "mosaic_latency",     testMosaicLatency,      false },
+        { "elevation_layers",   testElevationLayers,    false },
+        { "sqlite_threads",     testSqliteThreads,      false },
+        { "sqlite_stress",      testSqliteStress,       false },
+        { "reproject_utm",      testReprojectKernelUTM, false },
+        { "ecef_batch",         testECEFBatch,          false },
+        { "profile_hash",       testProfileHash,        false },
+        { "task_service",       testTaskService,        false },
+        { "task_requests",      testTaskRequests,       false },
+        { "zip_archive",        testZipArchive,         false },
+        { "extrude_batch",      testExtrudeBatch,       false },
+        { "encoded_data",       testEncodedData,        false },
+        { 0L, 0L, false }
+    };
 }
 
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc,argv);
+
+    std::set<std::string> only;
+    std::string name;
+    while( arguments.read( "--test", name ) )
+        only.insert( name );
+
+    bool offline = arguments.read( "--offline" );
+
+    if ( arguments.read( "--list" ) )
+    {
+        for( Test* t = s_tests; t->_name; ++t )
+            std::cout << t->_name << (t->_online ? " (online)" : "") << std::endl;
+        return 0;
+    }
+
+    for( Test* t = s_tests; t->_name; ++t )
+    {
+        if ( !only.empty() && only.find(t->_name) == only.end() )
+            continue;
+        if ( offline && t->_online && only.empty() )
+            continue;
+
+        OE_NOTICE << "Running " << t->_name << std::endl;
+        int before = s_failures;
+        t->_run();
+        OE_NOTICE << (s_failures == before ? "  ok" : "  FAILED") << std::endl;
+    }
+
+    if ( s_failures > 0 )
+        OE_WARN << s_failures << " check(s) failed" << std::endl;
+
+    return s_failures > 0 ? 1 : 0;
+}
@@ -19,12 +19,224 @@
 
 #include <osgEarth/CacheSeed>
 #include <osgEarth/Caching>
+#include <osgEarth/TaskService>
 #include <OpenThreads/ScopedLock>
+#include <osg/Timer>
 #include <limits.h>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <set>
 
 using namespace osgEarth;
 using namespace OpenThreads;
 
+#define LC "[CacheSeed] "
+
+// Depth of the subtrees handed to each worker. Each completed subtree is one
+// checkpoint record, so this bounds how much work is repeated after a resume.
+#define SUBTREE_DEPTH 6
+
+// Shallowest level at which to start handing out subtrees, so that there are
+// enough of them to keep all the workers busy.
+#define MIN_TASK_LEVEL 3
+
+namespace
+{
+    std::string formatTime( double seconds )
+    {
+        unsigned int t = (unsigned int)osg::maximum( seconds, 0.0 );
+        std::stringstream buf;
+        buf << std::setfill('0')
+            << (t/3600) << ":" << std::setw(2) << ((t/60)%60) << ":" << std::setw(2) << (t%60);
+        return buf.str();
+    }
+}
+
+/**
+ * Shared state for one run of CacheSeed::seed.
+ */
+struct CacheSeed::SeedState
+{
+    SeedState( ProgressCallback* progress, unsigned int numThreads ) :
+        _progress( progress ),
+        _maxInFlight( 2 * numThreads ),
+        _inFlight( 0 ),
+        _canceled( false ),
+        _numCached( 0 ),
+        _numSkipped( 0.0 ),
+        _total( 0.0 ),
+        _taskLevel( 0 ),
+        _startTime( osg::Timer::instance()->tick() )
+    {
+        if ( numThreads > 1 )
+            _service = new TaskService( "CacheSeed", numThreads );
+    }
+
+    bool isCanceled() const { return _canceled; }
+
+    // reads the list of completed subtrees from a checkpoint file, and opens it
+    // for appending. Returns false if the file cannot be written.
+    bool openCheckpoint( const std::string& filename, const std::string& header )
+    {
+        std::ifstream in( filename.c_str() );
+        if ( in.is_open() )
+        {
+            std::string line;
+            if ( std::getline(in, line) && line == header )
+            {
+                while( std::getline(in, line) )
+                {
+                    if ( !line.empty() )
+                        _completed.insert( line );
+                }
+            }
+            else
+            {
+                OE_WARN << LC << "Checkpoint file " << filename << " was made with different settings; starting over" << std::endl;
+                in.close();
+                _checkpoint.open( filename.c_str(), std::ios::out | std::ios::trunc );
+                _checkpoint << header << std::endl;
+                return _checkpoint.is_open();
+            }
+            in.close();
+        }
+
+        _checkpoint.open( filename.c_str(), std::ios::out | std::ios::app );
+        if ( _completed.empty() )
+            _checkpoint << header << std::endl;
+        else
+            OE_NOTICE << LC << "Resuming; " << _completed.size() << " subtrees already complete" << std::endl;
+
+        return _checkpoint.is_open();
+    }
+
+    bool isCompleted( const TileKey& key ) const
+    {
+        return _completed.find( key.str() ) != _completed.end();
+    }
+
+    // queues a task, blocking while too many are already outstanding. With no
+    // thread pool the task runs right here.
+    void submit( SeedTask* task );
+
+    // called by each task when it finishes.
+    void taskDone( const TileKey& key, bool isSubtree )
+    {
+        ScopedLock<Mutex> lock( _mutex );
+        if ( isSubtree && !_canceled && _checkpoint.is_open() )
+        {
+            _checkpoint << key.str() << std::endl;
+        }
+        --_inFlight;
+        _cond.signal();
+    }
+
+    void waitForAll()
+    {
+        ScopedLock<Mutex> lock( _mutex );
+        while( _inFlight > 0 )
+            _cond.wait( &_mutex );
+    }
+
+    // records a subtree that was completed in a previous run.
+    void subtreeSkipped( double numTiles )
+    {
+        ScopedLock<Mutex> lock( _reportMutex );
+        _numSkipped += numTiles;
+    }
+
+    // records a cached tile and reports progress, with the rate and estimated time left.
+    void tileDone( const TileKey& key )
+    {
+        ScopedLock<Mutex> lock( _reportMutex );
+        ++_numCached;
+
+        if ( _progress.valid() )
+        {
+            double elapsed = osg::Timer::instance()->delta_s( _startTime, osg::Timer::instance()->tick() );
+            double rate = elapsed > 0.0 ? (double)_numCached / elapsed : 0.0;
+            double current = (double)_numCached + _numSkipped;
+            double total = osg::maximum( _total, current );
+
+            std::stringstream buf;
+            buf << "Cached tile: " << key.str()
+                << " (" << std::fixed << std::setprecision(1) << rate << " tiles/s";
+            if ( rate > 0.0 )
+                buf << ", ETA " << formatTime( (total - current) / rate );
+            buf << ")";
+
+            if ( _progress->reportProgress( current, total, buf.str() ) )
+                _canceled = true; // task has been cancelled by user
+        }
+    }
+
+    osg::ref_ptr<ProgressCallback> _progress;
+    osg::ref_ptr<TaskService>      _service;
+    unsigned int                   _maxInFlight;
+    unsigned int                   _inFlight;
+    volatile bool                  _canceled;
+    Mutex                          _mutex;
+    Condition                      _cond;
+    Mutex                          _reportMutex;
+    std::set<std::string>          _completed;
+    std::ofstream                  _checkpoint;
+    unsigned int                   _numCached;
+    double                         _numSkipped;
+    double                         _total;
+    unsigned int                   _taskLevel;
+    osg::Timer_t                   _startTime;
+};
+
+/**
+ * Caches one tile, or a whole subtree of tiles.
+ */
+struct CacheSeed::SeedTask : public TaskRequest
+{
+    SeedTask( const CacheSeed* seeder, const MapFrame& mapf, const TileKey& key, bool isSubtree, SeedState& state ) :
+        _seeder( seeder ), _mapf( mapf ), _key( key ), _isSubtree( isSubtree ), _state( state ) { }
+
+    void operator()( ProgressCallback* )
+    {
+        execute();
+    }
+
+    void execute()
+    {
+        if ( _isSubtree )
+            _seeder->processKey( _mapf, _key, _state );
+        else
+            _seeder->cacheTile( _mapf, _key, _state );
+
+        _state.taskDone( _key, _isSubtree );
+    }
+
+    const CacheSeed* _seeder;
+    const MapFrame&  _mapf;
+    TileKey          _key;
+    bool             _isSubtree;
+    SeedState&       _state;
+};
+
+void
+CacheSeed::SeedState::submit( SeedTask* task )
+{
+    osg::ref_ptr<SeedTask> ref = task;
+    {
+        ScopedLock<Mutex> lock( _mutex );
+        while( _inFlight >= _maxInFlight )
+            _cond.wait( &_mutex );
+        ++_inFlight;
+    }
+
+    if ( _service.valid() )
+        _service->add( task );
+    else
+        task->execute();
+}
+
+//------------------------------------------------------------------------
+
 void CacheSeed::seed( Map* map )
 {
     //Threading::ScopedReadLock lock( map->getMapDataMutex() );
@@ -138,34 +350,97 @@ void CacheSeed::seed( Map* map )
 
     OE_NOTICE << "Maximum cache level will be " << _maxLevel << std::endl;
 
-    for (unsigned int i = 0; i < keys.size(); ++i)
+    SeedState state( _progress.get(), _numThreads );
+
+    // Hand out whole subtrees below the task level, so that each completed one
+    // can be recorded in the checkpoint file.
+    state._taskLevel = _maxLevel > MIN_TASK_LEVEL + SUBTREE_DEPTH ? _maxLevel - SUBTREE_DEPTH : osg::minimum(_maxLevel, (unsigned int)MIN_TASK_LEVEL);
+    state._total = countTiles( map->getProfile(), _bounds, 0 );
+
+    if ( !_checkpointFile.empty() )
+    {
+        std::stringstream header;
+        header << std::setprecision(12) << "# osgEarth cache seed: levels " << _minLevel << " " << _maxLevel
+            << " task level " << state._taskLevel
+            << " bounds " << _bounds.xMin() << " " << _bounds.yMin() << " " << _bounds.xMax() << " " << _bounds.yMax();
+
+        if ( !state.openCheckpoint( _checkpointFile, header.str() ) )
+        {
+            OE_WARN << LC << "Unable to write checkpoint file " << _checkpointFile << std::endl;
+        }
+    }
+
+    OE_NOTICE << LC << "Seeding about " << (unsigned int)state._total << " tiles with " << _numThreads << " thread(s)" << std::endl;
+
+    for (unsigned int i = 0; i < keys.size() && !state.isCanceled(); ++i)
     {
-        processKey( mapf, keys[i] );
+        scheduleKey( mapf, keys[i], state );
     }
-}
 
+    state.waitForAll();
+
+    OE_NOTICE << LC << (state.isCanceled() ? "Canceled" : "Done") << " after caching " << state._numCached << " tiles in "
+        << formatTime( osg::Timer::instance()->delta_s(state._startTime, osg::Timer::instance()->tick()) ) << std::endl;
+}
 
 void
-CacheSeed::processKey(const MapFrame& mapf, const TileKey& key ) const
+CacheSeed::scheduleKey( const MapFrame& mapf, const TileKey& key, SeedState& state ) const
 {
-    unsigned int x, y, lod;
-    key.getTileXY(x, y);
-    lod = key.getLevelOfDetail();
+    if ( state.isCanceled() )
+        return;
 
-//	osg::ref_ptr<osgEarth::VersionedTerrain> terrain = new osgEarth::VersionedTerrain( map, engine );
+    unsigned int lod = key.getLevelOfDetail();
+
+    // at the task level, the whole subtree goes to a single worker.
+    if ( lod >= state._taskLevel )
+    {
+        if ( state.isCompleted(key) )
+        {
+            state.subtreeSkipped( countTiles(key.getProfile(), key.getExtent().bounds(), lod) );
+        }
+        else
+        {
+            state.submit( new SeedTask(this, mapf, key, true, state) );
+        }
+        return;
+    }
 
     if ( _minLevel <= lod && _maxLevel >= lod )
     {
-//        OE_NOTICE << "Caching tile = " << key.str() << std::endl; //<< lod << " (" << x << ", " << y << ") " << std::endl;
-	if ( _progress.valid() && _progress->reportProgress(0, 0, "Caching tile: " + key.str()) )
-	    return; // Task has been cancelled by user
+        state.submit( new SeedTask(this, mapf, key, false, state) );
+    }
 
-        cacheTile( mapf, key );
-  //      bool validData;
-		//osg::ref_ptr<osg::Node> node = engine->createTile( map, terrain.get(), key, true, false, false, validData );        
+    TileKey k0 = key.createChildKey(0);
+    TileKey k1 = key.createChildKey(1);
+    TileKey k2 = key.createChildKey(2);
+    TileKey k3 = key.createChildKey(3);
+
+    //Check to see if the bounds intersects ANY of the tile's children.  If it does, then process all of the children
+    //for this level
+    if (_bounds.intersects( k0.getExtent().bounds() ) || _bounds.intersects(k1.getExtent().bounds()) ||
+        _bounds.intersects( k2.getExtent().bounds() ) || _bounds.intersects(k3.getExtent().bounds()) )
+    {
+        scheduleKey(mapf, k0, state);
+        scheduleKey(mapf, k1, state);
+        scheduleKey(mapf, k2, state);
+        scheduleKey(mapf, k3, state);
     }
+}
 
-    if (lod <= _maxLevel)
+void
+CacheSeed::processKey(const MapFrame& mapf, const TileKey& key, SeedState& state ) const
+{
+    if ( state.isCanceled() )
+        return;
+
+    unsigned int lod = key.getLevelOfDetail();
+
+    if ( _minLevel <= lod && _maxLevel >= lod )
+    {
+        cacheTile( mapf, key, state );
+    }
+
+    if (lod < _maxLevel)
     {
         TileKey k0 = key.createChildKey(0);
         TileKey k1 = key.createChildKey(1);
@@ -177,17 +452,20 @@ CacheSeed::processKey(const MapFrame& mapf, const TileKey& key ) const
         if (_bounds.intersects( k0.getExtent().bounds() ) || _bounds.intersects(k1.getExtent().bounds()) ||
             _bounds.intersects( k2.getExtent().bounds() ) || _bounds.intersects(k3.getExtent().bounds()) )
         {
-            processKey(mapf, k0);
-            processKey(mapf, k1);
-            processKey(mapf, k2);
-            processKey(mapf, k3);
+            processKey(mapf, k0, state);
+            processKey(mapf, k1, state);
+            processKey(mapf, k2, state);
+            processKey(mapf, k3, state);
         }
     }
 }
 
 void
-CacheSeed::cacheTile(const MapFrame& mapf, const TileKey& key ) const
+CacheSeed::cacheTile(const MapFrame& mapf, const TileKey& key, SeedState& state ) const
 {
+    if ( state.isCanceled() )
+        return;
+
     for( ImageLayerVector::const_iterator i = mapf.imageLayers().begin(); i != mapf.imageLayers().end(); i++ )
     {
         ImageLayer* layer = i->get();
@@ -202,4 +480,37 @@ CacheSeed::cacheTile(const MapFrame& mapf, const TileKey& key ) const
         osg::ref_ptr<osg::HeightField> hf;
         mapf.getHeightField( key, false, hf );
     }
+
+    state.tileDone( key );
+}
+
+double
+CacheSeed::countTiles( const Profile* profile, const Bounds& bounds, unsigned int minLevel ) const
+{
+    // Estimates the number of tiles to seed in the intersection of the given bounds
+    // and the seed bounds, from minLevel down to the maximum level.
+    const GeoExtent& ex = profile->getExtent();
+    double xmin = osg::maximum( bounds.xMin(), _bounds.xMin() );
+    double ymin = osg::maximum( bounds.yMin(), _bounds.yMin() );
+    double xmax = osg::minimum( bounds.xMax(), _bounds.xMax() );
+    double ymax = osg::minimum( bounds.yMax(), _bounds.yMax() );
+    if ( xmin > xmax || ymin > ymax )
+        return 0.0;
+
+    double count = 0.0;
+    for( unsigned int lod = osg::maximum(minLevel, _minLevel); lod <= _maxLevel; ++lod )
+    {
+        double tw, th;
+        unsigned int tilesWide, tilesHigh;
+        profile->getTileDimensions( lod, tw, th );
+        profile->getNumTiles( lod, tilesWide, tilesHigh );
+
+        double x0 = osg::clampBetween( floor((xmin - ex.xMin()) / tw), 0.0, (double)tilesWide-1 );
+        double x1 = osg::clampBetween( ceil ((xmax - ex.xMin()) / tw) - 1.0, x0, (double)tilesWide-1 );
+        double y0 = osg::clampBetween( floor((ex.yMax() - ymax) / th), 0.0, (double)tilesHigh-1 );
+        double y1 = osg::clampBetween( ceil ((ex.yMax() - ymin) / th) - 1.0, y0, (double)tilesHigh-1 );
+
+        count += (x1 - x0 + 1.0) * (y1 - y0 + 1.0);
+    }
+    return count;
 }
@@ -76,6 +76,22 @@ Cache::setHeightField( const TileKey& key, const CacheSpec& spec, const osg::Hei
 	setImage( key, spec, image.get() );
 }
 
+unsigned int
+Cache::areCached( const std::vector<TileKey>& keys, const CacheSpec& spec, std::vector<bool>& out_cached ) const
+{
+    unsigned int count = 0;
+    out_cached.assign( keys.size(), false );
+    for( unsigned int i=0; i<keys.size(); ++i )
+    {
+        if ( isCached( keys[i], spec ) )
+        {
+            out_cached[i] = true;
+            ++count;
+        }
+    }
+    return count;
+}
+
 //------------------------------------------------------------------------
 
 #undef  LC
@@ -247,6 +263,19 @@ DiskCache::setImage( const TileKey& key, const CacheSpec& spec, const osg::Image
         worldFile.close();
     }
 
+    // if the bytes the image was decoded from are still on record, and they are already
+    // in the cache's format, write them verbatim rather than re-encoding the pixels.
+    std::string encoded;
+    if ( !osgEarth::isZipPath(filename) && ImageUtils::getEncodedData(image, ext, encoded) )
+    {
+        std::ofstream out( filename.c_str(), std::ios::out | std::ios::binary );
+        if ( out.is_open() )
+        {
+            out.write( encoded.data(), encoded.size() );
+            return;
+        }
+    }
+
     bool writingJpeg = (ext == "jpg" || ext == "jpeg");
 
 	//If we are trying to write a non RGB image to JPEG, convert it to RGB before we write it
@@ -333,27 +362,43 @@ DiskCache::loadProperties(const std::string&           cacheId,
 #undef  LC
 #define LC "[MemCache] "
 
+// Number of independently locked partitions for a cache of a given size. Small
+// caches use one, so that LRU order is exact.
+#define MEMCACHE_SHARDS(maxSize) osg::clampBetween( (int)(maxSize)/64, 1, 16 )
+
 MemCache::MemCache( int maxSize ):
-_maxNumTilesInCache( maxSize )
+_objects( maxSize, MEMCACHE_SHARDS(maxSize) )
 {
     setName( "mem" );
 }
 
 MemCache::MemCache( const MemCache& rhs, const osg::CopyOp& op ) :
-_maxNumTilesInCache( rhs._maxNumTilesInCache )
+_objects( rhs._objects.getMaxSize(), MEMCACHE_SHARDS(rhs._objects.getMaxSize()), rhs._objects.getMaxBytes() )
 {
 }
 
 unsigned int
 MemCache::getMaxNumTilesInCache() const
 {
-	return _maxNumTilesInCache;
+	return _objects.getMaxSize();
 }
 
 void
 MemCache::setMaxNumTilesInCache(unsigned int max)
 {
-	_maxNumTilesInCache = max;
+	_objects.setMaxSize( max );
+}
+
+unsigned long
+MemCache::getMaxBytesInCache() const
+{
+	return _objects.getMaxBytes();
+}
+
+void
+MemCache::setMaxBytesInCache(unsigned long max)
+{
+	_objects.setMaxBytes( max );
 }
 
 bool
@@ -371,7 +416,11 @@ MemCache::getImage(const osgEarth::TileKey& key, const CacheSpec& spec, osg::ref
 void
 MemCache::setImage(const osgEarth::TileKey& key, const CacheSpec& spec, const osg::Image* image)
 {
-    setObject( key, spec, ImageUtils::cloneImage(image) );
+    // store a private, normalized copy. Entries are handed out shared and read-only
+    // by getImage, so they must never change after this point.
+    osg::Image* copy = ImageUtils::cloneImage(image);
+    ImageUtils::normalizeImage( copy );
+    setObject( key, spec, copy, copy->getTotalSizeInBytesIncludingMipmaps() );
 }
 
 bool
@@ -389,78 +438,40 @@ MemCache::getHeightField( const TileKey& key,const CacheSpec& spec, osg::ref_ptr
 void
 MemCache::setHeightField( const TileKey& key, const CacheSpec& spec, const osg::HeightField* hf)
 {
-    setObject( key, spec, new osg::HeightField(*hf) );
+    osg::HeightField* copy = new osg::HeightField(*hf);
+    setObject( key, spec, copy, copy->getNumColumns() * copy->getNumRows() * sizeof(float) );
 }
 
 bool
 MemCache::purge( const std::string& cacheId, int olderThan, bool async )
 {
-    //TODO: can this be a ReadWriteLock instead?
-
-    // MemCache does not support timestamps or async, so just clear it out altogether.
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-
-    // MemCache does not support cacheId...
-    _keyToIterMap.clear();
+    // MemCache does not support timestamps, async or cacheId, so just clear it out altogether.
     _objects.clear();
-
     return true;
 }
 
 bool
 MemCache::getObject( const TileKey& key, const CacheSpec& spec, osg::ref_ptr<const osg::Object>& output )
 {
-  OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-
-  std::string id = key.str() + spec.cacheId();
-  KeyToIteratorMap::iterator itr = _keyToIterMap.find(id);
-  if (itr != _keyToIterMap.end())
-  {
-    CachedObject entry = *itr->second;
-    _objects.erase(itr->second);
-    _objects.push_front(entry);
-    itr->second = _objects.begin();
-    output = itr->second->_object.get();
-    return output.valid();
-  }
-  return false;
+    ObjectCache::Record rec = _objects.get( ObjectKey(key.getID(), spec.cacheId()) );
+    if ( rec.valid() )
+    {
+        output = rec.value().get();
+        return output.valid();
+    }
+    return false;
 }
 
 void
-MemCache::setObject( const TileKey& key, const CacheSpec& spec, const osg::Object* referenced )
+MemCache::setObject( const TileKey& key, const CacheSpec& spec, const osg::Object* object, unsigned long bytes )
 {
-  OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-
-  std::string id = key.str() + spec.cacheId();
-
-  _objects.push_front(CachedObject());
-  CachedObject& entry = _objects.front();
-
-  //CachedObject entry;
-  entry._object = referenced;
-  entry._key = id;
-  //_objects.push_front(entry);
-
-  _keyToIterMap[id] = _objects.begin();
-
-  if (_objects.size() > _maxNumTilesInCache)
-  {
-      _keyToIterMap.erase( _objects.back()._key );
-      _objects.pop_back();
-    //CachedObject toRemove = _objects.back();
-    //_objects.pop_back();
-    //_keyToIterMap.erase(toRemove._key);
-  }
+    _objects.insert( ObjectKey(key.getID(), spec.cacheId()), object, bytes );
 }
 
 bool
 MemCache::isCached(const osgEarth::TileKey& key, const CacheSpec& spec) const
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( const_cast<MemCache*>(this)->_mutex);
-    std::string id = key.str() + spec.cacheId();
-    return _keyToIterMap.find(id) != _keyToIterMap.end();
-	//osg::ref_ptr<osg::Image> image = getImage(key,spec);
-	//return image.valid();
+    return _objects.contains( ObjectKey(key.getID(), spec.cacheId()) );
 }
 
 //------------------------------------------------------------------------
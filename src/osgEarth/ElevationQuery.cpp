@@ -180,7 +180,7 @@ ElevationQuery::getElevationImpl(const osg::Vec3d&       point,
     // fallback on a lower resolution, this cache will hold the final resolution heightfield
     // instead of trying to fetch the higher resolution one each tiem.
 
-    TileCache::Record record = _tileCache.get( key );
+    TileCache::Record record = _tileCache.get( key.getID() );
     if ( record.valid() )
         tile = record.value().get();
          
@@ -223,7 +223,7 @@ ElevationQuery::getElevationImpl(const osg::Vec3d&       point,
         tile->setTerrainTechnique( new osgTerrain::GeometryTechnique );
 
         // store it in the local tile cache.
-        _tileCache.insert( key, tile.get() );
+        _tileCache.insert( key.getID(), tile.get() );
     }
 
     OE_DEBUG << LC << "LRU Cache, hit ratio = " << _tileCache.getHitRatio() << std::endl;
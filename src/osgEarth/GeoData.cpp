@@ -21,6 +21,7 @@
 #include <osgEarth/ImageUtils>
 #include <osgEarth/Registry>
 #include <osgEarth/Cube>
+#include <osgEarth/TaskService>
 
 #include <osg/Notify>
 #include <osg/Timer>
@@ -736,9 +737,163 @@ reprojectImage(osg::Image* srcImage, const std::string srcWKT, double srcMinX, d
     return result;
 }    
 
+namespace
+{
+    /**
+     * Reprojection kernel for RGBA8 source images. Works on a band of rows of the
+     * destination image, sampling the source bytes directly and blending with
+     * 8-bit fixed-point weights. With clipping on, samples that fall outside the
+     * source image come out transparent (as they do from GDALReprojectImage)
+     * instead of repeating the edge pixels.
+     */
+    struct ReprojectRowsRGBA8
+    {
+        void init(const osg::Image* src, const GeoExtent& srcExtent, osg::Image* dst,
+                  const double* srcPointsX, const double* srcPointsY,
+                  bool bilinear, bool clip, unsigned int rowStart, unsigned int rowEnd)
+        {
+            _src = src;
+            _srcExtent = &srcExtent;
+            _dst = dst;
+            _srcPointsX = srcPointsX;
+            _srcPointsY = srcPointsY;
+            _bilinear = bilinear;
+            _clip = clip;
+            _rowStart = rowStart;
+            _rowEnd = rowEnd;
+        }
+
+        void execute()
+        {
+            const int sw = _src->s();
+            const int sh = _src->t();
+            const unsigned int width  = _dst->s();
+            const unsigned int height = _dst->t();
+            const unsigned int srcRowBytes = _src->getRowSizeInBytes();
+            const unsigned char* srcData = _src->data();
+
+            const double xmin = _srcExtent->xMin();
+            const double ymin = _srcExtent->yMin();
+            const double xfac = (sw - 1) / _srcExtent->width();
+            const double yfac = (sh - 1) / _srcExtent->height();
+
+            for (unsigned int r = _rowStart; r < _rowEnd; ++r)
+            {
+                unsigned char* out = _dst->data(0, r);
+
+                // the sample grid is column-major.
+                for (unsigned int c = 0, pixel = r; c < width; ++c, pixel += height, out += 4)
+                {
+                    float px = (_srcPointsX[pixel] - xmin) * xfac;
+                    float py = (_srcPointsY[pixel] - ymin) * yfac;
+
+                    if ( _clip && !(px >= -0.5f && px <= sw-0.5f && py >= -0.5f && py <= sh-0.5f) )
+                    {
+                        out[0] = out[1] = out[2] = out[3] = 0;
+                    }
+                    else if ( !_bilinear )
+                    {
+                        int px_i = osg::clampBetween( (int)osg::round(px), 0, sw-1 );
+                        int py_i = osg::clampBetween( (int)osg::round(py), 0, sh-1 );
+                        const unsigned char* p = srcData + py_i*srcRowBytes + px_i*4;
+                        out[0] = p[0]; out[1] = p[1]; out[2] = p[2]; out[3] = p[3];
+                    }
+                    else
+                    {
+                        int rowMin = osg::maximum((int)floor(py), 0);
+                        int rowMax = osg::maximum(osg::minimum((int)ceil(py), sh-1), 0);
+                        int colMin = osg::maximum((int)floor(px), 0);
+                        int colMax = osg::maximum(osg::minimum((int)ceil(px), sw-1), 0);
+
+                        if (rowMin > rowMax) rowMin = rowMax;
+                        if (colMin > colMax) colMin = colMax;
+
+                        // weights in 1/256ths:
+                        int fx = colMax > colMin ? osg::clampBetween( (int)((px - (float)colMin) * 256.0f + 0.5f), 0, 256 ) : 0;
+                        int fy = rowMax > rowMin ? osg::clampBetween( (int)((py - (float)rowMin) * 256.0f + 0.5f), 0, 256 ) : 0;
+
+                        const unsigned char* ll = srcData + rowMin*srcRowBytes + colMin*4;
+                        const unsigned char* lr = srcData + rowMin*srcRowBytes + colMax*4;
+                        const unsigned char* ul = srcData + rowMax*srcRowBytes + colMin*4;
+                        const unsigned char* ur = srcData + rowMax*srcRowBytes + colMax*4;
+
+                        for (int i = 0; i < 4; ++i)
+                        {
+                            int lo = ll[i] * (256 - fx) + lr[i] * fx;
+                            int hi = ul[i] * (256 - fx) + ur[i] * fx;
+                            out[i] = (unsigned char)((lo * (256 - fy) + hi * fy + 32768) >> 16);
+                        }
+                    }
+                }
+            }
+        }
+
+        const osg::Image* _src;
+        const GeoExtent*  _srcExtent;
+        osg::Image*       _dst;
+        const double*     _srcPointsX;
+        const double*     _srcPointsY;
+        bool              _bilinear;
+        bool              _clip;
+        unsigned int      _rowStart, _rowEnd;
+    };
+
+    // Thread pool shared by all parallel reprojections.
+    TaskService* getReprojectionService( int numThreads )
+    {
+        static Threading::Mutex s_mutex;
+        static osg::ref_ptr<TaskService> s_service;
+
+        Threading::ScopedMutexLock lock( s_mutex );
+        if ( !s_service.valid() )
+            s_service = new TaskService( "GeoImage reprojection", numThreads );
+        else if ( s_service->getNumThreads() < numThreads )
+            s_service->setNumThreads( numThreads );
+
+        return s_service.get();
+    }
+
+    void reprojectRGBA8(const osg::Image* src, const GeoExtent& srcExtent, osg::Image* dst,
+                        const double* srcPointsX, const double* srcPointsY,
+                        bool bilinear, bool clip, unsigned int numThreads)
+    {
+        unsigned int height = dst->t();
+        unsigned int numTasks = osg::clampBetween( numThreads, 1u, height );
+
+        if ( numTasks == 1 )
+        {
+            ReprojectRowsRGBA8 task;
+            task.init( src, srcExtent, dst, srcPointsX, srcPointsY, bilinear, clip, 0, height );
+            task.execute();
+            return;
+        }
+
+        // hand all but the first band of rows to the pool, and do the first one here.
+        TaskService* service = getReprojectionService( numTasks-1 );
+        Threading::MultiEvent semaphore( numTasks-1 );
+        unsigned int rowsPerTask = (height + numTasks - 1) / numTasks;
+
+        for( unsigned int t = 1; t < numTasks; ++t )
+        {
+            unsigned int rowStart = osg::minimum( t*rowsPerTask, height );
+            unsigned int rowEnd   = osg::minimum( rowStart + rowsPerTask, height );
+            ParallelTask<ReprojectRowsRGBA8>* task = new ParallelTask<ReprojectRowsRGBA8>( &semaphore );
+            task->init( src, srcExtent, dst, srcPointsX, srcPointsY, bilinear, clip, rowStart, rowEnd );
+            service->add( task );
+        }
+
+        ReprojectRowsRGBA8 first;
+        first.init( src, srcExtent, dst, srcPointsX, srcPointsY, bilinear, clip, 0, osg::minimum(rowsPerTask, height) );
+        first.execute();
+
+        semaphore.wait();
+    }
+}
+
 static osg::Image*
 manualReproject(const osg::Image* image, const GeoExtent& src_extent, const GeoExtent& dest_extent,
-                unsigned int width = 0, unsigned int height = 0)
+                unsigned int width = 0, unsigned int height = 0, unsigned int numThreads = 1,
+                bool clipToSource = false)
 {
     //TODO:  Compute the optimal destination size
     if (width == 0 || height == 0)
@@ -774,6 +929,14 @@ manualReproject(const osg::Image* image, const GeoExtent& src_extent, const GeoE
         dest_extent.xMax() - .5 * dx, dest_extent.yMax() - .5 * dy,
         srcPointsX, srcPointsY, width, height, 0, true);
 
+    // Fast path for RGBA8 source images:
+    if ( image->getPixelFormat() == GL_RGBA && image->getDataType() == GL_UNSIGNED_BYTE && image->r() == 1 )
+    {
+        reprojectRGBA8( image, src_extent, result, srcPointsX, srcPointsY, isSrcContiguous, clipToSource, numThreads );
+        delete[] srcPointsX;
+        return result;
+    }
+
     // Next, go through the source-SRS sample grid, read the color at each point from the source image,
     // and write it to the corresponding pixel in the destination image.
     int pixel = 0;
@@ -908,7 +1071,7 @@ manualReproject(const osg::Image* image, const GeoExtent& src_extent, const GeoE
 
 
 GeoImage
-GeoImage::reproject(const SpatialReference* to_srs, const GeoExtent* to_extent, unsigned int width, unsigned int height) const
+GeoImage::reproject(const SpatialReference* to_srs, const GeoExtent* to_extent, unsigned int width, unsigned int height, unsigned int numThreads) const
 {  
     GeoExtent destExtent;
     if (to_extent)
@@ -922,13 +1085,26 @@ GeoImage::reproject(const SpatialReference* to_srs, const GeoExtent* to_extent,
 
     osg::Image* resultImage = 0L;
 
+    const osg::Image* image = getImage();
+    bool isRGBA8 =
+        image->getPixelFormat() == GL_RGBA &&
+        image->getDataType() == GL_UNSIGNED_BYTE &&
+        image->r() == 1;
+
     if ( getSRS()->isUserDefined() || to_srs->isUserDefined() ||
         ( getSRS()->isMercator() && to_srs->isGeographic() ) ||
         ( getSRS()->isGeographic() && to_srs->isMercator() ) )
     {
         // if either of the SRS is a custom projection, we have to do a manual reprojection since
         // GDAL will not recognize the SRS.
-        resultImage = manualReproject(getImage(), getExtent(), *to_extent, width, height);
+        resultImage = manualReproject(image, getExtent(), destExtent, width, height, numThreads);
+    }
+    else if ( isRGBA8 && width > 0 && height > 0 )
+    {
+        // any other pair (UTM, state plane, ...) with an RGBA8 source and a known output size
+        // can use the RGBA8 kernel too. GDAL leaves areas the source doesn't cover transparent,
+        // so clip to the source extent to match.
+        resultImage = manualReproject(image, getExtent(), destExtent, width, height, numThreads, true);
     }
     else
     {
@@ -20,20 +20,40 @@
 #include <curl/curl.h>
 #include <curl/types.h>
 #include <osgEarth/HTTPClient>
+#include <osgEarth/ImageUtils>
 #include <osgEarth/Registry>
 #include <osgEarth/Version>
 #include <osgDB/Registry>
 #include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
 #include <osg/Notify>
 #include <string.h>
+#include <stdio.h>
+#include <time.h>
 #include <sstream>
 #include <fstream>
 #include <iterator>
+#include <list>
 #include <iostream>
 #include <algorithm>
 
+#ifndef WIN32
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <sys/select.h>
+#endif
+
 #define LC "[HTTPClient] "
 
+// curl_multi_poll can be interrupted by curl_multi_wakeup from another thread.
+// Older libcurls are woken through a self-pipe instead (not on Windows, where
+// the engine falls back on a short poll interval).
+#if LIBCURL_VERSION_NUM >= 0x074400
+#  define OE_CURL_MULTI_WAKEUP 1
+#elif !defined(WIN32)
+#  define OE_HTTP_WAKE_PIPE 1
+#endif
+
 #undef  OE_DEBUG
 #define OE_DEBUG OE_NULL
 
@@ -84,249 +104,1472 @@ namespace osgEarth
 
         void write(const char* ptr, size_t realsize)
         {
-            if (_stream) _stream->write(ptr, realsize);
+            if (_stream) _stream->write(ptr, realsize);
+        }
+
+        std::ostream* _stream;
+        std::string     _resultMimeType;
+    };
+
+    static size_t
+    StreamObjectReadCallback(void* ptr, size_t size, size_t nmemb, void* data)
+    {
+        size_t realsize = size* nmemb;
+        StreamObject* sp = (StreamObject*)data;
+        sp->write((const char*)ptr, realsize);
+        return realsize;
+    }
+}
+
+/****************************************************************************/
+
+HTTPRequest::HTTPRequest( const std::string& url )
+: _url( url )
+{
+    //NOP
+}
+
+HTTPRequest::HTTPRequest( const HTTPRequest& rhs ) :
+_parameters( rhs._parameters ),
+_url( rhs._url )
+{
+    //nop
+}
+
+void
+HTTPRequest::addParameter( const std::string& name, const std::string& value )
+{
+    _parameters[name] = value;
+}
+
+void
+HTTPRequest::addParameter( const std::string& name, int value )
+{
+    std::stringstream buf;
+    buf << value;
+	std::string bufStr;
+    bufStr = buf.str();
+    _parameters[name] = bufStr;
+}
+
+void
+HTTPRequest::addParameter( const std::string& name, double value )
+{
+    std::stringstream buf;
+    buf << value;
+	std::string bufStr;
+    bufStr = buf.str();
+    _parameters[name] = bufStr;
+}
+
+const HTTPRequest::Parameters&
+HTTPRequest::getParameters() const
+{
+    return _parameters; 
+}
+
+std::string
+HTTPRequest::getURL() const
+{
+    if ( _parameters.size() == 0 )
+    {
+        return _url;
+    }
+    else
+    {
+        std::stringstream buf;
+        buf << _url;
+        for( Parameters::const_iterator i = _parameters.begin(); i != _parameters.end(); i++ )
+        {
+            buf << ( i == _parameters.begin() && _url.find( "?" ) == std::string::npos? "?" : "&" );
+            buf << i->first << "=" << i->second;
+        }
+		std::string bufStr;
+		bufStr = buf.str();
+        return bufStr;
+    }
+}
+
+/****************************************************************************/
+
+HTTPResponse::HTTPResponse( long _code )
+: _response_code( _code ),
+  _cancelled(false)
+{
+    _parts.reserve(1);
+}
+
+HTTPResponse::HTTPResponse( const HTTPResponse& rhs ) :
+_response_code( rhs._response_code ),
+_parts( rhs._parts ),
+_mimeType( rhs._mimeType ),
+_cancelled( rhs._cancelled )
+{
+    //nop
+}
+
+long
+HTTPResponse::getCode() const {
+    return _response_code;
+}
+
+bool
+HTTPResponse::isOK() const {
+    return _response_code == 200L && !isCancelled();
+}
+
+bool
+HTTPResponse::isCancelled() const {
+    return _cancelled;
+}
+
+unsigned int
+HTTPResponse::getNumParts() const {
+    return _parts.size();
+}
+
+unsigned int
+HTTPResponse::getPartSize( unsigned int n ) const {
+    return _parts[n]->_size;
+}
+
+const std::string&
+HTTPResponse::getPartHeader( unsigned int n, const std::string& name ) const {
+    return _parts[n]->_headers[name];
+}
+
+std::istream&
+HTTPResponse::getPartStream( unsigned int n ) const {
+    return _parts[n]->_stream;
+}
+
+std::string
+HTTPResponse::getPartAsString( unsigned int n ) const {
+	std::string streamStr;
+	streamStr = _parts[n]->_stream.str();
+    return streamStr;
+}
+
+const std::string&
+HTTPResponse::getMimeType() const {
+    return _mimeType;
+}
+
+/****************************************************************************/
+
+#define QUOTE_(X) #X
+#define QUOTE(X) QUOTE_(X)
+#define USER_AGENT "osgearth" QUOTE(OSGEARTH_MAJOR_VERSION) "." QUOTE(OSGEARTH_MINOR_VERSION)
+
+static optional<ProxySettings>     _proxySettings;
+static std::string                 _userAgent = USER_AGENT;
+
+namespace
+{
+    unsigned int s_getDefaultMaxConnectionsPerHost()
+    {
+        const char* maxConnEnv = getenv("OSGEARTH_HTTP_CONNECTIONS_PER_HOST");
+        unsigned int value = maxConnEnv ? as<unsigned int>(std::string(maxConnEnv), 6) : 6;
+        return value > 0 ? value : 1;
+    }
+}
+
+static unsigned int                _maxConnectionsPerHost = s_getDefaultMaxConnectionsPerHost();
+
+namespace osgEarth
+{
+    /**
+     * Persistent on-disk cache of HTTP responses. Each response is stored as a pair
+     * of files named for a hash of its URL: the body (".body") and its caching
+     * metadata (".meta"). An in-memory index of the metadata is built when the cache
+     * folder is opened.
+     */
+    class HTTPResponseCache
+    {
+    public:
+        struct Entry
+        {
+            Entry() : _expires(0), _size(0), _lastUse(0) { }
+            std::string  _url;
+            std::string  _etag;
+            std::string  _lastModified;
+            std::string  _contentType;
+            time_t       _expires;
+            unsigned int _size;
+            time_t       _lastUse;
+
+            bool isFresh( time_t now ) const { return now < _expires; }
+            bool canRevalidate() const { return !_etag.empty() || !_lastModified.empty(); }
+        };
+
+        static HTTPResponseCache& instance() { return s_cache; }
+
+        bool isEnabled() const { return _enabled; }
+
+        std::string getPath()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            return _path;
+        }
+
+        void setPath( const std::string& path )
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            _path = path;
+            _entries.clear();
+            _totalSize = 0;
+            _enabled = false;
+
+            if ( !_path.empty() )
+            {
+                if ( !osgDB::makeDirectory(_path) )
+                {
+                    OE_WARN << LC << "Cannot create HTTP response cache folder " << _path << std::endl;
+                    return;
+                }
+                loadIndex();
+                _enabled = true;
+                OE_INFO << LC << "HTTP response cache at " << _path << " (" << _entries.size() << " responses)" << std::endl;
+            }
+        }
+
+        unsigned int getMaxSizeMB() const { return _maxSizeMB; }
+
+        void setMaxSizeMB( unsigned int value )
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            _maxSizeMB = value;
+            trim();
+        }
+
+        HTTPClient::ResponseCacheStats getStats()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            return _stats;
+        }
+
+        /** Finds the cache entry for a URL, if there is one. */
+        bool lookup( const std::string& url, Entry& out_entry )
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            EntryMap::iterator i = _entries.find( getName(url) );
+            if ( i == _entries.end() || i->second._url != url )
+                return false;
+
+            i->second._lastUse = ::time(0L);
+            out_entry = i->second;
+            return true;
+        }
+
+        /** Reads the cached response body for an entry. */
+        bool readBody( const Entry& entry, std::string& out_body )
+        {
+            std::ifstream in( getBodyFile(getName(entry._url)).c_str(), std::ios::in | std::ios::binary );
+            if ( !in.is_open() )
+                return false;
+
+            std::stringstream buf;
+            buf << in.rdbuf();
+            out_body = buf.str();
+            return out_body.size() == entry._size;
+        }
+
+        /**
+         * Stores (or replaces) a response. The files are written on the cache's writer
+         * thread, so this never blocks on the disk; the response becomes visible to
+         * lookup() once it's written.
+         */
+        void store( const Entry& entry, const std::string& body )
+        {
+            WriteJob job;
+            job._type  = WriteJob::STORE;
+            job._entry = entry;
+            job._body  = body;
+            queue( job );
+        }
+
+        /** Updates the caching metadata of an entry after the server revalidates it. */
+        void refresh( const Entry& entry )
+        {
+            WriteJob job;
+            job._type  = WriteJob::REFRESH;
+            job._entry = entry;
+            queue( job );
+        }
+
+        /** Discards an entry. */
+        void remove( const std::string& url )
+        {
+            WriteJob job;
+            job._type = WriteJob::REMOVE;
+            job._entry._url = url;
+            queue( job );
+        }
+
+        void countHit()          { Threading::ScopedMutexLock lock(_mutex); _stats._hits++; }
+        void countRevalidation() { Threading::ScopedMutexLock lock(_mutex); _stats._revalidations++; }
+        void countMiss()         { Threading::ScopedMutexLock lock(_mutex); _stats._misses++; }
+
+    private:
+        HTTPResponseCache() : _enabled(false), _maxSizeMB(256), _totalSize(0), _writer(this), _writerDone(false), _pendingBytes(0)
+        {
+            const char* pathEnv = getenv("OSGEARTH_HTTP_CACHE_PATH");
+            if ( pathEnv )
+                setPath( std::string(pathEnv) );
+        }
+
+        ~HTTPResponseCache()
+        {
+            // finish writing whatever is queued.
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _writeMutex );
+                _writerDone = true;
+                _writeCond.signal();
+            }
+            if ( _writer.isRunning() )
+                _writer.join();
+        }
+
+        struct WriteJob
+        {
+            enum Type { STORE, REFRESH, REMOVE };
+            Type        _type;
+            Entry       _entry;
+            std::string _body;
+        };
+
+        // performs the cache's file writes, so that no caller (in particular the
+        // HTTP engine thread) ever waits on the disk.
+        class WriterThread : public OpenThreads::Thread
+        {
+        public:
+            WriterThread( HTTPResponseCache* cache ) : _cache(cache) { }
+            void run() { _cache->runWriter(); }
+        private:
+            HTTPResponseCache* _cache;
+        };
+
+        // most response bodies that may wait in the write queue; past this, new
+        // responses are simply not cached until the writer catches up.
+        static unsigned int maxPendingBytes() { return 32u * 1048576u; }
+
+        void queue( const WriteJob& job )
+        {
+            if ( !_enabled )
+                return;
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _writeMutex );
+            if ( _writerDone )
+                return;
+
+            if ( job._type == WriteJob::STORE && _pendingBytes + job._body.size() > maxPendingBytes() )
+            {
+                OE_DEBUG << LC << "HTTP response cache writer is behind; not caching " << job._entry._url << std::endl;
+                return;
+            }
+
+            _pendingBytes += job._body.size();
+            _writeQueue.push_back( job );
+            _writeCond.signal();
+
+            if ( !_writer.isRunning() )
+                _writer.start();
+        }
+
+        void runWriter()
+        {
+            for( ;; )
+            {
+                WriteJob job;
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _writeMutex );
+                    while( _writeQueue.empty() && !_writerDone )
+                        _writeCond.wait( &_writeMutex );
+
+                    if ( _writeQueue.empty() )
+                        return;
+
+                    job = _writeQueue.front();
+                    _writeQueue.pop_front();
+                }
+
+                switch( job._type )
+                {
+                case WriteJob::STORE:   doStore( job._entry, job._body ); break;
+                case WriteJob::REFRESH: doRefresh( job._entry ); break;
+                case WriteJob::REMOVE:  doRemove( job._entry._url ); break;
+                }
+
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _writeMutex );
+                _pendingBytes -= job._body.size();
+            }
+        }
+
+        void doStore( const Entry& entry, const std::string& body )
+        {
+            std::string name = getName( entry._url );
+
+            // write to a temporary file and rename it, so readers never see a partial body.
+            std::string tempName = getBodyFile(name) + ".tmp";
+            {
+                std::ofstream out( tempName.c_str(), std::ios::out | std::ios::binary );
+                if ( !out.is_open() )
+                    return;
+                out.write( body.data(), body.size() );
+                if ( out.fail() )
+                {
+                    out.close();
+                    ::remove( tempName.c_str() );
+                    return;
+                }
+            }
+
+            Threading::ScopedMutexLock lock( _mutex );
+
+            removeFiles( name );
+            if ( ::rename( tempName.c_str(), getBodyFile(name).c_str() ) != 0 )
+            {
+                ::remove( tempName.c_str() );
+                removeEntry( name );
+                return;
+            }
+
+            Entry& e = _entries[name];
+            _totalSize -= e._size;
+            e = entry;
+            e._size = body.size();
+            e._lastUse = ::time(0L);
+            _totalSize += e._size;
+            writeMeta( name, e );
+
+            trim();
+        }
+
+        void doRefresh( const Entry& entry )
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            std::string name = getName( entry._url );
+            EntryMap::iterator i = _entries.find( name );
+            if ( i != _entries.end() && i->second._url == entry._url )
+            {
+                i->second._etag         = entry._etag;
+                i->second._lastModified = entry._lastModified;
+                i->second._expires      = entry._expires;
+                i->second._lastUse      = ::time(0L);
+                writeMeta( name, i->second );
+            }
+        }
+
+        void doRemove( const std::string& url )
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            std::string name = getName( url );
+            EntryMap::iterator i = _entries.find( name );
+            if ( i != _entries.end() && i->second._url == url )
+            {
+                removeFiles( name );
+                removeEntry( name );
+            }
+        }
+
+        typedef std::map<std::string, Entry> EntryMap;
+
+        // file name for a URL: the hex FNV-1a hash of the URL.
+        static std::string getName( const std::string& url )
+        {
+            unsigned long long h = 14695981039346656037ULL;
+            for( std::string::const_iterator i = url.begin(); i != url.end(); ++i )
+            {
+                h ^= (unsigned char)*i;
+                h *= 1099511628211ULL;
+            }
+            char buf[17];
+            ::sprintf( buf, "%08x%08x", (unsigned int)(h >> 32), (unsigned int)(h & 0xffffffff) );
+            return std::string( buf );
+        }
+
+        std::string getBodyFile( const std::string& name ) const { return osgDB::concatPaths( _path, name + ".body" ); }
+        std::string getMetaFile( const std::string& name ) const { return osgDB::concatPaths( _path, name + ".meta" ); }
+
+        void writeMeta( const std::string& name, const Entry& e )
+        {
+            std::ofstream out( getMetaFile(name).c_str() );
+            out << "url=" << e._url << "\n"
+                << "etag=" << e._etag << "\n"
+                << "last_modified=" << e._lastModified << "\n"
+                << "content_type=" << e._contentType << "\n"
+                << "expires=" << (long)e._expires << "\n"
+                << "size=" << e._size << "\n"
+                << "last_use=" << (long)e._lastUse << "\n";
+        }
+
+        bool readMeta( const std::string& name, Entry& e )
+        {
+            std::ifstream in( getMetaFile(name).c_str() );
+            if ( !in.is_open() )
+                return false;
+
+            std::string line;
+            while( std::getline(in, line) )
+            {
+                std::string::size_type eq = line.find( '=' );
+                if ( eq == std::string::npos )
+                    continue;
+                std::string key = line.substr( 0, eq );
+                std::string value = line.substr( eq+1 );
+
+                if      ( key == "url" )           e._url = value;
+                else if ( key == "etag" )          e._etag = value;
+                else if ( key == "last_modified" ) e._lastModified = value;
+                else if ( key == "content_type" )  e._contentType = value;
+                else if ( key == "expires" )       e._expires = (time_t)as<long>( value, 0L );
+                else if ( key == "size" )          e._size = as<unsigned int>( value, 0u );
+                else if ( key == "last_use" )      e._lastUse = (time_t)as<long>( value, 0L );
+            }
+            return !e._url.empty();
+        }
+
+        // call with the mutex held.
+        void loadIndex()
+        {
+            osgDB::DirectoryContents files = osgDB::getDirectoryContents( _path );
+            for( osgDB::DirectoryContents::const_iterator i = files.begin(); i != files.end(); ++i )
+            {
+                if ( osgDB::getLowerCaseFileExtension(*i) == "meta" )
+                {
+                    std::string name = osgDB::getNameLessExtension( *i );
+                    Entry e;
+                    if ( readMeta(name, e) && osgDB::fileExists(getBodyFile(name)) )
+                    {
+                        _entries[name] = e;
+                        _totalSize += e._size;
+                    }
+                    else
+                    {
+                        removeFiles( name );
+                    }
+                }
+            }
+            trim();
+        }
+
+        // call with the mutex held.
+        void removeFiles( const std::string& name )
+        {
+            ::remove( getBodyFile(name).c_str() );
+            ::remove( getMetaFile(name).c_str() );
+        }
+
+        // call with the mutex held.
+        void removeEntry( const std::string& name )
+        {
+            EntryMap::iterator i = _entries.find( name );
+            if ( i != _entries.end() )
+            {
+                _totalSize -= i->second._size;
+                _entries.erase( i );
+            }
+        }
+
+        // Discards the least recently used responses until the cache is back under 90%
+        // of its size limit. Call with the mutex held.
+        void trim()
+        {
+            double maxBytes = (double)_maxSizeMB * 1048576.0;
+            if ( (double)_totalSize <= maxBytes )
+                return;
+
+            typedef std::multimap<time_t, std::string> UseOrder;
+            UseOrder order;
+            for( EntryMap::const_iterator i = _entries.begin(); i != _entries.end(); ++i )
+                order.insert( UseOrder::value_type(i->second._lastUse, i->first) );
+
+            for( UseOrder::const_iterator i = order.begin(); i != order.end() && (double)_totalSize > 0.9*maxBytes; ++i )
+            {
+                removeFiles( i->second );
+                removeEntry( i->second );
+                _stats._evictions++;
+            }
+        }
+
+        bool                           _enabled;
+        unsigned int                   _maxSizeMB;
+        double                         _totalSize;
+        std::string                    _path;
+        EntryMap                       _entries;
+        HTTPClient::ResponseCacheStats _stats;
+        Threading::Mutex               _mutex;
+
+        WriterThread                   _writer;
+        OpenThreads::Mutex             _writeMutex;
+        OpenThreads::Condition         _writeCond;
+        std::list<WriteJob>            _writeQueue;
+        bool                           _writerDone;
+        unsigned int                   _pendingBytes;
+
+        static HTTPResponseCache       s_cache;
+    };
+
+    // Created while the library loads, like the HTTPEngine (which must not outlive it).
+    HTTPResponseCache HTTPResponseCache::s_cache;
+}
+
+namespace osgEarth
+{
+    /**
+     * One HTTP GET in flight: the curl handle that carries it, the buffers it
+     * writes into, and the results once it completes.
+     */
+    class HTTPTransfer : public osg::Referenced
+    {
+    public:
+        HTTPTransfer( const HTTPRequest& request ) :
+          _request     ( request ),
+          _url         ( request.getURL() ),
+          _handle      ( 0L ),
+          _requestHeaders( 0L ),
+          _part        ( new HTTPResponse::Part() ),
+          _sp          ( &_part->_stream ),
+          _useCache    ( false ),
+          _fromCache   ( false ),
+          _hasStaleEntry( false ),
+          _coalesced   ( false ),
+          _dlNow       ( 0.0 ),
+          _dlTotal     ( 0.0 ),
+          _abort       ( false ),
+          _result      ( CURLE_OK ),
+          _responseCode( 0L )
+        {
+            _errorBuf[0] = 0;
+        }
+
+        HTTPRequest                        _request;
+        std::string                        _url;
+        std::string                        _host;
+        std::string                        _proxyAddr;
+        std::string                        _proxyAuth;
+        std::string                        _userPassword;
+        CURL*                              _handle;
+        struct curl_slist*                 _requestHeaders;
+        osg::ref_ptr<HTTPResponse::Part>   _part;
+        StreamObject                       _sp;
+        osg::ref_ptr<ProgressCallback>     _progress;
+        osg::ref_ptr<HTTPClient::ResponseCallback> _responseCallback;
+        char                               _errorBuf[CURL_ERROR_SIZE];
+
+        // response caching:
+        bool                               _useCache;
+        bool                               _fromCache;
+        bool                               _hasStaleEntry;
+        HTTPResponseCache::Entry           _cacheEntry;
+        std::map<std::string,std::string>  _responseHeaders;
+
+        // request coalescing:
+        std::string                        _flightKey;
+        std::vector< osg::ref_ptr<HTTPTransfer> > _followers;
+        bool                               _coalesced;
+
+        // progress as curl reports it in the engine thread; the thread waiting on the
+        // transfer passes it on to the ProgressCallback (see HTTPClient::doGet).
+        volatile double                    _dlNow;
+        volatile double                    _dlTotal;
+        volatile bool                      _abort;   // the waiting thread canceled it
+
+        bool isCanceled() const { return _abort || (_progress.valid() && _progress->isCanceled()); }
+
+        // results:
+        CURLcode                           _result;
+        long                               _responseCode;
+        std::string                        _contentType;
+        Threading::Event                   _done;
+
+        /**
+         * Checks the response cache before going to the network. Returns true if a
+         * fresh cached response was found, in which case there's nothing to download.
+         * Otherwise, if there's a stale copy, sets up a conditional request for it.
+         */
+        bool checkCache()
+        {
+            HTTPResponseCache& cache = HTTPResponseCache::instance();
+            _useCache = cache.isEnabled();
+            if ( !_useCache || !cache.lookup(_url, _cacheEntry) )
+                return false;
+
+            if ( _cacheEntry.isFresh(::time(0L)) )
+            {
+                std::string body;
+                if ( cache.readBody(_cacheEntry, body) )
+                {
+                    cache.countHit();
+                    setCachedResult( body );
+                    return true;
+                }
+                cache.remove( _url );
+            }
+            else if ( _cacheEntry.canRevalidate() )
+            {
+                _hasStaleEntry = true;
+                if ( !_cacheEntry._etag.empty() )
+                    _requestHeaders = curl_slist_append( _requestHeaders, ("If-None-Match: " + _cacheEntry._etag).c_str() );
+                if ( !_cacheEntry._lastModified.empty() )
+                    _requestHeaders = curl_slist_append( _requestHeaders, ("If-Modified-Since: " + _cacheEntry._lastModified).c_str() );
+            }
+
+            return false;
+        }
+
+        /**
+         * Builds the response once the transfer is complete, serving the cached copy
+         * if the server says it's still good and caching the new response if it's
+         * cacheable.
+         */
+        HTTPResponse createResponse()
+        {
+            if ( _useCache && !_fromCache )
+            {
+                HTTPResponseCache& cache = HTTPResponseCache::instance();
+
+                if ( _responseCode == 304L && _hasStaleEntry )
+                {
+                    std::string body;
+                    if ( cache.readBody(_cacheEntry, body) )
+                    {
+                        cache.countRevalidation();
+                        updateCacheEntry( _cacheEntry );
+                        cache.refresh( _cacheEntry );
+                        setCachedResult( body );
+                    }
+                    else
+                    {
+                        cache.remove( _url );
+                    }
+                }
+                else if ( !_coalesced )
+                {
+                    cache.countMiss();
+
+                    if ( _responseCode == 200L && _result == CURLE_OK )
+                    {
+                        HTTPResponseCache::Entry entry;
+                        entry._url = _url;
+                        entry._contentType = _contentType;
+                        if ( updateCacheEntry(entry) )
+                            cache.store( entry, _part->_stream.str() );
+                        else
+                            cache.remove( _url );
+                    }
+                }
+            }
+
+            return HTTPClient::createResponse( _url, _result, _responseCode, _contentType, _part.get() );
+        }
+
+        /** Records a response header line (called from curl). */
+        void addResponseHeader( const std::string& line )
+        {
+            // a new status line (e.g., after a redirect) starts a new set of headers.
+            if ( line.compare(0, 5, "HTTP/") == 0 )
+            {
+                _responseHeaders.clear();
+                return;
+            }
+
+            std::string::size_type colon = line.find( ':' );
+            if ( colon != std::string::npos )
+            {
+                std::string name = toLower( trim(line.substr(0, colon)) );
+                _responseHeaders[name] = trim( line.substr(colon+1) );
+            }
+        }
+
+        ~HTTPTransfer()
+        {
+            if ( _requestHeaders )
+                curl_slist_free_all( _requestHeaders );
+        }
+
+    private:
+        void setCachedResult( const std::string& body )
+        {
+            _fromCache    = true;
+            _result       = CURLE_OK;
+            _responseCode = 200L;
+            _contentType  = _cacheEntry._contentType;
+            _part->_stream.str( body );
+        }
+
+        std::string getResponseHeader( const std::string& name ) const
+        {
+            std::map<std::string,std::string>::const_iterator i = _responseHeaders.find( name );
+            return i != _responseHeaders.end() ? i->second : std::string();
+        }
+
+        /**
+         * Applies the response's caching headers to a cache entry. Returns false if
+         * the response must not be cached, or if caching it would be pointless
+         * because it's already stale and there's no way to revalidate it.
+         */
+        bool updateCacheEntry( HTTPResponseCache::Entry& entry ) const
+        {
+            time_t now = ::time(0L);
+
+            std::string etag = getResponseHeader( "etag" );
+            if ( !etag.empty() )
+                entry._etag = etag;
+
+            std::string lastModified = getResponseHeader( "last-modified" );
+            if ( !lastModified.empty() )
+                entry._lastModified = lastModified;
+
+            // the cache is shared by every user of the machine, so never keep anything
+            // that was personalized for this one.
+            if ( !getResponseHeader("set-cookie").empty() )
+                return false;
+
+            bool noCache        = false;
+            bool mustRevalidate = false;
+            long maxAge         = -1L;
+
+            std::string cacheControl = toLower( getResponseHeader("cache-control") );
+            StringVector directives;
+            tokenize( cacheControl, directives, ",", "\"", false );
+            for( StringVector::const_iterator i = directives.begin(); i != directives.end(); ++i )
+            {
+                std::string d = trim( *i );
+                if ( d == "no-store" || d == "private" || d.compare(0, 8, "private=") == 0 )
+                    return false;
+                else if ( d == "no-cache" )
+                    noCache = true;
+                else if ( d == "must-revalidate" || d == "proxy-revalidate" )
+                    mustRevalidate = true;
+                else if ( d.compare(0, 8, "max-age=") == 0 )
+                    maxAge = as<long>( d.substr(8), -1L );
+            }
+
+            // Note: a stale entry is never served without a successful revalidation,
+            // which is what must-revalidate asks for. Beyond that, it rules out the
+            // heuristic freshness below: without an explicit lifetime, always check.
+            if ( noCache )
+            {
+                entry._expires = 0;
+            }
+            else if ( maxAge >= 0L )
+            {
+                entry._expires = now + maxAge;
+            }
+            else if ( !getResponseHeader("expires").empty() )
+            {
+                time_t expires = curl_getdate( getResponseHeader("expires").c_str(), 0L );
+                entry._expires = expires > 0 ? expires : 0;
+            }
+            else if ( !entry._lastModified.empty() && !mustRevalidate )
+            {
+                // heuristic freshness: 10% of the time since the last modification, up to a day.
+                time_t modified = curl_getdate( entry._lastModified.c_str(), 0L );
+                entry._expires = modified > 0 && modified < now ? now + osg::minimum( (now-modified)/10, (time_t)86400 ) : 0;
+            }
+            else
+            {
+                entry._expires = 0;
+            }
+
+            return entry.isFresh(now) || entry.canRevalidate();
+        }
+    };
+}
+
+namespace osgEarth
+{
+    /**
+     * Drives all HTTP traffic from a single curl_multi handle in its own thread.
+     * Requests from any number of threads are multiplexed over a shared pool of
+     * keep-alive connections, subject to a per-host limit on simultaneous requests.
+     */
+    class HTTPEngine : public OpenThreads::Thread
+    {
+        typedef std::list< osg::ref_ptr<HTTPTransfer> >       TransferList;
+        typedef std::map< CURL*, osg::ref_ptr<HTTPTransfer> > RunningMap;
+        typedef std::vector< osg::ref_ptr<HTTPTransfer> >     TransferVector;
+        typedef std::map< std::string, HTTPTransfer* >        FlightMap;
+
+    public:
+        static HTTPEngine& instance() { return s_engine; }
+
+        /** Gets a curl handle from the pool, reset to defaults. */
+        CURL* acquireHandle()
+        {
+            Threading::ScopedMutexLock lock( _poolMutex );
+            if ( _handlePool.empty() )
+                return curl_easy_init();
+
+            CURL* handle = _handlePool.back();
+            _handlePool.pop_back();
+            curl_easy_reset( handle );
+            return handle;
+        }
+
+        /** Number of requests that shared the response of an identical request. */
+        unsigned int getNumCoalesced() const { return _numCoalesced; }
+
+        /**
+         * Cancels a transfer on behalf of the thread waiting on it. A transfer that
+         * is waiting on an identical one (a follower) is detached and finished right
+         * away; a queued or running one is dropped the next time the engine looks.
+         */
+        void cancel( HTTPTransfer* transfer )
+        {
+            transfer->_abort = true;
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+                if ( !detachFollower( transfer ) )
+                {
+                    _queueCond.signal();
+                    wake();
+                    return;
+                }
+            }
+            transfer->_result = CURLE_ABORTED_BY_CALLBACK;
+            finish( transfer );
+        }
+
+        /** Queues a transfer. It starts as soon as its host has a free slot. */
+        void submit( HTTPTransfer* transfer )
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+
+            // If an identical request is already queued or running, just wait for its result.
+            transfer->_flightKey = getFlightKey( transfer );
+            FlightMap::iterator f = _inFlight.find( transfer->_flightKey );
+            if ( f != _inFlight.end() )
+            {
+                f->second->_followers.push_back( transfer );
+                return;
+            }
+
+            _inFlight[transfer->_flightKey] = transfer;
+            _pending.push_back( transfer );
+            _queueCond.signal();
+
+            if ( !isRunning() )
+                start();
+
+            // interrupt the socket wait so the transfer is admitted right away.
+            wake();
+        }
+
+    private:
+        HTTPEngine() : _done( false ), _numCoalesced( 0 )
+        {
+            // curl_global_init isn't thread-safe; the engine is created while the
+            // library loads (see s_engine), before there are other threads.
+            curl_global_init( CURL_GLOBAL_ALL );
+            _multi = curl_multi_init();
+
+#ifdef OE_HTTP_WAKE_PIPE
+            if ( ::pipe(_wakePipe) == 0 )
+            {
+                ::fcntl( _wakePipe[0], F_SETFL, ::fcntl(_wakePipe[0], F_GETFL) | O_NONBLOCK );
+                ::fcntl( _wakePipe[1], F_SETFL, ::fcntl(_wakePipe[1], F_GETFL) | O_NONBLOCK );
+            }
+            else
+            {
+                _wakePipe[0] = _wakePipe[1] = -1;
+            }
+#endif
+
+            // allow HTTP/2 multiplexing (or HTTP/1.1 pipelining on older libcurls)
+            // over the shared connections:
+#if LIBCURL_VERSION_NUM >= 0x072b00
+            curl_multi_setopt( _multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX );
+#elif LIBCURL_VERSION_NUM >= 0x071000
+            curl_multi_setopt( _multi, CURLMOPT_PIPELINING, 1L );
+#endif
+        }
+
+        ~HTTPEngine()
+        {
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+                _done = true;
+                _queueCond.signal();
+            }
+            wake();
+
+            if ( isRunning() )
+                join();
+
+            for( RunningMap::iterator i = _running.begin(); i != _running.end(); ++i )
+            {
+                curl_multi_remove_handle( _multi, i->first );
+                curl_easy_cleanup( i->first );
+            }
+            for( std::vector<CURL*>::iterator i = _handlePool.begin(); i != _handlePool.end(); ++i )
+            {
+                curl_easy_cleanup( *i );
+            }
+            curl_multi_cleanup( _multi );
+
+#ifdef OE_HTTP_WAKE_PIPE
+            if ( _wakePipe[0] >= 0 ) ::close( _wakePipe[0] );
+            if ( _wakePipe[1] >= 0 ) ::close( _wakePipe[1] );
+#endif
+            curl_global_cleanup();
+        }
+
+        // interrupts waitForActivity() from another thread.
+        void wake()
+        {
+#if defined(OE_CURL_MULTI_WAKEUP)
+            curl_multi_wakeup( _multi );
+#elif defined(OE_HTTP_WAKE_PIPE)
+            if ( _wakePipe[1] >= 0 )
+            {
+                // the pipe is non-blocking; if it's full, a wakeup is already pending.
+                char c = 1;
+                ssize_t n = ::write( _wakePipe[1], &c, 1 );
+                (void)n;
+            }
+#endif
+        }
+
+        // waits for socket activity on the running transfers, a wake() call or the
+        // timeout, whichever comes first.
+        void waitForActivity()
+        {
+            int timeout_ms = 1000;
+
+#if defined(OE_CURL_MULTI_WAKEUP)
+            int numfds = 0;
+            curl_multi_poll( _multi, 0L, 0, timeout_ms, &numfds );
+
+#elif LIBCURL_VERSION_NUM >= 0x071c00
+#  ifdef OE_HTTP_WAKE_PIPE
+            int numfds = 0;
+            struct curl_waitfd wakefd;
+            wakefd.fd      = _wakePipe[0];
+            wakefd.events  = CURL_WAIT_POLLIN;
+            wakefd.revents = 0;
+            curl_multi_wait( _multi, &wakefd, _wakePipe[0] >= 0 ? 1 : 0, timeout_ms, &numfds );
+            drainWakePipe();
+#  else
+            // no way to interrupt the wait, so keep it short.
+            int numfds = 0;
+            curl_multi_wait( _multi, 0L, 0, 10, &numfds );
+#  endif
+
+#else
+            // no curl_multi_wait; select() on curl's sockets (and the wake pipe) directly.
+            long curlTimeout = -1L;
+            curl_multi_timeout( _multi, &curlTimeout );
+            if ( curlTimeout >= 0L && curlTimeout < (long)timeout_ms )
+                timeout_ms = (int)curlTimeout;
+
+            fd_set readfds, writefds, exceptfds;
+            FD_ZERO( &readfds );
+            FD_ZERO( &writefds );
+            FD_ZERO( &exceptfds );
+            int maxfd = -1;
+            curl_multi_fdset( _multi, &readfds, &writefds, &exceptfds, &maxfd );
+
+#  ifdef OE_HTTP_WAKE_PIPE
+            if ( _wakePipe[0] >= 0 )
+            {
+                FD_SET( _wakePipe[0], &readfds );
+                maxfd = osg::maximum( maxfd, _wakePipe[0] );
+            }
+#  endif
+
+            if ( maxfd < 0 )
+            {
+                // curl has no sockets to wait on yet (e.g. still resolving).
+                OpenThreads::Thread::microSleep( 1000 * osg::minimum(timeout_ms, 10) );
+            }
+            else
+            {
+                struct timeval tv;
+                tv.tv_sec  = timeout_ms / 1000;
+                tv.tv_usec = (timeout_ms % 1000) * 1000;
+                ::select( maxfd+1, &readfds, &writefds, &exceptfds, &tv );
+            }
+#  ifdef OE_HTTP_WAKE_PIPE
+            drainWakePipe();
+#  endif
+#endif
+        }
+
+#ifdef OE_HTTP_WAKE_PIPE
+        void drainWakePipe()
+        {
+            if ( _wakePipe[0] >= 0 )
+            {
+                char buf[64];
+                while( ::read(_wakePipe[0], buf, sizeof(buf)) > 0 );
+            }
+        }
+#endif
+
+        void run()
+        {
+            TransferList   canceled;
+            TransferVector resubmit;
+
+            for(;;)
+            {
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+
+                    while( !_done && _running.empty() && _pending.empty() )
+                        _queueCond.wait( &_queueMutex );
+
+                    if ( _done )
+                        return;
+
+                    admitPending( canceled, resubmit );
+                    detachCanceledFollowers( canceled );
+                }
+
+                for( TransferList::iterator i = canceled.begin(); i != canceled.end(); ++i )
+                    finish( i->get() );
+                canceled.clear();
+
+                for( TransferVector::iterator i = resubmit.begin(); i != resubmit.end(); ++i )
+                    submit( i->get() );
+                resubmit.clear();
+
+                int stillRunning = 0;
+                while( curl_multi_perform( _multi, &stillRunning ) == CURLM_CALL_MULTI_PERFORM );
+
+                CURLMsg* msg;
+                int msgsLeft = 0;
+                while( (msg = curl_multi_info_read( _multi, &msgsLeft )) != 0L )
+                {
+                    if ( msg->msg == CURLMSG_DONE )
+                        complete( msg->easy_handle, msg->data.result );
+                }
+
+                // wait for socket activity; submit() interrupts the wait to admit new requests.
+                if ( !_running.empty() )
+                {
+                    waitForActivity();
+                }
+            }
+        }
+
+        // moves queued transfers into the multi handle, in order, as their hosts free up.
+        // Transfers canceled while waiting go into "out_canceled" instead, and anything
+        // that was waiting on them into "out_resubmit". Call with the queue mutex held.
+        void admitPending( TransferList& out_canceled, TransferVector& out_resubmit )
+        {
+            for( TransferList::iterator i = _pending.begin(); i != _pending.end(); )
+            {
+                HTTPTransfer* transfer = i->get();
+
+                if ( transfer->isCanceled() )
+                {
+                    transfer->_result = CURLE_ABORTED_BY_CALLBACK;
+                    detachFollowers( transfer, out_resubmit );
+                    out_canceled.push_back( transfer );
+                    i = _pending.erase( i );
+                }
+                else
+                {
+                    unsigned int& count = _hostCounts[transfer->_host];
+                    if ( count < _maxConnectionsPerHost )
+                    {
+                        count++;
+                        _running[transfer->_handle] = transfer;
+                        curl_multi_add_handle( _multi, transfer->_handle );
+                        i = _pending.erase( i );
+                    }
+                    else
+                    {
+                        ++i;
+                    }
+                }
+            }
+        }
+
+        // collects the results of a finished transfer and frees up its slot.
+        void complete( CURL* handle, CURLcode result )
+        {
+            RunningMap::iterator i = _running.find( handle );
+            if ( i == _running.end() )
+                return;
+
+            osg::ref_ptr<HTTPTransfer> transfer = i->second;
+            _running.erase( i );
+            curl_multi_remove_handle( _multi, handle );
+
+            transfer->_result = result;
+            curl_easy_getinfo( handle, CURLINFO_RESPONSE_CODE, &transfer->_responseCode );
+
+            // Note: CURL manages the buffer returned by this call.
+            char* contentType = 0L;
+            if ( curl_easy_getinfo( handle, CURLINFO_CONTENT_TYPE, &contentType ) == CURLE_OK && contentType )
+                transfer->_contentType = contentType;
+
+            TransferVector followers;
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+                _hostCounts[transfer->_host]--;
+                detachFollowers( transfer.get(), followers );
+            }
+
+            for( TransferVector::iterator f = followers.begin(); f != followers.end(); ++f )
+            {
+                // a canceled result is no good to the others, so they go again.
+                if ( result == CURLE_ABORTED_BY_CALLBACK )
+                {
+                    submit( f->get() );
+                }
+                else
+                {
+                    shareResult( transfer.get(), f->get() );
+                    finish( f->get() );
+                }
+            }
+
+            finish( transfer.get() );
+        }
+
+        // identifies requests that would produce the same response.
+        static std::string getFlightKey( const HTTPTransfer* t )
+        {
+            std::string key = t->_url + '\n' + t->_userPassword + '\n' + t->_proxyAddr + '\n' + t->_proxyAuth;
+            if ( t->_hasStaleEntry )
+                key += '\n' + t->_cacheEntry._etag + '\n' + t->_cacheEntry._lastModified;
+            return key;
+        }
+
+        // stops treating a transfer as in flight, and hands back the transfers that were
+        // waiting on it. Call with the queue mutex held.
+        void detachFollowers( HTTPTransfer* leader, TransferVector& out_followers )
+        {
+            FlightMap::iterator f = _inFlight.find( leader->_flightKey );
+            if ( f != _inFlight.end() && f->second == leader )
+                _inFlight.erase( f );
+
+            out_followers.insert( out_followers.end(), leader->_followers.begin(), leader->_followers.end() );
+            leader->_followers.clear();
+        }
+
+        // takes a follower off its leader's list; false if it isn't waiting on one.
+        // Call with the queue mutex held.
+        bool detachFollower( HTTPTransfer* follower )
+        {
+            FlightMap::iterator f = _inFlight.find( follower->_flightKey );
+            if ( f == _inFlight.end() || f->second == follower )
+                return false;
+
+            TransferVector& followers = f->second->_followers;
+            for( TransferVector::iterator i = followers.begin(); i != followers.end(); ++i )
+            {
+                if ( i->get() == follower )
+                {
+                    followers.erase( i );
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // detaches followers whose own requests were canceled (e.g. asynchronous ones,
+        // which nobody is waiting on), so they don't wait out their leader's download.
+        // Call with the queue mutex held.
+        void detachCanceledFollowers( TransferList& out_canceled )
+        {
+            for( FlightMap::iterator f = _inFlight.begin(); f != _inFlight.end(); ++f )
+            {
+                TransferVector& followers = f->second->_followers;
+                for( TransferVector::iterator i = followers.begin(); i != followers.end(); )
+                {
+                    if ( (*i)->isCanceled() )
+                    {
+                        (*i)->_result = CURLE_ABORTED_BY_CALLBACK;
+                        out_canceled.push_back( i->get() );
+                        i = followers.erase( i );
+                    }
+                    else ++i;
+                }
+            }
+        }
+
+        // gives a waiting transfer its own copy of the leader's response.
+        void shareResult( const HTTPTransfer* leader, HTTPTransfer* follower )
+        {
+            follower->_result          = leader->_result;
+            follower->_responseCode    = leader->_responseCode;
+            follower->_contentType     = leader->_contentType;
+            follower->_responseHeaders = leader->_responseHeaders;
+            follower->_part->_stream.str( leader->_part->_stream.str() );
+            follower->_coalesced       = true;
+            _numCoalesced++;
+        }
+
+        void releaseHandle( HTTPTransfer* transfer )
+        {
+            if ( transfer->_handle )
+            {
+                Threading::ScopedMutexLock lock( _poolMutex );
+                _handlePool.push_back( transfer->_handle );
+                transfer->_handle = 0L;
+            }
+        }
+
+        // returns the transfer's handle to the pool and hands off the results.
+        void finish( HTTPTransfer* transfer )
+        {
+            releaseHandle( transfer );
+
+            if ( transfer->_responseCallback.valid() )
+                transfer->_responseCallback->onResponse( transfer->_request, transfer->createResponse() );
+            else
+                transfer->_done.set();
         }
 
-        std::ostream* _stream;
-        std::string     _resultMimeType;
+        static HTTPEngine                    s_engine;
+
+        CURLM*                               _multi;
+        bool                                 _done;
+        OpenThreads::Mutex                   _queueMutex;
+        OpenThreads::Condition               _queueCond;
+        TransferList                         _pending;
+        RunningMap                           _running;
+        std::map<std::string, unsigned int>  _hostCounts;
+        FlightMap                            _inFlight;
+        unsigned int                         _numCoalesced;
+        Threading::Mutex                     _poolMutex;
+        std::vector<CURL*>                   _handlePool;
+#ifdef OE_HTTP_WAKE_PIPE
+        int                                  _wakePipe[2];
+#endif
     };
 
-    static size_t
-    StreamObjectReadCallback(void* ptr, size_t size, size_t nmemb, void* data)
+    // Created eagerly, while the library loads: C++03 doesn't make the first call
+    // to a function-local static thread-safe (nor does MSVC before 2015).
+    HTTPEngine HTTPEngine::s_engine;
+}
+
+namespace
+{
+    // records download progress for an HTTPTransfer, and aborts it if canceled.
+    // Runs in the engine thread, so it must not call the ProgressCallback itself.
+    int s_progressCallback( void* clientp, double dltotal, double dlnow, double ultotal, double ulnow )
     {
-        size_t realsize = size* nmemb;
-        StreamObject* sp = (StreamObject*)data;
-        sp->write((const char*)ptr, realsize);
+        HTTPTransfer* transfer = (HTTPTransfer*)clientp;
+        transfer->_dlNow   = dlnow;
+        transfer->_dlTotal = dltotal;
+        return transfer->isCanceled() ? 1 : 0;
+    }
+
+    // collects response headers for an HTTPTransfer.
+    size_t s_headerCallback( void* ptr, size_t size, size_t nmemb, void* data )
+    {
+        size_t realsize = size * nmemb;
+        HTTPTransfer* transfer = (HTTPTransfer*)data;
+        transfer->addResponseHeader( std::string((const char*)ptr, realsize) );
         return realsize;
     }
-}
 
-static int CurlProgressCallback(void *clientp,double dltotal,double dlnow,double ultotal,double ulnow)
-{
-    ProgressCallback* callback = (ProgressCallback*)clientp;
-    bool cancelled = false;
-    if (callback)
+    // extracts the "host[:port]" portion of a URL, for per-host connection limits.
+    std::string s_getHost( const std::string& url )
     {
-        cancelled = callback->isCanceled() || callback->reportProgress(dlnow, dltotal);
+        std::string::size_type start = url.find( "://" );
+        start = start == std::string::npos ? 0 : start + 3;
+
+        std::string::size_type end = url.find_first_of( "/?#", start );
+        std::string host = url.substr( start, end == std::string::npos ? std::string::npos : end - start );
+
+        // strip any user:password@
+        std::string::size_type at = host.rfind( '@' );
+        if ( at != std::string::npos )
+            host = host.substr( at+1 );
+
+        return host;
     }
-    return cancelled;
 }
 
-/****************************************************************************/
+// All the per-connection state lives in the HTTPEngine, so a single client serves every thread.
+// Like the engine, it's created while the library loads rather than on first use.
+osg::ref_ptr<HTTPClient> HTTPClient::_client = new HTTPClient();
 
-HTTPRequest::HTTPRequest( const std::string& url )
-: _url( url )
+HTTPClient& HTTPClient::getClient()
 {
-    //NOP
+    return *_client.get();
 }
 
-HTTPRequest::HTTPRequest( const HTTPRequest& rhs ) :
-_parameters( rhs._parameters ),
-_url( rhs._url )
+HTTPClient::HTTPClient()
 {
     //nop
 }
 
-void
-HTTPRequest::addParameter( const std::string& name, const std::string& value )
+HTTPClient::~HTTPClient()
 {
-    _parameters[name] = value;
+    //nop
 }
 
 void
-HTTPRequest::addParameter( const std::string& name, int value )
+HTTPClient::setProxySettings( const ProxySettings &proxySettings )
 {
-    std::stringstream buf;
-    buf << value;
-	std::string bufStr;
-    bufStr = buf.str();
-    _parameters[name] = bufStr;
+	_proxySettings = proxySettings;
 }
 
-void
-HTTPRequest::addParameter( const std::string& name, double value )
+const std::string& HTTPClient::getUserAgent()
 {
-    std::stringstream buf;
-    buf << value;
-	std::string bufStr;
-    bufStr = buf.str();
-    _parameters[name] = bufStr;
+	return _userAgent;
 }
 
-const HTTPRequest::Parameters&
-HTTPRequest::getParameters() const
+void  HTTPClient::setUserAgent(const std::string& userAgent)
 {
-    return _parameters; 
+	_userAgent = userAgent;
 }
 
-std::string
-HTTPRequest::getURL() const
+void
+HTTPClient::setMaxConnectionsPerHost( unsigned int maxConnections )
 {
-    if ( _parameters.size() == 0 )
-    {
-        return _url;
-    }
-    else
-    {
-        std::stringstream buf;
-        buf << _url;
-        for( Parameters::const_iterator i = _parameters.begin(); i != _parameters.end(); i++ )
-        {
-            buf << ( i == _parameters.begin() && _url.find( "?" ) == std::string::npos? "?" : "&" );
-            buf << i->first << "=" << i->second;
-        }
-		std::string bufStr;
-		bufStr = buf.str();
-        return bufStr;
-    }
+    _maxConnectionsPerHost = maxConnections > 0 ? maxConnections : 1;
 }
 
-/****************************************************************************/
-
-HTTPResponse::HTTPResponse( long _code )
-: _response_code( _code ),
-  _cancelled(false)
+unsigned int
+HTTPClient::getMaxConnectionsPerHost()
 {
-    _parts.reserve(1);
+    return _maxConnectionsPerHost;
 }
 
-HTTPResponse::HTTPResponse( const HTTPResponse& rhs ) :
-_response_code( rhs._response_code ),
-_parts( rhs._parts ),
-_mimeType( rhs._mimeType ),
-_cancelled( rhs._cancelled )
+void
+HTTPClient::setResponseCachePath( const std::string& path )
 {
-    //nop
-}
-
-long
-HTTPResponse::getCode() const {
-    return _response_code;
-}
-
-bool
-HTTPResponse::isOK() const {
-    return _response_code == 200L && !isCancelled();
-}
-
-bool
-HTTPResponse::isCancelled() const {
-    return _cancelled;
-}
-
-unsigned int
-HTTPResponse::getNumParts() const {
-    return _parts.size();
-}
-
-unsigned int
-HTTPResponse::getPartSize( unsigned int n ) const {
-    return _parts[n]->_size;
-}
-
-const std::string&
-HTTPResponse::getPartHeader( unsigned int n, const std::string& name ) const {
-    return _parts[n]->_headers[name];
-}
-
-std::istream&
-HTTPResponse::getPartStream( unsigned int n ) const {
-    return _parts[n]->_stream;
+    HTTPResponseCache::instance().setPath( path );
 }
 
 std::string
-HTTPResponse::getPartAsString( unsigned int n ) const {
-	std::string streamStr;
-	streamStr = _parts[n]->_stream.str();
-    return streamStr;
-}
-
-const std::string&
-HTTPResponse::getMimeType() const {
-    return _mimeType;
-}
-
-/****************************************************************************/
-
-#define QUOTE_(X) #X
-#define QUOTE(X) QUOTE_(X)
-#define USER_AGENT "osgearth" QUOTE(OSGEARTH_MAJOR_VERSION) "." QUOTE(OSGEARTH_MINOR_VERSION)
-
-typedef std::map< OpenThreads::Thread*, osg::ref_ptr<HTTPClient> >    ThreadClientMap;        
-static Threading::ReadWriteMutex   _threadClientMapMutex;
-static ThreadClientMap             _threadClientMap;
-static optional<ProxySettings>     _proxySettings;
-static std::string                 _userAgent = USER_AGENT;
-
-HTTPClient& HTTPClient::getClient()
-{
-    OpenThreads::Thread* current = OpenThreads::Thread::CurrentThread();
-
-    // first try the map:
-    {
-        Threading::ScopedReadLock sharedLock(_threadClientMapMutex);
-        ThreadClientMap::iterator i = _threadClientMap.find(current);
-        if ( i != _threadClientMap.end() )
-            return *i->second.get();
-    }
-
-    // not there; add it.
-    {
-        Threading::ScopedWriteLock exclusiveLock(_threadClientMapMutex);
-
-        // normally, we'd double check b/c of the race condition, but since the map is being 
-        // indexed by the actual thread pointer, there's no chance of a race.
-        HTTPClient* client = new HTTPClient();
-        _threadClientMap[current] = client;
-        return *client;
-    }
-}
-
-HTTPClient::HTTPClient()
+HTTPClient::getResponseCachePath()
 {
-    _previousHttpAuthentication = 0;
-    _curl_handle = curl_easy_init();
-
-
-	//Get the user agent
-	std::string userAgent = _userAgent;
-	const char* userAgentEnv = getenv("OSGEARTH_USERAGENT");
-    if (userAgentEnv)
-    {
-		userAgent = std::string(userAgentEnv);        
-    }
-
-	OE_DEBUG << LC << "HTTPClient setting userAgent=" << userAgent << std::endl;
-
-    curl_easy_setopt( _curl_handle, CURLOPT_USERAGENT, userAgent.c_str() );
-    curl_easy_setopt( _curl_handle, CURLOPT_WRITEFUNCTION, osgEarth::StreamObjectReadCallback );
-    curl_easy_setopt( _curl_handle, CURLOPT_FOLLOWLOCATION, (void*)1 );
-    curl_easy_setopt( _curl_handle, CURLOPT_MAXREDIRS, (void*)5 );
-    curl_easy_setopt( _curl_handle, CURLOPT_PROGRESSFUNCTION, &CurlProgressCallback);
-    curl_easy_setopt( _curl_handle, CURLOPT_NOPROGRESS, (void*)0 ); //FALSE);
-    //curl_easy_setopt( _curl_handle, CURLOPT_TIMEOUT, 1L );
+    return HTTPResponseCache::instance().getPath();
 }
 
-HTTPClient::~HTTPClient()
+void
+HTTPClient::setResponseCacheMaxSize( unsigned int megabytes )
 {
-    if (_curl_handle) curl_easy_cleanup( _curl_handle );
-    _curl_handle = 0;
+    HTTPResponseCache::instance().setMaxSizeMB( megabytes );
 }
 
-void
-HTTPClient::setProxySettings( const ProxySettings &proxySettings )
+unsigned int
+HTTPClient::getResponseCacheMaxSize()
 {
-	_proxySettings = proxySettings;
+    return HTTPResponseCache::instance().getMaxSizeMB();
 }
 
-const std::string& HTTPClient::getUserAgent()
+unsigned int
+HTTPClient::getNumCoalescedRequests()
 {
-	return _userAgent;
+    return HTTPEngine::instance().getNumCoalesced();
 }
 
-void  HTTPClient::setUserAgent(const std::string& userAgent)
+HTTPClient::ResponseCacheStats
+HTTPClient::getResponseCacheStats()
 {
-	_userAgent = userAgent;
+    return HTTPResponseCache::instance().getStats();
 }
 
 void
@@ -382,7 +1625,7 @@ tokenize_str(const std::string & str, const std::string & delims=", \t")
 void
 HTTPClient::decodeMultipartStream(const std::string&   boundary,
                                   HTTPResponse::Part*  input,
-                                  HTTPResponse::Parts& output) const
+                                  HTTPResponse::Parts& output)
 {
     std::string bstr = std::string("--") + boundary;
     std::string line;
@@ -480,6 +1723,25 @@ HTTPClient::get( const std::string &url,
     return getClient().doGet( url, options, callback);
 }
 
+void
+HTTPClient::getAsync(const HTTPRequest& request,
+                     ResponseCallback* responseCallback,
+                     const osgDB::ReaderWriter::Options* options,
+                     ProgressCallback* callback)
+{
+    osg::ref_ptr<HTTPTransfer> transfer = getClient().createTransfer( request, options, callback );
+    if ( transfer->_fromCache )
+    {
+        if ( responseCallback )
+            responseCallback->onResponse( request, transfer->createResponse() );
+    }
+    else
+    {
+        transfer->_responseCallback = responseCallback;
+        HTTPEngine::instance().submit( transfer.get() );
+    }
+}
+
 HTTPClient::ResultCode
 HTTPClient::readImageFile(const std::string &filename,
                           osg::ref_ptr<osg::Image>& output,
@@ -511,6 +1773,36 @@ HTTPClient::doGet( const HTTPRequest& request, const osgDB::ReaderWriter::Option
 {
     OE_DEBUG << LC << "doGet " << request.getURL() << std::endl;
 
+    osg::ref_ptr<HTTPTransfer> transfer = createTransfer( request, options, callback );
+
+    if ( !transfer->_fromCache )
+    {
+        HTTPEngine::instance().submit( transfer.get() );
+
+        // curl reports progress in the engine thread. Pass it on to the callback from
+        // this thread, which is where callers expect it (and where it used to run).
+        while( !transfer->_done.wait( 100 ) )
+        {
+            if ( callback && !transfer->_abort &&
+                 (callback->isCanceled() || callback->reportProgress(transfer->_dlNow, transfer->_dlTotal)) )
+            {
+                HTTPEngine::instance().cancel( transfer.get() );
+            }
+        }
+    }
+
+	OE_DEBUG << LC << "got response, code = " << transfer->_responseCode << std::endl;
+
+    return transfer->createResponse();
+}
+
+HTTPTransfer*
+HTTPClient::createTransfer( const HTTPRequest& request, const osgDB::ReaderWriter::Options* options, ProgressCallback* callback) const
+{
+    HTTPTransfer* transfer = new HTTPTransfer( request );
+    transfer->_host     = s_getHost( transfer->_url );
+    transfer->_progress = callback;
+
     const osgDB::AuthenticationMap* authenticationMap = (options && options->getAuthenticationMap()) ? 
             options->getAuthenticationMap() :
             osgDB::Registry::instance()->getAuthenticationMap();
@@ -558,112 +1850,119 @@ HTTPClient::doGet( const HTTPRequest& request, const osgDB::ReaderWriter::Option
 		proxy_auth = std::string(proxyEnvAuth);
 	}
 
+	//Get the user agent
+	std::string userAgent = _userAgent;
+	const char* userAgentEnv = getenv("OSGEARTH_USERAGENT");
+    if (userAgentEnv)
+    {
+		userAgent = std::string(userAgentEnv);        
+    }
+
+    const osgDB::AuthenticationDetails* details = authenticationMap ?
+        authenticationMap->getAuthenticationDetails(request.getURL()) :
+        0;
+
+    // The response cache is shared and keyed by URL alone, so requests that carry
+    // credentials (for the server or a proxy) neither use nor feed it. Otherwise
+    // there's nothing to download if there's a fresh copy in the cache.
+    bool credentialed = details != 0L || (!proxy_host.empty() && !proxy_auth.empty());
+    if ( !credentialed && transfer->checkCache() )
+        return transfer;
+
+    // Handles come out of the pool reset to defaults, so set everything every time.
+    CURL* handle = HTTPEngine::instance().acquireHandle();
+    transfer->_handle = handle;
+
+    curl_easy_setopt( handle, CURLOPT_USERAGENT, userAgent.c_str() );
+    curl_easy_setopt( handle, CURLOPT_WRITEFUNCTION, osgEarth::StreamObjectReadCallback );
+    curl_easy_setopt( handle, CURLOPT_WRITEDATA, (void*)&transfer->_sp );
+    curl_easy_setopt( handle, CURLOPT_FOLLOWLOCATION, 1L );
+    curl_easy_setopt( handle, CURLOPT_MAXREDIRS, 5L );
+    curl_easy_setopt( handle, CURLOPT_PROGRESSFUNCTION, &s_progressCallback );
+    curl_easy_setopt( handle, CURLOPT_NOPROGRESS, 0L );
+    curl_easy_setopt( handle, CURLOPT_PROGRESSDATA, (void*)transfer );
+    curl_easy_setopt( handle, CURLOPT_ERRORBUFFER, (void*)transfer->_errorBuf );
+    curl_easy_setopt( handle, CURLOPT_NOSIGNAL, 1L );
+    curl_easy_setopt( handle, CURLOPT_URL, transfer->_url.c_str() );
+
+    if ( transfer->_useCache )
+    {
+        // collect the response headers that control caching, and revalidate a stale copy if we have one.
+        curl_easy_setopt( handle, CURLOPT_HEADERFUNCTION, s_headerCallback );
+        curl_easy_setopt( handle, CURLOPT_WRITEHEADER, (void*)transfer );
+        if ( transfer->_requestHeaders )
+            curl_easy_setopt( handle, CURLOPT_HTTPHEADER, transfer->_requestHeaders );
+    }
+
+#if LIBCURL_VERSION_NUM >= 0x071900
+    curl_easy_setopt( handle, CURLOPT_TCP_KEEPALIVE, 1L );
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    // use HTTP/2 where the server offers it over TLS, and wait for a connection
+    // that can be multiplexed rather than opening a new one.
+    curl_easy_setopt( handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS );
+    curl_easy_setopt( handle, CURLOPT_PIPEWAIT, 1L );
+#endif
+
     // Set up proxy server:
-    std::string proxy_addr;
     if ( !proxy_host.empty() )
     {
         std::stringstream buf;
         buf << proxy_host << ":" << proxy_port;
-		std::string bufStr;
-		bufStr = buf.str();
-        proxy_addr = bufStr;
+        transfer->_proxyAddr = buf.str();
     
-        OE_DEBUG << LC << "setting proxy: " << proxy_addr << std::endl;
-		//curl_easy_setopt( _curl_handle, CURLOPT_HTTPPROXYTUNNEL, 1 ); 
-        curl_easy_setopt( _curl_handle, CURLOPT_PROXY, proxy_addr.c_str() );
+        OE_DEBUG << LC << "setting proxy: " << transfer->_proxyAddr << std::endl;
+		//curl_easy_setopt( handle, CURLOPT_HTTPPROXYTUNNEL, 1 ); 
+        curl_easy_setopt( handle, CURLOPT_PROXY, transfer->_proxyAddr.c_str() );
 
 		//Setup the proxy authentication if setup
 		if (!proxy_auth.empty())
 		{
 			OE_DEBUG << LC << "Setting up proxy authentication " << proxy_auth << std::endl;
-			curl_easy_setopt( _curl_handle, CURLOPT_PROXYUSERPWD, proxy_auth.c_str());
+            transfer->_proxyAuth = proxy_auth;
+			curl_easy_setopt( handle, CURLOPT_PROXYUSERPWD, transfer->_proxyAuth.c_str());
 		}
     }
 
-    const osgDB::AuthenticationDetails* details = authenticationMap ?
-        authenticationMap->getAuthenticationDetails(request.getURL()) :
-        0;
-
-        if (details)
-        {
-            const std::string colon(":");
-            std::string password(details->username + colon + details->password);
-            curl_easy_setopt(_curl_handle, CURLOPT_USERPWD, password.c_str());
-            const_cast<HTTPClient*>(this)->_previousPassword = password;
-
-            // use for https.
-            // curl_easy_setopt(_curl, CURLOPT_KEYPASSWD, password.c_str());
-
-#if LIBCURL_VERSION_NUM >= 0x070a07
-            if (details->httpAuthentication != _previousHttpAuthentication)
-            { 
-                curl_easy_setopt(_curl_handle, CURLOPT_HTTPAUTH, details->httpAuthentication); 
-                const_cast<HTTPClient*>(this)->_previousHttpAuthentication = details->httpAuthentication;
-            }
-#endif
-    }
-    else
+    if (details)
     {
-        if (!_previousPassword.empty())
-        {
-            curl_easy_setopt(_curl_handle, CURLOPT_USERPWD, 0);
-            const_cast<HTTPClient*>(this)->_previousPassword.clear();
-        }
+        const std::string colon(":");
+        transfer->_userPassword = details->username + colon + details->password;
+        curl_easy_setopt(handle, CURLOPT_USERPWD, transfer->_userPassword.c_str());
+
+        // use for https.
+        // curl_easy_setopt(_curl, CURLOPT_KEYPASSWD, password.c_str());
 
 #if LIBCURL_VERSION_NUM >= 0x070a07
-        // need to reset if previously set.
-        if (_previousHttpAuthentication!=0)
-        {
-            curl_easy_setopt(_curl_handle, CURLOPT_HTTPAUTH, 0); 
-            const_cast<HTTPClient*>(this)->_previousHttpAuthentication = 0;
+        if (details->httpAuthentication != 0)
+        { 
+            curl_easy_setopt(handle, CURLOPT_HTTPAUTH, details->httpAuthentication); 
         }
 #endif
     }
 
-    osg::ref_ptr<HTTPResponse::Part> part = new HTTPResponse::Part();
-    StreamObject sp( &part->_stream );
-
-    //Take a temporary ref to the callback
-    osg::ref_ptr<ProgressCallback> progressCallback = callback;
-    curl_easy_setopt( _curl_handle, CURLOPT_URL, request.getURL().c_str() );
-    if (callback)
-    {
-        curl_easy_setopt(_curl_handle, CURLOPT_PROGRESSDATA, progressCallback.get());
-    }
-
-    char errorBuf[CURL_ERROR_SIZE];
-    errorBuf[0] = 0;
-    curl_easy_setopt( _curl_handle, CURLOPT_ERRORBUFFER, (void*)errorBuf );
-
-    curl_easy_setopt( _curl_handle, CURLOPT_WRITEDATA, (void*)&sp);
-    CURLcode res = curl_easy_perform( _curl_handle );
-    curl_easy_setopt( _curl_handle, CURLOPT_WRITEDATA, (void*)0 );
-    curl_easy_setopt( _curl_handle, CURLOPT_PROGRESSDATA, (void*)0);
-
-    long response_code = 0L;
-	if (!proxy_addr.empty())
-	{
-		long connect_code = 0L;
-        curl_easy_getinfo( _curl_handle, CURLINFO_HTTP_CONNECTCODE, &connect_code );
-		OE_DEBUG << LC << "proxy connect code " << connect_code << std::endl;
-	}
-	
-    curl_easy_getinfo( _curl_handle, CURLINFO_RESPONSE_CODE, &response_code );     
+    return transfer;
+}
 
-	OE_DEBUG << LC << "got response, code = " << response_code << std::endl;
+HTTPResponse
+HTTPClient::createResponse(const std::string&  url,
+                           int                 curlResult,
+                           long                response_code,
+                           const std::string&  contentType,
+                           HTTPResponse::Part* part)
+{
+    CURLcode res = (CURLcode)curlResult;
 
     HTTPResponse response( response_code );
    
     if ( response_code == 200L && res != CURLE_ABORTED_BY_CALLBACK && res != CURLE_OPERATION_TIMEDOUT ) //res == 0 )
     {
         // check for multipart content:
-        char* content_type_cp;
-        curl_easy_getinfo( _curl_handle, CURLINFO_CONTENT_TYPE, &content_type_cp );
-        if ( content_type_cp == NULL )
+        if ( contentType.empty() )
         {
             OE_NOTICE << LC
                 << "NULL Content-Type (protocol violation) " 
-                << "URL=" << request.getURL() << std::endl;
+                << "URL=" << url << std::endl;
             return NULL;
         }
 
@@ -671,19 +1970,18 @@ HTTPClient::doGet( const HTTPRequest& request, const osgDB::ReaderWriter::Option
         //   WCS 1.1 specified a "multipart/mixed" response, but ArcGIS Server gives a "multipart/related"
         //   content type ...
 
-        std::string content_type( content_type_cp );
-        //OE_NOTICE << "[osgEarth.HTTPClient] content-type = \"" << content_type << "\"" << std::endl;
-        if ( content_type.length() > 9 && ::strstr( content_type.c_str(), "multipart" ) == content_type.c_str() )
-        //if ( content_type == "multipart/mixed; boundary=wcs" ) //todo: parse this.
+        //OE_NOTICE << "[osgEarth.HTTPClient] content-type = \"" << contentType << "\"" << std::endl;
+        if ( contentType.length() > 9 && ::strstr( contentType.c_str(), "multipart" ) == contentType.c_str() )
+        //if ( contentType == "multipart/mixed; boundary=wcs" ) //todo: parse this.
         {
             //OE_NOTICE << "[osgEarth.HTTPClient] detected multipart data; decoding..." << std::endl;
             //TODO: parse out the "wcs" -- this is WCS-specific
-            decodeMultipartStream( "wcs", part.get(), response._parts );
+            decodeMultipartStream( "wcs", part, response._parts );
         }
         else
         {
             //OE_NOTICE << "[osgEarth.HTTPClient] detected single part data" << std::endl;
-            response._parts.push_back( part.get() );
+            response._parts.push_back( part );
         }
     }
     else if (res == CURLE_ABORTED_BY_CALLBACK || res == CURLE_OPERATION_TIMEDOUT)
@@ -691,31 +1989,9 @@ HTTPClient::doGet( const HTTPRequest& request, const osgDB::ReaderWriter::Option
         //If we were aborted by a callback, then it was cancelled by a user
         response._cancelled = true;
     }
-    else
-    {        
-        //if ( callback )
-        //{
-        //    if ( errorBuf[0] ) {
-        //        callback->message() = errorBuf;
-        //    }
-        //    else {
-        //        std::stringstream buf;
-        //        buf << "HTTP Code " << response.getCode();
-        //        callback->message() = buf.str();
-        //    }
-        //}
-        //else {
-        //    OE_NOTICE << "[osgEarth] [HTTP] error, code = " << code << std::endl;
-        //}
-    }
 
-    // Store the mime-type, if any. (Note: CURL manages the buffer returned by
-    // this call.)
-    char* ctbuf = NULL;
-    if ( curl_easy_getinfo(_curl_handle, CURLINFO_CONTENT_TYPE, &ctbuf) == 0 && ctbuf )
-    {
-        response._mimeType = ctbuf;
-    }
+    // Store the mime-type, if any.
+    response._mimeType = contentType;
 
     return response;
 }
@@ -804,6 +2080,11 @@ HTTPClient::doReadImageFile(const std::string& filename,
                 if ( rr.validImage() )
                 {
                     output = rr.takeImage();
+
+                    // keep the original bytes so a cache can store them instead of re-encoding.
+                    std::string encoded = response.getPartAsString(0);
+                    if ( !ImageUtils::getEncodedFormat(encoded.data(), encoded.size()).empty() )
+                        ImageUtils::setEncodedData( output.get(), encoded );
                 }
                 else 
                 {
@@ -56,6 +56,8 @@ ImageLayerOptions::setDefaults()
     _minRange.init( -FLT_MAX );
     _maxRange.init( FLT_MAX );
     _lodBlending.init( false );
+    _reprojectionThreads.init( 1 );
+    _mosaicThreads.init( 1 );
 }
 
 void
@@ -74,6 +76,8 @@ ImageLayerOptions::fromConfig( const Config& conf )
     conf.getIfSet( "min_range", _minRange );
     conf.getIfSet( "max_range", _maxRange );
     conf.getIfSet( "lod_blending", _lodBlending );
+    conf.getIfSet( "reprojection_threads", _reprojectionThreads );
+    conf.getIfSet( "mosaic_threads", _mosaicThreads );
 
     if ( conf.hasValue( "transparent_color" ) )
         _transparentColor = stringToColor( conf.value( "transparent_color" ), osg::Vec4ub(0,0,0,0));
@@ -103,6 +107,8 @@ ImageLayerOptions::getConfig() const
     conf.updateIfSet( "min_range", _minRange );
     conf.updateIfSet( "max_range", _maxRange );
     conf.updateIfSet( "lod_blending", _lodBlending );
+    conf.updateIfSet( "reprojection_threads", _reprojectionThreads );
+    conf.updateIfSet( "mosaic_threads", _mosaicThreads );
 
 	if (_transparentColor.isSet())
         conf.update("transparent_color", colorToString( _transparentColor.value()));
@@ -138,6 +144,19 @@ namespace
         ImageLayerTileProcessor _processor;
     };
     
+    // Returns a normalized version of an image that may be shared with a cache or with
+    // other requests for the same tile. The image itself is returned (still shared and
+    // read-only) if it is already normalized; otherwise it is copied first if shared.
+    osg::Image* s_normalized( const osg::Image* image )
+    {
+        if ( ImageUtils::isNormalized(image) )
+            return const_cast<osg::Image*>( image );
+
+        osg::Image* result = ImageUtils::cloneIfShared( image );
+        ImageUtils::normalizeImage( result );
+        return result;
+    }
+
     struct ApplyChromaKey
     {
         osg::Vec4f _chromaKey;
@@ -216,6 +235,9 @@ ImageLayerTileProcessor::process( osg::ref_ptr<osg::Image>& image ) const
             image = ImageUtils::convertToRGBA8( image.get() );
         }           
 
+        // the source may have handed out an image it shares with its memory cache.
+        image = ImageUtils::cloneIfShared( image.get() );
+
         ImageUtils::PixelVisitor<ApplyChromaKey> applyChroma;
         applyChroma._chromaKey = _chromaKey;
         applyChroma.accept( image.get() );
@@ -224,7 +246,11 @@ ImageLayerTileProcessor::process( osg::ref_ptr<osg::Image>& image ) const
     // protected against multi threaded access. This is a requirement in sequential/preemptive mode, 
     // for example. This used to be in TextureCompositorTexArray::prepareImage.
     // TODO: review whether this affects performance.    
-    image->setDataVariance( osg::Object::DYNAMIC );
+    if ( image->getDataVariance() != osg::Object::DYNAMIC )
+    {
+        image = ImageUtils::cloneIfShared( image.get() );
+        image->setDataVariance( osg::Object::DYNAMIC );
+    }
 }
 
 //------------------------------------------------------------------------
@@ -406,8 +432,8 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
 		{
 			OE_DEBUG << LC << "Layer \"" << getName()<< "\" got tile " << key.str() << " from map cache " << std::endl;
 
-            result = GeoImage( ImageUtils::cloneImage(cachedImage.get()), key.getExtent() );
-            ImageUtils::normalizeImage( result.getImage() );
+            // no need to copy unless it has to change; the cached image is shared read-only.
+            result = GeoImage( s_normalized(cachedImage.get()), key.getExtent() );
             return result;
 		}
 	}
@@ -451,6 +477,10 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
 			osg::ref_ptr<ImageMosaic> mi = new ImageMosaic;
 			std::vector<TileKey> missingTiles;
 
+            // fetch all the intersecting tiles (possibly in parallel):
+            std::vector< osg::ref_ptr<osg::Image> > images;
+            fetchMosaicTiles( intersectingTiles, cacheInLayerProfile, progress, images );
+
             bool retry = false;
 			for (unsigned int j = 0; j < intersectingTiles.size(); ++j)
 			{
@@ -459,19 +489,10 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
 
 				OE_DEBUG << LC << "\t Intersecting Tile " << j << ": " << minX << ", " << minY << ", " << maxX << ", " << maxY << std::endl;
 
-				osg::ref_ptr<osg::Image> img;
-                img = createImageWrapper( intersectingTiles[j], cacheInLayerProfile, progress );
+				osg::ref_ptr<osg::Image> img = images[j];
 
                 if ( img.valid() )
                 {
-                    if (img->getPixelFormat() != GL_RGBA || img->getDataType() != GL_UNSIGNED_BYTE || img->getInternalTextureFormat() != GL_RGBA8 )
-					{
-                        osg::ref_ptr<osg::Image> convertedImg = ImageUtils::convertToRGBA8(img.get());
-                        if (convertedImg.valid())
-                        {
-                            img = convertedImg;
-                        }
-					}
 					mi->getImages().push_back(TileImage(img.get(), intersectingTiles[j]));
 				}
 				else
@@ -583,7 +604,8 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
                 result = mosaic.reproject( 
                     key.getProfile()->getSRS(),
                     &key.getExtent(), 
-                    _options.reprojectedTileSize().value(), _options.reprojectedTileSize().value() );
+                    _options.reprojectedTileSize().value(), _options.reprojectedTileSize().value(),
+                    _options.reprojectionThreads().value() );
             }
             else
             {
@@ -607,10 +629,11 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
         }
     }
 
-    // Normalize the image if necessary
-    if ( result.valid() )
+    // Normalize the image if necessary. It may be shared with a cache or with other
+    // requests for the same tile (single-tile case), so never change it in place.
+    if ( result.valid() && !ImageUtils::isNormalized(result.getImage()) )
     {
-        ImageUtils::normalizeImage( result.getImage() );
+        result = GeoImage( s_normalized(result.getImage()), result.getExtent() );
     }
 
 	//If we got a result, the cache is valid and we are caching in the map profile, write to the map cache.
@@ -619,6 +642,13 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
 		OE_DEBUG << LC << "Layer \"" << getName() << "\" writing tile " << key.str() << " to cache " << std::endl;
 		_cache->setImage( key, _cacheSpec, result.getImage());
 	}
+
+    // no more cache writes for this tile, so let go of any encoded bytes recorded
+    // for it rather than keeping them alive alongside the scene's texture.
+    if ( result.valid() )
+    {
+        ImageUtils::releaseEncodedData( result.getImage() );
+    }
     return result;
 }
 
@@ -645,7 +675,10 @@ ImageLayer::createImageWrapper(const TileKey& key,
 		if ( _cache->getImage( key, _cacheSpec, cachedImage ) )
 	    {
             OE_INFO << LC << " Layer \"" << getName() << "\" got " << key.str() << " from cache " << std::endl;
-            return ImageUtils::cloneImage(cachedImage.get());
+
+            // shared read-only; createImage() and the mosaic only ever read it, and
+            // anything that modifies it must go through ImageUtils::cloneIfShared.
+            return const_cast<osg::Image*>( cachedImage.release() );
     	}
     }
 
@@ -695,7 +728,121 @@ ImageLayer::createImageWrapper(const TileKey& key,
 		{
 			_cache->setImage( key, _cacheSpec, result );
 		}
+
+        // this was the last cache write for the tile; see createImage().
+        if ( result && cacheInLayerProfile )
+        {
+            ImageUtils::releaseEncodedData( result );
+        }
 	}
 
     return result;
 }
+
+//------------------------------------------------------------------------
+
+namespace osgEarth
+{
+    /**
+     * Fetches one source tile for a mosaic and converts it to RGBA8.
+     */
+    struct FetchMosaicTile
+    {
+        void init( ImageLayer* layer, const TileKey& key, bool cacheInLayerProfile, ProgressCallback* progress )
+        {
+            _layer = layer;
+            _key = key;
+            _cacheInLayerProfile = cacheInLayerProfile;
+            _progress = progress;
+        }
+
+        void execute()
+        {
+            // don't bother if another fetch has already canceled the request.
+            if ( _progress && (_progress->isCanceled() || _progress->needsRetry()) )
+                return;
+
+            _image = _layer->createImageWrapper( _key, _cacheInLayerProfile, _progress );
+
+            if ( _image.valid() &&
+                (_image->getPixelFormat() != GL_RGBA || _image->getDataType() != GL_UNSIGNED_BYTE || _image->getInternalTextureFormat() != GL_RGBA8) )
+            {
+                osg::ref_ptr<osg::Image> convertedImg = ImageUtils::convertToRGBA8( _image.get() );
+                if ( convertedImg.valid() )
+                {
+                    _image = convertedImg;
+                }
+            }
+        }
+
+        ImageLayer*              _layer;
+        TileKey                  _key;
+        bool                     _cacheInLayerProfile;
+        ProgressCallback*        _progress;
+        osg::ref_ptr<osg::Image> _image;
+    };
+}
+
+TaskService*
+ImageLayer::getMosaicService()
+{
+    Threading::ScopedMutexLock lock( _mosaicServiceMutex );
+    if ( !_mosaicService.valid() )
+    {
+        _mosaicService = new TaskService( "ImageLayer mosaic " + getName(), _options.mosaicThreads().value() );
+    }
+    return _mosaicService.get();
+}
+
+void
+ImageLayer::fetchMosaicTiles(const std::vector<TileKey>& keys,
+                             bool cacheInLayerProfile,
+                             ProgressCallback* progress,
+                             std::vector< osg::ref_ptr<osg::Image> >& out_images )
+{
+    out_images.resize( keys.size() );
+
+    if ( _options.mosaicThreads().value() <= 1 || keys.size() <= 1 )
+    {
+        for( unsigned int j = 0; j < keys.size(); ++j )
+        {
+            FetchMosaicTile fetch;
+            fetch.init( this, keys[j], cacheInLayerProfile, progress );
+            fetch.execute();
+            out_images[j] = fetch._image.get();
+
+            // stop at the first failure if the request was canceled.
+            if ( !out_images[j].valid() && progress && (progress->isCanceled() || progress->needsRetry()) )
+                break;
+        }
+    }
+    else
+    {
+        // hand all but the first tile to the pool and fetch the first one here.
+        TaskService* service = getMosaicService();
+        Threading::MultiEvent semaphore( keys.size()-1 );
+
+        std::vector< osg::ref_ptr< ParallelTask<FetchMosaicTile> > > tasks;
+        tasks.reserve( keys.size()-1 );
+
+        for( unsigned int j = 1; j < keys.size(); ++j )
+        {
+            ParallelTask<FetchMosaicTile>* task = new ParallelTask<FetchMosaicTile>( &semaphore );
+            task->init( this, keys[j], cacheInLayerProfile, progress );
+            tasks.push_back( task );
+            service->add( task );
+        }
+
+        FetchMosaicTile first;
+        first.init( this, keys[0], cacheInLayerProfile, progress );
+        first.execute();
+        out_images[0] = first._image.get();
+
+        semaphore.wait();
+
+        for( unsigned int j = 1; j < keys.size(); ++j )
+        {
+            out_images[j] = tasks[j-1]->_image.get();
+        }
+    }
+}
@@ -23,13 +23,151 @@
 #include <osg/ImageSequence>
 #include <osg/Timer>
 #include <osgDB/Registry>
+#include <osgDB/FileNameUtils>
+#include <osg/Observer>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
 #include <string.h>
 #include <memory.h>
+#include <vector>
+#include <list>
+#include <map>
 
 #define LC "[ImageUtils] "
 
 using namespace osgEarth;
 
+//------------------------------------------------------------------------
+
+// Fast paths for 8-bit-per-channel images. The generic PixelReader/PixelWriter go
+// through a function pointer and a float Vec4 per pixel; these kernels work on raw
+// bytes, a row at a time.
+namespace
+{
+    // Number of 8-bit channels in the image, or 0 if it's not a simple byte format.
+    int s_getByteChannels( const osg::Image* image )
+    {
+        if ( !image || !image->data() || image->getDataType() != GL_UNSIGNED_BYTE )
+            return 0;
+
+        switch( image->getPixelFormat() )
+        {
+        case GL_LUMINANCE:
+        case GL_ALPHA:
+            return 1;
+        case GL_LUMINANCE_ALPHA:
+            return 2;
+        case GL_RGB:
+        case GL_BGR:
+            return 3;
+        case GL_RGBA:
+        case GL_BGRA:
+            return 4;
+        default:
+            return 0;
+        }
+    }
+
+    // Like s_getByteChannels, but only for formats that convert into each other by
+    // channel count alone (L, LA, RGB, RGBA).
+    int s_getConvertibleChannels( const osg::Image* image )
+    {
+        GLenum pf = image ? image->getPixelFormat() : 0;
+        return pf == GL_ALPHA || pf == GL_BGR || pf == GL_BGRA ? 0 : s_getByteChannels( image );
+    }
+
+    unsigned int s_getRowBytes( const osg::Image* image, int s )
+    {
+        return osg::Image::computeRowWidthInBytes( s, image->getPixelFormat(), image->getDataType(), image->getPacking() );
+    }
+
+    // Converts one row of pixels from an N-channel to an M-channel layout, using the
+    // same expansion rules as PixelReader (L -> LLL1, RGB -> RGB1 ...).
+    template<int N, int M>
+    void s_convertRow( const unsigned char* src, unsigned char* dst, int count )
+    {
+        for( int i=0; i<count; ++i, src += N, dst += M )
+        {
+            unsigned char c[4];
+            if      ( N == 1 ) { c[0] = c[1] = c[2] = src[0]; c[3] = 255; }
+            else if ( N == 2 ) { c[0] = c[1] = c[2] = src[0]; c[3] = src[1]; }
+            else if ( N == 3 ) { c[0] = src[0]; c[1] = src[1]; c[2] = src[2]; c[3] = 255; }
+            else               { c[0] = src[0]; c[1] = src[1]; c[2] = src[2]; c[3] = src[3]; }
+
+            if      ( M == 1 ) { dst[0] = c[0]; }
+            else if ( M == 2 ) { dst[0] = c[0]; dst[1] = c[3]; }
+            else if ( M == 3 ) { dst[0] = c[0]; dst[1] = c[1]; dst[2] = c[2]; }
+            else               { dst[0] = c[0]; dst[1] = c[1]; dst[2] = c[2]; dst[3] = c[3]; }
+        }
+    }
+
+    typedef void (*RowConverter)( const unsigned char* src, unsigned char* dst, int count );
+
+    // Gets the row converter between two images, or NULL if there's no fast path.
+    RowConverter s_getRowConverter( const osg::Image* src, const osg::Image* dst )
+    {
+        static RowConverter s_converters[4][4] = {
+            { &s_convertRow<1,1>, &s_convertRow<1,2>, &s_convertRow<1,3>, &s_convertRow<1,4> },
+            { &s_convertRow<2,1>, &s_convertRow<2,2>, &s_convertRow<2,3>, &s_convertRow<2,4> },
+            { &s_convertRow<3,1>, &s_convertRow<3,2>, &s_convertRow<3,3>, &s_convertRow<3,4> },
+            { &s_convertRow<4,1>, &s_convertRow<4,2>, &s_convertRow<4,3>, &s_convertRow<4,4> } };
+
+        int n = s_getConvertibleChannels( src );
+        int m = s_getConvertibleChannels( dst );
+        return n > 0 && m > 0 ? s_converters[n-1][m-1] : 0L;
+    }
+
+    // Source row or column for a nearest-neighbor resample. Uses the same float math
+    // as the generic path in resizeImage() so both pick the same pixels.
+    inline int s_nearestIndex( int out_i, int out_n, int in_n )
+    {
+        int i = (int)( ((float)out_i/(float)out_n) * (float)in_n );
+        return i >= in_n ? in_n-1 : i;
+    }
+
+    // Nearest-neighbor resample of N-channel byte data. Source columns are looked up
+    // once per image instead of once per pixel.
+    template<int N>
+    void s_resizeNearest(const unsigned char* src, int in_s, int in_t, unsigned int srcRowBytes,
+                         unsigned char* dst, int out_s, int out_t, unsigned int dstRowBytes )
+    {
+        std::vector<unsigned int> cols( out_s );
+        for( int c=0; c<out_s; ++c )
+            cols[c] = N * (unsigned int)s_nearestIndex( c, out_s, in_s );
+
+        for( int r=0; r<out_t; ++r )
+        {
+            int in_row = s_nearestIndex( r, out_t, in_t );
+            const unsigned char* in  = src + in_row * srcRowBytes;
+            unsigned char*       out = dst + r * dstRowBytes;
+
+            for( int c=0; c<out_s; ++c, out += N )
+            {
+                const unsigned char* p = in + cols[c];
+                for( int k=0; k<N; ++k )
+                    out[k] = p[k];
+            }
+        }
+    }
+
+    // Blends an N-channel (3 or 4) byte row into an M-channel one, the same way as
+    // the MixImage functor: dest.rgb = lerp(dest.rgb, src.rgb, a * src.a).
+    template<int N, int M>
+    void s_mixRow( const unsigned char* src, unsigned char* dst, int count, unsigned int a )
+    {
+        for( int i=0; i<count; ++i, src += N, dst += M )
+        {
+            unsigned int sa = N == 4 ? (a * src[3] + 127u) / 255u : a;
+            unsigned int da = 255u - sa;
+            dst[0] = (unsigned char)( (dst[0] * da + src[0] * sa + 127u) / 255u );
+            dst[1] = (unsigned char)( (dst[1] * da + src[1] * sa + 127u) / 255u );
+            dst[2] = (unsigned char)( (dst[2] * da + src[2] * sa + 127u) / 255u );
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+
 osg::Image*
 ImageUtils::cloneImage( const osg::Image* input )
 {
@@ -45,6 +183,19 @@ ImageUtils::cloneImage( const osg::Image* input )
     return clone;
 }
 
+osg::Image*
+ImageUtils::cloneIfShared( const osg::Image* image )
+{
+    if ( !image ) return 0L;
+
+    // anyone else holding the image got it from somewhere that also keeps a reference
+    // (a cache, an in-flight request), so a count of one means the caller owns it.
+    if ( image->referenceCount() <= 1 )
+        return const_cast<osg::Image*>( image );
+
+    return cloneImage( image );
+}
+
 void
 ImageUtils::normalizeImage( osg::Image* image )
 {
@@ -60,6 +211,20 @@ ImageUtils::normalizeImage( osg::Image* image )
     }
 }
 
+bool
+ImageUtils::isNormalized( const osg::Image* image )
+{
+    if ( !image || image->getDataType() != GL_UNSIGNED_BYTE )
+        return true;
+
+    if ( image->getPixelFormat() == GL_RGB )
+        return image->getInternalTextureFormat() == GL_RGB8;
+    else if ( image->getPixelFormat() == GL_RGBA )
+        return image->getInternalTextureFormat() == GL_RGBA8;
+    else
+        return true;
+}
+
 bool
 ImageUtils::copyAsSubImage(const osg::Image* src, osg::Image* dst, int dst_start_col, int dst_start_row, int dst_img )
 {
@@ -84,6 +249,15 @@ ImageUtils::copyAsSubImage(const osg::Image* src, osg::Image* dst, int dst_start
         }
     }
 
+    // byte formats convert a row at a time:
+    else if ( RowConverter convertRow = s_getRowConverter(src, dst) )
+    {
+        for( int src_row=0, dst_row=dst_start_row; src_row < src->t(); src_row++, dst_row++ )
+        {
+            convertRow( src->data(0, src_row, 0), dst->data(dst_start_col, dst_row, dst_img), src->s() );
+        }
+    }
+
     // otherwise loop through an convert pixel-by-pixel.
     else
     {
@@ -99,6 +273,7 @@ ImageUtils::copyAsSubImage(const osg::Image* src, osg::Image* dst, int dst_start
         }
     }
 
+    dst->dirty();
     return true;
 }  
 
@@ -152,6 +327,24 @@ ImageUtils::resizeImage(const osg::Image* input,
     {
         memcpy( output->data(), input->data(), input->getTotalSizeInBytes() );
     }
+    else if (s_getByteChannels(input) > 0 &&
+             input->getPixelFormat() == output->getPixelFormat() &&
+             input->getDataType() == output->getDataType() )
+    {
+        // same byte layout on both sides: resample the raw bytes.
+        const unsigned char* src = input->data();
+        unsigned int srcRowBytes = input->getRowSizeInBytes();
+        unsigned char* dst = output->getMipmapData(mipmapLevel);
+        unsigned int dstRowBytes = output->getRowSizeInBytes() >> mipmapLevel;
+
+        switch( s_getByteChannels(input) )
+        {
+        case 1: s_resizeNearest<1>( src, in_s, in_t, srcRowBytes, dst, out_s, out_t, dstRowBytes ); break;
+        case 2: s_resizeNearest<2>( src, in_s, in_t, srcRowBytes, dst, out_s, out_t, dstRowBytes ); break;
+        case 3: s_resizeNearest<3>( src, in_s, in_t, srcRowBytes, dst, out_s, out_t, dstRowBytes ); break;
+        case 4: s_resizeNearest<4>( src, in_s, in_t, srcRowBytes, dst, out_s, out_t, dstRowBytes ); break;
+        }
+    }
     else
     {       
         PixelReader read( input );
@@ -186,11 +379,158 @@ ImageUtils::resizeImage(const osg::Image* input,
     return true;
 }
 
+namespace
+{
+    // Channel count for the box filter kernels, which only handle 2D images.
+    int s_getMipmapChannels( const osg::Image* image )
+    {
+        return image && image->r() == 1 ? s_getByteChannels( image ) : 0;
+    }
+
+    // Computes the offsets of mipmap levels 1..n-1 in a single buffer holding the whole
+    // chain (level 0 at offset 0), and returns the total size of the buffer.
+    unsigned int s_computeMipmapLayout( const osg::Image* image, int numLevels, osg::Image::MipmapDataType& offsets )
+    {
+        unsigned int total = 0;
+        offsets.clear();
+        offsets.reserve( numLevels-1 );
+
+        for( int i=0; i<numLevels; ++i )
+        {
+            if ( i > 0 )
+                offsets.push_back( total );
+
+            int level_s = osg::maximum( image->s() >> i, 1 );
+            int level_t = osg::maximum( image->t() >> i, 1 );
+            total += s_getRowBytes( image, level_s ) * level_t;
+        }
+        return total;
+    }
+
+    // 2x2 box filter that reduces one level to the next. The channel count is a template
+    // parameter so the inner loop has a fixed trip count the compiler can unroll and
+    // vectorize. Odd sizes clamp at the last row/column.
+    template<int N>
+    void s_boxFilter(const unsigned char* src, int src_s, int src_t, unsigned int srcRowBytes,
+                     unsigned char* dst, int dst_s, int dst_t, unsigned int dstRowBytes )
+    {
+        for( int t=0; t<dst_t; ++t )
+        {
+            const unsigned char* row0 = src + (2*t) * srcRowBytes;
+            const unsigned char* row1 = src + osg::minimum(2*t+1, src_t-1) * srcRowBytes;
+            unsigned char*       out  = dst + t * dstRowBytes;
+
+            for( int s=0; s<dst_s; ++s )
+            {
+                const int s0 = (2*s) * N;
+                const int s1 = osg::minimum(2*s+1, src_s-1) * N;
+                for( int c=0; c<N; ++c )
+                {
+                    out[s*N+c] = (unsigned char)(
+                        ((unsigned int)row0[s0+c] + row0[s1+c] + row1[s0+c] + row1[s1+c] + 2u) >> 2 );
+                }
+            }
+        }
+    }
+
+    void s_boxFilter(int channels,
+                     const unsigned char* src, int src_s, int src_t, unsigned int srcRowBytes,
+                     unsigned char* dst, int dst_s, int dst_t, unsigned int dstRowBytes )
+    {
+        switch( channels )
+        {
+        case 1: s_boxFilter<1>( src, src_s, src_t, srcRowBytes, dst, dst_s, dst_t, dstRowBytes ); break;
+        case 2: s_boxFilter<2>( src, src_s, src_t, srcRowBytes, dst, dst_s, dst_t, dstRowBytes ); break;
+        case 3: s_boxFilter<3>( src, src_s, src_t, srcRowBytes, dst, dst_s, dst_t, dstRowBytes ); break;
+        case 4: s_boxFilter<4>( src, src_s, src_t, srcRowBytes, dst, dst_s, dst_t, dstRowBytes ); break;
+        }
+    }
+
+    // Allocates an image with room for its full mipmap chain, in the format of "format".
+    osg::Image* s_allocateMipmappedImage( const osg::Image* format )
+    {
+        int numLevels = osg::Image::computeNumberOfMipmapLevels( format->s(), format->t() );
+        osg::Image::MipmapDataType offsets;
+        unsigned int totalSizeBytes = s_computeMipmapLayout( format, numLevels, offsets );
+
+        osg::Image* result = new osg::Image();
+        result->setImage(
+            format->s(), format->t(), 1,
+            format->getInternalTextureFormat(),
+            format->getPixelFormat(),
+            format->getDataType(),
+            new unsigned char[totalSizeBytes], osg::Image::USE_NEW_DELETE,
+            format->getPacking() );
+
+        result->setMipmapLevels( offsets );
+        return result;
+    }
+
+    // Fills levels [firstLevel..n-1] of a mipmapped image, each one from the level above it.
+    // If "source" is set, it stands in for the level above "firstLevel"; it must be the same
+    // size and format as the image.
+    void s_buildMipmapLevels( osg::Image* image, int channels, unsigned int firstLevel, const osg::Image* source =0L )
+    {
+        unsigned int numLevels = image->getNumMipmapLevels();
+
+        for( unsigned int level = osg::maximum(firstLevel, 1u); level < numLevels; ++level )
+        {
+            int src_s = osg::maximum( image->s() >> (level-1), 1 );
+            int src_t = osg::maximum( image->t() >> (level-1), 1 );
+            int dst_s = osg::maximum( image->s() >> level, 1 );
+            int dst_t = osg::maximum( image->t() >> level, 1 );
+
+            const unsigned char* src = 
+                source && level == firstLevel ? source->data() : image->getMipmapData( level-1 );
+
+            s_boxFilter(
+                channels,
+                src, src_s, src_t, s_getRowBytes(image, src_s),
+                image->getMipmapData(level), dst_s, dst_t, s_getRowBytes(image, dst_s) );
+        }
+    }
+}
+
+bool
+ImageUtils::canGenerateMipmaps( const osg::Image* image )
+{
+    return s_getMipmapChannels( image ) > 0;
+}
+
+osg::Image*
+ImageUtils::createMipmappedImage( const osg::Image* image )
+{
+    int channels = s_getMipmapChannels( image );
+    if ( channels == 0 )
+        return 0L;
+
+    osg::ref_ptr<osg::Image> result = s_allocateMipmappedImage( image );
+
+    // level 0 is a straight copy; every other level derives from the one above it.
+    ::memcpy( result->data(), image->data(), s_getRowBytes(image, image->s()) * image->t() );
+    s_buildMipmapLevels( result.get(), channels, 1 );
+
+    return result.release();
+}
+
 osg::Image*
 ImageUtils::createMipmapBlendedImage( const osg::Image* primary, const osg::Image* secondary )
 {
     // ASSUMPTION: primary and secondary are the same size, same format.
 
+    // fast path: box-filter each level from the previous one.
+    int channels = s_getMipmapChannels( primary );
+    if ( channels > 0 && (!secondary || (
+            s_getMipmapChannels(secondary) == channels &&
+            secondary->s() == primary->s() && secondary->t() == primary->t() &&
+            secondary->getPacking() == primary->getPacking())) )
+    {
+        osg::ref_ptr<osg::Image> result = s_allocateMipmappedImage( primary );
+        ::memcpy( result->data(), primary->data(), s_getRowBytes(primary, primary->s()) * primary->t() );
+        s_buildMipmapLevels( result.get(), channels, 1, secondary );
+        return result.release();
+    }
+
     // first, build the image that will hold all the mipmap levels.
     int numMipmapLevels = osg::Image::computeNumberOfMipmapLevels( primary->s(), primary->t() );
     int pixelSizeBytes  = osg::Image::computeRowWidthInBytes( primary->s(), primary->getPixelFormat(), primary->getDataType(), primary->getPacking() ) / primary->s();
@@ -267,6 +607,29 @@ ImageUtils::mix(osg::Image* dest, const osg::Image* src, float a)
 {
     if (!dest || !src || dest->s() != src->s() || dest->t() != src->t() )
         return false;
+
+    // fast path for RGB8/RGBA8:
+    int n = s_getConvertibleChannels( src );
+    int m = s_getConvertibleChannels( dest );
+    if ( n >= 3 && m >= 3 && src->r() == dest->r() )
+    {
+        unsigned int a8 = (unsigned int)( osg::clampBetween(a, 0.0f, 1.0f) * 255.0f + 0.5f );
+        for( int r=0; r<src->r(); ++r )
+        {
+            for( int t=0; t<src->t(); ++t )
+            {
+                const unsigned char* srcRow = src->data(0, t, r);
+                unsigned char* destRow = dest->data(0, t, r);
+
+                if      ( n == 3 && m == 3 ) s_mixRow<3,3>( srcRow, destRow, src->s(), a8 );
+                else if ( n == 3 && m == 4 ) s_mixRow<3,4>( srcRow, destRow, src->s(), a8 );
+                else if ( n == 4 && m == 3 ) s_mixRow<4,3>( srcRow, destRow, src->s(), a8 );
+                else                         s_mixRow<4,4>( srcRow, destRow, src->s(), a8 );
+            }
+        }
+        dest->dirty();
+        return true;
+    }
     
     PixelVisitor<MixImage> mixer;
     mixer._a = osg::clampBetween( a, 0.0f, 1.0f );
@@ -420,7 +783,16 @@ ImageUtils::convert(const osg::Image* image, GLenum pixelFormat, GLenum dataType
     else
         result->setInternalTextureFormat( pixelFormat );
 
-    PixelVisitor<CopyImage>().accept( image, result );
+    if ( RowConverter convertRow = s_getRowConverter(image, result) )
+    {
+        for( int r=0; r<image->r(); ++r )
+            for( int t=0; t<image->t(); ++t )
+                convertRow( image->data(0, t, r), result->data(0, t, r), image->s() );
+    }
+    else
+    {
+        PixelVisitor<CopyImage>().accept( image, result );
+    }
 
     return result;
 }
@@ -507,6 +879,179 @@ ImageUtils::isCompressed(const osg::Image *image)
 
 //------------------------------------------------------------------------
 
+namespace
+{
+    // encoded bytes recorded for an image, with the image's modified count at the
+    // time. Anything that changes the pixels in place dirty()s the image, which
+    // bumps the count, so a mismatch means the bytes are stale.
+    struct EncodedImageData
+    {
+        std::string        _data;
+        unsigned int       _modifiedCount;
+        std::list<const osg::Referenced*>::iterator _age;
+    };
+
+    // Side table of encoded bytes, keyed by image. Entries are dropped when their
+    // image is deleted (via the observer) and, oldest first, when the table grows
+    // past its byte limit, so bytes that no cache ever asks for can't pile up.
+    class EncodedDataTable : public osg::Observer
+    {
+    public:
+        EncodedDataTable() : _totalBytes( 0 ), _maxBytes( 32 * 1024 * 1024 ) { }
+
+        void set( const osg::Image* image, const std::string& data, unsigned int modifiedCount )
+        {
+            if ( data.size() > _maxBytes )
+                return;
+
+            // register outside our lock: image deletion calls objectDeleted() while
+            // holding the image's observer lock, so taking the locks in the other
+            // order here could deadlock. The observer is never removed; a
+            // notification for an image that has no entry is harmless.
+            const_cast<osg::Image*>(image)->addObserver( this );
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            removeEntry( image );
+
+            EncodedImageData& entry = _table[image];
+            entry._data = data;
+            entry._modifiedCount = modifiedCount;
+            entry._age  = _ages.insert( _ages.end(), image );
+            _totalBytes += data.size();
+
+            while ( _totalBytes > _maxBytes && !_ages.empty() )
+                removeEntry( _ages.front() );
+        }
+
+        bool get( const osg::Image* image, std::string& out_data, unsigned int& out_modifiedCount )
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            Table::const_iterator i = _table.find( image );
+            if ( i == _table.end() )
+                return false;
+            out_data = i->second._data;
+            out_modifiedCount = i->second._modifiedCount;
+            return true;
+        }
+
+        void remove( const osg::Referenced* image )
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            removeEntry( image );
+        }
+
+        void objectDeleted( void* ptr )
+        {
+            remove( static_cast<osg::Referenced*>(ptr) );
+        }
+
+    private:
+        typedef std::map<const osg::Referenced*, EncodedImageData> Table;
+
+        // assumes _mutex is held.
+        void removeEntry( const osg::Referenced* image )
+        {
+            Table::iterator i = _table.find( image );
+            if ( i != _table.end() )
+            {
+                _totalBytes -= i->second._data.size();
+                _ages.erase( i->second._age );
+                _table.erase( i );
+            }
+        }
+
+        OpenThreads::Mutex     _mutex;
+        Table                  _table;
+        std::list<const osg::Referenced*> _ages;
+        unsigned long          _totalBytes;
+        unsigned long          _maxBytes;
+    };
+
+    // deliberately never deleted: images destroyed during static destruction
+    // still notify it.
+    EncodedDataTable* s_encodedData = new EncodedDataTable();
+
+    std::string s_canonicalImageFormat( const std::string& format )
+    {
+        std::string f = osgDB::convertToLowerCase( format );
+        std::string::size_type slash = f.rfind( '/' );
+        if ( slash != std::string::npos )
+            f = f.substr( slash+1 );
+        if ( f.length() > 2 && f.compare(0, 2, "x-") == 0 )
+            f = f.substr( 2 );
+        if ( f == "jpeg" ) f = "jpg";
+        if ( f == "tiff" ) f = "tif";
+        return f;
+    }
+}
+
+void
+ImageUtils::setEncodedData( const osg::Image* image, const std::string& data )
+{
+    if ( !image || data.empty() )
+        return;
+
+    s_encodedData->set( image, data, image->getModifiedCount() );
+}
+
+bool
+ImageUtils::getEncodedData( const osg::Image* image, const std::string& format, std::string& out_data )
+{
+    if ( !image )
+        return false;
+
+    std::string data;
+    unsigned int modifiedCount;
+    if ( !s_encodedData->get( image, data, modifiedCount ) )
+        return false;
+
+    // the pixels may have been modified in place (a pre-cache operation, say)
+    // since the bytes were recorded. Only trust them if the image is unchanged.
+    if ( modifiedCount != image->getModifiedCount() )
+        return false;
+
+    if ( !format.empty() && !isSameImageFormat(getEncodedFormat(data.data(), data.size()), format) )
+        return false;
+
+    out_data.swap( data );
+    return true;
+}
+
+void
+ImageUtils::releaseEncodedData( const osg::Image* image )
+{
+    if ( image )
+        s_encodedData->remove( image );
+}
+
+bool
+ImageUtils::isSameImageFormat( const std::string& a, const std::string& b )
+{
+    std::string ca = s_canonicalImageFormat( a );
+    return !ca.empty() && ca == s_canonicalImageFormat( b );
+}
+
+std::string
+ImageUtils::getEncodedFormat( const char* data, unsigned int size )
+{
+    const unsigned char* b = (const unsigned char*)data;
+
+    if ( size >= 8 && b[0] == 0x89 && b[1] == 'P' && b[2] == 'N' && b[3] == 'G' )
+        return "png";
+    if ( size >= 3 && b[0] == 0xFF && b[1] == 0xD8 && b[2] == 0xFF )
+        return "jpg";
+    if ( size >= 6 && ::memcmp(b, "GIF8", 4) == 0 )
+        return "gif";
+    if ( size >= 4 && (::memcmp(b, "II*\0", 4) == 0 || ::memcmp(b, "MM\0*", 4) == 0) )
+        return "tif";
+    if ( size >= 4 && ::memcmp(b, "DDS ", 4) == 0 )
+        return "dds";
+
+    return "";
+}
+
+//------------------------------------------------------------------------
+
 namespace
 {
     //static const float r10= 1.0f/1023.0f;
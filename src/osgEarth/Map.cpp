@@ -19,6 +19,8 @@
 #include <osgEarth/Map>
 #include <osgEarth/Registry>
 #include <osgEarth/TileSource>
+#include <osgEarth/TaskService>
+#include <osgEarth/HeightFieldUtils>
 #include <OpenThreads/ScopedLock>
 #include <iterator>
 
@@ -876,6 +878,134 @@ Map::calculateProfile()
 
 namespace
 {
+    // Fetches the heightfield for one elevation layer. If "fallback" is set, walks
+    // up the parent keys until it finds data.
+    struct FetchElevationLayer
+    {
+        void init( ElevationLayer* layer, const TileKey& key, bool fallback, ProgressCallback* progress )
+        {
+            _layer    = layer;
+            _key      = key;
+            _fallback = fallback;
+            _progress = progress;
+        }
+
+        void execute()
+        {
+            TileKey hf_key = _key;
+            while( hf_key.valid() )
+            {
+                _hf = _layer->createHeightField( hf_key, _progress );
+                if ( _hf.valid() || !_fallback )
+                    break;
+
+                hf_key = hf_key.createParentKey();
+            }
+            _hfKey = hf_key;
+        }
+
+        ElevationLayer*                _layer;
+        TileKey                        _key;
+        bool                           _fallback;
+        ProgressCallback*              _progress;
+        osg::ref_ptr<osg::HeightField> _hf;
+        TileKey                        _hfKey;
+    };
+
+    typedef std::vector< osg::ref_ptr< ParallelTask<FetchElevationLayer> > > FetchElevationLayerVector;
+
+    // Thread pool shared by all parallel elevation layer fetches.
+    TaskService* getElevationService( int numThreads )
+    {
+        static Threading::Mutex s_mutex;
+        static osg::ref_ptr<TaskService> s_service;
+
+        Threading::ScopedMutexLock lock( s_mutex );
+        if ( !s_service.valid() )
+            s_service = new TaskService( "Map elevation", numThreads );
+        else if ( s_service->getNumThreads() < numThreads )
+            s_service->setNumThreads( numThreads );
+
+        return s_service.get();
+    }
+
+    // Runs a set of fetches concurrently: all but the first go to the pool, and the
+    // first runs in the calling thread.
+    void runElevationFetches( FetchElevationLayerVector& jobs )
+    {
+        if ( jobs.size() == 0 )
+            return;
+
+        if ( jobs.size() == 1 )
+        {
+            jobs[0]->execute();
+            return;
+        }
+
+        TaskService* service = getElevationService( jobs.size()-1 );
+        Threading::MultiEvent semaphore( jobs.size()-1 );
+
+        for( unsigned int j = 1; j < jobs.size(); ++j )
+        {
+            jobs[j]->_mev = &semaphore;
+            service->add( jobs[j].get() );
+        }
+
+        jobs[0]->execute();
+
+        semaphore.wait();
+    }
+
+    // Converts a coordinate to a pixel coordinate along one axis of a heightfield,
+    // the same way GeoHeightField::getElevation does. Returns -1 if it's outside.
+    double s_toPixel( double v, double vmin, double vmax, unsigned int numPixels )
+    {
+        //Account for small rounding errors along the edges of the extent
+        if ( osg::equivalent(vmin, v) ) v = vmin;
+        if ( osg::equivalent(vmax, v) ) v = vmax;
+        if ( v < vmin || v > vmax )
+            return -1.0;
+
+        double interval = (vmax - vmin) / (double)(numPixels-1);
+        return osg::clampBetween( (v - vmin) / interval, 0.0, (double)(numPixels-1) );
+    }
+
+    // Per-layer sampling coordinates for compositing. When the heightfield is in the
+    // same SRS as the output and needs no vertical datum conversion, the pixel
+    // coordinates for each output column and row are computed once up front;
+    // otherwise every sample goes through GeoHeightField::getElevation.
+    struct ElevationSampler
+    {
+        void init(const GeoHeightField* geoHF, const SpatialReference* keySRS, const VerticalSpatialReference* vsrs,
+                  double minx, double dx, unsigned int width,
+                  double miny, double dy, unsigned int height)
+        {
+            _geoHF = geoHF;
+            _hf    = geoHF->getHeightField();
+
+            const GeoExtent& ex = geoHF->getExtent();
+            _direct =
+                ex.getSRS()->isEquivalentTo( keySRS ) &&
+                !VerticalSpatialReference::canTransform( geoHF->getVerticalSRS(), vsrs );
+
+            if ( _direct )
+            {
+                _px.resize( width );
+                for( unsigned int c = 0; c < width; ++c )
+                    _px[c] = s_toPixel( minx + dx*(double)c, ex.xMin(), ex.xMax(), _hf->getNumColumns() );
+
+                _py.resize( height );
+                for( unsigned int r = 0; r < height; ++r )
+                    _py[r] = s_toPixel( miny + dy*(double)r, ex.yMin(), ex.yMax(), _hf->getNumRows() );
+            }
+        }
+
+        const GeoHeightField*   _geoHF;
+        const osg::HeightField* _hf;
+        bool                    _direct;
+        std::vector<double>     _px, _py;
+    };
+
     bool
     s_getHeightField(const TileKey& key,
                      const ElevationLayerVector& elevLayers,
@@ -890,9 +1020,6 @@ namespace
         unsigned int lowestLOD = key.getLevelOfDetail();
         bool hfInitialized = false;
 
-        typedef std::map< TerrainLayer*, bool > LayerValidMap;
-        LayerValidMap layerValidMap;
-
 	    //Get a HeightField for each of the enabled layers
 	    GeoHeightFieldVector heightFields;
 
@@ -901,23 +1028,30 @@ namespace
         if ( out_isFallback )
             *out_isFallback = false;
         
-        //First pass:  Try to get the exact LOD requested for each enabled heightfield
+        //First pass:  Try to get the exact LOD requested for each enabled heightfield. The layers
+        //             are independent, so fetch them all at once.
+        FetchElevationLayerVector exactJobs;
         for( ElevationLayerVector::const_iterator i = elevLayers.begin(); i != elevLayers.end(); i++ )
         {
             ElevationLayer* layer = i->get();
             if (layer->getProfile() && layer->getEnabled() )
             {
-                osg::HeightField* hf = layer->createHeightField( key, progress );
-                //osg::ref_ptr< osg::HeightField > hf;
-                //layer->getHeightField( key, hf, progress );
-                layerValidMap[ layer ] = (hf != 0L); //hf.valid();
-                if ( hf )
-                //if (hf.valid())
-                {
-                    numValidHeightFields++;
-                    GeoHeightField ghf( hf, key.getExtent(), layer->getProfile()->getVerticalSRS() );
-                    heightFields.push_back( ghf );
-                }
+                ParallelTask<FetchElevationLayer>* job = new ParallelTask<FetchElevationLayer>();
+                job->init( layer, key, false, progress );
+                exactJobs.push_back( job );
+            }
+        }
+
+        runElevationFetches( exactJobs );
+
+        for( FetchElevationLayerVector::iterator j = exactJobs.begin(); j != exactJobs.end(); ++j )
+        {
+            FetchElevationLayer* job = j->get();
+            if ( job->_hf.valid() )
+            {
+                numValidHeightFields++;
+                GeoHeightField ghf( job->_hf.get(), key.getExtent(), job->_layer->getProfile()->getVerticalSRS() );
+                heightFields.push_back( ghf );
             }
         }
 
@@ -932,34 +1066,31 @@ namespace
 
         //Second pass:  We were either asked to fallback or we might have some heightfields at the requested
         //              LOD and some that are NULL. Fall back on parent tiles to fill in the missing data if possible.
-        for( ElevationLayerVector::const_iterator i = elevLayers.begin(); i != elevLayers.end(); i++ )
+        //              The exact key already failed for these layers, so start at its parent.
+        FetchElevationLayerVector fallbackJobs;
+        for( FetchElevationLayerVector::iterator j = exactJobs.begin(); j != exactJobs.end(); ++j )
         {
-            ElevationLayer* layer = i->get();
-
-            if (layer->getProfile() && layer->getEnabled() )
+            FetchElevationLayer* exactJob = j->get();
+            if ( !exactJob->_hf.valid() )
             {
-                if (!layerValidMap[ layer ])
-                {
-                    TileKey hf_key = key;
-                    osg::ref_ptr< osg::HeightField > hf;
-                    while (hf_key.valid())
-                    {
-                        hf = layer->createHeightField( hf_key, progress );
-                        if ( hf.valid() )
-                            break;
+                ParallelTask<FetchElevationLayer>* job = new ParallelTask<FetchElevationLayer>();
+                job->init( exactJob->_layer, key.createParentKey(), true, progress );
+                fallbackJobs.push_back( job );
+            }
+        }
 
-                        hf_key = hf_key.createParentKey();
-                    }
+        runElevationFetches( fallbackJobs );
 
-                    if (hf.valid())
-                    {
-                        if ( hf_key.getLevelOfDetail() < lowestLOD )
-                            lowestLOD = hf_key.getLevelOfDetail();
+        for( FetchElevationLayerVector::iterator j = fallbackJobs.begin(); j != fallbackJobs.end(); ++j )
+        {
+            FetchElevationLayer* job = j->get();
+            if ( job->_hf.valid() )
+            {
+                if ( job->_hfKey.getLevelOfDetail() < lowestLOD )
+                    lowestLOD = job->_hfKey.getLevelOfDetail();
 
-                        heightFields.push_back( GeoHeightField(
-                            hf.get(), hf_key.getExtent(), layer->getProfile()->getVerticalSRS() ) );
-                    }
-                }
+                heightFields.push_back( GeoHeightField(
+                    job->_hf.get(), job->_hfKey.getExtent(), job->_layer->getProfile()->getVerticalSRS() ) );
             }
         }
 
@@ -1007,66 +1138,67 @@ namespace
             double dy = (maxy - miny)/(double)(out_result->getNumRows()-1);
 
             const VerticalSpatialReference* vsrs = mapProfile->getVerticalSRS();
-            
-		    //Create the new heightfield by sampling all of them.
-            for (unsigned int c = 0; c < width; ++c)
+            const SpatialReference* keySRS = key.getExtent().getSRS();
+
+            std::vector<ElevationSampler> samplers( heightFields.size() );
+            for (unsigned int i = 0; i < heightFields.size(); ++i)
             {
-                double geoX = minx + (dx * (double)c);
-                for (unsigned r = 0; r < height; ++r)
-                {
-                    double geoY = miny + (dy * (double)r);
+                samplers[i].init( &heightFields[i], keySRS, vsrs, minx, dx, width, miny, dy, height );
+            }
 
-                    //Collect elevations from all of the layers
-                    std::vector<float> elevations;
-                    for (GeoHeightFieldVector::iterator itr = heightFields.begin(); itr != heightFields.end(); ++itr)
-                    {
-                        const GeoHeightField& geoHF = *itr;
+		    //Create the new heightfield by sampling all of them, one row at a time.
+            for (unsigned int r = 0; r < height; ++r)
+            {
+                double geoY = miny + (dy * (double)r);
 
-                        float elevation = 0.0f;
-                        if ( geoHF.getElevation(key.getExtent().getSRS(), geoX, geoY, interpolation, vsrs, elevation) )
-                        {
-                            if (elevation != NO_DATA_VALUE)
-                            {
-                                elevations.push_back(elevation);
-                            }
-                        }
-                    }
+                for (unsigned int c = 0; c < width; ++c)
+                {
+                    double geoX = minx + (dx * (double)c);
 
+                    //Combine the valid elevations from all the layers as we go
                     float elevation = NO_DATA_VALUE;
+                    unsigned int numValid = 0;
 
-                    //The list of elevations only contains valid values
-                    if (elevations.size() > 0)
+                    for (unsigned int i = 0; i < samplers.size(); ++i)
                     {
-                        if (samplePolicy == SAMPLE_FIRST_VALID)
-                        {
-                            elevation = elevations[0];
-                        }
-                        else if (samplePolicy == SAMPLE_HIGHEST)
+                        const ElevationSampler& sampler = samplers[i];
+
+                        float layerElevation = 0.0f;
+                        if ( sampler._direct )
                         {
-                            elevation = -FLT_MAX;
-                            for (unsigned int i = 0; i < elevations.size(); ++i)
-                            {
-                                if (elevation < elevations[i]) elevation = elevations[i];
-                            }
+                            double px = sampler._px[c], py = sampler._py[r];
+                            if ( px < 0.0 || py < 0.0 )
+                                continue;
+                            layerElevation = HeightFieldUtils::getHeightAtPixel( sampler._hf, px, py, interpolation );
                         }
-                        else if (samplePolicy == SAMPLE_LOWEST)
+                        else if ( !sampler._geoHF->getElevation(keySRS, geoX, geoY, interpolation, vsrs, layerElevation) )
                         {
-                            elevation = FLT_MAX;
-                            for (unsigned i = 0; i < elevations.size(); ++i)
-                            {
-                                if (elevation > elevations[i]) elevation = elevations[i];
-                            }
+                            continue;
                         }
+
+                        if (layerElevation == NO_DATA_VALUE)
+                            continue;
+
+                        if (numValid == 0)
+                            elevation = layerElevation;
+                        else if (samplePolicy == SAMPLE_HIGHEST && layerElevation > elevation)
+                            elevation = layerElevation;
+                        else if (samplePolicy == SAMPLE_LOWEST && layerElevation < elevation)
+                            elevation = layerElevation;
                         else if (samplePolicy == SAMPLE_AVERAGE)
-                        {
-                            elevation = 0.0;
-                            for (unsigned i = 0; i < elevations.size(); ++i)
-                            {
-                                elevation += elevations[i];
-                            }
-                            elevation /= (float)elevations.size();
-                        }
+                            elevation += layerElevation;
+
+                        numValid++;
+
+                        if (samplePolicy == SAMPLE_FIRST_VALID)
+                            break;
+                    }
+
+                    if (samplePolicy == SAMPLE_AVERAGE && numValid > 1)
+                    {
+                        elevation /= (float)numValid;
                     }
+
                     out_result->setHeight(c, r, elevation);
                 }
             }
@@ -1351,15 +1483,24 @@ MapFrame::isCached( const osgEarth::TileKey& key ) const
             layer->getProfile()->getIntersectingTiles( key, keys );
         }
 
+        std::vector<TileKey> validKeys;
         for (unsigned int j = 0; j < keys.size(); ++j)
         {
             if ( layer->isKeyValid( keys[j] ) )
-            {
-                if ( !cache->isCached( keys[j], layer->getCacheSpec() ) )
-                {
-                    return false;
-                }
-            }
+                validKeys.push_back( keys[j] );
+        }
+
+        // check all the keys in one batch so the cache can answer them together
+        if ( validKeys.size() == 1 )
+        {
+            if ( !cache->isCached( validKeys[0], layer->getCacheSpec() ) )
+                return false;
+        }
+        else if ( validKeys.size() > 1 )
+        {
+            std::vector<bool> cached;
+            if ( cache->areCached( validKeys, layer->getCacheSpec(), cached ) < validKeys.size() )
+                return false;
         }
     }
 
@@ -1382,15 +1523,24 @@ MapFrame::isCached( const osgEarth::TileKey& key ) const
             layer->getProfile()->getIntersectingTiles( key, keys );
         }
 
+        std::vector<TileKey> validKeys;
         for (unsigned int j = 0; j < keys.size(); ++j)
         {
             if ( layer->isKeyValid( keys[j] ) )
-            {
-                if ( !cache->isCached( keys[j], layer->getCacheSpec() ) )
-                {
-                    return false;
-                }
-            }
+                validKeys.push_back( keys[j] );
+        }
+
+        // check all the keys in one batch so the cache can answer them together
+        if ( validKeys.size() == 1 )
+        {
+            if ( !cache->isCached( validKeys[0], layer->getCacheSpec() ) )
+                return false;
+        }
+        else if ( validKeys.size() > 1 )
+        {
+            std::vector<bool> cached;
+            if ( cache->areCached( validKeys, layer->getCacheSpec(), cached ) < validKeys.size() )
+                return false;
         }
     }
     return true;
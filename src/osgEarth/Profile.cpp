@@ -23,8 +23,12 @@
 #include <osgEarth/Cube>
 #include <osgEarth/SpatialReference>
 #include <osgDB/FileNameUtils>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
 #include <algorithm>
 #include <sstream>
+#include <map>
+#include <vector>
 
 using namespace osgEarth;
 
@@ -32,6 +36,52 @@ using namespace osgEarth;
 
 //------------------------------------------------------------------------
 
+namespace
+{
+    // One entry per distinct (non-equivalent) tiling scheme seen recently, keyed by a
+    // hash of its extent and LOD 0 tile grid. Only the values isEquivalentTo()
+    // compares are kept, so profiles themselves are never held alive. The table is
+    // bounded; once the least recently matched identity is dropped, a new profile
+    // equivalent to it just gets a new identity. Identities are never reused, so two
+    // profiles that are not equivalent still never share one.
+    struct ProfileIdentity
+    {
+        GeoExtent    _extent;
+        unsigned int _tilesWide, _tilesHigh;
+        unsigned int _id;
+        unsigned int _lastUsed;
+    };
+    typedef std::multimap<unsigned int, ProfileIdentity> ProfileIdentities;
+    typedef std::map<unsigned int, ProfileIdentities::iterator> ProfileIdentitiesByUse;
+
+    const unsigned int MAX_PROFILE_IDENTITIES = 256;
+
+    OpenThreads::Mutex     s_profileIdentitiesMutex;
+    ProfileIdentities      s_profileIdentities;
+    ProfileIdentitiesByUse s_profileIdentitiesByUse; // by _lastUsed, least recent first
+    unsigned int           s_profileIdentityGen = 0;
+    unsigned int           s_profileIdentityUse = 0;
+
+    // marks an identity as just matched, if it's still in the table.
+    // assumes the caller holds s_profileIdentitiesMutex.
+    void touchProfileIdentity( unsigned int hash, unsigned int id )
+    {
+        std::pair<ProfileIdentities::iterator, ProfileIdentities::iterator> range = s_profileIdentities.equal_range( hash );
+        for( ProfileIdentities::iterator i = range.first; i != range.second; ++i )
+        {
+            if ( i->second._id == id )
+            {
+                s_profileIdentitiesByUse.erase( i->second._lastUsed );
+                i->second._lastUsed = ++s_profileIdentityUse;
+                s_profileIdentitiesByUse[i->second._lastUsed] = i;
+                return;
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+
 ProfileOptions::ProfileOptions( const ConfigOptions& options ) :
 ConfigOptions( options ),
 _namedProfile( "" ),
@@ -272,6 +322,8 @@ _vsrs( vsrs )
 
     if ( !_vsrs.valid() )
         _vsrs = Registry::instance()->getDefaultVSRS();
+
+    computeHash();
 }
 
 Profile::Profile(const SpatialReference* srs,
@@ -294,6 +346,90 @@ _vsrs( vsrs )
 
     if ( !_vsrs.valid() )
         _vsrs = Registry::instance()->getDefaultVSRS();
+
+    computeHash();
+}
+
+void
+Profile::computeHash()
+{
+    // FNV-1a over the extent and tile grid that isEquivalentTo() compares. (Adding
+    // 0.0 folds -0.0 into 0.0, since they compare equal.)
+    double values[4] = { _extent.xMin()+0.0, _extent.yMin()+0.0, _extent.xMax()+0.0, _extent.yMax()+0.0 };
+    unsigned int tiles[2] = { _numTilesWideAtLod0, _numTilesHighAtLod0 };
+
+    unsigned int h = 2166136261u;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(values);
+    for( unsigned int i = 0; i < sizeof(values); ++i )
+        h = (h ^ p[i]) * 16777619u;
+    p = reinterpret_cast<const unsigned char*>(tiles);
+    for( unsigned int i = 0; i < sizeof(tiles); ++i )
+        h = (h ^ p[i]) * 16777619u;
+
+    // That hash ignores the SRS, so two profiles with the same numbers in different
+    // SRSs (e.g. a custom datum vs. WGS84) would collide. Resolve the final identity
+    // with a full equivalence test (SRS included) against the profiles seen so far.
+    // The SRS test may need the GDAL mutex, so it runs outside our own lock.
+    // (Destroying an extent can release an SRS, which takes the GDAL mutex, so an
+    // evicted one is held until our lock is released.)
+    GeoExtent evicted;
+    unsigned int seen = 0;
+    for( ;; )
+    {
+        std::vector<ProfileIdentity> candidates;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( s_profileIdentitiesMutex );
+
+            // an invalid profile is equivalent to nothing, so it needs no entry.
+            if ( !_extent.isValid() )
+            {
+                _hash = ++s_profileIdentityGen;
+                return;
+            }
+
+            if ( seen == s_profileIdentityGen )
+            {
+                // nothing new to compare against; this is a new identity.
+                if ( s_profileIdentities.size() >= MAX_PROFILE_IDENTITIES )
+                {
+                    evicted = s_profileIdentitiesByUse.begin()->second->second._extent;
+                    s_profileIdentities.erase( s_profileIdentitiesByUse.begin()->second );
+                    s_profileIdentitiesByUse.erase( s_profileIdentitiesByUse.begin() );
+                }
+
+                ProfileIdentity identity;
+                identity._extent    = _extent;
+                identity._tilesWide = _numTilesWideAtLod0;
+                identity._tilesHigh = _numTilesHighAtLod0;
+                identity._id        = ++s_profileIdentityGen;
+                identity._lastUsed  = ++s_profileIdentityUse;
+                s_profileIdentitiesByUse[identity._lastUsed] = s_profileIdentities.insert( std::make_pair(h, identity) );
+                _hash = identity._id;
+                return;
+            }
+
+            std::pair<ProfileIdentities::iterator, ProfileIdentities::iterator> range = s_profileIdentities.equal_range( h );
+            for( ProfileIdentities::iterator i = range.first; i != range.second; ++i )
+            {
+                if ( i->second._id > seen )
+                    candidates.push_back( i->second );
+            }
+            seen = s_profileIdentityGen;
+        }
+
+        for( std::vector<ProfileIdentity>::const_iterator i = candidates.begin(); i != candidates.end(); ++i )
+        {
+            if (_extent == i->_extent &&
+                _numTilesWideAtLod0 == i->_tilesWide &&
+                _numTilesHighAtLod0 == i->_tilesHigh )
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( s_profileIdentitiesMutex );
+                touchProfileIdentity( h, i->_id );
+                _hash = i->_id;
+                return;
+            }
+        }
+    }
 }
 
 Profile::ProfileType
@@ -49,7 +49,7 @@ ConsoleProgressCallback::reportProgress(double current, double total, const std:
     if (total > 0)
     {
 	double percentComplete = (current / total) * 100.0;
-	OE_NOTICE << "Completed " << percentComplete << "% " << current << " of " << total << std::endl;
+	OE_NOTICE << "Completed " << percentComplete << "% " << current << " of " << total << (msg.empty() ? "" : " - ") << msg << std::endl;
     }
     else
     {
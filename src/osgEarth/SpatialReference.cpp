@@ -21,17 +21,30 @@
 #include <osgEarth/Registry>
 #include <osgEarth/Cube>
 #include <OpenThreads/ScopedLock>
+#include <OpenThreads/Atomic>
 #include <osg/Notify>
 #include <ogr_api.h>
 #include <ogr_spatialref.h>
 #include <algorithm>
+#include <set>
+#include <vector>
+
+#ifdef WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  define NOMINMAX
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
 
 #define LC "[SpatialReference] "
 
 using namespace osgEarth;
 
-#define USE_CUSTOM_MERCATOR_TRANSFORM 1
-//#undef USE_CUSTOM_MERCATOR_TRANSFORM
+// Use closed-form kernels instead of OGR for common SRS pairs
+// (see SpatialReference::nativeTransform)
+#define USE_NATIVE_TRANSFORMS 1
+//#undef USE_NATIVE_TRANSFORMS
 
 //------------------------------------------------------------------------
 
@@ -68,6 +81,151 @@ namespace
         }
         return s;
     }
+
+    // generator for SpatialReference::_uid
+    OpenThreads::Atomic s_srsUIDGen;
+
+    // most SRS's are only ever compared with a handful of others.
+    const unsigned MAX_EQUIVALENCE_CACHE_SIZE = 64;
+
+    /**
+     * The OGR transform handles owned by one thread, keyed by the (source, target)
+     * SRS UIDs. Only the owning thread transforms with them; the mutex is there so
+     * a dying SpatialReference can release its handles from another thread.
+     */
+    struct ThreadTransformHandles
+    {
+        typedef std::map< std::pair<UID,UID>, void* > HandleMap;
+
+        OpenThreads::Mutex _mutex;
+        HandleMap          _handles;
+
+        // removes every handle that transforms from or to the given SRS and hands
+        // it back for the caller to destroy once it has dropped its own locks.
+        void release( UID uid, std::vector<void*>& out_handles )
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            for( HandleMap::iterator i = _handles.begin(); i != _handles.end(); )
+            {
+                if ( i->first.first == uid || i->first.second == uid )
+                {
+                    if ( i->second )
+                        out_handles.push_back( i->second );
+                    _handles.erase( i++ );
+                }
+                else ++i;
+            }
+        }
+
+        ~ThreadTransformHandles()
+        {
+            GDAL_SCOPED_LOCK;
+            for( HandleMap::iterator i = _handles.begin(); i != _handles.end(); ++i )
+            {
+                if ( i->second )
+                    OCTDestroyCoordinateTransformation( i->second );
+            }
+        }
+    };
+
+#ifdef WIN32
+    VOID WINAPI s_releaseThreadTransformHandles( PVOID data );
+#else
+    void s_releaseThreadTransformHandles( void* data );
+#endif
+
+    /**
+     * Hands each thread its ThreadTransformHandles through a thread-specific data
+     * slot whose destructor frees the handles when the thread exits. All live sets
+     * are tracked so that ~SpatialReference can release its handles in every thread.
+     */
+    class ThreadTransformHandleRegistry
+    {
+    public:
+        ThreadTransformHandleRegistry()
+        {
+#ifdef WIN32
+            _key = FlsAlloc( &s_releaseThreadTransformHandles );
+#else
+            pthread_key_create( &_key, &s_releaseThreadTransformHandles );
+#endif
+        }
+
+        ThreadTransformHandles* get()
+        {
+#ifdef WIN32
+            ThreadTransformHandles* handles = static_cast<ThreadTransformHandles*>( FlsGetValue(_key) );
+#else
+            ThreadTransformHandles* handles = static_cast<ThreadTransformHandles*>( pthread_getspecific(_key) );
+#endif
+            if ( !handles )
+            {
+                handles = new ThreadTransformHandles();
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+                    _live.insert( handles );
+                }
+#ifdef WIN32
+                FlsSetValue( _key, handles );
+#else
+                pthread_setspecific( _key, handles );
+#endif
+            }
+            return handles;
+        }
+
+        // called on thread exit.
+        void remove( ThreadTransformHandles* handles )
+        {
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+                _live.erase( handles );
+            }
+            delete handles;
+        }
+
+        // called when an SRS goes away. SRS objects are often destroyed while the
+        // GDAL mutex is held, so the GDAL mutex must never be taken while holding
+        // one of ours: collect the handles first, then destroy them.
+        void release( UID uid )
+        {
+            std::vector<void*> handles;
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+                for( std::set<ThreadTransformHandles*>::iterator i = _live.begin(); i != _live.end(); ++i )
+                    (*i)->release( uid, handles );
+            }
+
+            if ( !handles.empty() )
+            {
+                GDAL_SCOPED_LOCK;
+                for( unsigned i = 0; i < handles.size(); ++i )
+                    OCTDestroyCoordinateTransformation( handles[i] );
+            }
+        }
+
+    private:
+        OpenThreads::Mutex                _mutex;
+        std::set<ThreadTransformHandles*> _live;
+#ifdef WIN32
+        DWORD                             _key;
+#else
+        pthread_key_t                     _key;
+#endif
+    };
+
+    // never destroyed, since SRS objects may outlive static destruction.
+    ThreadTransformHandleRegistry* s_threadTransformHandles = new ThreadTransformHandleRegistry();
+
+#ifdef WIN32
+    VOID WINAPI s_releaseThreadTransformHandles( PVOID data )
+#else
+    void s_releaseThreadTransformHandles( void* data )
+#endif
+    {
+        if ( data )
+            s_threadTransformHandles->remove( static_cast<ThreadTransformHandles*>(data) );
+    }
 }
 
 //------------------------------------------------------------------------
@@ -293,9 +451,14 @@ osg::Referenced( true ),
 _initialized( false ),
 _handle( handle ),
 _owns_handle( true ),
+_native( NATIVE_NONE ),
+_utm_zone( 0 ),
+_utm_north( true ),
+_utm_kernel( 0L ),
 _name( name ),
 _init_type( init_type ),
-_init_str( init_str )
+_init_str( init_str ),
+_uid( (UID)++s_srsUIDGen )
 {
     _init_str_lc = init_str;
     std::transform( _init_str_lc.begin(), _init_str_lc.end(), _init_str_lc.begin(), ::tolower );
@@ -305,21 +468,26 @@ SpatialReference::SpatialReference(void* handle, bool ownsHandle) :
 osg::Referenced( true ),
 _initialized( false ),
 _handle( handle ),
-_owns_handle( ownsHandle )
+_owns_handle( ownsHandle ),
+_native( NATIVE_NONE ),
+_utm_zone( 0 ),
+_utm_north( true ),
+_utm_kernel( 0L ),
+_uid( (UID)++s_srsUIDGen )
 {
     //nop
 }
 
 SpatialReference::~SpatialReference()
 {
+    delete _utm_kernel;
+
     if ( _handle )
     {
-        GDAL_SCOPED_LOCK;
+        // release the transform handles every thread holds to or from this SRS.
+        s_threadTransformHandles->release( _uid );
 
-        for (TransformHandleCache::iterator itr = _transformHandleCache.begin(); itr != _transformHandleCache.end(); ++itr)
-        {
-            OCTDestroyCoordinateTransformation(itr->second);
-        }
+        GDAL_SCOPED_LOCK;
 
         if ( _owns_handle )
         {
@@ -392,7 +560,33 @@ SpatialReference::isEquivalentTo( const SpatialReference* rhs ) const
     if ( !_initialized )
         const_cast<SpatialReference*>(this)->init();
 
-    return _isEquivalentTo( rhs );
+    if ( !rhs )
+        return false;
+
+    if ( this == rhs )
+        return true;
+
+    // the full test compares WKT strings and may need the GDAL mutex, so
+    // remember the answer for each SRS we compare against.
+    {
+        Threading::ScopedReadLock sharedLock( _equivalenceCacheMutex );
+        EquivalenceCache::const_iterator i = _equivalenceCache.find( rhs->_uid );
+        if ( i != _equivalenceCache.end() )
+            return i->second;
+    }
+
+    bool result = _isEquivalentTo( rhs );
+    {
+        Threading::ScopedWriteLock exclusiveLock( _equivalenceCacheMutex );
+
+        // UIDs are never reused, so entries for destroyed SRS's are never hit
+        // again; start over rather than let the cache grow without bound.
+        if ( _equivalenceCache.size() >= MAX_EQUIVALENCE_CACHE_SIZE )
+            _equivalenceCache.clear();
+
+        _equivalenceCache[rhs->_uid] = result;
+    }
+    return result;
 }
 
 bool
@@ -612,38 +806,15 @@ SpatialReference::transform(double x, double y,
         return true;
     }
 
-    GDAL_SCOPED_LOCK;
-
     preTransform(x, y, context);
 
-    void* xform_handle = NULL;
-    TransformHandleCache::const_iterator itr = _transformHandleCache.find(out_srs->getWKT());
-    if (itr != _transformHandleCache.end())
-    {
-        //OE_DEBUG << "SpatialReference: using cached transform handle" << std::endl;
-        xform_handle = itr->second;
-    }
-    else
-    {
-        xform_handle = OCTNewCoordinateTransformation( _handle, out_srs->_handle);
-        const_cast<SpatialReference*>(this)->_transformHandleCache[out_srs->getWKT()] = xform_handle;
-    }
-
-    if ( !xform_handle )
-    {
-        OE_WARN << LC
-            << "SRS xform not possible" << std::endl
-            << "    From => " << getName() << std::endl
-            << "    To   => " << out_srs->getName() << std::endl;
-        return false;
-    }
-
     double temp_x = x;
     double temp_y = y;
     double temp_z = 0.0;
     bool result;
 
-    if ( OCTTransform( xform_handle, 1, &temp_x, &temp_y, &temp_z ) )
+    if ( nativeTransform( out_srs, &temp_x, &temp_y, 1 ) || 
+         ogrTransform( out_srs, 1, &temp_x, &temp_y, &temp_z ) )
     {
         result = true;
         out_x = temp_x;
@@ -661,6 +832,45 @@ SpatialReference::transform(double x, double y,
     return result;
 }
 
+bool
+SpatialReference::ogrTransform(const SpatialReference* out_srs,
+                               int numPoints, double* x, double* y, double* z ) const
+{
+    // this thread's handles; only this thread transforms with them, so the lock
+    // is never contended except by an SRS being destroyed.
+    ThreadTransformHandles* handles = s_threadTransformHandles->get();
+    std::pair<UID,UID> key( _uid, out_srs->_uid );
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( handles->_mutex );
+        ThreadTransformHandles::HandleMap::const_iterator itr = handles->_handles.find( key );
+        if ( itr != handles->_handles.end() )
+        {
+            return itr->second && OCTTransform( itr->second, numPoints, x, y, z ) > 0;
+        }
+    }
+
+    // creating a transformation is not thread-safe in OGR. Never hold our own lock
+    // while waiting on the GDAL mutex (see ThreadTransformHandleRegistry::release).
+    void* xform_handle = NULL;
+    {
+        GDAL_SCOPED_LOCK;
+        xform_handle = OCTNewCoordinateTransformation( _handle, out_srs->_handle );
+    }
+
+    if ( !xform_handle )
+    {
+        OE_WARN << LC
+            << "SRS xform not possible" << std::endl
+            << "    From => " << getName() << std::endl
+            << "    To   => " << out_srs->getName() << std::endl;
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( handles->_mutex );
+    handles->_handles[key] = xform_handle;
+    return xform_handle && OCTTransform( xform_handle, numPoints, x, y, z ) > 0;
+}
+
 // http://en.wikipedia.org/wiki/Mercator_projection#Mathematics_of_the_projection
 static bool
 mercatorToGeographic( double* x, double* y, int numPoints )
@@ -698,6 +908,146 @@ geographicToMercator( double* x, double* y, int numPoints )
     return true;
 }
 
+namespace
+{
+    inline double atanh_( double x ) { return 0.5 * log( (1.0+x)/(1.0-x) ); }
+}
+
+/**
+ * Universal Transverse Mercator by the Kruger series, to third order in the
+ * third flattening. Agrees with OGR/PROJ to within a millimeter inside the zone
+ * (and to within a few centimeters out to 3000km from the central meridian).
+ * http://en.wikipedia.org/wiki/Universal_Transverse_Mercator_coordinate_system
+ */
+struct SpatialReference::UTMKernel
+{
+    UTMKernel( const osg::EllipsoidModel* ellipsoid, int zone, bool north )
+    {
+        double a  = ellipsoid->getRadiusEquator();
+        double b  = ellipsoid->getRadiusPolar();
+        double f  = (a - b) / a;
+        double n  = f / (2.0 - f);
+        double n2 = n*n, n3 = n2*n;
+
+        _e    = 2.0*sqrt(n) / (1.0+n);
+        _kA   = 0.9996 * a / (1.0+n) * (1.0 + n2/4.0 + n2*n2/64.0);
+        _lon0 = osg::DegreesToRadians( (double)(zone*6 - 183) );
+        _e0   = 500000.0;
+        _n0   = north ? 0.0 : 10000000.0;
+
+        _alpha[0] = n/2.0 - 2.0/3.0*n2 + 5.0/16.0*n3;
+        _alpha[1] = 13.0/48.0*n2 - 3.0/5.0*n3;
+        _alpha[2] = 61.0/240.0*n3;
+
+        _beta[0]  = n/2.0 - 2.0/3.0*n2 + 37.0/96.0*n3;
+        _beta[1]  = 1.0/48.0*n2 + 1.0/15.0*n3;
+        _beta[2]  = 17.0/480.0*n3;
+
+        _delta[0] = 2.0*n - 2.0/3.0*n2 - 2.0*n3;
+        _delta[1] = 7.0/3.0*n2 - 8.0/5.0*n3;
+        _delta[2] = 56.0/15.0*n3;
+    }
+
+    void fromGeographic( double* x, double* y, unsigned int numPoints ) const
+    {
+        for( unsigned int i=0; i<numPoints; ++i )
+        {
+            double phi  = osg::DegreesToRadians( y[i] );
+            double dlon = osg::DegreesToRadians( x[i] ) - _lon0;
+            double s    = sin( phi );
+            double t    = sinh( atanh_(s) - _e*atanh_(_e*s) );
+            double xi   = atan2( t, cos(dlon) );
+            double eta  = atanh_( sin(dlon) / sqrt(1.0 + t*t) );
+
+            double e = eta, n = xi;
+            for( int j=0; j<3; ++j )
+            {
+                double j2 = 2.0*(double)(j+1);
+                e += _alpha[j] * cos(j2*xi) * sinh(j2*eta);
+                n += _alpha[j] * sin(j2*xi) * cosh(j2*eta);
+            }
+            x[i] = _e0 + _kA * e;
+            y[i] = _n0 + _kA * n;
+        }
+    }
+
+    void toGeographic( double* x, double* y, unsigned int numPoints ) const
+    {
+        for( unsigned int i=0; i<numPoints; ++i )
+        {
+            double xi  = (y[i] - _n0) / _kA;
+            double eta = (x[i] - _e0) / _kA;
+
+            double xip = xi, etap = eta;
+            for( int j=0; j<3; ++j )
+            {
+                double j2 = 2.0*(double)(j+1);
+                xip  -= _beta[j] * sin(j2*xi) * cosh(j2*eta);
+                etap -= _beta[j] * cos(j2*xi) * sinh(j2*eta);
+            }
+
+            double chi = asin( sin(xip) / cosh(etap) );
+            double phi = chi;
+            for( int j=0; j<3; ++j )
+            {
+                phi += _delta[j] * sin( 2.0*(double)(j+1)*chi );
+            }
+
+            x[i] = osg::RadiansToDegrees( _lon0 + atan2( sinh(etap), cos(xip) ) );
+            y[i] = osg::RadiansToDegrees( phi );
+        }
+    }
+
+    double _e, _kA, _lon0, _e0, _n0;
+    double _alpha[3], _beta[3], _delta[3];
+};
+
+bool
+SpatialReference::nativeTransform(const SpatialReference* out_srs,
+                                  double* x, double* y,
+                                  unsigned int numPoints ) const
+{
+#ifdef USE_NATIVE_TRANSFORMS
+
+    if ( _native == NATIVE_NONE || out_srs->_native == NATIVE_NONE )
+        return false;
+
+    // geographic-to-geographic may involve a datum shift; leave that to OGR.
+    if ( _native == NATIVE_GEOGRAPHIC && out_srs->_native == NATIVE_GEOGRAPHIC )
+        return false;
+
+    // by convention, spherical mercator pairs with any geographic SRS:
+    if ( _native == NATIVE_SPHERICAL_MERCATOR || out_srs->_native == NATIVE_SPHERICAL_MERCATOR )
+    {
+        if ( _native != NATIVE_GEOGRAPHIC && out_srs->_native != NATIVE_GEOGRAPHIC )
+            return false;
+    }
+
+    // otherwise the two must share a datum.
+    else if ( !getGeographicSRS()->isEquivalentTo( out_srs->getGeographicSRS() ) )
+    {
+        return false;
+    }
+
+    // into geographic:
+    if ( _native == NATIVE_SPHERICAL_MERCATOR )
+        mercatorToGeographic( x, y, numPoints );
+    else if ( _native == NATIVE_UTM )
+        _utm_kernel->toGeographic( x, y, numPoints );
+
+    // and out of it:
+    if ( out_srs->_native == NATIVE_SPHERICAL_MERCATOR )
+        geographicToMercator( x, y, numPoints );
+    else if ( out_srs->_native == NATIVE_UTM )
+        out_srs->_utm_kernel->fromGeographic( x, y, numPoints );
+
+    return true;
+
+#else
+    return false;
+#endif
+}
+
 bool
 SpatialReference::transformPoints(const SpatialReference* out_srs,
                                   double* x, double* y,
@@ -718,51 +1068,15 @@ SpatialReference::transformPoints(const SpatialReference* out_srs,
     
     bool success = false;
 
-#ifdef USE_CUSTOM_MERCATOR_TRANSFORM
-
-    if ( isGeographic() && out_srs->isMercator() )
+    if ( nativeTransform( out_srs, x, y, numPoints ) )
     {
-        success = geographicToMercator( x, y, numPoints );
+        success = true;
     }
-
-    else if ( isMercator() && out_srs->isGeographic() )
-    {
-        success = mercatorToGeographic( x, y, numPoints );
-    }
-
     else
-#endif
-
     {    
-        GDAL_SCOPED_LOCK;
-
-        void* xform_handle = NULL;
-        TransformHandleCache::const_iterator itr = _transformHandleCache.find(out_srs->getWKT());
-        if (itr != _transformHandleCache.end())
-        {
-            //OE_DEBUG << "SpatialRefernece: using cached transform handle" << std::endl;
-            xform_handle = itr->second;
-        }
-        else
-        {
-            xform_handle = OCTNewCoordinateTransformation( _handle, out_srs->_handle);
-            const_cast<SpatialReference*>(this)->_transformHandleCache[out_srs->getWKT()] = xform_handle;
-        }
-
-        if ( !xform_handle )
-        {
-            OE_WARN << LC
-                << "SRS xform not possible" << std::endl
-                << "    From => " << getName() << std::endl
-                << "    To   => " << out_srs->getName() << std::endl;
-            return false;
-        }
-
         double* temp_z = new double[numPoints];
-        success = OCTTransform( xform_handle, numPoints, x, y, temp_z ) > 0;
+        success = ogrTransform( out_srs, numPoints, x, y, temp_z );
         delete[] temp_z;
-
-        // END GDAL_SCOPE_LOCK
     }
 
     if ( success || ignore_errors )
@@ -820,6 +1134,39 @@ SpatialReference::transformPoints(const SpatialReference* out_srs,
     return success;
 }
 
+namespace
+{
+    // transforms the points in one batch if possible. Otherwise transforms them a
+    // point at a time, so that one bad point doesn't sink the rest, and warns once
+    // (unless told to ignore errors) about the ones that failed.
+    bool transformPointsOrEach( const SpatialReference* from, const SpatialReference* to,
+                                osg::Vec3dArray* points, bool ignoreErrors )
+    {
+        // quiet, and leaves the points untouched on failure:
+        if ( from->transformPoints( to, points, 0L, true ) )
+            return true;
+
+        unsigned failed = 0;
+        for( unsigned i=0; i<points->size(); ++i )
+        {
+            osg::Vec3d& p = (*points)[i];
+            double x = p.x(), y = p.y();
+            if ( from->transformPoints( to, &x, &y, 1, 0L, true ) )
+                p.set( x, y, p.z() );
+            else
+                ++failed;
+        }
+
+        if ( failed > 0 && !ignoreErrors )
+        {
+            OE_WARN << LC << "Failed to xform " << failed << " of " << points->size() << " points from "
+                << from->getName() << " to " << to->getName()
+                << std::endl;
+        }
+        return failed == 0;
+    }
+}
+
 bool 
 SpatialReference::transformToECEF(const osg::Vec3d& input,
                                   osg::Vec3d&       output ) const
@@ -849,13 +1196,18 @@ SpatialReference::transformToECEF(osg::Vec3dArray*    points,
     const SpatialReference* geoSRS = getGeographicSRS();
     const osg::EllipsoidModel* ellipsoid = geoSRS->getEllipsoid();
 
+    // first convert all the points to lat/long in one batch (in place). If the batch
+    // fails, fall back on a point at a time so that one bad point doesn't sink the
+    // rest; like the per-point path always has, this still produces ECEF output.
+    if ( !isGeographic() )
+    {
+        transformPointsOrEach( this, geoSRS, points, ignoreErrors );
+    }
+
     for( unsigned i=0; i<points->size(); ++i )
     {
         osg::Vec3d& p = (*points)[i];
 
-        if ( !isGeographic() )
-            transform( p.x(), p.y(), geoSRS, p.x(), p.y() );
-
         ellipsoid->convertLatLongHeightToXYZ(
             osg::DegreesToRadians( p.y() ), osg::DegreesToRadians( p.x() ), p.z(),
             p.x(), p.y(), p.z() );
@@ -896,28 +1248,28 @@ bool
 SpatialReference::transformFromECEF(osg::Vec3dArray* points,
                                     bool             ignoreErrors ) const
 {
-    bool ok = true;
+    if ( !points ) return false;
+
+    const SpatialReference* geoSRS = getGeographicSRS();
+    const osg::EllipsoidModel* ellipsoid = geoSRS->getEllipsoid();
 
     // first convert all the points to lat/long (in place):
     for( unsigned i=0; i<points->size(); ++i )
     {
         osg::Vec3d& p = (*points)[i];
-        osg::Vec3d geo;
-        getGeographicSRS()->getEllipsoid()->convertXYZToLatLongHeight(
-            p.x(), p.y(), p.z(),
-            geo.y(), geo.x(), geo.z() );
-        geo.x() = osg::RadiansToDegrees( geo.x() );
-        geo.y() = osg::RadiansToDegrees( geo.y() );
-        p = geo;
+        double lat, lon, height;
+        ellipsoid->convertXYZToLatLongHeight( p.x(), p.y(), p.z(), lat, lon, height );
+        p.set( osg::RadiansToDegrees(lon), osg::RadiansToDegrees(lat), height );
     }
 
-    // then convert them all to the local SRS if necessary.
+    // then convert them all to the local SRS in one batch, a point at a time
+    // only if the batch fails.
     if ( !isGeographic() )
     {
-        ok = getGeographicSRS()->transformPoints( this, points, 0L, ignoreErrors );
+        return transformPointsOrEach( geoSRS, this, points, ignoreErrors );
     }
 
-    return ok;
+    return true;
 }
 
 bool
@@ -1003,6 +1355,53 @@ SpatialReference::init()
         // calls the internal version, which can be overriden by the developer.
         // therefore do not call init() from the constructor!
         _init();
+
+        initNativeTransform();
+    }
+}
+
+void
+SpatialReference::initNativeTransform()
+{
+    // called with the GDAL mutex held.
+    _native = NATIVE_NONE;
+
+    delete _utm_kernel;
+    _utm_kernel = 0L;
+
+    if ( _is_cube || _is_user_defined )
+        return;
+
+    if ( _is_geographic )
+    {
+        _native = NATIVE_GEOGRAPHIC;
+    }
+
+    else if ( _is_mercator )
+    {
+        // only the plain spherical flavor (e.g. "spherical-mercator"):
+        OGRErr err;
+        if (_ellipsoid->getRadiusEquator() == _ellipsoid->getRadiusPolar() &&
+            OSRGetProjParm( _handle, SRS_PP_CENTRAL_MERIDIAN, 0.0, &err ) == 0.0 &&
+            OSRGetProjParm( _handle, SRS_PP_FALSE_EASTING,    0.0, &err ) == 0.0 &&
+            OSRGetProjParm( _handle, SRS_PP_FALSE_NORTHING,   0.0, &err ) == 0.0 &&
+            OSRGetProjParm( _handle, SRS_PP_SCALE_FACTOR,     1.0, &err ) == 1.0 )
+        {
+            _native = NATIVE_SPHERICAL_MERCATOR;
+        }
+    }
+
+    else
+    {
+        int north = 0;
+        int zone = OSRGetUTMZone( _handle, &north );
+        if ( zone > 0 && OSRGetLinearUnits( _handle, 0L ) == 1.0 )
+        {
+            _native     = NATIVE_UTM;
+            _utm_zone   = zone;
+            _utm_north  = north != 0;
+            _utm_kernel = new UTMKernel( _ellipsoid.get(), _utm_zone, _utm_north );
+        }
     }
 }
 
@@ -18,6 +18,7 @@
  */
 #include <osgEarth/TaskService>
 #include <osg/Notify>
+#include <algorithm>
 
 using namespace osgEarth;
 using namespace OpenThreads;
@@ -64,24 +65,148 @@ TaskRequest::wasCanceled() const
 
 //------------------------------------------------------------------------
 
+void
+TaskRequestLane::push( TaskRequest* request )
+{
+    ScopedLock<Mutex> lock(_mutex);
+    _buckets[request->getPriority()].push_back( request );
+}
+
+TaskRequest*
+TaskRequestLane::popFront()
+{
+    ScopedLock<Mutex> lock(_mutex);
+    if ( _buckets.empty() )
+        return 0L;
+
+    Buckets::iterator b = _buckets.begin();
+    osg::ref_ptr<TaskRequest> next = b->second.front();
+    b->second.pop_front();
+    if ( b->second.empty() )
+        _buckets.erase( b );
+
+    return next.release();
+}
+
+TaskRequest*
+TaskRequestLane::popBack()
+{
+    ScopedLock<Mutex> lock(_mutex);
+    if ( _buckets.empty() )
+        return 0L;
+
+    // steal from the most urgent bucket, but from the far end so we don't fight
+    // the lane's own thread for the request it is about to take.
+    Buckets::iterator b = _buckets.begin();
+    osg::ref_ptr<TaskRequest> next = b->second.back();
+    b->second.pop_back();
+    if ( b->second.empty() )
+        _buckets.erase( b );
+
+    return next.release();
+}
+
+bool
+TaskRequestLane::reprioritize( TaskRequest* request, float priority )
+{
+    ScopedLock<Mutex> lock(_mutex);
+
+    // the request sits in the bucket for its current priority; buckets are usually tiny.
+    Buckets::iterator b = _buckets.find( request->getPriority() );
+    if ( b == _buckets.end() )
+        return false;
+
+    for( Bucket::iterator i = b->second.begin(); i != b->second.end(); ++i )
+    {
+        if ( i->get() == request )
+        {
+            osg::ref_ptr<TaskRequest> holder = request;
+            b->second.erase( i );
+            if ( b->second.empty() )
+                _buckets.erase( b );
+
+            request->setPriority( priority );
+            _buckets[priority].push_back( request );
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned int
+TaskRequestLane::clear()
+{
+    ScopedLock<Mutex> lock(_mutex);
+    unsigned int count = 0;
+    for( Buckets::const_iterator b = _buckets.begin(); b != _buckets.end(); ++b )
+        count += b->second.size();
+    _buckets.clear();
+    return count;
+}
+
+//------------------------------------------------------------------------
+
 TaskRequestQueue::TaskRequestQueue() :
 osg::Referenced( true ),
-_done( false )
+_numLanesCreated( 1 ),
+_numLanes( 1 ),
+_done( false ),
+_stamp( 0 )
 {
+    for( unsigned int i = 0; i < MAX_LANES; ++i )
+        _lanes[i] = 0L;
+    _lanes[0] = new TaskRequestLane();
+}
+
+TaskRequestQueue::~TaskRequestQueue()
+{
+    for( unsigned int i = 0; i < MAX_LANES; ++i )
+        delete _lanes[i];
 }
 
 void
 TaskRequestQueue::clear()
 {
+    unsigned int numLanes = _numLanesCreated;
+    for( unsigned int i = 0; i < numLanes; ++i )
+    {
+        unsigned int count = _lanes[i]->clear();
+        for( unsigned int j = 0; j < count; ++j )
+            --_numRequests;
+    }
+}
+
+void
+TaskRequestQueue::setNumLanes( unsigned int value )
+{
+    value = osg::clampBetween( value, 1u, (unsigned int)MAX_LANES );
+
     ScopedLock<Mutex> lock(_mutex);
-    _requests.clear();
+
+    // create the lane before publishing the new count, so readers never see a NULL lane.
+    for( unsigned int i = _numLanesCreated; i < value; ++i )
+    {
+        _lanes[i] = new TaskRequestLane();
+        ++_numLanesCreated;
+    }
+
+    // requests left in lanes that are no longer active get stolen by the rest.
+    _numLanes.exchange( value );
 }
 
-unsigned int
-TaskRequestQueue::getNumRequests() const
+void
+TaskRequestQueue::setWorkGroup( TaskWorkGroup* group )
 {
-    ScopedLock<Mutex> lock(const_cast<TaskRequestQueue*>(this)->_mutex);
-    return _requests.size();
+    ScopedLock<Mutex> lock(_groupMutex);
+    _group = group;
+    ++_groupRevision;
+}
+
+TaskWorkGroup*
+TaskRequestQueue::getWorkGroup() const
+{
+    ScopedLock<Mutex> lock(const_cast<TaskRequestQueue*>(this)->_groupMutex);
+    return _group.get();
 }
 
 void 
@@ -93,58 +218,96 @@ TaskRequestQueue::add( TaskRequest* request )
     if ( !request->getProgressCallback() )
         request->setProgressCallback( new ProgressCallback() );
 
-    ScopedLock<Mutex> lock(_mutex);
+    // count it first, so a thread that sees the count go up will find the request
+    // (or find it a moment later) rather than miss it.
+    ++_numRequests;
 
-    // insert by priority.
-    _requests.insert( std::pair<float,TaskRequest*>(request->getPriority(), request) );
+    unsigned int lane = (++_nextLane) % _numLanes;
+    _lanes[lane]->push( request );
 
-#if 0
-    // insert by priority.
-    bool inserted = false;
-    for( TaskRequestList::iterator i = _requests.begin(); i != _requests.end(); i++ )
+    // wake up one waiting task thread, if there is one.
+    if ( _numWaiting > 0 )
     {
-        if ( request->getPriority() > i->get()->getPriority() )
-        {
-            _requests.insert( i, request );
-            inserted = true;
-            //OE_NOTICE << "TaskRequestQueue size=" << _requests.size() << std::endl;
-            break;
-        }
+        ScopedLock<Mutex> lock(_mutex);
+        _cond.signal();
     }
 
-    if ( !inserted )
-        _requests.push_back( request );
-#endif
-
-    // since there is data in the queue, wake up one waiting task thread.
-    _cond.signal();
+    // threads in a work group wait on the group instead of the queue:
+    osg::ref_ptr<TaskWorkGroup> group = getWorkGroup();
+    if ( group.valid() )
+        group->notify();
 }
 
 TaskRequest* 
-TaskRequestQueue::get()
+TaskRequestQueue::get( unsigned int lane )
 {
-    ScopedLock<Mutex> lock(_mutex);
-
-    while ( !_done && _requests.empty() )
+    while( true )
     {
-        // releases the mutex and waits on the condition.
-        _cond.wait( &_mutex );
+        TaskRequest* request = tryGet( lane );
+        if ( request )
+            return request;
+
+        ScopedLock<Mutex> lock(_mutex);
+
+        // register as waiting before checking the count; an add() that follows will
+        // then see us and signal (see add).
+        ++_numWaiting;
+        while ( !_done && _numRequests == 0 )
+        {
+            // releases the mutex and waits on the condition.
+            _cond.wait( &_mutex );
+        }
+        --_numWaiting;
+
+        if ( _done )
+        {
+            return 0L;
+        }
     }
+}
 
-    if ( _done )
-    {
+TaskRequest*
+TaskRequestQueue::tryGet( unsigned int lane )
+{
+    if ( _done || _numRequests == 0 )
         return 0L;
+
+    // our own lane first, most urgent request first:
+    unsigned int home = lane % _numLanes;
+    TaskRequest* request = _lanes[home]->popFront();
+
+    // then help out the other lanes (including retired ones):
+    unsigned int numLanes = _numLanesCreated;
+    for( unsigned int i = 1; !request && i < numLanes; ++i )
+    {
+        request = _lanes[(home + i) % numLanes]->popBack();
     }
 
-    osg::ref_ptr<TaskRequest> next = _requests.begin()->second.get(); //_requests.front();
-    _requests.erase( _requests.begin() ); //_requests.pop_front();
+    if ( request )
+        --_numRequests;
 
-    // I'm done, someone else take a turn:
-    // (technically this shouldn't be necessary since add() bumps the semaphore once
-    // for each request in the queue)
-    _cond.signal();
+    return request;
+}
 
-    return next.release();
+TaskRequest*
+TaskRequestQueue::steal()
+{
+    if ( _done || _numRequests == 0 )
+        return 0L;
+
+    // rotate the starting lane so thieves spread out.
+    unsigned int numLanes = _numLanesCreated;
+    unsigned int start = (++_nextVictim) % numLanes;
+    TaskRequest* request = 0L;
+    for( unsigned int i = 0; !request && i < numLanes; ++i )
+    {
+        request = _lanes[(start + i) % numLanes]->popBack();
+    }
+
+    if ( request )
+        --_numRequests;
+
+    return request;
 }
 
 void
@@ -163,11 +326,118 @@ TaskRequestQueue::setDone()
         _cond.signal();
 }
 
+bool
+TaskRequestQueue::reprioritize( TaskRequest* request, float priority )
+{
+    unsigned int numLanes = _numLanesCreated;
+    for( unsigned int i = 0; i < numLanes; ++i )
+    {
+        if ( _lanes[i]->reprioritize( request, priority ) )
+            return true;
+    }
+
+    // not queued; the new priority applies the next time it's added.
+    request->setPriority( priority );
+    return false;
+}
+
+//------------------------------------------------------------------------
+
+TaskWorkGroup::TaskWorkGroup() :
+osg::Referenced( true ),
+_numIdle( 0 )
+{
+    //nop
+}
+
+void
+TaskWorkGroup::addQueue( TaskRequestQueue* queue )
+{
+    Threading::ScopedWriteLock lock( _queuesMutex );
+    if ( std::find( _queues.begin(), _queues.end(), queue ) == _queues.end() )
+        _queues.push_back( queue );
+}
+
+void
+TaskWorkGroup::removeQueue( TaskRequestQueue* queue )
+{
+    Threading::ScopedWriteLock lock( _queuesMutex );
+    QueueVector::iterator i = std::find( _queues.begin(), _queues.end(), queue );
+    if ( i != _queues.end() )
+        _queues.erase( i );
+}
+
+TaskRequest*
+TaskWorkGroup::steal( TaskRequestQueue* home )
+{
+    Threading::ScopedReadLock lock( _queuesMutex );
+
+    // take from the queue with the largest backlog. Priorities are only meaningful
+    // within a single queue, so backlog is the only fair way to compare them.
+    TaskRequestQueue* victim = 0L;
+    unsigned int most = 0;
+    for( QueueVector::const_iterator i = _queues.begin(); i != _queues.end(); ++i )
+    {
+        if ( i->get() != home )
+        {
+            unsigned int num = (*i)->getNumRequests();
+            if ( num > most )
+            {
+                most = num;
+                victim = i->get();
+            }
+        }
+    }
+
+    // the victim may have emptied since we looked; that's fine, we'll try again later.
+    return victim ? victim->steal() : 0L;
+}
+
+bool
+TaskWorkGroup::hasWork() const
+{
+    Threading::ScopedReadLock lock( const_cast<TaskWorkGroup*>(this)->_queuesMutex );
+    for( QueueVector::const_iterator i = _queues.begin(); i != _queues.end(); ++i )
+    {
+        if ( (*i)->getNumRequests() > 0 )
+            return true;
+    }
+    return false;
+}
+
+void
+TaskWorkGroup::waitForWork( unsigned long timeout_ms )
+{
+    ScopedLock<Mutex> lock( _idleMutex );
+
+    // register as idle before checking the queues; any request added after the
+    // check will then see us waiting and signal (see notify).
+    ++_numIdle;
+    if ( !hasWork() )
+    {
+        // the timeout is just a safety net for shutdown and thread count changes.
+        _idleCond.wait( &_idleMutex, timeout_ms );
+    }
+    --_numIdle;
+}
+
+void
+TaskWorkGroup::notify()
+{
+    // _numIdle must be read under the lock; otherwise a thread that has just
+    // registered as idle (and found no work) could miss this wakeup.
+    ScopedLock<Mutex> lock( _idleMutex );
+    if ( _numIdle > 0 )
+        _idleCond.signal();
+}
+
 //------------------------------------------------------------------------
 
-TaskThread::TaskThread( TaskRequestQueue* queue ) :
+TaskThread::TaskThread( TaskRequestQueue* queue, unsigned int lane ) :
 _queue( queue ),
-_done( false )
+_done( false ),
+_lane( lane ),
+_groupRevision( 0 )
 {
     //nop
 }
@@ -177,7 +447,7 @@ TaskThread::run()
 {
     while( !_done )
     {
-        _request = _queue->get();
+        _request = getNextRequest();
 
         if ( _done )
             break;
@@ -217,6 +487,38 @@ TaskThread::run()
     }
 }
 
+TaskRequest*
+TaskThread::getNextRequest()
+{
+    // only go back to the queue for its work group when the group has changed.
+    unsigned int revision = _queue->getWorkGroupRevision();
+    if ( revision != _groupRevision )
+    {
+        _group = _queue->getWorkGroup();
+        _groupRevision = revision;
+    }
+
+    if ( !_group.valid() )
+    {
+        // block on our own queue.
+        return _queue->get( _lane );
+    }
+
+    // in a work group: prefer our own queue, then help out elsewhere, then sleep.
+    // If the queue changes groups, return so the caller comes back around.
+    while( !_done && !_queue->isDone() && _queue->getWorkGroupRevision() == _groupRevision )
+    {
+        TaskRequest* request = _queue->tryGet( _lane );
+        if ( !request )
+            request = _group->steal( _queue.get() );
+        if ( request )
+            return request;
+
+        _group->waitForWork( 100 );
+    }
+    return 0L;
+}
+
 int
 TaskThread::cancel()
 {
@@ -241,6 +543,8 @@ TaskThread::cancel()
 
 TaskService::TaskService( const std::string& name, int numThreads ):
 osg::Referenced( true ),
+_numThreads(0),
+_nextLane(0),
 _lastRemoveFinishedThreadsStamp(0),
 _name(name)
 {
@@ -261,8 +565,36 @@ TaskService::add( TaskRequest* request )
     _queue->add( request );
 }
 
+void
+TaskService::reprioritize( TaskRequest* request, float priority )
+{
+    _queue->reprioritize( request, priority );
+}
+
+void
+TaskService::setWorkGroup( TaskWorkGroup* group )
+{
+    TaskWorkGroup* oldGroup = _queue->getWorkGroup();
+    if ( oldGroup == group )
+        return;
+
+    if ( oldGroup )
+        oldGroup->removeQueue( _queue.get() );
+
+    _queue->setWorkGroup( group );
+
+    // in a group, give each thread its own lane so they don't all contend for one lock.
+    _queue->setNumLanes( group ? _numThreads : 1 );
+
+    if ( group )
+        group->addQueue( _queue.get() );
+}
+
 TaskService::~TaskService()
 {
+    // leave the work group first so that no other service steals from us.
+    setWorkGroup( 0L );
+
     _queue->setDone();
 
     for( TaskThreads::iterator i = _threads.begin(); i != _threads.end(); i++ )
@@ -308,6 +640,9 @@ TaskService::setNumThreads(int numThreads )
     {
         _numThreads = osg::maximum(1, numThreads);
         adjustThreadCount();
+
+        if ( _queue->getWorkGroup() )
+            _queue->setNumLanes( _numThreads );
     }
 }
 
@@ -329,7 +664,7 @@ TaskService::adjustThreadCount()
         //We need to add some threads
         for (int i = 0; i < diff; ++i)
         {
-            TaskThread* thread = new TaskThread( _queue.get() );
+            TaskThread* thread = new TaskThread( _queue.get(), _nextLane++ );
             _threads.push_back( thread );
             thread->start();
         }       
@@ -411,6 +746,8 @@ TaskServiceManager::add( UID uid, float weight )
     else
     {
         TaskService* newService = new TaskService( "", 1 );
+        if ( _workGroup.valid() )
+            newService->setWorkGroup( _workGroup.get() );
         _services[uid] = WeightedTaskService( newService, weight );
         reallocate( _targetNumThreads );
         return newService;
@@ -440,6 +777,7 @@ TaskServiceManager::remove( TaskService* service )
     {
         if ( i->second.first.get() == service ) 
         {
+            service->setWorkGroup( 0L );
             _services.erase( i );
             reallocate( _targetNumThreads );
             break;
@@ -451,7 +789,12 @@ void
 TaskServiceManager::remove( UID uid )
 {
     ScopedLock<Mutex> lock( _taskServiceMgrMutex );
-    _services.erase( uid );
+    TaskServiceMap::iterator i = _services.find( uid );
+    if ( i != _services.end() )
+    {
+        i->second.first->setWorkGroup( 0L );
+        _services.erase( i );
+    }
     reallocate( _targetNumThreads );
 }
 
@@ -477,6 +820,20 @@ TaskServiceManager::setWeight( TaskService* service, float weight )
     }    
 }
 
+void
+TaskServiceManager::setWorkStealing( bool value )
+{
+    ScopedLock<Mutex> lock( _taskServiceMgrMutex );
+
+    if ( value == _workGroup.valid() )
+        return;
+
+    _workGroup = value ? new TaskWorkGroup() : 0L;
+
+    for( TaskServiceMap::iterator i = _services.begin(); i != _services.end(); ++i )
+        i->second.first->setWorkGroup( _workGroup.get() );
+}
+
 void
 TaskServiceManager::reallocate( int numThreads )
 {
@@ -30,7 +30,8 @@ _mode( MODE_STANDARD ),
 _numLoadingThreads( 4 ),
 _numLoadingThreadsPerCore( 2 ),
 _numCompileThreads( 2 ),
-_numCompileThreadsPerCore( 0.5 )
+_numCompileThreadsPerCore( 0.5 ),
+_workStealing( false )
 {
     fromConfig( conf );
 }
@@ -48,6 +49,7 @@ LoadingPolicy::fromConfig( const Config& conf )
     conf.getIfSet( "loading_threads_per_core", _numLoadingThreadsPerCore );
     conf.getIfSet( "compile_threads", _numCompileThreads );
     conf.getIfSet( "compile_threads_per_core", _numCompileThreadsPerCore );
+    conf.getIfSet( "work_stealing", _workStealing );
 }
 
 Config
@@ -62,6 +64,7 @@ LoadingPolicy::getConfig() const
     conf.addIfSet( "loading_threads_per_core", _numLoadingThreadsPerCore );
     conf.addIfSet( "compile_threads", _numCompileThreads );
     conf.addIfSet( "compile_threads_per_core", _numCompileThreadsPerCore );
+    conf.addIfSet( "work_stealing", _workStealing );
     return conf;
 }
 
@@ -100,7 +103,8 @@ _attenuationDistance( 1000000 ),
 _lodBlending( false ),
 _lodTransitionTimeSeconds( 0.5f ),
 _elevationInterpolation( INTERP_BILINEAR ),
-_enableMipmapping( true )
+_enableMipmapping( true ),
+_cpuMipmapping( false )
 {
     fromConfig( _conf );
 }
@@ -122,6 +126,7 @@ TerrainOptions::getConfig() const
     conf.updateIfSet( "attenuation_distance", _attenuationDistance );
     conf.updateIfSet( "lod_transition_time", _lodTransitionTimeSeconds );
     conf.updateIfSet( "mipmapping", _enableMipmapping );
+    conf.updateIfSet( "cpu_mipmapping", _cpuMipmapping );
 
     conf.updateIfSet( "compositor", "auto",             _compositingTech, COMPOSITING_AUTO );
     conf.updateIfSet( "compositor", "texture_array",    _compositingTech, COMPOSITING_TEXTURE_ARRAY );
@@ -151,6 +156,7 @@ TerrainOptions::fromConfig( const Config& conf )
     conf.getIfSet( "attenuation_distance", _attenuationDistance );
     conf.getIfSet( "lod_transition_time", _lodTransitionTimeSeconds );
     conf.getIfSet( "mipmapping", _enableMipmapping );
+    conf.getIfSet( "cpu_mipmapping", _cpuMipmapping );
 
     conf.getIfSet( "compositor", "auto",             _compositingTech, COMPOSITING_AUTO );
     conf.getIfSet( "compositor", "texture_array",    _compositingTech, COMPOSITING_TEXTURE_ARRAY );
@@ -256,11 +256,33 @@ namespace
 TextureCompositorMultiTexture::TextureCompositorMultiTexture( bool useGPU, const TerrainOptions& options ) :
 _lodTransitionTime( *options.lodTransitionTime() ),
 _enableMipmapping( *options.enableMipmapping() ),
+_cpuMipmapping( *options.cpuMipmapping() ),
 _useGPU( useGPU )
 {
     _enableMipmappingOnUpdatedTextures = Registry::instance()->getCapabilities().supportsMipmappedTextureUpdates();
 }
 
+GeoImage
+TextureCompositorMultiTexture::prepareImage( const GeoImage& layerImage, const GeoExtent& tileExtent ) const
+{
+    // Optionally build the mipmap chain here, since this runs in the loading thread,
+    // so the driver doesn't have to generate it when the texture is applied.
+    const osg::Image* image = layerImage.getImage();
+    if (_cpuMipmapping &&
+        _enableMipmapping &&
+        _enableMipmappingOnUpdatedTextures &&
+        image && 
+        !image->isMipmap() &&
+        ImageUtils::isPowerOfTwo( image ) &&
+        ImageUtils::canGenerateMipmaps( image ) )
+    {
+        osg::Image* mipmapped = ImageUtils::createMipmappedImage( image );
+        if ( mipmapped )
+            return GeoImage( mipmapped, layerImage.getExtent() );
+    }
+    return layerImage;
+}
+
 void
 TextureCompositorMultiTexture::applyLayerUpdate(osg::StateSet*       stateSet,
                                                 UID                  layerUID,
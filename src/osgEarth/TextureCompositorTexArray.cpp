@@ -262,14 +262,23 @@ TextureCompositorTexArray::prepareImage( const GeoImage& layerImage, const GeoEx
         image->t() != textureSize )
     {
         // Because all tex2darray layers must be identical in format, let's use RGBA.
-        osg::ref_ptr<osg::Image> newImage = ImageUtils::convertToRGBA8( image );
+        // (Skip the conversion if only the size is off, since the resize makes a copy anyway.)
+        osg::ref_ptr<osg::Image> newImage;
+        const osg::Image* rgbaImage = image;
+        if ( image->getPixelFormat() != GL_RGBA || image->getDataType() != GL_UNSIGNED_BYTE || image->getInternalTextureFormat() != GL_RGBA8 )
+        {
+            newImage = ImageUtils::convertToRGBA8( image );
+            rgbaImage = newImage.get();
+        }
         
         // TODO: revisit. For now let's just settle on 256 (again, all layers must be the same size)
-        if ( image->s() != textureSize || image->t() != textureSize )
+        if ( rgbaImage && (image->s() != textureSize || image->t() != textureSize) )
         {
             osg::ref_ptr<osg::Image> resizedImage;
-            if ( ImageUtils::resizeImage( newImage.get(), textureSize, textureSize, resizedImage ) )
+            if ( ImageUtils::resizeImage( rgbaImage, textureSize, textureSize, resizedImage ) )
                 newImage = resizedImage.get();
+            else if ( !newImage.valid() )
+                newImage = ImageUtils::cloneImage( image );
         }
 
         return GeoImage( newImage.get(), layerImage.getExtent() );
@@ -23,6 +23,25 @@ using namespace osgEarth;
 
 //------------------------------------------------------------------------
 
+namespace
+{
+    const std::string s_invalidKeyStr( "invalid" );
+
+    // appends the decimal digits of a value (cheaper than a stringstream).
+    void appendUInt( std::string& out, unsigned int value )
+    {
+        char buf[16];
+        char* p = buf + sizeof(buf);
+        do {
+            *--p = (char)('0' + value % 10);
+            value /= 10;
+        } while( value > 0 );
+        out.append( p, buf + sizeof(buf) );
+    }
+}
+
+//------------------------------------------------------------------------
+
 TileKey TileKey::INVALID( 0, 0, 0, 0L );
 
 //------------------------------------------------------------------------
@@ -46,28 +65,39 @@ TileKey::TileKey( unsigned int lod, unsigned int tile_x, unsigned int tile_y, co
 
         _extent = GeoExtent( _profile->getSRS(), xmin, ymin, xmax, ymax );
 
-        std::stringstream buf;
-        buf << _lod << "_" << _x << "_" << _y;
-        _key = buf.str();
+        _id = TileKeyID( _lod, _x, _y, _profile->getHash() );
+
+        _key.reserve( 24 );
+        appendUInt( _key, _lod );
+        _key.push_back( '_' );
+        appendUInt( _key, _x );
+        _key.push_back( '_' );
+        appendUInt( _key, _y );
     }
     else
     {
         _extent = GeoExtent::INVALID;
-        _key = "invalid";
     }
 }
 
 TileKey::TileKey( const TileKey& rhs ) :
-_key( rhs._key ),
+_id( rhs._id ),
 _lod(rhs._lod),
 _x(rhs._x),
 _y(rhs._y),
 _profile( rhs._profile.get() ),
-_extent( rhs._extent )
+_extent( rhs._extent ),
+_key( rhs._key )
 {
     //NOP
 }
 
+const std::string&
+TileKey::str() const
+{
+    return valid() ? _key : s_invalidKeyStr;
+}
+
 const Profile*
 TileKey::getProfile() const
 {
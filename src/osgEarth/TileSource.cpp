@@ -197,21 +197,42 @@ TileSource::createImage(const TileKey& key, ImageOperation* prepOp, ProgressCall
         osg::ref_ptr<const osg::Image> cachedImage;
         if ( _memCache->getImage( key, CacheSpec(), cachedImage ) )
         {
-            return ImageUtils::cloneImage(cachedImage.get());
+            // shared read-only with the memory cache.
+            return const_cast<osg::Image*>( cachedImage.release() );
         }
     }
 
+    // If another thread is already creating this tile with the same operation, wait
+    // for it and share its result (read-only, like a memcache hit) instead of creating
+    // it again. Gives up, returning NULL, if this request is canceled meanwhile.
+    ImageFlightKey flightKey( key.getID(), prepOp );
+    osg::ref_ptr<const osg::Image> sharedImage;
+    if ( !_imageFlights.enter(flightKey, sharedImage, progress) )
+    {
+        return const_cast<osg::Image*>( sharedImage.release() );
+    }
+
     osg::ref_ptr<osg::Image> newImage = createImage(key, progress);
 
     if ( prepOp )
         (*prepOp)( newImage );
 
+    // normalize it before it is shared (memory cache, waiting requests) so nobody
+    // downstream needs a private copy to do so.
+    if ( newImage.valid() && !ImageUtils::isNormalized(newImage.get()) )
+    {
+        newImage = ImageUtils::cloneIfShared( newImage.get() );
+        ImageUtils::normalizeImage( newImage.get() );
+    }
+
     if ( newImage.valid() && _memCache.valid() )
     {
         // cache it to the memory cache.
         _memCache->setImage( key, CacheSpec(), newImage.get() );
     }
 
+    _imageFlights.leave( flightKey, newImage.get(), isShareable(progress) );
+
     return newImage.release();
 }
 
@@ -228,6 +249,15 @@ TileSource::createHeightField(const TileKey& key, HeightFieldOperation* prepOp,
         }
 	}
 
+    // If another thread is already creating this tile with the same operation, wait
+    // for it and use a copy of its result.
+    HeightFieldFlightKey flightKey( key.getID(), prepOp );
+    osg::ref_ptr<const osg::HeightField> sharedHF;
+    if ( !_heightFieldFlights.enter(flightKey, sharedHF, progress) )
+    {
+        return sharedHF.valid() ? new osg::HeightField( *sharedHF.get() ) : 0L;
+    }
+
     osg::ref_ptr<osg::HeightField> newHF = createHeightField( key, progress );
 
     if ( prepOp )
@@ -238,10 +268,32 @@ TileSource::createHeightField(const TileKey& key, HeightFieldOperation* prepOp,
         _memCache->setHeightField( key, CacheSpec(), newHF.get() );
     }
 
+    _heightFieldFlights.leave( flightKey, newHF.get(), isShareable(progress) );
+
     //TODO: why not just newHF.release()? -gw
     return newHF.valid() ? new osg::HeightField( *newHF.get() ) : 0L;
 }
 
+bool
+TileSource::isShareable( ProgressCallback* progress ) const
+{
+    // An empty result from a canceled or failed-but-retryable request doesn't mean
+    // there's no data, so other requesters should try for themselves.
+    return !progress || (!progress->isCanceled() && !progress->needsRetry());
+}
+
+unsigned int
+TileSource::getNumCoalescedRequests() const
+{
+    return _imageFlights.getNumShared() + _heightFieldFlights.getNumShared();
+}
+
+unsigned int
+TileSource::getNumUncoalescedRequests() const
+{
+    return _imageFlights.getNumLeaders() + _heightFieldFlights.getNumLeaders();
+}
+
 osg::HeightField*
 TileSource::createHeightField( const TileKey& key,
                                ProgressCallback* progress)
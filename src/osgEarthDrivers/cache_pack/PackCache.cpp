@@ -0,0 +1,1004 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "PackCacheOptions"
+
+#include <osgEarth/FileUtils>
+#include <osgEarth/ImageUtils>
+#include <osgEarth/StringUtils>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+#include <osgEarth/TMS>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/ReaderWriter>
+#include <osgDB/Registry>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <streambuf>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#ifdef WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  define NOMINMAX
+#  include <windows.h>
+#else
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers;
+using namespace OpenThreads;
+
+#define LC "[PackCache] "
+
+#define PACK_MAGIC   "OEPK"
+#define PACK_VERSION 1
+
+// --------------------------------------------------------------------------
+
+namespace
+{
+    /**
+     * On-disk index record. The index file is a header followed by these
+     * records sorted by _key, so it can be searched in place once mapped.
+     * A record with _size == 0 in the journal marks a deleted tile.
+     */
+    struct IndexEntry
+    {
+        unsigned long long _key;    // lod/x/y, packed the same way as TileKeyID
+        unsigned long long _offset; // byte offset of the encoded tile in the pack file
+        unsigned int       _size;   // encoded size in bytes
+        unsigned int       _time;   // UTC seconds when the tile was written
+
+        bool operator < (const IndexEntry& rhs) const { return _key < rhs._key; }
+    };
+
+    struct IndexHeader
+    {
+        char               _magic[4];
+        unsigned int       _version;
+        unsigned int       _generation; // names the pack and journal files that go with this index
+        unsigned int       _reserved;
+        unsigned long long _count;
+    };
+
+    unsigned long long s_packKey( const TileKey& key )
+    {
+        unsigned int x, y;
+        key.getTileXY( x, y );
+        return
+            ((unsigned long long)(key.getLevelOfDetail() & 0x3F) << 58) |
+            ((unsigned long long)(x & 0x1FFFFFFF) << 29) |
+            ((unsigned long long)(y & 0x1FFFFFFF));
+    }
+
+    unsigned long long s_fileSize( const std::string& filename )
+    {
+        std::ifstream in( filename.c_str(), std::ios::binary );
+        if ( !in.is_open() )
+            return 0;
+        in.seekg( 0, std::ios::end );
+        std::streamoff size = in.tellg();
+        return size > 0 ? (unsigned long long)size : 0;
+    }
+
+    // forces a closed file's contents out to the disk, so that a rename that
+    // follows can't reach the disk before the data does.
+    bool s_syncFile( const std::string& filename )
+    {
+#ifdef WIN32
+        HANDLE file = ::CreateFileA( filename.c_str(), GENERIC_WRITE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            0L, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0L );
+        if ( file == INVALID_HANDLE_VALUE )
+            return false;
+        bool ok = ::FlushFileBuffers( file ) != 0;
+        ::CloseHandle( file );
+        return ok;
+#else
+        int fd = ::open( filename.c_str(), O_RDONLY );
+        if ( fd < 0 )
+            return false;
+        bool ok = ::fsync( fd ) == 0;
+        ::close( fd );
+        return ok;
+#endif
+    }
+
+    // renames a file, replacing the target if it exists. The rename is atomic
+    // on the platforms we support, so readers see either the old or the new file.
+    // The caller syncs the source first; we sync the rename itself.
+    bool s_replaceFile( const std::string& from, const std::string& to )
+    {
+#ifdef WIN32
+        return ::MoveFileExA( from.c_str(), to.c_str(),
+            MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH ) != 0;
+#else
+        if ( ::rename( from.c_str(), to.c_str() ) != 0 )
+            return false;
+
+        // the rename lives in the directory; sync that too (best effort).
+        int fd = ::open( osgDB::getFilePath(to).c_str(), O_RDONLY );
+        if ( fd >= 0 )
+        {
+            ::fsync( fd );
+            ::close( fd );
+        }
+        return true;
+#endif
+    }
+
+    /**
+     * Read-only memory mapping of an entire file.
+     */
+    class MappedFile
+    {
+    public:
+        MappedFile() : _data(0L), _size(0)
+#ifdef WIN32
+            , _file(INVALID_HANDLE_VALUE), _mapping(0L)
+#endif
+        { }
+
+        ~MappedFile() { unmap(); }
+
+        bool map( const std::string& filename )
+        {
+            unmap();
+#ifdef WIN32
+            _file = ::CreateFileA( filename.c_str(), GENERIC_READ,
+                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                0L, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0L );
+            if ( _file == INVALID_HANDLE_VALUE )
+                return false;
+
+            LARGE_INTEGER size;
+            if ( !::GetFileSizeEx( _file, &size ) )
+            {
+                unmap();
+                return false;
+            }
+            if ( size.QuadPart == 0 ) // can't map an empty file
+                return true;
+
+            _mapping = ::CreateFileMappingA( _file, 0L, PAGE_READONLY, 0, 0, 0L );
+            if ( !_mapping )
+            {
+                unmap();
+                return false;
+            }
+            _data = (const char*)::MapViewOfFile( _mapping, FILE_MAP_READ, 0, 0, 0 );
+            if ( !_data )
+            {
+                unmap();
+                return false;
+            }
+            _size = (std::size_t)size.QuadPart;
+#else
+            int fd = ::open( filename.c_str(), O_RDONLY );
+            if ( fd < 0 )
+                return false;
+
+            struct stat st;
+            if ( ::fstat( fd, &st ) != 0 )
+            {
+                ::close( fd );
+                return false;
+            }
+            if ( st.st_size == 0 ) // can't map an empty file
+            {
+                ::close( fd );
+                return true;
+            }
+
+            void* data = ::mmap( 0L, (std::size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+            ::close( fd ); // the mapping keeps its own reference to the file
+            if ( data == MAP_FAILED )
+                return false;
+
+            _data = (const char*)data;
+            _size = (std::size_t)st.st_size;
+#endif
+            return true;
+        }
+
+        void unmap()
+        {
+#ifdef WIN32
+            if ( _data )
+                ::UnmapViewOfFile( _data );
+            if ( _mapping )
+                ::CloseHandle( _mapping );
+            if ( _file != INVALID_HANDLE_VALUE )
+                ::CloseHandle( _file );
+            _mapping = 0L;
+            _file = INVALID_HANDLE_VALUE;
+#else
+            if ( _data )
+                ::munmap( (void*)_data, _size );
+#endif
+            _data = 0L;
+            _size = 0;
+        }
+
+        const char* data() const { return _data; }
+        std::size_t size() const { return _size; }
+
+    private:
+        const char* _data;
+        std::size_t _size;
+#ifdef WIN32
+        HANDLE _file;
+        HANDLE _mapping;
+#endif
+    };
+}
+
+// --------------------------------------------------------------------------
+
+/**
+ * All the cached tiles for one layer (cache ID). Lives in its own folder:
+ *
+ *   tms.xml        layer properties (profile, format, tile size)
+ *   tiles.idx      sorted index; header names the current generation N
+ *   tiles.N.pack   encoded tiles, back to back
+ *   tiles.N.log    journal of index records written since tiles.idx was built
+ *
+ * Readers map tiles.idx and tiles.N.pack and look keys up in place. Writers
+ * append to the pack, then the journal, and keep the journaled records in
+ * memory (_journal) where they override the mapped index. compact() writes
+ * generation N+1 next to the current one and commits it by renaming the
+ * new index over tiles.idx, so a crash at any point leaves a usable cache.
+ */
+class PackLayer : public osg::Referenced
+{
+public:
+    PackLayer( const std::string& path, const std::string& format, unsigned long long remapThreshold ) :
+      _path( path ),
+      _format( format ),
+      _remapThreshold( remapThreshold ),
+      _index( 0L ),
+      _indexCount( 0 ),
+      _generation( 0 ),
+      _packSize( 0 )
+    {
+#if OSG_MIN_VERSION_REQUIRED(2,9,5)
+        _rw = osgDB::Registry::instance()->getReaderWriterForMimeType( _format );
+        if ( !_rw.valid() )
+#endif
+            _rw = osgDB::Registry::instance()->getReaderWriterForExtension( _format );
+
+        if ( !_rw.valid() )
+        {
+            OE_WARN << LC << "Cannot initialize ReaderWriter for format \"" << _format << "\"" << std::endl;
+        }
+
+        open();
+    }
+
+    bool valid() const { return _rw.valid(); }
+
+    bool isCached( const TileKey& key )
+    {
+        Threading::ScopedReadLock lock( _mutex );
+        IndexEntry entry;
+        return find( s_packKey(key), entry );
+    }
+
+    bool getImage( const TileKey& key, osg::ref_ptr<const osg::Image>& out_image )
+    {
+        if ( !_rw.valid() )
+            return false;
+
+        // copy the encoded tile under the lock, then decode it outside, so a slow
+        // decode never holds up a writer (or compaction) waiting to remap.
+        std::string data;
+        {
+            Threading::ScopedReadLock lock( _mutex );
+
+            IndexEntry entry;
+            if ( !find( s_packKey(key), entry ) )
+                return false;
+
+            if ( entry._offset + entry._size <= _packMap.size() )
+            {
+                data.assign( _packMap.data() + entry._offset, entry._size );
+            }
+            else if ( !readTile( entry, data ) )
+            {
+                // written since the pack was last mapped, and unreadable.
+                return false;
+            }
+        }
+
+        MemoryStreamBuf buf( data.data(), data.size() );
+        std::istream in( &buf );
+        osgDB::ReaderWriter::ReadResult rr = getReaderWriter( data.data(), data.size() )->readImage( in );
+
+        if ( rr.error() )
+        {
+            OE_WARN << LC << "Failed to decode tile " << key.str() << ": " << rr.message() << std::endl;
+            return false;
+        }
+
+        out_image = rr.takeImage();
+        return out_image.valid();
+    }
+
+    void setImage( const TileKey& key, const osg::Image* image )
+    {
+        if ( !_rw.valid() || !image )
+            return;
+
+        // store the bytes the image was decoded from if they are on record and
+        // already in this layer's format; otherwise encode it, outside the lock.
+        std::string data;
+        if ( !ImageUtils::getEncodedData(image, _format, data) )
+        {
+            std::stringstream out;
+            osgDB::ReaderWriter::WriteResult wr = _rw->writeImage( *image, out );
+            if ( wr.error() )
+            {
+                OE_WARN << LC << "Failed to encode tile " << key.str() << ": " << wr.message() << std::endl;
+                return;
+            }
+            data = out.str();
+        }
+        if ( data.empty() )
+            return;
+
+        ScopedLock<Mutex> writeLock( _writeMutex );
+
+        if ( !openForWriting() )
+            return;
+
+        IndexEntry entry;
+        entry._key    = s_packKey( key );
+        entry._offset = _packSize;
+        entry._size   = (unsigned int)data.size();
+        entry._time   = (unsigned int)::time(0L);
+
+        // the tile data goes to disk before the journal record that points at it.
+        _pack.write( data.c_str(), data.size() );
+        _pack.flush();
+        if ( _pack.fail() )
+        {
+            OE_WARN << LC << "Failed to write to " << packFileName(_generation) << std::endl;
+            _pack.clear();
+            return;
+        }
+
+        _log.write( (const char*)&entry, sizeof(IndexEntry) );
+        _log.flush();
+
+        {
+            Threading::ScopedWriteLock lock( _mutex );
+            _packSize += data.size();
+            _journal[entry._key] = entry;
+
+            if ( _packSize - _packMap.size() > _remapThreshold )
+                _packMap.map( packFileName(_generation) );
+        }
+    }
+
+    /** Marks every tile written before the timestamp as deleted. */
+    bool purge( int olderThanUTC )
+    {
+        ScopedLock<Mutex> writeLock( _writeMutex );
+
+        std::vector<IndexEntry> removed;
+        {
+            Threading::ScopedReadLock lock( _mutex );
+
+            for( unsigned long long i = 0; i < _indexCount; ++i )
+            {
+                const IndexEntry& e = _index[i];
+                if ( (int)e._time < olderThanUTC && _journal.find(e._key) == _journal.end() )
+                    removed.push_back( e );
+            }
+            for( Journal::const_iterator i = _journal.begin(); i != _journal.end(); ++i )
+            {
+                if ( i->second._size > 0 && (int)i->second._time < olderThanUTC )
+                    removed.push_back( i->second );
+            }
+        }
+
+        if ( removed.empty() )
+            return true;
+
+        if ( !openForWriting() )
+            return false;
+
+        Threading::ScopedWriteLock lock( _mutex );
+        for( std::vector<IndexEntry>::iterator i = removed.begin(); i != removed.end(); ++i )
+        {
+            i->_size = 0;
+            _log.write( (const char*)&(*i), sizeof(IndexEntry) );
+            _journal[i->_key] = *i;
+        }
+        _log.flush();
+
+        OE_INFO << LC << "Purged " << removed.size() << " tiles from " << _path << std::endl;
+        return true;
+    }
+
+    /**
+     * Folds the journal into a new index and copies the live tiles into a new
+     * pack file, dropping deleted and replaced ones. Readers continue against
+     * the current generation until the new one is committed.
+     */
+    bool compact()
+    {
+        ScopedLock<Mutex> writeLock( _writeMutex );
+
+        unsigned int newGen = _generation + 1;
+        std::string newPackName = packFileName( newGen );
+        std::string newIndexName = _path + "/tiles.idx.tmp";
+
+        std::vector<IndexEntry> live;
+        {
+            Threading::ScopedReadLock lock( _mutex );
+
+            if ( _journal.empty() )
+                return true; // nothing to do
+
+            // merge the sorted index with the sorted journal; the journal wins.
+            live.reserve( (std::size_t)_indexCount + _journal.size() );
+            unsigned long long i = 0;
+            Journal::const_iterator j = _journal.begin();
+            while( i < _indexCount || j != _journal.end() )
+            {
+                if ( j == _journal.end() || (i < _indexCount && _index[i]._key < j->first) )
+                {
+                    live.push_back( _index[i++] );
+                }
+                else
+                {
+                    if ( i < _indexCount && _index[i]._key == j->first )
+                        ++i;
+                    if ( j->second._size > 0 )
+                        live.push_back( j->second );
+                    ++j;
+                }
+            }
+
+            // copy the live tiles into the new pack.
+            std::ofstream pack( newPackName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+            if ( !pack.is_open() )
+            {
+                OE_WARN << LC << "Failed to create " << newPackName << std::endl;
+                return false;
+            }
+
+            std::vector<IndexEntry> packed;
+            packed.reserve( live.size() );
+            unsigned long long offset = 0;
+            std::string data;
+            for( std::vector<IndexEntry>::const_iterator e = live.begin(); e != live.end(); ++e )
+            {
+                if ( e->_offset + e->_size <= _packMap.size() )
+                {
+                    pack.write( _packMap.data() + e->_offset, e->_size );
+                }
+                else
+                {
+                    if ( !readTile( *e, data ) )
+                        continue; // unreadable; drop it
+                    pack.write( data.c_str(), data.size() );
+                }
+                packed.push_back( *e );
+                packed.back()._offset = offset;
+                offset += e->_size;
+            }
+            live.swap( packed );
+            pack.close();
+            if ( pack.fail() )
+            {
+                OE_WARN << LC << "Failed to write " << newPackName << std::endl;
+                ::remove( newPackName.c_str() );
+                return false;
+            }
+
+            if ( !writeIndex( newIndexName, newGen, live ) )
+            {
+                ::remove( newPackName.c_str() );
+                return false;
+            }
+
+            // the new pack and index must be on disk before the rename commits them.
+            if ( !s_syncFile( newPackName ) || !s_syncFile( newIndexName ) )
+            {
+                OE_WARN << LC << "Failed to sync compacted files for " << _path << std::endl;
+                ::remove( newIndexName.c_str() );
+                ::remove( newPackName.c_str() );
+                return false;
+            }
+        }
+
+        unsigned int oldGen = _generation;
+        {
+            Threading::ScopedWriteLock lock( _mutex );
+
+            _pack.close();
+            _log.close();
+            _indexMap.unmap();
+            _packMap.unmap();
+
+            // this rename is the commit point.
+            if ( !s_replaceFile( newIndexName, indexFileName() ) )
+            {
+                OE_WARN << LC << "Failed to commit compacted index for " << _path << std::endl;
+                ::remove( newIndexName.c_str() );
+                ::remove( newPackName.c_str() );
+                mapFiles();
+                return false;
+            }
+
+            _generation = newGen;
+            _journal.clear();
+            mapFiles();
+        }
+
+        ::remove( packFileName(oldGen).c_str() );
+        ::remove( logFileName(oldGen).c_str() );
+
+        OE_INFO << LC << "Compacted " << _path << ": " << live.size() << " tiles" << std::endl;
+        return true;
+    }
+
+private:
+    typedef std::map<unsigned long long, IndexEntry> Journal;
+
+    std::string indexFileName() const { return _path + "/tiles.idx"; }
+
+    std::string packFileName( unsigned int gen ) const {
+        std::stringstream buf; buf << _path << "/tiles." << gen << ".pack"; return buf.str(); }
+
+    std::string logFileName( unsigned int gen ) const {
+        std::stringstream buf; buf << _path << "/tiles." << gen << ".log"; return buf.str(); }
+
+    void open()
+    {
+        Threading::ScopedWriteLock lock( _mutex );
+        mapFiles();
+
+        // replay the journal for this generation. A partial trailing record
+        // (from a crash mid-write) is ignored.
+        std::ifstream log( logFileName(_generation).c_str(), std::ios::binary );
+        if ( log.is_open() )
+        {
+            IndexEntry entry;
+            while( log.read( (char*)&entry, sizeof(IndexEntry) ) )
+            {
+                if ( entry._size == 0 || entry._offset + entry._size <= _packSize )
+                    _journal[entry._key] = entry;
+            }
+        }
+
+        OE_DEBUG << LC << "Opened " << _path << ": " << _indexCount << " indexed, "
+            << _journal.size() << " journaled" << std::endl;
+    }
+
+    // maps the index and the pack for the current generation. Caller holds the write lock.
+    void mapFiles()
+    {
+        _index = 0L;
+        _indexCount = 0;
+        _generation = 0;
+
+        if ( _indexMap.map( indexFileName() ) && _indexMap.size() >= sizeof(IndexHeader) )
+        {
+            const IndexHeader* header = (const IndexHeader*)_indexMap.data();
+            if ( ::memcmp( header->_magic, PACK_MAGIC, 4 ) != 0 || header->_version != PACK_VERSION ||
+                 sizeof(IndexHeader) + header->_count * sizeof(IndexEntry) > _indexMap.size() )
+            {
+                OE_WARN << LC << "Ignoring invalid index " << indexFileName() << std::endl;
+                _indexMap.unmap();
+            }
+            else
+            {
+                _generation = header->_generation;
+                _indexCount = header->_count;
+                _index = (const IndexEntry*)(_indexMap.data() + sizeof(IndexHeader));
+            }
+        }
+
+        _packMap.map( packFileName(_generation) );
+        _packSize = s_fileSize( packFileName(_generation) );
+    }
+
+    // opens the pack and journal for appending. Caller holds _writeMutex.
+    bool openForWriting()
+    {
+        if ( _pack.is_open() && _log.is_open() )
+            return true;
+
+        if ( !osgDB::fileExists(_path) && !osgDB::makeDirectory(_path) )
+        {
+            OE_WARN << LC << "Couldn't create path " << _path << std::endl;
+            return false;
+        }
+
+        if ( !_pack.is_open() )
+            _pack.open( packFileName(_generation).c_str(), std::ios::out | std::ios::binary | std::ios::app );
+        if ( !_log.is_open() )
+            _log.open( logFileName(_generation).c_str(), std::ios::out | std::ios::binary | std::ios::app );
+
+        if ( !_pack.is_open() || !_log.is_open() )
+        {
+            OE_WARN << LC << "Failed to open " << _path << " for writing" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // looks up a key in the journal, then the index. Caller holds a lock on _mutex.
+    bool find( unsigned long long key, IndexEntry& out ) const
+    {
+        Journal::const_iterator j = _journal.find( key );
+        if ( j != _journal.end() )
+        {
+            out = j->second;
+            return out._size > 0;
+        }
+
+        if ( _indexCount == 0 )
+            return false;
+
+        IndexEntry probe;
+        probe._key = key;
+        const IndexEntry* end = _index + _indexCount;
+        const IndexEntry* i = std::lower_bound( _index, end, probe );
+        if ( i != end && i->_key == key )
+        {
+            out = *i;
+            return true;
+        }
+        return false;
+    }
+
+    // tiles stored verbatim may be in a different format than the layer's.
+    osgDB::ReaderWriter* getReaderWriter( const char* data, unsigned int size ) const
+    {
+        std::string format = ImageUtils::getEncodedFormat( data, size );
+        if ( !format.empty() && !ImageUtils::isSameImageFormat(format, _format) )
+        {
+            osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension( format );
+            if ( rw )
+                return rw;
+        }
+        return _rw.get();
+    }
+
+    // reads a tile that isn't covered by the current mapping.
+    bool readTile( const IndexEntry& entry, std::string& out ) const
+    {
+        std::ifstream in( packFileName(_generation).c_str(), std::ios::binary );
+        if ( !in.is_open() )
+            return false;
+        in.seekg( (std::streamoff)entry._offset );
+        out.resize( entry._size );
+        in.read( &out[0], entry._size );
+        return !in.fail();
+    }
+
+    bool writeIndex( const std::string& filename, unsigned int generation, const std::vector<IndexEntry>& entries ) const
+    {
+        std::ofstream out( filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+        if ( !out.is_open() )
+        {
+            OE_WARN << LC << "Failed to create " << filename << std::endl;
+            return false;
+        }
+
+        IndexHeader header;
+        ::memset( &header, 0, sizeof(IndexHeader) );
+        ::memcpy( header._magic, PACK_MAGIC, 4 );
+        header._version    = PACK_VERSION;
+        header._generation = generation;
+        header._count      = entries.size();
+
+        out.write( (const char*)&header, sizeof(IndexHeader) );
+        if ( !entries.empty() )
+            out.write( (const char*)&entries[0], entries.size() * sizeof(IndexEntry) );
+        out.close();
+
+        if ( out.fail() )
+        {
+            OE_WARN << LC << "Failed to write " << filename << std::endl;
+            ::remove( filename.c_str() );
+            return false;
+        }
+        return true;
+    }
+
+    std::string        _path;
+    std::string        _format;
+    unsigned long long _remapThreshold;
+
+    osg::ref_ptr<osgDB::ReaderWriter> _rw;
+
+    Threading::ReadWriteMutex _mutex;      // protects the mappings and the journal
+    Mutex                     _writeMutex; // serializes writers and compaction
+
+    MappedFile         _indexMap;
+    MappedFile         _packMap;
+    const IndexEntry*  _index;
+    unsigned long long _indexCount;
+    unsigned int       _generation;
+    unsigned long long _packSize;
+    Journal            _journal;
+
+    std::ofstream      _pack;
+    std::ofstream      _log;
+};
+
+// --------------------------------------------------------------------------
+
+struct AsyncCompact : public TaskRequest
+{
+    AsyncCompact( PackLayer* layer ) : _layer(layer) { }
+
+    void operator()( ProgressCallback* progress ) {
+        osg::ref_ptr<PackLayer> layer = _layer.get();
+        if ( layer.valid() )
+            layer->compact();
+    }
+
+    osg::observer_ptr<PackLayer> _layer;
+};
+
+class PackCache : public Cache
+{
+public:
+    PackCache( const CacheOptions& options )
+      : Cache(options), _options(options)
+    {
+        if ( _options.path().get().empty() || options.getReferenceURI().empty() )
+            _path = _options.path().get();
+        else
+            _path = osgEarth::getFullPath( options.getReferenceURI(), _options.path().get() );
+
+        setName( "pack" );
+
+        OE_INFO << LC << "options: " << _options.getConfig().toString() << std::endl;
+    }
+
+    // just here to satisfy the osg::Object requirements
+    PackCache() { }
+    PackCache( const PackCache& rhs, const osg::CopyOp& op ) { }
+    META_Object(osgEarth,PackCache);
+
+public: // Cache interface
+
+    bool isCached( const TileKey& key, const CacheSpec& spec ) const
+    {
+        PackLayer* layer = const_cast<PackCache*>(this)->getLayer( spec );
+        return layer && layer->isCached( key );
+    }
+
+    bool getImage( const TileKey& key, const CacheSpec& spec, osg::ref_ptr<const osg::Image>& out_image )
+    {
+        PackLayer* layer = getLayer( spec );
+        return layer && layer->getImage( key, out_image );
+    }
+
+    void setImage( const TileKey& key, const CacheSpec& spec, const osg::Image* image )
+    {
+        PackLayer* layer = getLayer( spec );
+        if ( layer )
+            layer->setImage( key, image );
+    }
+
+    void storeProperties( const CacheSpec& spec, const Profile* profile, unsigned int tileSize )
+    {
+        if ( spec.cacheId().empty() || profile == 0L || spec.format().empty() )
+        {
+            OE_WARN << LC << "ILLEGAL: cannot cache a layer without a layer id" << std::endl;
+            return;
+        }
+
+        std::string path = getLayerPath( spec.cacheId() );
+        if ( !osgDB::fileExists(path) && !osgDB::makeDirectory(path) )
+        {
+            OE_WARN << LC << "Couldn't create path " << path << std::endl;
+            return;
+        }
+
+        osg::ref_ptr<TileMap> tileMap = TileMap::create( "", profile, spec.format(), tileSize, tileSize );
+        tileMap->setTitle( spec.name() );
+        TileMapReaderWriter::write( tileMap.get(), path + "/tms.xml" );
+
+        ScopedLock<Mutex> lock( _layersMutex );
+        LayerProperties& props = _properties[spec.cacheId()];
+        props._format   = spec.format();
+        props._tileSize = tileSize;
+        props._profile  = profile;
+    }
+
+    bool loadProperties(
+        const std::string&           cacheId,
+        CacheSpec&                   out_spec,
+        osg::ref_ptr<const Profile>& out_profile,
+        unsigned int&                out_tileSize )
+    {
+        ScopedLock<Mutex> lock( _layersMutex );
+
+        PropertiesByName::const_iterator i = _properties.find( cacheId );
+        if ( i == _properties.end() )
+        {
+            std::string filename = getLayerPath( cacheId ) + "/tms.xml";
+            if ( !osgDB::fileExists(filename) )
+                return false;
+
+            osg::ref_ptr<TileMap> tileMap = TileMapReaderWriter::read( filename, 0L );
+            if ( !tileMap.valid() )
+            {
+                OE_WARN << LC << "Failed to load cache metadata from " << filename << std::endl;
+                return false;
+            }
+
+            LayerProperties props;
+            props._format   = tileMap->getFormat().getExtension();
+            props._tileSize = tileMap->getFormat().getWidth();
+            props._profile  = tileMap->createProfile();
+            i = _properties.insert( std::make_pair(cacheId, props) ).first;
+        }
+
+        out_spec     = CacheSpec( cacheId, i->second._format );
+        out_tileSize = i->second._tileSize;
+        out_profile  = i->second._profile.get();
+        return true;
+    }
+
+    bool compact( bool async )
+    {
+        std::vector< osg::ref_ptr<PackLayer> > layers;
+        {
+            ScopedLock<Mutex> lock( _layersMutex );
+            for( LayersByName::iterator i = _layers.begin(); i != _layers.end(); ++i )
+                layers.push_back( i->second.get() );
+
+            if ( async && !_compactService.valid() )
+                _compactService = new TaskService( "PackCache Compaction Service", 1 );
+        }
+
+        for( unsigned int i = 0; i < layers.size(); ++i )
+        {
+            if ( async )
+                _compactService->add( new AsyncCompact(layers[i].get()) );
+            else
+                layers[i]->compact();
+        }
+        return true;
+    }
+
+    bool purge( const std::string& cacheId, int olderThanUTC, bool async )
+    {
+        osg::ref_ptr<PackLayer> layer;
+        {
+            ScopedLock<Mutex> lock( _layersMutex );
+            LayersByName::iterator i = _layers.find( cacheId );
+            if ( i != _layers.end() )
+                layer = i->second.get();
+        }
+
+        // a layer this session hasn't touched yet is opened from its stored properties.
+        if ( !layer.valid() )
+        {
+            CacheSpec spec;
+            osg::ref_ptr<const Profile> profile;
+            unsigned int tileSize;
+            if ( !loadProperties( cacheId, spec, profile, tileSize ) )
+                return false;
+            layer = getLayer( spec );
+        }
+
+        if ( !layer.valid() || !layer->valid() )
+            return false;
+
+        // purging only writes tombstones; compact() reclaims the space.
+        return layer->purge( olderThanUTC );
+    }
+
+private:
+    std::string getLayerPath( const std::string& cacheId ) const
+    {
+        return _path + "/" + cacheId;
+    }
+
+    // gets the layer for a cache spec, opening it on first use.
+    PackLayer* getLayer( const CacheSpec& spec )
+    {
+        ScopedLock<Mutex> lock( _layersMutex );
+
+        LayersByName::iterator i = _layers.find( spec.cacheId() );
+        if ( i != _layers.end() )
+            return i->second->valid() ? i->second.get() : 0L;
+
+        std::string format = spec.format();
+        if ( format.empty() )
+        {
+            PropertiesByName::const_iterator p = _properties.find( spec.cacheId() );
+            if ( p != _properties.end() )
+                format = p->second._format;
+        }
+
+        PackLayer* layer = new PackLayer(
+            getLayerPath( spec.cacheId() ),
+            format,
+            (unsigned long long)_options.remapThreshold().value() * 1024 * 1024 );
+
+        _layers[spec.cacheId()] = layer;
+        return layer->valid() ? layer : 0L;
+    }
+
+    struct LayerProperties
+    {
+        std::string                 _format;
+        unsigned int                _tileSize;
+        osg::ref_ptr<const Profile> _profile;
+    };
+
+    typedef std::map<std::string, osg::ref_ptr<PackLayer> > LayersByName;
+    typedef std::map<std::string, LayerProperties>          PropertiesByName;
+
+    const PackCacheOptions    _options;
+    std::string               _path;
+    Mutex                     _layersMutex;
+    LayersByName              _layers;
+    PropertiesByName          _properties;
+    osg::ref_ptr<TaskService> _compactService;
+};
+
+//------------------------------------------------------------------------
+
+class PackCacheFactory : public CacheDriver
+{
+public:
+    PackCacheFactory()
+    {
+        supportsExtension( "osgearth_cache_pack", "Memory-mapped pack file cache for osgEarth" );
+    }
+
+    virtual const char* className()
+    {
+        return "Memory-mapped pack file cache for osgEarth";
+    }
+
+    virtual ReadResult readObject(const std::string& file_name, const Options* options) const
+    {
+        if ( !acceptsExtension(osgDB::getLowerCaseFileExtension( file_name )))
+            return ReadResult::FILE_NOT_HANDLED;
+
+        return ReadResult( new PackCache( getCacheOptions(options) ) );
+    }
+};
+
+REGISTER_OSGPLUGIN(osgearth_cache_pack, PackCacheFactory)
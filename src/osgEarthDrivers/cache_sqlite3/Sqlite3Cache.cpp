@@ -19,10 +19,12 @@
 #include "Sqlite3CacheOptions"
 
 #include <osgEarth/FileUtils>
+#include <osgEarth/ImageUtils>
 #include <osgEarth/TaskService>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <osgDB/ReaderWriter>
+#include <osgDB/Registry>
 #if OSG_MIN_VERSION_REQUIRED(2,9,5)
 #  include <osgDB/Options>
 #endif
@@ -39,6 +41,14 @@
 
 #include <sqlite3.h>
 
+#ifdef WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  define NOMINMAX
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
+
 using namespace osgEarth;
 using namespace osgEarth::Drivers;
 using namespace OpenThreads;
@@ -61,9 +71,26 @@ using namespace OpenThreads;
 
 // --------------------------------------------------------------------------
 
+// identifies the calling thread. Thread::CurrentThread() is NULL for threads
+// that OpenThreads did not create (the main thread, GDAL/curl workers, etc.), so
+// it cannot be used to key per-thread connections.
+typedef unsigned long ThreadId;
+
+static
+ThreadId getCurrentThreadId()
+{
+#ifdef WIN32
+    return (ThreadId)::GetCurrentThreadId();
+#else
+    return (ThreadId)::pthread_self();
+#endif
+}
+
+// --------------------------------------------------------------------------
+
 // opens a database connection with default settings.
 static
-sqlite3* openDatabase( const std::string& path, bool serialized )
+sqlite3* openDatabase( const std::string& path, bool serialized, bool wal )
 {
     //Try to create the path if it doesn't exist
     std::string dirPath = osgDB::getFilePath(path);    
@@ -91,6 +118,24 @@ sqlite3* openDatabase( const std::string& path, bool serialized )
     // make sure that writes actually finish
     sqlite3_busy_timeout( db, 60000 );
 
+    if ( wal )
+    {
+        // write-ahead logging lets readers proceed against a snapshot while the
+        // writer connection holds a transaction open. The journal mode is stored
+        // in the file, so this is a no-op after the first connection sets it.
+        char* errMsg = 0L;
+        if ( sqlite3_exec( db, "PRAGMA journal_mode=WAL", 0L, 0L, &errMsg ) != SQLITE_OK )
+        {
+            OE_WARN << LC << "Failed to enable WAL on \"" << path << "\": " << (errMsg ? errMsg : "") << std::endl;
+            sqlite3_free( errMsg );
+        }
+        else
+        {
+            // in WAL mode NORMAL is still safe against corruption and avoids an fsync per commit.
+            sqlite3_exec( db, "PRAGMA synchronous=NORMAL", 0L, 0L, 0L );
+        }
+    }
+
     return db;
 }
 
@@ -104,7 +149,8 @@ public:
     virtual void setImageSync(
         const TileKey& key,
         const CacheSpec& spec,
-        const osg::Image* image ) =0;
+        const osg::Image* image,
+        const std::string& encoded ) =0;
 };
 
 
@@ -312,6 +358,7 @@ struct ImageRecord
     int _created;
     int _accessed;
     osg::ref_ptr<const osg::Image> _image;
+    std::string _encoded; // bytes the image was decoded from, if known
 };
 
 #ifdef INSERT_POOL
@@ -379,6 +426,12 @@ struct LayerTable : public osg::Referenced
 #endif
         _selectSQL = buf.str();
 
+        // initialize the key-only SELECT statement for existence checks. This only
+        // touches the primary key index and never reads the blob.
+        buf.str("");
+        buf << "SELECT 1 FROM \"" << _tableName << "\" WHERE key = ?";
+        _existsSQL = buf.str();
+
         // initialize the UPDATE statement for updating the timestamp of an accessed record
         buf.str("");
         buf << "UPDATE \"" << _tableName << "\" SET accessed = ? "
@@ -420,6 +473,60 @@ struct LayerTable : public osg::Referenced
         _statsDeleted = 0;
     }
 
+    ~LayerTable()
+    {
+        ScopedLock<Mutex> lock( _statementsMutex );
+        for( StatementsByDB::iterator i = _statements.begin(); i != _statements.end(); ++i )
+        {
+            for( int t = 0; t < NUM_STATEMENTS; ++t )
+            {
+                if ( i->second._stmt[t] )
+                    sqlite3_finalize( i->second._stmt[t] );
+            }
+        }
+        _statements.clear();
+    }
+
+    enum StatementType
+    {
+        STMT_SELECT,
+        STMT_EXISTS,
+        STMT_INSERT,
+        STMT_UPDATE_TIME,
+        STMT_UPDATE_TIME_POOL,
+        NUM_STATEMENTS
+    };
+
+    /** Gets a prepared statement of the given type for a database connection, preparing
+        it the first time it's requested. Each connection belongs to one thread, so the
+        returned statement is only ever used by that thread. Call releaseStatement()
+        when done with it instead of sqlite3_finalize(). */
+    sqlite3_stmt* getStatement( sqlite3* db, StatementType type )
+    {
+        sqlite3_stmt*& stmt = getStatementSlot( db, type );
+        if ( !stmt )
+        {
+            const std::string& sql = getSQL( type );
+            int rc = sqlite3_prepare_v2( db, sql.c_str(), sql.length(), &stmt, 0L );
+            if ( rc != SQLITE_OK )
+            {
+                OE_WARN << LC << "Failed to prepare SQL: " << sql << "; " << sqlite3_errmsg(db) << std::endl;
+                stmt = 0L;
+            }
+        }
+        return stmt;
+    }
+
+    /** Resets a statement obtained from getStatement() so it can be reused. */
+    void releaseStatement( sqlite3_stmt* stmt )
+    {
+        if ( stmt )
+        {
+            sqlite3_reset( stmt );
+            sqlite3_clear_bindings( stmt );
+        }
+    }
+
 
     sqlite3_int64 getTableSize(sqlite3* db)
     {
@@ -494,17 +601,9 @@ struct LayerTable : public osg::Referenced
     {
         displayStats();
 
-        sqlite3_stmt* insert = 0L;
-        int rc = sqlite3_prepare_v2( db, _insertSQL.c_str(), _insertSQL.length(), &insert, 0L );
-        if ( rc != SQLITE_OK )
-        {
-            OE_WARN 
-                << LC << "Error preparing SQL: " 
-                << sqlite3_errmsg( db )
-                << "(SQL: " << _insertSQL << ")"
-                << std::endl;
+        sqlite3_stmt* insert = getStatement( db, STMT_INSERT );
+        if ( !insert )
             return false;
-        }
 
         // bind the key string:
         std::string keyStr = rec._key.str();
@@ -526,27 +625,39 @@ struct LayerTable : public osg::Referenced
         }
         sqlite3_bind_int( insert, 4, outBuf.length() );
 #else
-        std::stringstream outStream;
-        _rw->writeImage( *rec._image.get(), outStream, _rwOptions.get() );
-        std::string outBuf = outStream.str();
-        sqlite3_bind_blob( insert, 4, outBuf.c_str(), outBuf.length(), SQLITE_STATIC );
+        // if we have the bytes the image was decoded from (e.g. the PNG from the tile
+        // server) and they are what _rw would produce -- same format, no compressor --
+        // store those verbatim. load() recognizes them by their header.
+        std::string outBuf;
+        if ( !rec._encoded.empty() && _meta._compressor.empty() &&
+             ImageUtils::isSameImageFormat(ImageUtils::getEncodedFormat(rec._encoded.data(), rec._encoded.size()), _meta._format) )
+        {
+            sqlite3_bind_blob( insert, 4, rec._encoded.data(), rec._encoded.length(), SQLITE_STATIC );
+        }
+        else
+        {
+            std::stringstream outStream;
+            _rw->writeImage( *rec._image.get(), outStream, _rwOptions.get() );
+            outBuf = outStream.str();
+            sqlite3_bind_blob( insert, 4, outBuf.c_str(), outBuf.length(), SQLITE_STATIC );
+        }
 #endif
 
         // write to the database:
-        rc = sqlite3_step( insert );
+        int rc = sqlite3_step( insert );
 
         if ( rc != SQLITE_DONE )
         {
             OE_WARN << LC << "SQL INSERT failed for key " << rec._key.str() << ": " 
                 << sqlite3_errmsg( db ) //<< "; tries=" << (1000-tries)
                 << ", rc = " << rc << std::endl;
-            sqlite3_finalize( insert );
+            releaseStatement( insert );
             return false;
         }
         else
         {
             OE_DEBUG << LC << "cache INSERT tile " << rec._key.str() << std::endl;
-            sqlite3_finalize( insert );
+            releaseStatement( insert );
             _statsStored++;
             return true;
         }
@@ -639,51 +750,43 @@ struct LayerTable : public osg::Referenced
 
     bool updateAccessTime( const TileKey& key, int newTimestamp, sqlite3* db )
     { 
-        sqlite3_stmt* update = 0L;
-        int rc = sqlite3_prepare_v2( db, _updateTimeSQL.c_str(), _updateTimeSQL.length(), &update, 0L );
-        if ( rc != SQLITE_OK )
-        {
-            OE_WARN << LC << "Failed to prepare SQL " << _updateTimeSQL << "; " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_stmt* update = getStatement( db, STMT_UPDATE_TIME );
+        if ( !update )
             return false;
-        }
 
         bool success = true;
         sqlite3_bind_int( update, 1, newTimestamp );
         std::string keyStr = key.str();
         sqlite3_bind_text( update, 2, keyStr.c_str(), keyStr.length(), SQLITE_STATIC );
-        rc = sqlite3_step( update );
+        int rc = sqlite3_step( update );
         if ( rc != SQLITE_DONE )
         {
             OE_WARN << LC << "Failed to update timestamp for " << key.str() << " on layer " << _meta._layerName << " rc = " << rc << std::endl;
             success = false;
         }
 
-        sqlite3_finalize( update );
+        releaseStatement( update );
         return success;
     }
 
     bool updateAccessTimePool( const std::string&  keyStr, int newTimestamp, sqlite3* db )
     {
         //OE_WARN << LC << "update access times " << _meta._layerName << " " << keyStr << std::endl;
-        sqlite3_stmt* update = 0L;
-        int rc = sqlite3_prepare_v2( db, _updateTimePoolSQL.c_str(), _updateTimePoolSQL.length(), &update, 0L );
-        if ( rc != SQLITE_OK )
-        {
-            OE_WARN << LC << "Failed to prepare SQL " << _updateTimePoolSQL << "; " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_stmt* update = getStatement( db, STMT_UPDATE_TIME_POOL );
+        if ( !update )
             return false;
-        }
 
         bool success = true;
         sqlite3_bind_int( update, 1, newTimestamp );
         sqlite3_bind_text( update, 2, keyStr.c_str(), keyStr.length(), SQLITE_STATIC );
-        rc = sqlite3_step( update );
+        int rc = sqlite3_step( update );
         if ( rc != SQLITE_DONE )
         {
             OE_WARN << LC << "Failed to update timestamp for " << keyStr << " on layer " << _meta._layerName << " rc = " << rc << std::endl;
             success = false;
         }
 
-        sqlite3_finalize( update );
+        releaseStatement( update );
         return success;
     }
 
@@ -692,23 +795,19 @@ struct LayerTable : public osg::Referenced
         displayStats();
         int imageBufLen = 0;
         
-        sqlite3_stmt* select = 0L;
-        int rc = sqlite3_prepare_v2( db, _selectSQL.c_str(), _selectSQL.length(), &select, 0L );
-        if ( rc != SQLITE_OK )
-        {
-            OE_WARN << LC << "Failed to prepare SQL: " << _selectSQL << "; " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_stmt* select = getStatement( db, STMT_SELECT );
+        if ( !select )
             return false;
-        }
 
         std::string keyStr = key.str();
         sqlite3_bind_text( select, 1, keyStr.c_str(), keyStr.length(), SQLITE_STATIC );
 
-        rc = sqlite3_step( select );
+        int rc = sqlite3_step( select );
         if ( rc != SQLITE_ROW ) // == SQLITE_DONE ) // SQLITE_DONE means "no more rows"
         {
             // cache miss
             OE_DEBUG << LC << "Cache MISS on tile " << key.str() << std::endl;
-            sqlite3_finalize(select);
+            releaseStatement( select );
             return false;
         }
 
@@ -727,7 +826,7 @@ struct LayerTable : public osg::Referenced
         // deserialize the image from the buffer:
         std::string imageString( data, imageBufLen );
         std::stringstream imageBufStream( imageString );
-        osgDB::ReaderWriter::ReadResult rr = _rw->readImage( imageBufStream );
+        osgDB::ReaderWriter::ReadResult rr = getReaderWriter( data, imageBufLen )->readImage( imageBufStream );
 #endif
         if ( rr.error() )
         {
@@ -740,12 +839,42 @@ struct LayerTable : public osg::Referenced
             OE_DEBUG << LC << "Cache HIT on tile " << key.str() << std::endl;
         }
 
-        sqlite3_finalize(select);
+        releaseStatement( select );
 
         _statsLoaded++;
         return output._image.valid();
     }
 
+    /** Gets the ReaderWriter for a stored blob. Tiles stored in their original
+        encoding (see store()) are read with the plugin for that format; everything
+        else was written by _rw. */
+    osgDB::ReaderWriter* getReaderWriter( const char* data, int size ) const
+    {
+        std::string format = ImageUtils::getEncodedFormat( data, size > 0 ? size : 0 );
+        if ( !format.empty() )
+        {
+            osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension( format );
+            if ( rw )
+                return rw;
+        }
+        return _rw.get();
+    }
+
+    /** Checks whether a record exists for the key without reading its data. */
+    bool exists( const TileKey& key, sqlite3* db )
+    {
+        sqlite3_stmt* select = getStatement( db, STMT_EXISTS );
+        if ( !select )
+            return false;
+
+        std::string keyStr = key.str();
+        sqlite3_bind_text( select, 1, keyStr.c_str(), keyStr.length(), SQLITE_STATIC );
+
+        int rc = sqlite3_step( select );
+        releaseStatement( select );
+        return rc == SQLITE_ROW;
+    }
+
     void displayStats()
     {
         osg::Timer_t t = osg::Timer::instance()->tick();
@@ -905,6 +1034,7 @@ struct LayerTable : public osg::Referenced
     }
 
     std::string _selectSQL;
+    std::string _existsSQL;
     std::string _insertSQL;
     std::string _updateTimeSQL;
     std::string _updateTimePoolSQL;
@@ -925,6 +1055,35 @@ struct LayerTable : public osg::Referenced
     int _statsStored;
     int _statsDeleted;
 
+private:
+    struct Statements
+    {
+        Statements() { for( int t = 0; t < NUM_STATEMENTS; ++t ) _stmt[t] = 0L; }
+        sqlite3_stmt* _stmt[NUM_STATEMENTS];
+    };
+    typedef std::map<sqlite3*, Statements> StatementsByDB;
+
+    sqlite3_stmt*& getStatementSlot( sqlite3* db, StatementType type )
+    {
+        // std::map never moves its elements, so the reference stays valid after unlocking.
+        ScopedLock<Mutex> lock( _statementsMutex );
+        return _statements[db]._stmt[type];
+    }
+
+    const std::string& getSQL( StatementType type ) const
+    {
+        switch( type )
+        {
+        case STMT_EXISTS:           return _existsSQL;
+        case STMT_INSERT:           return _insertSQL;
+        case STMT_UPDATE_TIME:      return _updateTimeSQL;
+        case STMT_UPDATE_TIME_POOL: return _updateTimePoolSQL;
+        default:                    return _selectSQL;
+        }
+    }
+
+    Mutex          _statementsMutex;
+    StatementsByDB _statements;
 };
 
 // --------------------------------------------------------------------------
@@ -951,18 +1110,19 @@ struct AsyncPurge : public TaskRequest {
 };
 
 struct AsyncInsert : public TaskRequest {
-    AsyncInsert( const TileKey& key, const CacheSpec& spec, const osg::Image* image, AsyncCache* cache )
-        : _cacheSpec(spec), _key(key), _image(image), _cache(cache) { }
+    AsyncInsert( const TileKey& key, const CacheSpec& spec, const osg::Image* image, const std::string& encoded, AsyncCache* cache )
+        : _cacheSpec(spec), _key(key), _image(image), _encoded(encoded), _cache(cache) { }
 
     void operator()( ProgressCallback* progress ) {
         osg::ref_ptr<AsyncCache> cache = _cache.get();
         if ( cache.valid() )
-            cache->setImageSync( _key, _cacheSpec, _image.get() );
+            cache->setImageSync( _key, _cacheSpec, _image.get(), _encoded );
     }
 
     CacheSpec _cacheSpec;
     TileKey _key;
     osg::ref_ptr<const osg::Image> _image;
+    std::string _encoded;
     osg::observer_ptr<AsyncCache> _cache;
 };
 
@@ -1045,7 +1205,9 @@ public:
         OE_INFO << LC << "Using L2 memory cache" << std::endl;
 #endif
         
-        _db = openDatabase( _databasePath, _options.serialized().value() );
+        // _db is the dedicated writer connection. Readers each get their own connection
+        // (see getOrCreateDbForThread) so they never queue behind a write transaction.
+        _db = openDatabase( _databasePath, _options.serialized().value(), _options.walMode().value() );
 
         if ( _db )
         {
@@ -1077,11 +1239,68 @@ public: // Cache interface
      */
     bool isCached( const TileKey& key, const CacheSpec& spec ) const
     {
-        // this looks ineffecient, but usually when isCached() is called, getImage() will be
-        // called soon thereafter. And this call will load it into the L2 cache so the subsequent
-        // getImage call will not hit the DB again.
-        osg::ref_ptr<const osg::Image> temp;
-        return const_cast<Sqlite3Cache*>(this)->getImage( key, spec, temp );
+        if ( !_db ) return false;
+
+        Sqlite3Cache* self = const_cast<Sqlite3Cache*>(this);
+
+        if ( isCachedInMemory( key, spec ) )
+            return true;
+
+        // query the primary key index only; the blob is never read or decoded.
+        ThreadTable tt = self->getTable( spec.cacheId() );
+        return tt._table && tt._table->exists( key, tt._db );
+    }
+
+    /**
+     * Checks a batch of TileKeys, querying the database for all of them
+     * in a single read transaction.
+     */
+    unsigned int areCached( const std::vector<TileKey>& keys, const CacheSpec& spec, std::vector<bool>& out_cached ) const
+    {
+        out_cached.assign( keys.size(), false );
+        if ( !_db || keys.empty() ) return 0;
+
+        Sqlite3Cache* self = const_cast<Sqlite3Cache*>(this);
+
+        unsigned int count = 0;
+        std::vector<unsigned int> remaining;
+        for( unsigned int i = 0; i < keys.size(); ++i )
+        {
+            if ( isCachedInMemory( keys[i], spec ) )
+            {
+                out_cached[i] = true;
+                ++count;
+            }
+            else
+            {
+                remaining.push_back( i );
+            }
+        }
+
+        if ( remaining.empty() )
+            return count;
+
+        ThreadTable tt = self->getTable( spec.cacheId() );
+        if ( !tt._table )
+            return count;
+
+        // one transaction for the whole batch so sqlite only takes the shared lock once.
+        bool inTransaction = sqlite3_exec( tt._db, "BEGIN", 0L, 0L, 0L ) == SQLITE_OK;
+
+        for( unsigned int j = 0; j < remaining.size(); ++j )
+        {
+            unsigned int i = remaining[j];
+            if ( tt._table->exists( keys[i], tt._db ) )
+            {
+                out_cached[i] = true;
+                ++count;
+            }
+        }
+
+        if ( inTransaction )
+            sqlite3_exec( tt._db, "COMMIT", 0L, 0L, 0L );
+
+        return count;
     }
 
     /**
@@ -1097,14 +1316,15 @@ public: // Cache interface
             return;
         }
 
-        ScopedLock<Mutex> lock( _tableListMutex ); // b/c we're using the base db handle
 #ifdef SPLIT_LAYER_DB
+        ScopedLock<Mutex> lock( _tableListMutex );
         sqlite3* db = getOrCreateMetaDbForThread();
-#else
-        sqlite3* db = getOrCreateDbForThread();
-#endif
         if ( !db )
             return;
+#else
+        ScopedLock<Mutex> lock( _writeMutex );
+        sqlite3* db = _db;
+#endif
 
         //OE_INFO << "Storing metadata for layer \"" << layerName << "\"" << std::endl;
 
@@ -1163,8 +1383,8 @@ public: // Cache interface
     {
         if ( !_db ) return false;
 
-        // wait if we are purging the db
-        ScopedLock<Mutex> lock2( _pendingPurgeMutex );
+        // no need to wait on a purge or insert here: those run on the writer
+        // connection and sqlite isolates this thread's reader connection from them.
 
         // first try the L2 cache.
         if ( _L2cache.valid() )
@@ -1265,6 +1485,11 @@ public: // Cache interface
     {        
         if ( !_db ) return;
 
+        // capture the bytes the image was decoded from now; the caller may release
+        // them once this returns, before an asynchronous write gets to run.
+        std::string encoded;
+        ImageUtils::getEncodedData( image, "", encoded );
+
         if ( _options.asyncWrites() == true )
         {
             // the "pending writes" table is here so that we don't try to write data to
@@ -1288,7 +1513,7 @@ public: // Cache interface
             std::string name = key.str() + spec.cacheId();
             if ( _pendingWrites.find(name) == _pendingWrites.end() )
             {
-                AsyncInsert* req = new AsyncInsert(key, spec, image, this);
+                AsyncInsert* req = new AsyncInsert(key, spec, image, encoded, this);
                 _pendingWrites[name] = req;
                 _writeService->add( req );
             }
@@ -1302,7 +1527,7 @@ public: // Cache interface
         else
         {
 
-            setImageSync( key, spec, image );
+            setImageSync( key, spec, image, encoded );
         }
     }
 
@@ -1337,13 +1562,13 @@ public: // Cache interface
         else
         {
 #ifdef PURGE_GENERAL
-            ScopedLock<Mutex> lock( _pendingPurgeMutex );
+            ScopedLock<Mutex> lock( _writeMutex );
 
             sqlite3_int64 limit = _options.maxSize().value() * 1024 * 1024;
             std::map<std::string, std::pair<sqlite3_int64,int> > layers;
             sqlite3_int64 totalSize = 0;
             for (unsigned int i = 0; i < _layersList.size(); ++i) {
-                ThreadTable tt = getTable( _layersList[i] );
+                ThreadTable tt = getWriteTable( _layersList[i] );
                 if ( tt._table ) {
                     sqlite3_int64 size = tt._table->getTableSize(tt._db);
                     layers[_layersList[i] ].first = size;
@@ -1366,7 +1591,7 @@ public: // Cache interface
 
                         if ( _L2cache.valid() )
                             _L2cache->purge( _layersList[i], olderThanUTC, async );
-                        ThreadTable tt = getTable(_layersList[i]);
+                        ThreadTable tt = getWriteTable(_layersList[i]);
                         if ( tt._table ) {
                             float averageSizePerElement = layers[_layersList[i] ].first * 1.0 /layers[_layersList[i] ].second;
                             int nb = (int)floor(sizeToRemove / averageSizePerElement);
@@ -1378,18 +1603,24 @@ public: // Cache interface
                     }
                 }
             }
-            _pendingPurges.clear();
+            {
+                ScopedLock<Mutex> lock2( _pendingPurgeMutex );
+                _pendingPurges.clear();
+            }
             displayPendingOperations();
 
 #else
-            ScopedLock<Mutex> lock( _pendingPurgeMutex );
+            ScopedLock<Mutex> lock( _writeMutex );
             if ( _L2cache.valid() )
                 _L2cache->purge( layerName, olderThanUTC, async );
 
-            ThreadTable tt = getTable( layerName );
+            ThreadTable tt = getWriteTable( layerName );
             if ( tt._table )
             {
-                _pendingPurges.erase( layerName );
+                {
+                    ScopedLock<Mutex> lock2( _pendingPurgeMutex );
+                    _pendingPurges.erase( layerName );
+                }
 
                 unsigned int maxsize = _options.getSize(layerName);
                 tt._table->checkAndPurgeIfNeeded(tt._db, maxsize * 1024 * 1024);
@@ -1407,7 +1638,8 @@ public: // Cache interface
     {
         if ( !_db ) return false;
 
-        ThreadTable tt = getTable(layerName);
+        ScopedLock<Mutex> lock( _writeMutex );
+        ThreadTable tt = getWriteTable(layerName);
         if ( tt._table )
         {
             tt._table->updateAccessTime( key, newTimestamp, tt._db );
@@ -1422,10 +1654,13 @@ public: // Cache interface
     {
         if ( !_db ) return false;
 
-        ThreadTable tt = getTable(layerName);
-        if ( tt._table )
         {
-            tt._table->updateAccessTimePool( keys, newTimestamp, tt._db );
+            ScopedLock<Mutex> lock( _writeMutex );
+            ThreadTable tt = getWriteTable(layerName);
+            if ( tt._table )
+            {
+                tt._table->updateAccessTimePool( keys, newTimestamp, tt._db );
+            }
         }
 
         {
@@ -1440,9 +1675,10 @@ public: // Cache interface
     void setImageSyncPool( AsyncInsertPool* pool, const std::string& layerName)
     {
         ScopedLock<Mutex> lock( _pendingWritesMutex );
+        ScopedLock<Mutex> wlock( _writeMutex );
         const AsyncInsertPool::PoolContainer& entries = pool->_pool;
         OE_WARN << "write " << entries.size() << std::endl;
-        ThreadTable tt = getTable(layerName);
+        ThreadTable tt = getWriteTable(layerName);
         if ( tt._table )
         {
             sqlite3_stmt* insert;
@@ -1463,6 +1699,28 @@ public: // Cache interface
 
 private:
 
+    // checks the L2 cache and the deferred-write queue.
+    bool isCachedInMemory( const TileKey& key, const CacheSpec& spec ) const
+    {
+        if ( _L2cache.valid() && _L2cache->isCached( key, spec ) )
+            return true;
+
+        if ( _options.asyncWrites() == true )
+        {
+            Sqlite3Cache* self = const_cast<Sqlite3Cache*>(this);
+            ScopedLock<Mutex> lock( self->_pendingWritesMutex );
+#ifdef INSERT_POOL
+            std::map<std::string, osg::ref_ptr<AsyncInsertPool> >::const_iterator it = _pendingWrites.find( spec.cacheId() );
+            if ( it != _pendingWrites.end() && it->second->findImage( key.str() ) )
+                return true;
+#else
+            if ( _pendingWrites.find( key.str() + spec.cacheId() ) != _pendingWrites.end() )
+                return true;
+#endif
+        }
+        return false;
+    }
+
     void displayPendingOperations() {
         if (_pendingWrites.size())
             OE_DEBUG<< LC << "pending insert " << _pendingWrites.size() << std::endl;
@@ -1473,7 +1731,7 @@ private:
         //OE_INFO << LC << "Pending writes: " << std::dec << _writeService->getNumRequests() << std::endl;
     }
 
-    void setImageSync( const TileKey& key, const CacheSpec& spec, const osg::Image* image )
+    void setImageSync( const TileKey& key, const CacheSpec& spec, const osg::Image* image, const std::string& encoded )
     {
         if (_options.maxSize().value() > 0 && _nbRequest > MAX_REQUEST_TO_RUN_PURGE) {
             int t = (int)::time(0L);
@@ -1482,16 +1740,20 @@ private:
         }
         _nbRequest++;
 
-        ThreadTable tt = getTable( spec.cacheId() );
-        if ( tt._table )
         {
-            ::time_t t = ::time(0L);
-            ImageRecord rec( key );
-            rec._created = (int)t;
-            rec._accessed = (int)t;
-            rec._image = image;
-
-            tt._table->store( rec, tt._db );
+            ScopedLock<Mutex> lock( _writeMutex );
+            ThreadTable tt = getWriteTable( spec.cacheId() );
+            if ( tt._table )
+            {
+                ::time_t t = ::time(0L);
+                ImageRecord rec( key );
+                rec._created = (int)t;
+                rec._accessed = (int)t;
+                rec._image = image;
+                rec._encoded = encoded;
+
+                tt._table->store( rec, tt._db );
+            }
         }
 
         if ( _options.asyncWrites() == true )
@@ -1512,11 +1774,11 @@ private:
         // this method assumes the thread already holds a lock on _tableListMutex, which
         // doubles to protect _dbPerThread
 
-        Thread* thread = Thread::CurrentThread();
-        std::map<Thread*,sqlite3*>::const_iterator k = _dbPerThreadLayers[layer].find(thread);
+        ThreadId thread = getCurrentThreadId();
+        std::map<ThreadId,sqlite3*>::const_iterator k = _dbPerThreadLayers[layer].find(thread);
         if ( k == _dbPerThreadLayers[layer].end() )
         {
-            db = openDatabase( layer + _options.path().value(), _options.serialized().value() );
+            db = openDatabase( layer + _options.path().value(), _options.serialized().value(), _options.walMode().value() );
             if ( db )
             {
                 _dbPerThreadLayers[layer][thread] = db;
@@ -1543,11 +1805,11 @@ private:
         // this method assumes the thread already holds a lock on _tableListMutex, which
         // doubles to protect _dbPerThread
 
-        Thread* thread = Thread::CurrentThread();
-        std::map<Thread*,sqlite3*>::const_iterator k = _dbPerThreadMeta.find(thread);
+        ThreadId thread = getCurrentThreadId();
+        std::map<ThreadId,sqlite3*>::const_iterator k = _dbPerThreadMeta.find(thread);
         if ( k == _dbPerThreadMeta.end() )
         {
-            db = openDatabase( _options.path().value(), _options.serialized().value() );
+            db = openDatabase( _options.path().value(), _options.serialized().value(), _options.walMode().value() );
             if ( db )
             {
                 _dbPerThreadMeta[thread] = db;
@@ -1574,11 +1836,11 @@ private:
         // this method assumes the thread already holds a lock on _tableListMutex, which
         // doubles to protect _dbPerThread
 
-        Thread* thread = Thread::CurrentThread();
-        std::map<Thread*,sqlite3*>::const_iterator k = _dbPerThread.find(thread);
+        ThreadId thread = getCurrentThreadId();
+        std::map<ThreadId,sqlite3*>::const_iterator k = _dbPerThread.find(thread);
         if ( k == _dbPerThread.end() )
         {
-            db = openDatabase( _databasePath, _options.serialized().value() );
+            db = openDatabase( _databasePath, _options.serialized().value(), _options.walMode().value() );
             if ( db )
             {
                 _dbPerThread[thread] = db;
@@ -1599,7 +1861,7 @@ private:
 #endif
 
     // gets the layer table for the specified layer name, creating it if it does
-    // not already exist...
+    // not already exist, paired with the calling thread's reader connection.
     ThreadTable getTable( const std::string& tableName )
     {
         ScopedLock<Mutex> lock( _tableListMutex );
@@ -1609,6 +1871,24 @@ private:
 #else
         sqlite3* db = getOrCreateDbForThread();
 #endif
+        return getTable( tableName, db );
+    }
+
+    // gets the layer table paired with the writer connection. The caller
+    // must hold _writeMutex for as long as it uses the returned connection.
+    ThreadTable getWriteTable( const std::string& tableName )
+    {
+#ifdef SPLIT_LAYER_DB
+        return getTable( tableName );
+#else
+        ScopedLock<Mutex> lock( _tableListMutex );
+        return getTable( tableName, _db );
+#endif
+    }
+
+    // assumes the caller holds _tableListMutex.
+    ThreadTable getTable( const std::string& tableName, sqlite3* db )
+    {
         if ( !db )
             return ThreadTable( 0L, 0L );
 
@@ -1658,11 +1938,12 @@ private:
     Mutex _pendingPurgeMutex;
     std::map<std::string, osg::ref_ptr<AsyncPurge> > _pendingPurges;
 
+    Mutex    _writeMutex; // serializes use of the writer connection, _db
     sqlite3* _db;
-    std::map<Thread*,sqlite3*> _dbPerThread;
+    std::map<ThreadId,sqlite3*> _dbPerThread;
 
-    std::map<std::string, std::map<Thread*,sqlite3*> > _dbPerThreadLayers;
-    std::map<Thread*,sqlite3*> _dbPerThreadMeta;
+    std::map<std::string, std::map<ThreadId,sqlite3*> > _dbPerThreadLayers;
+    std::map<ThreadId,sqlite3*> _dbPerThreadMeta;
 
     osg::ref_ptr<MemCache> _L2cache;
 
@@ -67,7 +67,13 @@ namespace
                 if ( node->asGroup()->getNumChildren() > 0 )
                 {
                     StreamingTile* tile = static_cast<StreamingTile*>( node->asGroup()->getChild(0) );
-                    tile->servicePendingImageRequests( _mapf, nv->getFrameStamp()->getFrameNumber() );
+
+                    // distance from the eye relative to the tile's size, mapped to [0..1):
+                    const osg::BoundingSphere& bs = node->getBound();
+                    float range = nv->getDistanceToViewPoint( bs.center(), true );
+                    float viewFactor = range > 0.0f ? range / (range + bs.radius()) : 0.0f;
+
+                    tile->servicePendingImageRequests( _mapf, nv->getFrameStamp()->getFrameNumber(), viewFactor );
                 }
             }
             traverse( node, nv );
@@ -52,6 +52,10 @@ _numLoadingThreads( 0 )
     _alwaysUpdate = true;
     _numLoadingThreads = computeLoadingThreads(_loadingPolicy);
 
+    // let the elevation and imagery loading threads run each other's requests:
+    if ( _loadingPolicy.workStealing() == true )
+        _loadingWorkGroup = new TaskWorkGroup();
+
     OE_INFO << LC << "Using a total of " << _numLoadingThreads << " loading threads " << std::endl;
 }
 
@@ -234,6 +238,7 @@ StreamingTerrain::updateTraversal( osg::NodeVisitor& nv )
             // update the neighbor list for each tile.
             refreshFamily( _update_mapf.getMapInfo(), tile->getKey(), tile->getFamily(), true );
 
+            tile->cancelStaleRequests( stamp );
             tile->servicePendingElevationRequests( _update_mapf, stamp, true );                   
             tile->serviceCompletedRequests( _update_mapf, true );
         }
@@ -278,6 +283,8 @@ StreamingTerrain::getElevationTaskService()
     if (!service)
     {
         service = createTaskService( "elevation", ELEVATION_TASK_SERVICE_ID, 1 );
+        if ( _loadingWorkGroup.valid() )
+            service->setWorkGroup( _loadingWorkGroup.get() );
     }
     return service;
 }
@@ -293,6 +300,8 @@ StreamingTerrain::getImageryTaskService(int layerId)
         buf << "layer " << layerId;
         std::string bufStr = buf.str();
         service = createTaskService( bufStr, layerId, 1 );
+        if ( _loadingWorkGroup.valid() )
+            service->setWorkGroup( _loadingWorkGroup.get() );
     }
     return service;
 }
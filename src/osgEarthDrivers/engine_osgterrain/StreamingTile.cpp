@@ -96,7 +96,7 @@ namespace
     struct TileColorLayerRequest : public TileLayerRequest
     {
         TileColorLayerRequest( const TileKey& key, const MapFrame& mapf, OSGTileFactory* tileFactory, UID layerUID )
-            : TileLayerRequest( key, mapf, tileFactory ), _layerUID(layerUID) { }
+            : TileLayerRequest( key, mapf, tileFactory ), _layerUID(layerUID), _service(0L) { }
 
         void operator()( ProgressCallback* progress )
         {
@@ -111,6 +111,11 @@ namespace
             }
         }
         UID _layerUID;
+
+        // the layer's task service, looked up once when the request is made so the
+        // CULL traversal doesn't have to find it every frame. The terrain keeps its
+        // task services for its whole life.
+        TaskService* _service;
     };
 
     struct TileElevationLayerRequest : public TileLayerRequest
@@ -207,7 +212,9 @@ _elevationLayerDirty   ( false ),
 _colorLayersDirty      ( false ),
 _elevationLayerUpToDate( true ),
 _elevationLOD          ( key.getLevelOfDetail() ),
-_useTileGenRequest     ( true )
+_useTileGenRequest     ( true ),
+_viewFactor            ( 1.0f ),
+_lastCullStamp         ( 0 )
 {
     // because the lowest LOD (1) is always loaded fully:
     _elevationLayerUpToDate = _key.getLevelOfDetail() <= 1;
@@ -369,6 +376,53 @@ StreamingTile::readyForNewImagery(ImageLayer* layer, int currentLOD)
 
 #define PRI_IMAGE_OFFSET 0.1f // priority offset of imagery relative to elevation
 #define PRI_LAYER_OFFSET 0.1f // priority offset of image layer(x) vs. image layer(x+1)
+#define PRI_VIEW_RANGE   0.5f // range of the camera-distance term; keeps it below the LOD spacing
+#define PRI_VIEW_EPSILON 0.01f // smallest priority change worth moving a queued request for
+
+// The task queue runs the lowest priority value first, so the view term grows with
+// the distance from the camera.
+
+float
+StreamingTile::getImageryPriority() const
+{
+    const StreamingTerrain* terrain = getStreamingTerrain();
+    float view = PRI_VIEW_RANGE * _viewFactor;
+
+    // in image-sequential mode, we want to prioritize lower-LOD imagery since it
+    // needs to come in before higher-resolution stuff. 
+    if ( terrain->getLoadingPolicy().mode() == LoadingPolicy::MODE_SEQUENTIAL )
+    {
+        return -(float)_key.getLevelOfDetail() + PRI_IMAGE_OFFSET + view;
+    }
+
+    // in image-preemptive mode, the highest LOD should get higher load priority:
+    else // MODE_PREEMPTIVE
+    {
+        return PRI_IMAGE_OFFSET + (float)_key.getLevelOfDetail() + view;
+    }
+}
+
+float
+StreamingTile::getElevationPriority() const
+{
+    return (float)_key.getLevelOfDetail() + PRI_VIEW_RANGE * _viewFactor;
+}
+
+// moves a queued request to reflect its new priority, but only if it changed enough
+// to matter; re-scoring happens every frame and most changes are tiny.
+void
+StreamingTile::updatePriority( TaskRequest* request, float priority, TaskService* service )
+{
+    if ( request->isPending() )
+    {
+        if ( osg::absolute( request->getPriority() - priority ) > PRI_VIEW_EPSILON )
+            service->reprioritize( request, priority );
+    }
+    else if ( request->isIdle() )
+    {
+        request->setPriority( priority );
+    }
+}
 
 void
 StreamingTile::installRequests( const MapFrame& mapf, int stamp )
@@ -406,7 +460,7 @@ StreamingTile::resetElevationRequests( const MapFrame& mapf )
 
     // this request will load real elevation data for the tile:
     _elevRequest = new TileElevationLayerRequest(_key, mapf, terrain->getTileFactory());
-    float priority = (float)_key.getLevelOfDetail();
+    float priority = getElevationPriority();
     _elevRequest->setPriority( priority );
     std::stringstream ss;
     ss << "TileElevationLayerRequest " << _key.str() << std::endl;
@@ -436,30 +490,17 @@ StreamingTile::updateImagery( ImageLayer* imageLayer, const MapFrame& mapf, OSGT
     StreamingTerrain* terrain = getStreamingTerrain();
 
     // imagery is slighty higher priority than elevation data
-    TaskRequest* r = new TileColorLayerRequest( _key, mapf, tileFactory, imageLayer->getUID() );
+    TileColorLayerRequest* r = new TileColorLayerRequest( _key, mapf, tileFactory, imageLayer->getUID() );
+    r->_service = terrain->getImageryTaskService( imageLayer->getUID() );
     std::stringstream ss;
     ss << "TileColorLayerRequest " << _key.str() << std::endl;
     std::string ssStr;
     ssStr = ss.str();
     r->setName( ssStr );
     r->setState( osgEarth::TaskRequest::STATE_IDLE );
+    r->setPriority( getImageryPriority() );
 
-    // in image-sequential mode, we want to prioritize lower-LOD imagery since it
-    // needs to come in before higher-resolution stuff. 
-    if ( terrain->getLoadingPolicy().mode() == LoadingPolicy::MODE_SEQUENTIAL )
-    {
-        r->setPriority( -(float)_key.getLevelOfDetail() + PRI_IMAGE_OFFSET );
-    }
-
-    // in image-preemptive mode, the highest LOD should get higher load priority:
-    else // MODE_PREEMPTIVE
-    {
-        r->setPriority( PRI_IMAGE_OFFSET + (float)_key.getLevelOfDetail());
-    }
-
-    r->setProgressCallback( new StampedProgressCallback( 
-        r,
-        terrain->getImageryTaskService( imageLayer->getUID() ) ) );
+    r->setProgressCallback( new StampedProgressCallback( r, r->_service ) );
 
     //If we already have a request for this layer, remove it from the list and use the new one
     for( TaskRequestList::iterator i = _requests.begin(); i != _requests.end(); )
@@ -477,11 +518,14 @@ StreamingTile::updateImagery( ImageLayer* imageLayer, const MapFrame& mapf, OSGT
 
 // This method is called during the UPDATE TRAVERSAL in StreamingTerrain.
 void
-StreamingTile::servicePendingImageRequests( const MapFrame& mapf, int stamp )
+StreamingTile::servicePendingImageRequests( const MapFrame& mapf, int stamp, float viewFactor )
 {       
     // Don't do anything until we have been added to the scene graph
     if ( !_hasBeenTraversed ) return;
 
+    _viewFactor = viewFactor;
+    _lastCullStamp = stamp;
+
     // install our requests if they are not already installed:
     if ( !_requestsInstalled )
     {
@@ -489,9 +533,12 @@ StreamingTile::servicePendingImageRequests( const MapFrame& mapf, int stamp )
         installRequests( mapf, stamp );
     }
 
+    float priority = getImageryPriority();
+
     for( TaskRequestList::iterator i = _requests.begin(); i != _requests.end(); ++i )
     {
         TileColorLayerRequest* r = static_cast<TileColorLayerRequest*>( i->get() );
+        TaskService* service = r->_service;
 
         //If a request has been marked as IDLE, the TaskService has tried to service it
         //and it was either deemed out of date or was cancelled, so we need to add it again.
@@ -499,13 +546,55 @@ StreamingTile::servicePendingImageRequests( const MapFrame& mapf, int stamp )
         {
             //OE_NOTICE << "Queuing IR (" << _key.str() << ")" << std::endl;
             r->setStamp( stamp );
-            getStreamingTerrain()->getImageryTaskService( r->_layerUID )->add( r );
+            r->setPriority( priority );
+            service->add( r );
         }
         else if ( !r->isCompleted() )
         {
             r->setStamp( stamp );
+
+            // the camera may have moved since the request was queued:
+            updatePriority( r, priority, service );
         }
     }    
+
+    // elevation requests are queued during UPDATE, but only the CULL traversal knows
+    // the tile is still in view, so keep their stamps fresh here as well.
+    if ( _elevRequest.valid() && !_elevRequest->isIdle() && !_elevRequest->isCompleted() )
+    {
+        _elevRequest->setStamp( stamp );
+    }
+    if ( _elevPlaceholderRequest.valid() && !_elevPlaceholderRequest->isIdle() && !_elevPlaceholderRequest->isCompleted() )
+    {
+        _elevPlaceholderRequest->setStamp( stamp );
+    }
+}
+
+// This method is called during the UPDATE TRAVERSAL in StreamingTerrain.
+void
+StreamingTile::cancelStaleRequests( int stamp )
+{
+    // request stamps are refreshed by the CULL traversal, so a stale stamp means
+    // the tile is out of view. Canceling a queued request is cheap: the task thread
+    // discards it without running it, and it's re-queued if the tile comes back.
+    for( TaskRequestList::iterator i = _requests.begin(); i != _requests.end(); ++i )
+    {
+        TaskRequest* r = i->get();
+        if ( r->isPending() && !r->wasCanceled() && stamp - r->getStamp() > 2 )
+        {
+            r->cancel();
+        }
+    }
+
+    if ( _elevRequest.valid() && _elevRequest->isPending() && !_elevRequest->wasCanceled() && stamp - _elevRequest->getStamp() > 2 )
+    {
+        _elevRequest->cancel();
+    }
+
+    if ( _elevPlaceholderRequest.valid() && _elevPlaceholderRequest->isPending() && !_elevPlaceholderRequest->wasCanceled() && stamp - _elevPlaceholderRequest->getStamp() > 2 )
+    {
+        _elevPlaceholderRequest->cancel();
+    }
 }
 
 // This method is called from the UPDATE TRAVERSAL, from CustomTerrain::traverse.
@@ -532,9 +621,10 @@ StreamingTile::servicePendingElevationRequests( const MapFrame& mapf, int stamp,
             OE_NOTICE << "Tile (" << _key.str() << ") .. ER not idle" << std::endl;
 #endif
             
+            // (the stamp is refreshed by the CULL traversal; see servicePendingImageRequests)
             if ( !_elevRequest->isCompleted() )
             {
-                _elevRequest->setStamp( stamp );
+                updatePriority( _elevRequest.get(), getElevationPriority(), terrain->getElevationTaskService() );
             }
         }
 
@@ -546,17 +636,19 @@ StreamingTile::servicePendingElevationRequests( const MapFrame& mapf, int stamp,
 #endif
             if ( !_elevPlaceholderRequest->isCompleted() )
             {
-               _elevPlaceholderRequest->setStamp( stamp );
+               updatePriority( _elevPlaceholderRequest.get(), getElevationPriority(), terrain->getElevationTaskService() );
             }
         }
 
-        // otherwise, see if it is legal yet to start a new request:
-        else if ( readyForNewElevation() )
+        // otherwise, see if it is legal yet to start a new request. Don't queue one
+        // for a tile that has left the view; cancelStaleRequests() would only drop it.
+        else if ( stamp - _lastCullStamp <= 2 && readyForNewElevation() )
         {
             if ( _elevationLOD + 1 == _key.getLevelOfDetail() )
             {
                 _elevRequest->setStamp( stamp );
                 _elevRequest->setProgressCallback( new ProgressCallback() );
+                _elevRequest->setPriority( getElevationPriority() );
                 terrain->getElevationTaskService()->add( _elevRequest.get() );
 #ifdef PREEMPTIVE_DEBUG
                 OE_NOTICE << "..queued FE req for (" << _key.str() << ")" << std::endl;
@@ -574,8 +666,7 @@ StreamingTile::servicePendingElevationRequests( const MapFrame& mapf, int stamp,
 
                     er->setStamp( stamp );
                     er->setProgressCallback( new ProgressCallback() );
-                    float priority = (float)_key.getLevelOfDetail();
-                    er->setPriority( priority );
+                    er->setPriority( getElevationPriority() );
                     //TODO: should there be a read lock here when accessing the parent tile's elevation layer? GW
                     osgTerrain::HeightFieldLayer* hfLayer = static_cast<osgTerrain::HeightFieldLayer*>(parentTile->getElevationLayer());
                     er->setParentHF( hfLayer->getHeightField() );
@@ -710,8 +801,7 @@ StreamingTile::serviceCompletedRequests( const MapFrame& mapf, bool tileTableLoc
                         {
                             //Reset the cancelled task to IDLE and give it a new progress callback.
                             r->setState( TaskRequest::STATE_IDLE );
-                            r->setProgressCallback( new StampedProgressCallback(
-                                r, terrain->getImageryTaskService( r->_layerUID )));
+                            r->setProgressCallback( new StampedProgressCallback( r, r->_service ) );
                             r->reset();
                         }
                         else // success..
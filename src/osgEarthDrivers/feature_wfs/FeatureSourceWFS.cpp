@@ -19,6 +19,7 @@
 
 #include <osgEarth/Registry>
 #include <osgEarth/FileUtils>
+#include <osgEarth/Containers>
 #include <osgEarthFeatures/FeatureSource>
 #include <osgEarthFeatures/Filter>
 #include <osgEarthFeatures/BufferFilter>
@@ -29,11 +30,13 @@
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
+#include <OpenThreads/Atomic>
 #include <list>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <ogr_api.h>
+#include <cpl_vsi.h>
 
 #ifdef WIN32
 #include <windows.h>
@@ -48,6 +51,9 @@ using namespace osgEarth::Drivers;
 
 #define OGR_SCOPED_LOCK GDAL_SCOPED_LOCK
 
+// generates unique names for responses placed in GDAL's in-memory file system
+static OpenThreads::Atomic s_vsimemUID;
+
 std::string getTempPath()
 {
 #if defined(WIN32)  && !defined(__CYGWIN__)
@@ -93,7 +99,8 @@ class WFSFeatureSource : public FeatureSource
 {
 public:
     WFSFeatureSource( const WFSFeatureOptions& options ) : FeatureSource( options ),      
-      _options( options )
+      _options( options ),
+      _featureCache( *options.featureCacheSize() )
     {        
     }
 
@@ -231,25 +238,8 @@ public:
         return "";
     }
 
-    void getFeatures(HTTPResponse &response, FeatureList& features)
-    {        
-        //OE_NOTICE << "mimetype=" << response.getMimeType() << std::endl;
-        //TODO:  Handle more than just geojson...
-        std::string ext = getExtensionForMimeType(response.getMimeType());
-        //Save the response to a temp file            
-        std::string tmpPath = getTempPath();        
-        std::string name = getTempName(tmpPath, ext);
-        saveResponse(response, name );
-        //OE_NOTICE << "Saving to " << name << std::endl;        
-
-        //OGRDataSourceH ds = OGROpen(name.c_str(), FALSE, &driver);            
-        OGRDataSourceH ds = OGROpen(name.c_str(), FALSE, NULL);            
-        if (!ds)
-        {
-            OE_NOTICE << "Error opening data with contents " << std::endl
-                << response.getPartAsString(0) << std::endl;
-        }
-
+    void readFeatures(OGRDataSourceH ds, FeatureList& features)
+    {
         OGRLayerH layer = OGR_DS_GetLayer(ds, 0);
         //Read all the features
         if (layer)
@@ -258,22 +248,69 @@ public:
             OGRFeatureH feat_handle;
             while ((feat_handle = OGR_L_GetNextFeature( layer )) != NULL)
             {
-                if ( feat_handle )
+                Feature* f = createFeature( feat_handle );
+                if ( f ) 
                 {
-                    Feature* f = createFeature( feat_handle );
-                    if ( f ) 
-                    {
-                        features.push_back( f );
-                    }
-                    OGR_F_Destroy( feat_handle );
+                    features.push_back( f );
                 }
+                OGR_F_Destroy( feat_handle );
+            }
+        }
+    }
+
+    bool getFeatures(HTTPResponse &response, FeatureList& features)
+    {        
+        std::string ext = getExtensionForMimeType(response.getMimeType());
+        std::string data = response.getPartAsString(0);
+        if ( data.empty() )
+            return false;
+
+        // Hand the response buffer to OGR through GDAL's in-memory file system so we
+        // don't have to write it to disk. The buffer stays owned by us.
+        std::stringstream buf;
+        buf << "/vsimem/osgearth_wfs_" << (++s_vsimemUID) << ext;
+        std::string name = buf.str();
+
+        FILE* fp = VSIFileFromMemBuffer( name.c_str(), (GByte*)&data[0], (vsi_l_offset)data.size(), FALSE );
+        if ( fp )
+        {
+            VSIFCloseL( fp );
+
+            OGRDataSourceH ds = OGROpen(name.c_str(), FALSE, NULL);
+            if ( ds )
+            {
+                readFeatures( ds, features );
+                OGR_DS_Destroy( ds );
+                VSIUnlink( name.c_str() );
+                return true;
             }
+            VSIUnlink( name.c_str() );
         }
 
+        // Not every OGR driver can read from /vsimem/ (older GDAL versions), so fall
+        // back on a temporary file.
+        OE_DEBUG << LC << "Unable to parse response in memory; using a temporary file" << std::endl;
+
+        std::string tmpPath = getTempPath();        
+        name = getTempName(tmpPath, ext);
+        saveResponse(response, name );
+
+        OGRDataSourceH ds = OGROpen(name.c_str(), FALSE, NULL);            
+        if (!ds)
+        {
+            OE_NOTICE << "Error opening data with contents " << std::endl
+                << data << std::endl;
+            remove( name.c_str() );
+            return false;
+        }
+
+        readFeatures( ds, features );
+
         //Destroy the datasource
         OGR_DS_Destroy( ds );
         //Remove the temporary file
         remove( name.c_str() );            
+        return true;
     }
 
     std::string createURL(const Symbology::Query& query)
@@ -305,16 +342,41 @@ public:
         return buf.str();
     }
 
+    /** Copies features so the caller can modify them without touching the cached originals. */
+    void cloneFeatures( const FeatureList& input, FeatureList& output )
+    {
+        for( FeatureList::const_iterator i = input.begin(); i != input.end(); ++i )
+            output.push_back( new Feature( *i->get(), osg::CopyOp::DEEP_COPY_ALL ) );
+    }
+
     //override
     FeatureCursor* createFeatureCursor( const Symbology::Query& query )
     {
+        // The URL encodes the query (tile key or bounds), so it doubles as the cache key.
         std::string url = createURL( query );
-        HTTPResponse response = HTTPClient::get(url);                
+        bool useCache = *_options.featureCacheSize() > 0;
+
         FeatureList features;
+
+        if ( useCache )
+        {
+            FeatureCache::Record rec = _featureCache.get( url );
+            if ( rec.valid() )
+            {
+                cloneFeatures( rec.value(), features );
+                return new FeatureListCursor( features );
+            }
+        }
+
+        HTTPResponse response = HTTPClient::get(url);                
         if (response.isOK())
         {
-            getFeatures(response, features);            
-            std::string data = response.getPartAsString(0);        
+            if ( getFeatures(response, features) && useCache )
+            {
+                FeatureList cached;
+                cloneFeatures( features, cached );
+                _featureCache.insert( url, cached );
+            }
         }
         else
         {
@@ -326,6 +388,9 @@ public:
 private:
     const WFSFeatureOptions _options;  
     osg::ref_ptr< WFSCapabilities > _capabilities;
+
+    typedef LRUCache<std::string, FeatureList> FeatureCache;
+    FeatureCache _featureCache;
 };
 
 
@@ -21,6 +21,7 @@
 #include <osgEarth/FileUtils>
 #include <osgEarth/Registry>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/ThreadingUtils>
 
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
@@ -32,6 +33,7 @@
 #include <sstream>
 #include <stdlib.h>
 #include <memory.h>
+#include <memory>
 
 #include <gdal_priv.h>
 #include <gdalwarper.h>
@@ -41,6 +43,11 @@
 
 #define LC "[GDAL driver] "
 
+// Largest source window (as a multiple of the output sample count) that
+// createHeightField will read in a single block before falling back to
+// per-sample reads.
+#define MAX_WINDOW_OVERSAMPLING 16
+
 // From easyrgb.com
 float Hue_2_RGB( float v1, float v2, float vH )
 {
@@ -630,13 +637,135 @@ GDALDatasetH GDALAutoCreateWarpedVRTforPolarStereographic(
 }
 
 
-class GDALTileSource : public TileSource
+/**
+ * An independently opened source dataset and its (optionally) warped view.
+ */
+struct DatasetHandle
+{
+    DatasetHandle() : _srcDS(0L), _warpedDS(0L) { }
+    GDALDataset* _srcDS;
+    GDALDataset* _warpedDS;
+};
+
+/**
+ * Knows how to open a new DatasetHandle for a DatasetPool.
+ */
+struct DatasetHandleFactory
+{
+    virtual bool openDatasetHandle( DatasetHandle& out_handle ) =0;
+};
+
+static void
+closeDatasetHandle( DatasetHandle& handle )
+{
+    GDAL_SCOPED_LOCK;
+
+    if ( handle._warpedDS && handle._warpedDS != handle._srcDS )
+        delete handle._warpedDS;
+    if ( handle._srcDS )
+        delete handle._srcDS;
+
+    handle = DatasetHandle();
+}
+
+/**
+ * Bounded pool of dataset handles. A GDALDataset cannot be shared across threads,
+ * but separate handles on the same file can be read concurrently; so each reader
+ * checks out a handle of its own, and only opening and closing datasets requires
+ * the global GDAL mutex.
+ */
+class DatasetPool
+{
+public:
+    DatasetPool( DatasetHandleFactory* factory, unsigned int maxSize ) :
+      _factory( factory ),
+      _maxSize( osg::maximum(maxSize, 1u) ),
+      _numOpen( 0 )
+    {
+        //nop
+    }
+
+    ~DatasetPool()
+    {
+        for( std::vector<DatasetHandle>::iterator i = _idle.begin(); i != _idle.end(); ++i )
+            closeDatasetHandle( *i );
+    }
+
+    /** Checks out a handle, opening a new one if the pool is not yet full and
+        blocking until one is released if it is. */
+    bool acquire( DatasetHandle& out_handle )
+    {
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            while( _idle.empty() && _numOpen >= _maxSize )
+                _cond.wait( &_mutex );
+
+            if ( !_idle.empty() )
+            {
+                out_handle = _idle.back();
+                _idle.pop_back();
+                return true;
+            }
+
+            // reserve a slot, and open the new handle outside the pool lock.
+            ++_numOpen;
+        }
+
+        if ( _factory->openDatasetHandle( out_handle ) )
+            return true;
+
+        Threading::ScopedMutexLock lock( _mutex );
+        --_numOpen;
+        _cond.signal();
+        return false;
+    }
+
+    /** Returns a handle checked out with acquire(). */
+    void release( const DatasetHandle& handle )
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        _idle.push_back( handle );
+        _cond.signal();
+    }
+
+private:
+    DatasetHandleFactory*      _factory;
+    unsigned int               _maxSize;
+    unsigned int               _numOpen;
+    std::vector<DatasetHandle> _idle;
+    OpenThreads::Mutex         _mutex;
+    OpenThreads::Condition     _cond;
+};
+
+/**
+ * Checks a handle out of a DatasetPool for the life of the object.
+ */
+struct ScopedDatasetHandle
+{
+    ScopedDatasetHandle( DatasetPool* pool ) : _pool(pool) {
+        _valid = _pool->acquire( _handle ); }
+
+    ~ScopedDatasetHandle() {
+        if ( _valid ) _pool->release( _handle ); }
+
+    bool valid() const { return _valid; }
+    GDALDataset* warpedDS() const { return _handle._warpedDS; }
+
+private:
+    DatasetPool*  _pool;
+    DatasetHandle _handle;
+    bool          _valid;
+};
+
+
+class GDALTileSource : public TileSource, public DatasetHandleFactory
 {
 public:
     GDALTileSource( const TileSourceOptions& options ) :
       TileSource( options ),
       _srcDS(NULL),
       _warpedDS(NULL),
+      _warpPolar(false),
       _options(options),
       _maxDataLevel(30)
     {
@@ -645,6 +774,9 @@ public:
 
     ~GDALTileSource()
     {
+        // close any pooled handles before the primary dataset.
+        _pool.reset();
+
         GDAL_SCOPED_LOCK;
 
         if (_warpedDS != _srcDS)
@@ -703,26 +835,11 @@ public:
             return;
         }
 
-        //If we found more than one file, try to combine them into a single logical dataset
-        if (files.size() > 1)
+        _files = files;
+        _srcDS = openSourceDataset();
+        if ( !_srcDS )
         {
-            _srcDS = (GDALDataset*)build_vrt(files, HIGHEST_RESOLUTION);
-            if (!_srcDS)
-            {
-                OE_WARN << "[osgEarth::GDAL] Failed to build VRT from input datasets" << std::endl;
-                return;
-            }
-        }
-        else
-        {
-            //If we couldn't build a VRT, just try opening the file directly
-            //Open the dataset
-            _srcDS = (GDALDataset*)GDALOpen( files[0].c_str(), GA_ReadOnly );
-            if ( !_srcDS )
-            {
-                OE_WARN << LC << "Failed to open dataset " << files[0] << std::endl;
-                return;
-            }
+            return;
         }
 
         //Create a spatial reference for the source.
@@ -785,26 +902,11 @@ public:
 
         if ( profile && !profile->getSRS()->isEquivalentTo( src_srs.get() ) )
         {
-            if ( profile->getSRS()->isGeographic() && (src_srs->isNorthPolar() || src_srs->isSouthPolar()) )
-            {
-                _warpedDS = (GDALDataset*)GDALAutoCreateWarpedVRTforPolarStereographic(
-                    _srcDS,
-                    src_srs->getWKT().c_str(),
-                    profile->getSRS()->getWKT().c_str(),
-                    GRA_NearestNeighbour,
-                    5.0,
-                    NULL);
-            }
-            else
-            {
-                _warpedDS = (GDALDataset*)GDALAutoCreateWarpedVRT(
-                    _srcDS,
-                    src_srs->getWKT().c_str(),
-                    profile->getSRS()->getWKT().c_str(),
-                    GRA_NearestNeighbour,
-                    5.0,
-                    NULL);
-            }
+            _warpSrcWKT = src_srs->getWKT();
+            _warpDstWKT = profile->getSRS()->getWKT();
+            _warpPolar  = profile->getSRS()->isGeographic() && (src_srs->isNorthPolar() || src_srs->isSouthPolar());
+
+            _warpedDS = createWarpedDataset( _srcDS );
 
             if ( _warpedDS )
             {
@@ -929,16 +1031,103 @@ public:
 
 		//Set the profile
 		setProfile( profile );
+
+        if ( _options.readerPoolSize().isSet() && _options.readerPoolSize().value() > 0 )
+        {
+            _pool.reset( new DatasetPool(this, _options.readerPoolSize().value()) );
+            OE_INFO << LC << "Using a pool of up to " << _options.readerPoolSize().value()
+                << " dataset handles for concurrent reads" << std::endl;
+        }
     }
 
+    /**
+    * Opens the source file(s) found during initialization, combining
+    * multiple files into a single VRT. Call with the GDAL mutex held.
+    */
+    GDALDataset* openSourceDataset()
+    {
+        GDALDataset* ds = 0L;
+
+        //If we found more than one file, try to combine them into a single logical dataset
+        if (_files.size() > 1)
+        {
+            ds = (GDALDataset*)build_vrt(_files, HIGHEST_RESOLUTION);
+            if (!ds)
+            {
+                OE_WARN << "[osgEarth::GDAL] Failed to build VRT from input datasets" << std::endl;
+            }
+        }
+        else if (_files.size() == 1)
+        {
+            //If we couldn't build a VRT, just try opening the file directly
+            //Open the dataset
+            ds = (GDALDataset*)GDALOpen( _files[0].c_str(), GA_ReadOnly );
+            if ( !ds )
+            {
+                OE_WARN << LC << "Failed to open dataset " << _files[0] << std::endl;
+            }
+        }
+        return ds;
+    }
 
     /**
-    * Finds a raster band based on color interpretation 
+    * Wraps a source dataset in a warped VRT if the source SRS differs from the
+    * profile SRS, or returns the source dataset itself if it does not. Call with
+    * the GDAL mutex held.
     */
-    static GDALRasterBand* findBand(GDALDataset *ds, GDALColorInterp colorInterp)
+    GDALDataset* createWarpedDataset( GDALDataset* srcDS )
+    {
+        if ( _warpDstWKT.empty() )
+            return srcDS;
+
+        if ( _warpPolar )
+        {
+            return (GDALDataset*)GDALAutoCreateWarpedVRTforPolarStereographic(
+                srcDS,
+                _warpSrcWKT.c_str(),
+                _warpDstWKT.c_str(),
+                GRA_NearestNeighbour,
+                5.0,
+                NULL);
+        }
+        else
+        {
+            return (GDALDataset*)GDALAutoCreateWarpedVRT(
+                srcDS,
+                _warpSrcWKT.c_str(),
+                _warpDstWKT.c_str(),
+                GRA_NearestNeighbour,
+                5.0,
+                NULL);
+        }
+    }
+
+    // DatasetHandleFactory
+    bool openDatasetHandle( DatasetHandle& out_handle )
     {
         GDAL_SCOPED_LOCK;
 
+        out_handle._srcDS = openSourceDataset();
+        if ( !out_handle._srcDS )
+            return false;
+
+        out_handle._warpedDS = createWarpedDataset( out_handle._srcDS );
+        if ( !out_handle._warpedDS )
+        {
+            delete out_handle._srcDS;
+            out_handle._srcDS = 0L;
+            return false;
+        }
+        return true;
+    }
+
+
+    /**
+    * Finds a raster band based on color interpretation. The caller must either
+    * hold the GDAL mutex or own the dataset handle.
+    */
+    static GDALRasterBand* findBand(GDALDataset *ds, GDALColorInterp colorInterp)
+    {
         for (int i = 1; i <= ds->GetRasterCount(); ++i)
         {
             if (ds->GetRasterBand(i)->GetColorInterpretation() == colorInterp) return ds->GetRasterBand(i);
@@ -962,8 +1151,24 @@ public:
             return NULL;
         }
 
-        GDAL_SCOPED_LOCK;
+        if ( _pool.get() )
+        {
+            ScopedDatasetHandle handle( _pool.get() );
+            return handle.valid() ? readImage( handle.warpedDS(), key ) : 0L;
+        }
+        else
+        {
+            GDAL_SCOPED_LOCK;
+            return readImage( _warpedDS, key );
+        }
+    }
 
+    /**
+    * Reads an image tile from the dataset. The caller must either hold the
+    * GDAL mutex or own the dataset handle.
+    */
+    osg::Image* readImage( GDALDataset* ds, const TileKey& key )
+    {
         int tileSize = _options.tileSize().value();
 
         osg::ref_ptr<osg::Image> image;
@@ -983,11 +1188,11 @@ public:
             int width = int(((xmax - _geotransform[0]) / _geotransform[1]) - off_x);
             int height = int(((ymin - _geotransform[3]) / _geotransform[5]) - off_y);
 
-            if (off_x + width > _warpedDS->GetRasterXSize())
+            if (off_x + width > ds->GetRasterXSize())
             {
-                int oversize_right = off_x + width - _warpedDS->GetRasterXSize();
+                int oversize_right = off_x + width - ds->GetRasterXSize();
                 target_width = target_width - int(float(oversize_right) / width * target_width);
-                width = _warpedDS->GetRasterXSize() - off_x;
+                width = ds->GetRasterXSize() - off_x;
             }
 
             if (off_x < 0)
@@ -999,11 +1204,11 @@ public:
                 off_x = 0;
             }
 
-            if (off_y + height > _warpedDS->GetRasterYSize())
+            if (off_y + height > ds->GetRasterYSize())
             {
-                int oversize_bottom = off_y + height - _warpedDS->GetRasterYSize();
+                int oversize_bottom = off_y + height - ds->GetRasterYSize();
                 target_height = target_height - (int)osg::round(float(oversize_bottom) / height * target_height);
-                height = _warpedDS->GetRasterYSize() - off_y;
+                height = ds->GetRasterYSize() - off_y;
             }
 
 
@@ -1026,14 +1231,14 @@ public:
 
 
 
-            GDALRasterBand* bandRed = findBand(_warpedDS, GCI_RedBand);
-            GDALRasterBand* bandGreen = findBand(_warpedDS, GCI_GreenBand);
-            GDALRasterBand* bandBlue = findBand(_warpedDS, GCI_BlueBand);
-            GDALRasterBand* bandAlpha = findBand(_warpedDS, GCI_AlphaBand);
+            GDALRasterBand* bandRed = findBand(ds, GCI_RedBand);
+            GDALRasterBand* bandGreen = findBand(ds, GCI_GreenBand);
+            GDALRasterBand* bandBlue = findBand(ds, GCI_BlueBand);
+            GDALRasterBand* bandAlpha = findBand(ds, GCI_AlphaBand);
 
-            GDALRasterBand* bandGray = findBand(_warpedDS, GCI_GrayIndex);
+            GDALRasterBand* bandGray = findBand(ds, GCI_GrayIndex);
 
-			GDALRasterBand* bandPalette = findBand(_warpedDS, GCI_PaletteIndex);
+			GDALRasterBand* bandPalette = findBand(ds, GCI_PaletteIndex);
 
             //The pixel format is always RGBA to support transparency
             GLenum pixelFormat = GL_RGBA;
@@ -1251,10 +1456,8 @@ public:
         return image.release();
     }
 
-    bool isValidValue(float v, GDALRasterBand* band)
+    float getBandNoDataValue(GDALRasterBand* band)
     {
-        GDAL_SCOPED_LOCK;
-
         float bandNoData = -32767.0f;
         int success;
         float value = band->GetNoDataValue(&success);
@@ -1262,7 +1465,11 @@ public:
         {
             bandNoData = value;
         }
+        return bandNoData;
+    }
 
+    bool isValidValue(float v, float bandNoData)
+    {
         //Check to see if the value is equal to the bands specified no data
         if (bandNoData == v) return false;
         //Check to see if the value is equal to the user specified nodata value
@@ -1279,50 +1486,119 @@ public:
         return true;
     }
 
-
-    float getInterpolatedValue(GDALRasterBand *band, double x, double y)
+    bool isValidValue(float v, GDALRasterBand* band)
     {
-        double r, c;
-        GDALApplyGeoTransform(_invtransform, x, y, &c, &r);
+        return isValidValue(v, getBandNoDataValue(band));
+    }
 
+    /**
+    * Adjusts a raw pixel coordinate (as computed from the inverse geotransform)
+    * to a sample position, where 0 is the center of the first pixel. Returns
+    * false if the position falls outside the dataset.
+    */
+    static bool toSamplePosition(double& p, int size)
+    {
         //Account for slight rounding errors.  If we are right on the edge of the dataset, clamp to the edge
         double eps = 0.0001;
-        if (osg::equivalent(c, 0, eps)) c = 0;
-        if (osg::equivalent(r, 0, eps)) r = 0;
-        if (osg::equivalent(c, (double)_warpedDS->GetRasterXSize(), eps)) c = _warpedDS->GetRasterXSize();
-        if (osg::equivalent(r, (double)_warpedDS->GetRasterYSize(), eps)) r = _warpedDS->GetRasterYSize();
+        if (osg::equivalent(p, 0, eps)) p = 0;
+        if (osg::equivalent(p, (double)size, eps)) p = size;
 
         //Apply half pixel offset
-        r-= 0.5;
-        c-= 0.5;
+        p -= 0.5;
 
         //Account for the half pixel offset in the geotransform.  If the pixel value is -0.5 we are still technically in the dataset
         //since 0,0 is now the center of the pixel.  So, if are within a half pixel above or a half pixel below the dataset just use
         //the edge values
-        if (c < 0 && c >= -0.5)
+        if (p < 0 && p >= -0.5)
         {
-            c = 0;
+            p = 0;
         }
-        else if (c > _warpedDS->GetRasterXSize()-1 && c <= _warpedDS->GetRasterXSize()-0.5)
+        else if (p > size-1 && p <= size-0.5)
         {
-            c = _warpedDS->GetRasterXSize()-1;
+            p = size-1;
         }
 
-        if (r < 0 && r >= -0.5)
+        //If the location is outside of the pixel values of the dataset, there is no data
+        return !(p < 0 || p > size-1);
+    }
+
+    /**
+    * Computes the pair of pixel indices bracketing a sample position.
+    */
+    static void getSampleBounds(double p, int size, int& pMin, int& pMax)
+    {
+        pMin = osg::maximum((int)floor(p), 0);
+        pMax = osg::maximum(osg::minimum((int)ceil(p), size-1), 0);
+        if (pMin > pMax) pMin = pMax;
+    }
+
+    /**
+    * Blends the four pixel values surrounding a sample position according to the
+    * interpolation option (INTERP_AVERAGE or INTERP_BILINEAR).
+    */
+    float interpolate(double c, double r, int colMin, int colMax, int rowMin, int rowMax,
+                      float llHeight, float ulHeight, float lrHeight, float urHeight) const
+    {
+        float result = 0.0f;
+
+        if ( _options.interpolation() == INTERP_AVERAGE )
         {
-            r = 0;
+            double x_rem = c - (int)c;
+            double y_rem = r - (int)r;
+
+            double w00 = (1.0 - y_rem) * (1.0 - x_rem) * (double)llHeight;
+            double w01 = (1.0 - y_rem) * x_rem * (double)lrHeight;
+            double w10 = y_rem * (1.0 - x_rem) * (double)ulHeight;
+            double w11 = y_rem * x_rem * (double)urHeight;
+
+            result = (float)(w00 + w01 + w10 + w11);
         }
-        else if (r > _warpedDS->GetRasterYSize()-1 && r <= _warpedDS->GetRasterYSize()-0.5)
+        else if ( _options.interpolation() == INTERP_BILINEAR )
         {
-            r = _warpedDS->GetRasterYSize()-1;
+            //Check for exact value
+            if ((colMax == colMin) && (rowMax == rowMin))
+            {
+                //OE_NOTICE << "Exact value" << std::endl;
+                result = llHeight;
+            }
+            else if (colMax == colMin)
+            {
+                //OE_NOTICE << "Vertically" << std::endl;
+                //Linear interpolate vertically
+                result = ((float)rowMax - r) * llHeight + (r - (float)rowMin) * ulHeight;
+            }
+            else if (rowMax == rowMin)
+            {
+                //OE_NOTICE << "Horizontally" << std::endl;
+                //Linear interpolate horizontally
+                result = ((float)colMax - c) * llHeight + (c - (float)colMin) * lrHeight;
+            }
+            else
+            {
+                //OE_NOTICE << "Bilinear" << std::endl;
+                //Bilinear interpolate
+                float r1 = ((float)colMax - c) * llHeight + (c - (float)colMin) * lrHeight;
+                float r2 = ((float)colMax - c) * ulHeight + (c - (float)colMin) * urHeight;
+
+                //OE_INFO << "r1, r2 = " << r1 << " , " << r2 << std::endl;
+                result = ((float)rowMax - r) * r1 + (r - (float)rowMin) * r2;
+            }
         }
 
-        float result = 0.0f;
+        return result;
+    }
+
+
+    float getInterpolatedValue(GDALRasterBand *band, double x, double y)
+    {
+        double r, c;
+        GDALApplyGeoTransform(_invtransform, x, y, &c, &r);
 
-        //If the location is outside of the pixel values of the dataset, just return 0
-        if (c < 0 || r < 0 || c > _warpedDS->GetRasterXSize()-1 || r > _warpedDS->GetRasterYSize()-1)
+        if (!toSamplePosition(c, band->GetXSize()) || !toSamplePosition(r, band->GetYSize()))
             return NO_DATA_VALUE;
 
+        float result = 0.0f;
+
         if ( _options.interpolation() == INTERP_NEAREST )
         {
             band->RasterIO(GF_Read, (int)osg::round(c), (int)osg::round(r), 1, 1, &result, 1, 1, GDT_Float32, 0, 0);
@@ -1333,13 +1609,9 @@ public:
         }
         else
         {
-            int rowMin = osg::maximum((int)floor(r), 0);
-            int rowMax = osg::maximum(osg::minimum((int)ceil(r), (int)(_warpedDS->GetRasterYSize()-1)), 0);
-            int colMin = osg::maximum((int)floor(c), 0);
-            int colMax = osg::maximum(osg::minimum((int)ceil(c), (int)(_warpedDS->GetRasterXSize()-1)), 0);
-
-            if (rowMin > rowMax) rowMin = rowMax;
-            if (colMin > colMax) colMin = colMax;
+            int rowMin, rowMax, colMin, colMax;
+            getSampleBounds(r, band->GetYSize(), rowMin, rowMax);
+            getSampleBounds(c, band->GetXSize(), colMin, colMax);
 
             float urHeight, llHeight, ulHeight, lrHeight;
 
@@ -1359,52 +1631,155 @@ public:
                 return NO_DATA_VALUE;
             }
 
-            if ( _options.interpolation() == INTERP_AVERAGE )
+            result = interpolate(c, r, colMin, colMax, rowMin, rowMax, llHeight, ulHeight, lrHeight, urHeight);
+        }
+
+        return result;
+    }
+
+    /**
+    * Samples a heightfield from a single block read of the source window that
+    * covers the tile, interpolating in memory. Produces the same values as
+    * calling getInterpolatedValue for each sample. Only valid for north-up
+    * datasets; returns false (leaving the heightfield untouched) if the dataset
+    * is rotated, or the window is too large, or the read fails, in which case
+    * the caller should fall back to per-sample reads.
+    */
+    bool readHeightFieldWindow(GDALRasterBand* band, osg::HeightField* hf,
+                               double xmin, double ymin, double dx, double dy)
+    {
+        // the windowed read requires that pixel columns depend only on X and
+        // pixel rows only on Y.
+        if ( _invtransform[2] != 0.0 || _invtransform[4] != 0.0 )
+            return false;
+
+        const int numCols = hf->getNumColumns();
+        const int numRows = hf->getNumRows();
+        const int xsize   = band->GetXSize();
+        const int ysize   = band->GetYSize();
+        const bool nearest = _options.interpolation() == INTERP_NEAREST;
+
+        // precompute the sample positions and bracketing pixels of each column and row.
+        std::vector<double> cs(numCols), rs(numRows);
+        std::vector<int>    cMin(numCols), cMax(numCols), rMin(numRows), rMax(numRows);
+        std::vector<char>   cValid(numCols), rValid(numRows);
+
+        int x0 = xsize, x1 = -1, y0 = ysize, y1 = -1;
+
+        for (int c = 0; c < numCols; ++c)
+        {
+            double geoX = xmin + (dx * (double)c);
+            double px, py;
+            GDALApplyGeoTransform(_invtransform, geoX, ymin, &px, &py);
+            cValid[c] = toSamplePosition(px, xsize);
+            cs[c] = px;
+            if ( cValid[c] )
             {
-                double x_rem = c - (int)c;
-                double y_rem = r - (int)r;
+                if ( nearest ) cMin[c] = cMax[c] = (int)osg::round(px);
+                else getSampleBounds(px, xsize, cMin[c], cMax[c]);
+                x0 = osg::minimum(x0, cMin[c]);
+                x1 = osg::maximum(x1, cMax[c]);
+            }
+        }
 
-                double w00 = (1.0 - y_rem) * (1.0 - x_rem) * (double)llHeight;
-                double w01 = (1.0 - y_rem) * x_rem * (double)lrHeight;
-                double w10 = y_rem * (1.0 - x_rem) * (double)ulHeight;
-                double w11 = y_rem * x_rem * (double)urHeight;
+        for (int r = 0; r < numRows; ++r)
+        {
+            double geoY = ymin + (dy * (double)r);
+            double px, py;
+            GDALApplyGeoTransform(_invtransform, xmin, geoY, &px, &py);
+            rValid[r] = toSamplePosition(py, ysize);
+            rs[r] = py;
+            if ( rValid[r] )
+            {
+                if ( nearest ) rMin[r] = rMax[r] = (int)osg::round(py);
+                else getSampleBounds(py, ysize, rMin[r], rMax[r]);
+                y0 = osg::minimum(y0, rMin[r]);
+                y1 = osg::maximum(y1, rMax[r]);
+            }
+        }
+
+        osg::HeightField::HeightList& heights = hf->getHeightList();
+
+        // no part of the tile falls inside the dataset.
+        if ( x1 < x0 || y1 < y0 )
+        {
+            for (unsigned int i = 0; i < heights.size(); ++i) heights[i] = NO_DATA_VALUE;
+            return true;
+        }
 
-                result = (float)(w00 + w01 + w10 + w11);
+        // pad the window by one pixel:
+        x0 = osg::maximum(x0-1, 0);
+        y0 = osg::maximum(y0-1, 0);
+        x1 = osg::minimum(x1+1, xsize-1);
+        y1 = osg::minimum(y1+1, ysize-1);
+
+        const int w = x1 - x0 + 1;
+        const int h = y1 - y0 + 1;
+
+        // a low-LOD tile over a high-res dataset would need a huge window; per-sample
+        // reads are cheaper in that case.
+        if ( (double)w * (double)h > (double)(MAX_WINDOW_OVERSAMPLING * numCols * numRows) )
+            return false;
+
+        std::vector<float> window(w * h);
+        if ( band->RasterIO(GF_Read, x0, y0, w, h, &window[0], w, h, GDT_Float32, 0, 0) != CE_None )
+            return false;
+
+        const float bandNoData = getBandNoDataValue(band);
+
+        // re-base the column indices into the window:
+        for (int c = 0; c < numCols; ++c)
+        {
+            cMin[c] -= x0;
+            cMax[c] -= x0;
+        }
+
+        for (int r = 0; r < numRows; ++r)
+        {
+            float* out = &heights[r * numCols];
+
+            if ( !rValid[r] )
+            {
+                for (int c = 0; c < numCols; ++c) out[c] = NO_DATA_VALUE;
+                continue;
             }
-            else if ( _options.interpolation() == INTERP_BILINEAR )
+
+            const float* lo = &window[(rMin[r] - y0) * w];
+            const float* hi = &window[(rMax[r] - y0) * w];
+
+            for (int c = 0; c < numCols; ++c)
             {
-                //Check for exact value
-                if ((colMax == colMin) && (rowMax == rowMin))
+                if ( !cValid[c] )
                 {
-                    //OE_NOTICE << "Exact value" << std::endl;
-                    result = llHeight;
+                    out[c] = NO_DATA_VALUE;
                 }
-                else if (colMax == colMin)
+                else if ( nearest )
                 {
-                    //OE_NOTICE << "Vertically" << std::endl;
-                    //Linear interpolate vertically
-                    result = ((float)rowMax - r) * llHeight + (r - (float)rowMin) * ulHeight;
-                }
-                else if (rowMax == rowMin)
-                {
-                    //OE_NOTICE << "Horizontally" << std::endl;
-                    //Linear interpolate horizontally
-                    result = ((float)colMax - c) * llHeight + (c - (float)colMin) * lrHeight;
+                    float v = lo[cMin[c]];
+                    out[c] = isValidValue(v, bandNoData) ? v : NO_DATA_VALUE;
                 }
                 else
                 {
-                    //OE_NOTICE << "Bilinear" << std::endl;
-                    //Bilinear interpolate
-                    float r1 = ((float)colMax - c) * llHeight + (c - (float)colMin) * lrHeight;
-                    float r2 = ((float)colMax - c) * ulHeight + (c - (float)colMin) * urHeight;
+                    float llHeight = lo[cMin[c]];
+                    float lrHeight = lo[cMax[c]];
+                    float ulHeight = hi[cMin[c]];
+                    float urHeight = hi[cMax[c]];
 
-                    //OE_INFO << "r1, r2 = " << r1 << " , " << r2 << std::endl;
-                    result = ((float)rowMax - r) * r1 + (r - (float)rowMin) * r2;
+                    if (!isValidValue(urHeight, bandNoData) || !isValidValue(llHeight, bandNoData) ||
+                        !isValidValue(ulHeight, bandNoData) || !isValidValue(lrHeight, bandNoData))
+                    {
+                        out[c] = NO_DATA_VALUE;
+                    }
+                    else
+                    {
+                        out[c] = interpolate(cs[c], rs[r], cMin[c]+x0, cMax[c]+x0, rMin[r], rMax[r],
+                                             llHeight, ulHeight, lrHeight, urHeight);
+                    }
                 }
             }
         }
 
-        return result;
+        return true;
     }
 
 
@@ -1417,8 +1792,24 @@ public:
             return NULL;
         }
 
-        GDAL_SCOPED_LOCK;
+        if ( _pool.get() )
+        {
+            ScopedDatasetHandle handle( _pool.get() );
+            return handle.valid() ? readHeightField( handle.warpedDS(), key ) : 0L;
+        }
+        else
+        {
+            GDAL_SCOPED_LOCK;
+            return readHeightField( _warpedDS, key );
+        }
+    }
 
+    /**
+    * Samples a heightfield tile from the first band of the dataset. The caller
+    * must either hold the GDAL mutex or own the dataset handle.
+    */
+    osg::HeightField* readHeightField( GDALDataset* ds, const TileKey& key )
+    {
         int tileSize = _options.tileSize().value();
 
         //Allocate the heightfield
@@ -1432,19 +1823,22 @@ public:
             key.getExtent().getBounds(xmin, ymin, xmax, ymax);
 
             //Just read from the first band
-            GDALRasterBand* band = _warpedDS->GetRasterBand(1);
+            GDALRasterBand* band = ds->GetRasterBand(1);
 
             double dx = (xmax - xmin) / (tileSize-1);
             double dy = (ymax - ymin) / (tileSize-1);
 
-            for (int c = 0; c < tileSize; ++c)
+            if ( !readHeightFieldWindow(band, hf.get(), xmin, ymin, dx, dy) )
             {
-                double geoX = xmin + (dx * (double)c);
-                for (int r = 0; r < tileSize; ++r)
+                for (int c = 0; c < tileSize; ++c)
                 {
-                    double geoY = ymin + (dy * (double)r);
-                    float h = getInterpolatedValue(band, geoX, geoY);
-                    hf->setHeight(c, r, h);
+                    double geoX = xmin + (dx * (double)c);
+                    for (int r = 0; r < tileSize; ++r)
+                    {
+                        double geoY = ymin + (dy * (double)r);
+                        float h = getInterpolatedValue(band, geoX, geoY);
+                        hf->setHeight(c, r, h);
+                    }
                 }
             }
         }
@@ -1469,6 +1863,11 @@ private:
 
     GDALDataset* _srcDS;
     GDALDataset* _warpedDS;
+    std::auto_ptr<DatasetPool> _pool;
+    std::vector<std::string> _files;
+    std::string  _warpSrcWKT;
+    std::string  _warpDstWKT;
+    bool         _warpPolar;
     double       _geotransform[6];
     double       _invtransform[6];
 
@@ -17,16 +17,28 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 
+#include <osgEarth/StringUtils>
+
+#include <osg/Math>
 #include <osg/Notify>
+#include <osg/observer_ptr>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <osgDB/Registry>
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 
+#include <OpenThreads/Condition>
+#include <OpenThreads/Mutex>
 #include <OpenThreads/ReentrantMutex>
+#include <OpenThreads/ScopedLock>
 
+#include <list>
+#include <map>
+#include <set>
 #include <sstream>
+#include <streambuf>
+#include <vector>
 #include <string.h>
 
 #include "zip.h"
@@ -34,8 +46,397 @@
 using namespace osg;
 using namespace osgDB;
 
+// serializes writes. Reads go through the archive pool below and don't take it.
 static OpenThreads::ReentrantMutex s_mutex;
 
+// maximum number of archives kept open at once
+#define MAX_OPEN_ARCHIVES 16
+
+// maximum number of idle handles kept per archive. Each concurrent reader of an
+// archive needs its own handle, since a libzip archive can't be read from two
+// threads at once.
+#define MAX_IDLE_HANDLES 4
+
+namespace
+{
+    /**
+     * An open zip archive with an index of its entry names, built once when the
+     * archive is opened. Hands out libzip handles to concurrent readers.
+     */
+    class ZipArchive : public osg::Referenced
+    {
+    public:
+        ZipArchive( const std::string& path ) : _path(path), _busy(0), _closed(false) { }
+
+        const std::string& getPath() const { return _path; }
+
+        /** Whether close() was called; a failed read() on a closed archive should be retried. */
+        bool isClosed() const
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            return _closed;
+        }
+
+        /**
+         * Stops handing out handles, waits for current readers to finish, and
+         * closes every handle, so the file can be rewritten (and, on Windows,
+         * replaced) underneath us.
+         */
+        void close()
+        {
+            std::vector<struct zip*> idle;
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+                _closed = true;
+                while( _busy > 0 )
+                    _released.wait( &_mutex );
+                idle.swap( _idle );
+            }
+            for( std::vector<struct zip*>::iterator i = idle.begin(); i != idle.end(); ++i )
+                zip_close( *i );
+        }
+
+        /** Opens the archive and indexes its entries. Call before sharing the archive. */
+        bool open()
+        {
+            int err = 0;
+            struct zip* za = zip_open( _path.c_str(), 0, &err );
+            if ( !za )
+                return false;
+
+            // open-addressed hash table of entry indices, at most half full.
+            int numFiles = osg::maximum( zip_get_num_files( za ), 0 );
+            unsigned size = 16;
+            while( size < 2u * (unsigned)numFiles )
+                size <<= 1;
+            _names.resize( numFiles );
+            _table.assign( size, -1 );
+
+            for( int i = 0; i < numFiles; ++i )
+            {
+                const char* name = zip_get_name( za, i, 0 );
+                if ( !name )
+                    continue;
+                _names[i] = name;
+
+                // a duplicate name replaces the earlier entry, as the old std::map did.
+                unsigned slot = hash( _names[i] ) & (size - 1);
+                while( _table[slot] >= 0 && _names[_table[slot]] != _names[i] )
+                    slot = (slot + 1) & (size - 1);
+                _table[slot] = i;
+            }
+
+            _idle.push_back( za );
+            return true;
+        }
+
+        /** Index of the named entry, or -1 if it isn't in the archive. */
+        int find( const std::string& entry ) const
+        {
+            if ( _table.empty() )
+                return -1;
+
+            unsigned mask = _table.size() - 1;
+            for( unsigned slot = hash( entry ) & mask; _table[slot] >= 0; slot = (slot + 1) & mask )
+            {
+                if ( _names[_table[slot]] == entry )
+                    return _table[slot];
+            }
+            return -1;
+        }
+
+        /** Reads an entry into a buffer of exactly its uncompressed size. */
+        bool read( int index, std::string& out )
+        {
+            struct zip* za = acquire();
+            if ( !za )
+                return false;
+
+            bool ok = false;
+            struct zip_stat st;
+            if ( zip_stat_index( za, index, 0, &st ) == 0 )
+            {
+                out.resize( (std::string::size_type)st.size );
+                if ( st.size == 0 )
+                {
+                    ok = true;
+                }
+                else
+                {
+                    struct zip_file* zf = zip_fopen_index( za, index, 0 );
+                    if ( zf )
+                    {
+                        std::string::size_type total = 0;
+                        while( total < out.size() )
+                        {
+                            int n = zip_fread( zf, &out[total], out.size() - total );
+                            if ( n <= 0 )
+                                break;
+                            total += n;
+                        }
+                        zip_fclose( zf );
+                        ok = total == out.size();
+                    }
+                }
+            }
+
+            release( za );
+            return ok;
+        }
+
+    protected:
+        virtual ~ZipArchive()
+        {
+            for( std::vector<struct zip*>::iterator i = _idle.begin(); i != _idle.end(); ++i )
+                zip_close( *i );
+        }
+
+    private:
+        // FNV-1a
+        static unsigned hash( const std::string& s )
+        {
+            unsigned h = 2166136261u;
+            for( std::string::const_iterator c = s.begin(); c != s.end(); ++c )
+                h = (h ^ (unsigned char)*c) * 16777619u;
+            return h;
+        }
+
+        struct zip* acquire()
+        {
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+                if ( _closed )
+                    return 0L;
+                ++_busy;
+                if ( !_idle.empty() )
+                {
+                    struct zip* za = _idle.back();
+                    _idle.pop_back();
+                    return za;
+                }
+            }
+
+            // every handle is busy; open another one for this reader. It counts as
+            // busy, so close() waits for it.
+            int err = 0;
+            struct zip* za = zip_open( _path.c_str(), 0, &err );
+            if ( !za )
+                release( 0L );
+            return za;
+        }
+
+        void release( struct zip* za )
+        {
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+                if ( --_busy == 0 )
+                    _released.broadcast();
+                if ( !za )
+                    return;
+                if ( !_closed && _idle.size() < MAX_IDLE_HANDLES )
+                {
+                    _idle.push_back( za );
+                    return;
+                }
+            }
+            zip_close( za );
+        }
+
+        std::string                _path;
+        std::vector<std::string>   _names;  // entry names by index
+        std::vector<int>           _table;  // hash table of entry indices; -1 = empty
+        mutable OpenThreads::Mutex _mutex;
+        OpenThreads::Condition     _released;
+        std::vector<struct zip*>   _idle;
+        unsigned                   _busy;
+        bool                       _closed;
+    };
+
+    /**
+     * Bounded, least-recently-used set of open archives, keyed by the zip
+     * path as it appears in the requested file name.
+     */
+    class ZipArchivePool
+    {
+    public:
+        ZipArchivePool() : _suspends(0) { }
+
+        /** Gets an open archive, opening it if necessary. Returns NULL if the archive doesn't exist. */
+        osg::ref_ptr<ZipArchive> get( const std::string& key, osgDB::ReaderWriter::ReadResult::ReadStatus& out_status )
+        {
+            // an archive we opened but lost out with, or evicted; released outside the lock.
+            osg::ref_ptr<ZipArchive> discard;
+
+            for( ;; )
+            {
+                discard = 0L;
+
+                unsigned suspends;
+                {
+                    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+
+                    // don't hand out (or open) an archive while it's being rewritten,
+                    // and let one thread open a given archive while the rest wait.
+                    while( _writing.find(key) != _writing.end() || _opening.find(key) != _opening.end() )
+                        _changed.wait( &_mutex );
+
+                    Archives::iterator i = _archives.find( key );
+                    if ( i != _archives.end() )
+                    {
+                        _lru.splice( _lru.begin(), _lru, i->second._lru );
+                        return i->second._archive;
+                    }
+
+                    _opening.insert( key );
+                    suspends = _suspends;
+                }
+
+                // resolve, open and index the archive without the pool lock, so reads
+                // of archives that are already open carry on. findDataFile can touch
+                // the disk many times, and indexing a big archive takes a while.
+                std::string zipFile = osgDB::findDataFile( key );
+                zipFile = osgDB::convertFileNameToNativeStyle( zipFile );
+
+                osg::ref_ptr<ZipArchive> archive;
+                if ( !osgDB::fileExists( zipFile ) )
+                {
+                    out_status = osgDB::ReaderWriter::ReadResult::FILE_NOT_FOUND;
+                }
+                else
+                {
+                    osg::notify(osg::INFO) << "ReaderWriterZipFS: opening " << zipFile << std::endl;
+
+                    archive = new ZipArchive( zipFile );
+                    if ( !archive->open() )
+                    {
+                        osg::notify(osg::NOTICE) << "ReaderWriterZipFS couldn't open zip " << zipFile << std::endl;
+                        out_status = osgDB::ReaderWriter::ReadResult::FILE_NOT_HANDLED;
+                        archive = 0L;
+                    }
+                }
+
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+                _opening.erase( key );
+                _changed.broadcast();
+
+                // a writer got to this archive (or one like it) while we were opening
+                // it, so what we found may be stale or half written; wait and start over.
+                if ( _suspends != suspends || _writing.find(zipFile) != _writing.end() )
+                {
+                    discard = archive.get();
+                    while( _writing.find(zipFile) != _writing.end() )
+                        _changed.wait( &_mutex );
+                    continue;
+                }
+
+                if ( !archive.valid() )
+                    return 0L;
+
+                if ( _archives.size() >= MAX_OPEN_ARCHIVES )
+                {
+                    // readers still using the evicted archive hold a reference to it.
+                    // Remember it so a writer can still close it; see suspend().
+                    for( Retired::iterator r = _retired.begin(); r != _retired.end(); )
+                    {
+                        if ( !r->valid() ) r = _retired.erase( r );
+                        else ++r;
+                    }
+                    discard = _archives[_lru.back()]._archive.get();
+                    _retired.push_back( discard.get() );
+                    _archives.erase( _lru.back() );
+                    _lru.pop_back();
+                }
+
+                _lru.push_front( key );
+                Entry& entry = _archives[key];
+                entry._archive = archive.get();
+                entry._lru = _lru.begin();
+                return archive;
+            }
+        }
+
+        /**
+         * Takes an archive (by key or resolved path) out of service before it's
+         * rewritten: closes its handles, once current reads finish, and blocks
+         * get() until resume() is called. The next read reopens and reindexes it.
+         */
+        void suspend( const std::string& key, const std::string& realPath )
+        {
+            // archives remember the path in native style; see get().
+            std::string path = osgDB::convertFileNameToNativeStyle( realPath );
+            std::vector< osg::ref_ptr<ZipArchive> > closing;
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+                ++_writing[key];
+                ++_writing[path];
+                ++_suspends;
+                for( Archives::iterator i = _archives.begin(); i != _archives.end(); )
+                {
+                    if ( i->first == key || i->second._archive->getPath() == path )
+                    {
+                        closing.push_back( i->second._archive.get() );
+                        _lru.erase( i->second._lru );
+                        _archives.erase( i++ );
+                    }
+                    else ++i;
+                }
+
+                // evicted archives that readers are still holding on to.
+                for( Retired::iterator i = _retired.begin(); i != _retired.end(); )
+                {
+                    osg::ref_ptr<ZipArchive> archive = i->get();
+                    if ( !archive.valid() )
+                    {
+                        i = _retired.erase( i );
+                    }
+                    else
+                    {
+                        if ( archive->getPath() == path )
+                            closing.push_back( archive.get() );
+                        ++i;
+                    }
+                }
+            }
+
+            // outside the pool lock, so reads of other archives carry on.
+            for( unsigned i = 0; i < closing.size(); ++i )
+                closing[i]->close();
+        }
+
+        /** Puts an archive back in service after suspend(). */
+        void resume( const std::string& key, const std::string& realPath )
+        {
+            std::string path = osgDB::convertFileNameToNativeStyle( realPath );
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            if ( --_writing[key] == 0 )
+                _writing.erase( key );
+            if ( --_writing[path] == 0 )
+                _writing.erase( path );
+            _changed.broadcast();
+        }
+
+    private:
+        struct Entry
+        {
+            osg::ref_ptr<ZipArchive>         _archive;
+            std::list<std::string>::iterator _lru;
+        };
+        typedef std::map<std::string, Entry> Archives;
+        typedef std::list< osg::observer_ptr<ZipArchive> > Retired;
+
+        OpenThreads::Mutex         _mutex;
+        Archives                   _archives;
+        std::list<std::string>     _lru;
+        Retired                    _retired;
+        std::map<std::string,int>  _writing;   // keys and paths being rewritten
+        std::set<std::string>      _opening;   // keys being opened outside the lock
+        unsigned                   _suspends;  // counts suspend() calls
+        OpenThreads::Condition     _changed;   // signaled when a write or an open finishes
+    };
+
+    ZipArchivePool s_archives;
+}
+
 /**
 * The ZipFS plugin allows you to treat zip files almost like a virtual file system.
 * You can read and write objects from zips using paths like c:/data/models.zip/cow.osg where cow.osg is a file within the models.zip file.
@@ -131,8 +532,6 @@ public:
 
     ReadResult readFile(ObjectType objectType, const std::string &fullFileName, const osgDB::ReaderWriter::Options* options) const
     {
-        OpenThreads::ScopedLock<OpenThreads::ReentrantMutex> lock(s_mutex);
-
         //This plugin allows you to treat zip files almost like virtual directories.  So, the pathname to the file you want in the zip should
         //be of the format c:\data\myzip.zip\images\foo.png
 
@@ -143,14 +542,7 @@ public:
             return ReadResult::FILE_NOT_HANDLED;
         }
 
-        std::string zipFile = fullFileName.substr(0, len + 4);
-        zipFile = osgDB::findDataFile(zipFile);
-        zipFile = osgDB::convertFileNameToNativeStyle( zipFile );
-
-        //Return if the file doesn't exist
-        if (!osgDB::fileExists( zipFile )) return ReadResult::FILE_NOT_FOUND;
-
-        osg::notify(osg::INFO) << "ReaderWriterZipFS::readFile  ZipFile path is " << zipFile << std::endl;
+        std::string zipKey = fullFileName.substr(0, len + 4);
 
         std::string zipEntry = fullFileName.substr(len+4);
 
@@ -175,63 +567,42 @@ public:
              return ReadResult::FILE_NOT_HANDLED;
          }
 
+        //Get the archive from the pool; it stays open and indexed between reads
+        ReadResult::ReadStatus status = ReadResult::FILE_NOT_HANDLED;
+        osg::ref_ptr<ZipArchive> archive = s_archives.get( zipKey, status );
+        if ( !archive.valid() )
+            return status;
 
-        int err;
-
-        //Open the zip file
-        struct zip* pZip = zip_open(zipFile.c_str(), ZIP_CHECKCONS, &err);
-        if (pZip)
+        int zipIndex = archive->find( zipEntry );
+        osg::notify(osg::INFO) << "ReaderWriterZipFS: ZipFile index " << zipIndex << std::endl;
+        if (zipIndex < 0)
         {
-            //List the files
-            /*int numFiles = zip_get_num_files(pZip);
-            osg::notify(osg::NOTICE) << zipFile << " has " << numFiles << " files " << std::endl;
-            for (int i = 0; i < numFiles; ++i)
-            {
-            osg::notify(osg::NOTICE) << i << ": " << zip_get_name(pZip, i, 0) << std::endl;
-            }*/
-
-            //Find the index within the zip file for the given zip entry
-            int zipIndex = zip_name_locate(pZip, zipEntry.c_str(), 0);
-
-            osg::notify(osg::INFO) << "ReaderWriterZipFS: ZipFile index " << zipIndex << std::endl;
-            if (zipIndex < 0)
-            {
-                osg::notify(osg::INFO) << "Could not find zip entry " << zipEntry << " in " << zipFile << std::endl;
-                //Make sure to close the zipfile
-                zip_close(pZip);
-                return ReadResult::FILE_NOT_FOUND;  
-            }
-            
-            //Open the entry for reading
-            zip_file* pZipFile = zip_fopen_index(pZip, zipIndex, 0);
-
-            if (pZipFile) 
-            {
-                //Read the data from the entry into a std::string
-                int dataSize = 0;
-                std::string data;
-                do{
-                    char buffer[1024];
-                    dataSize = zip_fread(pZipFile, buffer, 1024);
-                    if (dataSize > 0)
-                    {
-                       data.append((char*)buffer, dataSize);
-                    }
-                }while (dataSize > 0);
-
-                //Close the zip entry and the actual zip file itself
-                zip_fclose(pZipFile);
-                zip_close(pZip);
+            osg::notify(osg::INFO) << "Could not find zip entry " << zipEntry << " in " << archive->getPath() << std::endl;
+            return ReadResult::FILE_NOT_FOUND;  
+        }
 
-                std::stringstream strstream(data);
-                return readFile(objectType, rw, strstream, options);
-            }
+        std::string data;
+        bool ok = archive->read( zipIndex, data );
+        if ( !ok && archive->isClosed() )
+        {
+            // a writer took the archive out of service mid-read; read the new copy.
+            archive = s_archives.get( zipKey, status );
+            if ( !archive.valid() )
+                return status;
+            zipIndex = archive->find( zipEntry );
+            if ( zipIndex < 0 )
+                return ReadResult::FILE_NOT_FOUND;
+            ok = archive->read( zipIndex, data );
         }
-        else
+        if ( !ok )
         {
-            osg::notify(osg::NOTICE) << "ReaderWriterZipFS::readFile couldn't open zip " << zipFile << " full filename " << fullFileName << std::endl;
+            osg::notify(osg::NOTICE) << "ReaderWriterZipFS::readFile couldn't read " << zipEntry << " from " << archive->getPath() << std::endl;
+            return ReadResult::ERROR_IN_READING_FILE;
         }
-        return ReadResult::FILE_NOT_HANDLED;
+
+        osgEarth::MemoryStreamBuf buf( data.data(), data.size() );
+        std::istream in( &buf );
+        return readFile(objectType, rw, in, options);
     }
 
     WriteResult writeFile(ObjectType objectType, const osg::Object* object, const std::string& fullFileName, const osgDB::ReaderWriter::Options* options) const
@@ -282,6 +653,11 @@ public:
 
         int err;
 
+        //Readers must let go of the archive before we rewrite it; libzip replaces the
+        //file on zip_close, which fails on Windows while other handles are open.
+        std::string zipKey = fullFileName.substr(0, len + 4);
+        s_archives.suspend( zipKey, zipFile );
+
         //Open the zip file
         struct zip* pZip = zip_open(zipFile.c_str(), ZIP_CREATE|ZIP_CHECKCONS, &err);
         if (pZip)
@@ -314,12 +690,15 @@ public:
             }
             zip_close(pZip);
             delete[] data;
+
+            s_archives.resume( zipKey, zipFile );
             return wr;
         }
         else
         {
             osg::notify(osg::NOTICE) << "ReaderWriterZipFS::writeFile couldn't open zip " << zipFile << " full filename " << fullFileName << std::endl;
         }
+        s_archives.resume( zipKey, zipFile );
         return WriteResult::FILE_NOT_HANDLED;      
     }
 };
@@ -17,15 +17,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthFeatures/ExtrudeGeometryFilter>
-#include <osgEarthSymbology/MeshSubdivider>
-#include <osgEarthSymbology/MeshConsolidator>
 #include <osg/Geode>
 #include <osg/Geometry>
 #include <osg/ClusterCullingCallback>
 #include <osgUtil/Tessellator>
-#include <osgUtil/Optimizer>
-#include <osgUtil/SmoothingVisitor>
-#include <osg/Version>
 #include <osgEarth/Version>
 
 #define LC "[ExtrudeGeometryFilter] "
@@ -41,7 +36,9 @@ _mergeGeometry( false ),
 _height( 10.0 ),
 _flatten( true ),
 _wallAngleThresh_deg( 60.0 ),
-_color( osg::Vec4f(1, 1, 1, 1) )
+_color( osg::Vec4f(1, 1, 1, 1) ),
+_wallVertsHint( 0 ),
+_roofVertsHint( 0 )
 {
     reset();
 }
@@ -50,79 +47,347 @@ void
 ExtrudeGeometryFilter::reset()
 {
     _geode = new osg::Geode();
-    _cosWallAngleThresh = cos( _wallAngleThresh_deg );
+    _batches.clear();
+    _cosWallAngleThresh = cos( osg::DegreesToRadians(_wallAngleThresh_deg) );
 }
 
-#undef USE_TEX
+namespace 
+{
+    // Maximum number of vertices in one batch. Past this a new batch (drawable) is
+    // started, so a large layer still culls per batch instead of as a single
+    // drawable. This is about where the optimizer's MERGE_GEOMETRY used to split.
+    const unsigned MAX_BATCH_VERTS = 10000;
 
-bool
-ExtrudeGeometryFilter::extrudeGeometry(const Geometry*         input,
-                                       double                  height,
-                                       bool                    flatten,
-                                       osg::Geometry*          walls,
-                                       osg::Geometry*          topCap,
-                                       osg::Geometry*          bottomCap,
-                                       const osg::Vec4&        color,
-                                       const FilterContext&    cx )
+    // Roofs with no holes and up to this many points (i.e. nearly every building
+    // footprint) are triangulated by ear clipping. Anything else goes through the
+    // GLU tessellator, which copes with holes and big rings better.
+    const unsigned MAX_EAR_CLIP_VERTS = 64;
+
+    inline double s_cross2( const osg::Vec2d& a, const osg::Vec2d& b, const osg::Vec2d& c )
+    {
+        return (b.x()-a.x())*(c.y()-a.y()) - (b.y()-a.y())*(c.x()-a.x());
+    }
+
+    bool s_isEar( const std::vector<osg::Vec2d>& p, const std::vector<unsigned>& idx, int nv, int a, int b, int c )
+    {
+        const osg::Vec2d& A = p[idx[a]];
+        const osg::Vec2d& B = p[idx[b]];
+        const osg::Vec2d& C = p[idx[c]];
+
+        // reflex or degenerate corner
+        if ( s_cross2(A, B, C) <= 0.0 )
+            return false;
+
+        for( int k=0; k<nv; ++k )
+        {
+            if ( k == a || k == b || k == c )
+                continue;
+            const osg::Vec2d& P = p[idx[k]];
+            if ( s_cross2(A, B, P) >= 0.0 && s_cross2(B, C, P) >= 0.0 && s_cross2(C, A, P) >= 0.0 )
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * Triangulates a simple ring by ear clipping, in the plane perpendicular to "up".
+     * Triangles come out counter-clockwise about "up". Returns false if the ring is
+     * degenerate or self-intersecting, in which case the caller should tessellate.
+     */
+    bool s_earClip(const std::vector<osg::Vec3>& ring,
+                   const osg::Vec3&              up,
+                   std::vector<osg::Vec2d>&      p,
+                   std::vector<unsigned>&        idx,
+                   std::vector<unsigned>&        tris )
+    {
+        tris.clear();
+        int n = ring.size();
+        if ( n < 3 )
+            return false;
+
+        // (u, v, up) is right-handed, so counter-clockwise in (u, v) faces up.
+        osg::Vec3d upd( up );
+        osg::Vec3d u = fabs(upd.x()) < 0.9 ? osg::Vec3d(1,0,0) ^ upd : osg::Vec3d(0,1,0) ^ upd;
+        u.normalize();
+        osg::Vec3d v = upd ^ u;
+
+        p.resize( n );
+        for( int i=0; i<n; ++i )
+        {
+            osg::Vec3d r( ring[i] );
+            p[i].set( r * u, r * v );
+        }
+
+        double area = 0.0;
+        for( int i=0; i<n; ++i )
+        {
+            const osg::Vec2d& a = p[i];
+            const osg::Vec2d& b = p[(i+1)%n];
+            area += a.x()*b.y() - b.x()*a.y();
+        }
+        if ( area == 0.0 )
+            return false;
+
+        idx.resize( n );
+        for( int i=0; i<n; ++i )
+            idx[i] = area > 0.0 ? i : n-1-i;
+
+        int nv = n;
+        int guard = 2*nv;
+        for( int b = nv-1; nv > 3; )
+        {
+            // no ear in a full lap: the ring isn't simple.
+            if ( guard-- <= 0 )
+                return false;
+
+            int a = b;   if ( a >= nv ) a = 0;
+            b = a+1;     if ( b >= nv ) b = 0;
+            int c = b+1; if ( c >= nv ) c = 0;
+
+            if ( s_isEar(p, idx, nv, a, b, c) )
+            {
+                tris.push_back( idx[a] );
+                tris.push_back( idx[b] );
+                tris.push_back( idx[c] );
+                idx.erase( idx.begin() + b );
+                --nv;
+                guard = 2*nv;
+            }
+        }
+
+        tris.push_back( idx[0] );
+        tris.push_back( idx[1] );
+        tris.push_back( idx[2] );
+        return true;
+    }
+
+    // appends a triangle, flipping it if necessary so it faces "up".
+    inline void s_addTriangle(osg::DrawElementsUInt* tris, const osg::Vec3Array& verts, unsigned offset,
+                              unsigned i0, unsigned i1, unsigned i2, const osg::Vec3& up )
+    {
+        const osg::Vec3& a = verts[offset+i0];
+        if ( ((verts[offset+i1]-a) ^ (verts[offset+i2]-a)) * up < 0.0f )
+            std::swap( i1, i2 );
+        tris->push_back( offset+i0 );
+        tris->push_back( offset+i1 );
+        tris->push_back( offset+i2 );
+    }
+}
+
+ExtrudeGeometryFilter::MeshBatch&
+ExtrudeGeometryFilter::getBatch( osg::StateSet* stateSet, unsigned numVerts, unsigned numIndices, unsigned reserveVerts )
 {
-    bool made_geom = false;
+    MeshBatch& batch = _batches[stateSet];
 
-#ifdef USE_TEX
-    double tex_width_m = skin? skin->getTextureWidthMeters() : 1.0;
-    double tex_height_m = skin? skin->getTextureHeightMeters() : 1.0;
-    //Adjust the texture height so it is a multiple of the extrusion height
-    bool   tex_repeats_y = skin? skin->getRepeatsVertically() : true;
-#else
-    double tex_width_m = 1.0;
-    double tex_height_m = 1.0;
-    bool   tex_repeats_y = true;
-#endif
+    // if the current batch is full, leave it in the geode and start another one.
+    if ( batch._geom.valid() && batch._verts->size() > 0 && batch._verts->size() + numVerts > MAX_BATCH_VERTS )
+    {
+        batch = MeshBatch();
+    }
 
-    bool isPolygon = input->getComponentType() == Geometry::TYPE_POLYGON;
+    if ( !batch._geom.valid() )
+    {
+        reserveVerts = osg::clampBetween( reserveVerts, numVerts, osg::maximum(numVerts, MAX_BATCH_VERTS) );
+
+        batch._geom = new osg::Geometry();
+        batch._geom->setUseVertexBufferObjects( true );
+        if ( stateSet )
+            batch._geom->setStateSet( stateSet );
+
+        batch._verts = new osg::Vec3Array();
+        batch._verts->reserve( reserveVerts );
+        batch._geom->setVertexArray( batch._verts );
+
+        batch._normals = new osg::Vec3Array();
+        batch._normals->reserve( reserveVerts );
+        batch._geom->setNormalArray( batch._normals );
+        batch._geom->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+
+        batch._colors = new osg::Vec4Array();
+        batch._colors->reserve( reserveVerts );
+        batch._geom->setColorArray( batch._colors );
+        batch._geom->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
+
+        // walls use 6 indices per 4 verts and roofs fewer than 3 per vert.
+        batch._tris = new osg::DrawElementsUInt( GL_TRIANGLES );
+        batch._tris->reserve( osg::maximum(3 * reserveVerts / 2, numIndices) );
+        batch._geom->addPrimitiveSet( batch._tris );
 
-    unsigned pointCount = input->getTotalPointCount();
-    unsigned numVerts = 2 * pointCount;
+        _geode->addDrawable( batch._geom.get() );
+    }
+    return batch;
+}
+
+void
+ExtrudeGeometryFilter::addWalls( bool closed, const osg::Vec4& color )
+{
+    unsigned count = _tops.size();
+    if ( count < 2 )
+        return;
 
-    // create all the OSG geometry components
-    osg::Vec3Array* verts = new osg::Vec3Array( numVerts );
-    walls->setVertexArray( verts );
+    unsigned numSegs = closed ? count : count-1;
 
-#ifdef USE_TEX
-    osg::Vec2Array* texcoords = new osg::Vec2Array( numVerts );
-    walls->setTexCoordArray( 0, texcoords );
-#endif
+    // There is no skin, so disable texturing for the walls to prevent other
+    // textures from being applied to them
+    if ( !_noTextureStateSet.valid() )
+    {
+        _noTextureStateSet = new osg::StateSet();
+        _noTextureStateSet->setTextureMode(0, GL_TEXTURE_2D, osg::StateAttribute::OFF);
+    }
 
-    osg::Vec4Array* colors = new osg::Vec4Array( numVerts );
-    walls->setColorArray( colors );
-    walls->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
+    MeshBatch& batch = getBatch( _noTextureStateSet.get(), 4*numSegs, 6*numSegs, _wallVertsHint );
 
-    osg::Vec3Array* topVerts = NULL;
-    osg::Vec4Array* topColors = NULL;
-    if ( topCap )
+    // one normal per wall face, following the winding of its triangles.
+    _faceNormals.resize( numSegs );
+    for( unsigned s=0; s<numSegs; ++s )
     {
-        topVerts = new osg::Vec3Array( pointCount );
-        topCap->setVertexArray( topVerts );
+        unsigned i = s, j = (s+1) % count;
+        osg::Vec3 n = (_bottoms[i] - _tops[i]) ^ (_tops[j] - _tops[i]);
+        n.normalize();
+        _faceNormals[s] = n;
+    }
+
+    unsigned offset = batch._verts->size();
+    batch._verts->resize( offset + 4*numSegs );
+    batch._normals->resize( offset + 4*numSegs );
+    batch._colors->resize( offset + 4*numSegs, color );
+
+    osg::Vec3* verts   = &(*batch._verts)[offset];
+    osg::Vec3* normals = &(*batch._normals)[offset];
+
+    for( unsigned s=0; s<numSegs; ++s )
+    {
+        unsigned i = s, j = (s+1) % count;
+
+        // Each face gets its own 4 verts. Corner normals are shared with the
+        // neighboring face unless the corner is sharper than the wall angle
+        // threshold; this is what the crease-angle smoothing used to produce.
+        const osg::Vec3& n = _faceNormals[s];
+        osg::Vec3 n0 = n, n1 = n;
+        if ( closed || s > 0 )
+        {
+            const osg::Vec3& prev = _faceNormals[(s+numSegs-1) % numSegs];
+            if ( n * prev >= _cosWallAngleThresh )
+            {
+                n0 = n + prev;
+                n0.normalize();
+            }
+        }
+        if ( closed || s+1 < numSegs )
+        {
+            const osg::Vec3& next = _faceNormals[(s+1) % numSegs];
+            if ( n * next >= _cosWallAngleThresh )
+            {
+                n1 = n + next;
+                n1.normalize();
+            }
+        }
+
+        unsigned p = 4*s;
+        verts[p]   = _tops[i];    normals[p]   = n0;
+        verts[p+1] = _bottoms[i]; normals[p+1] = n0;
+        verts[p+2] = _tops[j];    normals[p+2] = n1;
+        verts[p+3] = _bottoms[j]; normals[p+3] = n1;
+
+        unsigned v = offset + p;
+        batch._tris->push_back( v );
+        batch._tris->push_back( v+1 );
+        batch._tris->push_back( v+2 );
+        batch._tris->push_back( v+1 );
+        batch._tris->push_back( v+3 );
+        batch._tris->push_back( v+2 );
+    }
+}
+
+void
+ExtrudeGeometryFilter::addRoof( const osg::Vec3& up, const osg::Vec4& color )
+{
+    unsigned count = _roofVerts.size();
+    if ( count < 3 )
+        return;
+
+    if (_roofRings.size() == 1 &&
+        count <= MAX_EAR_CLIP_VERTS &&
+        s_earClip(_roofVerts, up, _roofPoly, _roofIndex, _roofTris) )
+    {
+        MeshBatch& batch = getBatch( 0L, count, _roofTris.size(), _roofVertsHint );
+        unsigned offset = batch._verts->size();
+        batch._verts->insert( batch._verts->end(), _roofVerts.begin(), _roofVerts.end() );
+        batch._normals->resize( offset + count, up );
+        batch._colors->resize( offset + count, color );
+        for( std::vector<unsigned>::const_iterator i = _roofTris.begin(); i != _roofTris.end(); ++i )
+            batch._tris->push_back( offset + *i );
+        return;
+    }
 
-        topColors = new osg::Vec4Array( pointCount );
-        topCap->setColorArray( topColors );
-        topCap->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
+    // holes, big rings or bad rings: hand the outlines to the tessellator.
+    osg::ref_ptr<osg::Geometry> roof = new osg::Geometry();
+    roof->setVertexArray( new osg::Vec3Array(_roofVerts.begin(), _roofVerts.end()) );
+    unsigned first = 0;
+    for( std::vector<unsigned>::const_iterator r = _roofRings.begin(); r != _roofRings.end(); ++r )
+    {
+        roof->addPrimitiveSet( new osg::DrawArrays(osg::PrimitiveSet::LINE_LOOP, first, *r) );
+        first += *r;
     }
 
-    osg::Vec3Array* bottomVerts = NULL;
-    if ( bottomCap )
+    osgUtil::Tessellator tess;
+    tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
+    tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_ODD );
+    tess.retessellatePolygons( *roof.get() );
+
+    // the tessellator may add verts where edges cross.
+    osg::Vec3Array* verts = static_cast<osg::Vec3Array*>( roof->getVertexArray() );
+    unsigned numIndices = 0;
+    for( unsigned i=0; i<roof->getNumPrimitiveSets(); ++i )
+        numIndices += 3 * roof->getPrimitiveSet(i)->getNumIndices();
+
+    MeshBatch& batch = getBatch( 0L, verts->size(), numIndices, _roofVertsHint );
+    unsigned offset = batch._verts->size();
+    batch._verts->insert( batch._verts->end(), verts->begin(), verts->end() );
+    batch._normals->resize( offset + verts->size(), up );
+    batch._colors->resize( offset + verts->size(), color );
+
+    const osg::Vec3Array& all = *batch._verts;
+    for( unsigned i=0; i<roof->getNumPrimitiveSets(); ++i )
     {
-        bottomVerts = new osg::Vec3Array( pointCount );
-        bottomCap->setVertexArray( bottomVerts );
+        const osg::PrimitiveSet* ps = roof->getPrimitiveSet(i);
+        unsigned n = ps->getNumIndices();
+        switch( ps->getMode() )
+        {
+        case osg::PrimitiveSet::TRIANGLES:
+            for( unsigned k=0; k+2<n; k+=3 )
+                s_addTriangle( batch._tris, all, offset, ps->index(k), ps->index(k+1), ps->index(k+2), up );
+            break;
+        case osg::PrimitiveSet::TRIANGLE_STRIP:
+            for( unsigned k=0; k+2<n; ++k )
+                s_addTriangle( batch._tris, all, offset, ps->index(k), ps->index(k+1), ps->index(k+2), up );
+            break;
+        case osg::PrimitiveSet::TRIANGLE_FAN:
+        case osg::PrimitiveSet::POLYGON:
+            for( unsigned k=1; k+1<n; ++k )
+                s_addTriangle( batch._tris, all, offset, ps->index(0), ps->index(k), ps->index(k+1), up );
+            break;
+        default:
+            break;
+        }
     }
+}
+
+bool
+ExtrudeGeometryFilter::extrudeGeometry(const Geometry*         input,
+                                       double                  height,
+                                       bool                    flatten,
+                                       bool                    makeRoof,
+                                       const osg::Vec4&        color,
+                                       const FilterContext&    cx )
+{
+    bool made_geom = false;
 
-    unsigned wallVertPtr   = 0;
-    unsigned topVertPtr    = 0;
-    unsigned bottomVertPtr = 0;
+    bool isPolygon = input->getComponentType() == Geometry::TYPE_POLYGON;
 
     double targetLen = -DBL_MAX;
     osg::Vec3d minLoc(DBL_MAX, DBL_MAX, DBL_MAX);
 
-
     // Initial pass over the geometry does two things:
     // 1: Calculate the minimum Z across all parts.
     // 2: Establish a "target length" for extrusion
@@ -159,31 +424,18 @@ ExtrudeGeometryFilter::extrudeGeometry(const Geometry*         input,
         }
     }
 
-    // now generate the extruded geometry.
+    _roofVerts.clear();
+    _roofRings.clear();
+    osg::Vec3 up;
+
+    // now generate the extruded geometry, straight into the batches.
     ConstGeometryIterator iter( input );
     while( iter.hasMore() )
     {
         const Geometry* part = iter.next();
 
-        double tex_height_m_adj = tex_height_m;
-
-        unsigned wallPartPtr = wallVertPtr;
-        unsigned topPartPtr  = topVertPtr;
-        unsigned bottomPartPtr = bottomVertPtr;
-        double   partLen = 0.0;
-        double   maxHeight = 0.0;
-
-        if ( cx.isGeocentric() )
-            maxHeight = targetLen - minLoc.length();
-        else
-            maxHeight = targetLen - minLoc.z();
-
-        //Adjust the texture height so it is a multiple of the maximum height
-        double div = osg::round(maxHeight / tex_height_m);
-        if (div == 0) div = 1; //Prevent divide by zero
-        tex_height_m_adj = maxHeight / div;
-
-        osg::DrawElementsUInt* idx = new osg::DrawElementsUInt( GL_TRIANGLES );
+        _tops.clear();
+        _bottoms.clear();
 
         for( Geometry::const_iterator m = part->begin(); m != part->end(); ++m )
         {
@@ -220,96 +472,37 @@ ExtrudeGeometryFilter::extrudeGeometry(const Geometry*         input,
                 extrudeVec = extrudeVec * cx.referenceFrame();
             }
 
-            // build the top and bottom caps
-            if ( topCap )
-            {
-                (*topColors)[topVertPtr]  = color;
-                (*topVerts)[topVertPtr++] = extrudeVec;
-            }
-            if ( bottomCap )
-            {
-                (*bottomVerts)[bottomVertPtr++] = *m;
-            }
-             
-            partLen += wallVertPtr > wallPartPtr ?
-                (extrudeVec - (*verts)[wallVertPtr-2]).length() :
-                0.0;
-
-            double h;
-            if ( tex_repeats_y )
-                h = -(extrudeVec - *m).length();
-            else
-                h = -tex_height_m_adj;
-
-            int p;
-
-            p = wallVertPtr; // ++
-            (*colors)[p] = color;
-            (*verts)[p] = extrudeVec;
-#ifdef USE_TEX
-            (*texcoords)[p].set( part_len/tex_width_m, 0.0f );
-#endif
-
-            p = wallVertPtr+1; // ++
-            (*colors)[p] = color;
-            (*verts)[p] = *m;
-#ifdef USE_TEX
-            (*texcoords)[p].set( part_len/tex_width_m, h/tex_height_m_adj );
-#endif
-
-            // form the 2 triangles
-            if ( (m+1) == part->end() )
-            {
-                if ( isPolygon )
-                {
-                    // end of the wall; loop around to close it off.
-                    idx->push_back(wallVertPtr); 
-                    idx->push_back(wallVertPtr+1);
-                    idx->push_back(wallPartPtr);
-
-                    idx->push_back(wallVertPtr+1);
-                    idx->push_back(wallPartPtr+1);
-                    idx->push_back(wallPartPtr);
-                }
-                else
-                {
-                    //nop - no elements required at the end of a line
-                }
-            }
-            else
-            {
-                idx->push_back(wallVertPtr); 
-                idx->push_back(wallVertPtr+1);
-                idx->push_back(wallVertPtr+2); 
-
-                idx->push_back(wallVertPtr+1);
-                idx->push_back(wallVertPtr+3);
-                idx->push_back(wallVertPtr+2);
-            }
+            _tops.push_back( extrudeVec );
+            _bottoms.push_back( *m );
+            up += _tops.back() - _bottoms.back();
+        }
 
-            wallVertPtr += 2;
+        if ( _tops.size() >= 2 )
+        {
+            addWalls( isPolygon, color );
             made_geom = true;
         }
 
-        walls->addPrimitiveSet( idx );
-
-        if ( topCap )
+        if ( makeRoof && !_tops.empty() )
         {
-            topCap->addPrimitiveSet( new osg::DrawArrays(
-                osg::PrimitiveSet::LINE_LOOP,
-                topPartPtr, topVertPtr - topPartPtr ) );
+            _roofVerts.insert( _roofVerts.end(), _tops.begin(), _tops.end() );
+            _roofRings.push_back( _tops.size() );
         }
-        if ( bottomCap )
+    }
+
+    if ( makeRoof && made_geom )
+    {
+        // roofs face the direction of extrusion; with no height, fall back on
+        // the ring's own (Newell) normal.
+        if ( up.normalize() == 0.0f )
         {
-            // reverse the bottom verts:
-            int len = bottomVertPtr - bottomPartPtr;
-            for( int i=bottomPartPtr; i<len/2; i++ )
-                std::swap( (*bottomVerts)[i], (*bottomVerts)[bottomPartPtr+(len-1)-i] );
-
-            bottomCap->addPrimitiveSet( new osg::DrawArrays(
-                osg::PrimitiveSet::LINE_LOOP,
-                bottomPartPtr, bottomVertPtr - bottomPartPtr ) );
+            unsigned n = _roofRings.empty() ? 0 : _roofRings.front();
+            for( unsigned i=0; i<n; ++i )
+                up += _roofVerts[i] ^ _roofVerts[(i+1)%n];
+            if ( up.normalize() == 0.0f )
+                up.set( 0.0f, 0.0f, 1.0f );
         }
+        addRoof( up, color );
     }
 
     return made_geom;
@@ -323,14 +516,9 @@ ExtrudeGeometryFilter::pushFeature( Feature* input, const FilterContext& context
     {
         Geometry* part = iter.next();
 
-        osg::ref_ptr<osg::Geometry> walls = new osg::Geometry();
-        
-        osg::ref_ptr<osg::Geometry> rooflines = 0L;
-        
-        if ( part->getType() == Geometry::TYPE_POLYGON )
+        bool makeRoof = part->getType() == Geometry::TYPE_POLYGON;
+        if ( makeRoof )
         {
-            rooflines = new osg::Geometry();
-
             // prep the shapes by making sure all polys are open:
             static_cast<Polygon*>(part)->open();
         }
@@ -354,119 +542,34 @@ ExtrudeGeometryFilter::pushFeature( Feature* input, const FilterContext& context
             height = _height;
         }
 
-        if ( extrudeGeometry( part, height, _flatten, walls.get(), rooflines.get(), 0L, _color, context ) )
-        {      
-#ifdef USE_TEX
-            if ( skin )
-            {
-                osg::StateSet* wall_ss = env->getResourceCache()->getStateSet( skin );
-                if ( wall_ss )
-                {
-                    walls->setStateSet( wall_ss );
-                }
-                //env->getSession()->getResources()->getStateSet( skin ) );
-                //env->getSession()->markResourceUsed( skin );
-            }
-            else
-#endif
-            {
-                //There is no skin, so disable texturing for the walls to prevent other textures from being applied to the walls
-                if ( !_noTextureStateSet.valid() )
-                {
-                    _noTextureStateSet = new osg::StateSet();
-                    _noTextureStateSet->setTextureMode(0, GL_TEXTURE_2D, osg::StateAttribute::OFF);
-                }
-
-                walls->setStateSet( _noTextureStateSet.get() );
-            }
-
-            // generate per-vertex normals, altering the geometry as necessary to avoid
-            // smoothing around sharp corners
-#if OSG_MIN_VERSION_REQUIRED(2,9,9)
-            //Crease angle threshold wasn't added until
-            osgUtil::SmoothingVisitor::smooth(
-                *walls.get(), 
-                osg::DegreesToRadians(_wallAngleThresh_deg) );            
-#else
-            osgUtil::SmoothingVisitor::smooth(*walls.get());            
-#endif
-
-            // tessellate and add the roofs if necessary:
-            if ( rooflines.valid() )
-            {
-                osgUtil::Tessellator tess;
-                tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
-                tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_ODD ); //POSITIVE );
-                tess.retessellatePolygons( *(rooflines.get()) );
-
-                // generate default normals (no crease angle necessary; they are all pointing up)
-                osgUtil::SmoothingVisitor::smooth( *rooflines.get() );
-
-                // texture the rooflines if necessary
-                //applyOverlayTexturing( rooflines.get(), input, env );
-                
-                // reorganize the drawable into a single triangle set.
-                MeshConsolidator::run( *rooflines.get() );
-
-                // mark this geometry as DYNAMIC because otherwise the OSG optimizer will destroy it.
-                rooflines->setDataVariance( osg::Object::DYNAMIC );
-            }
-
-            //applyFragmentName( new_fragment, input, env );
-
-            _geode->addDrawable( walls.get() );
-
-            if ( rooflines.valid() )
-                _geode->addDrawable( rooflines.get() );
-        }   
+        extrudeGeometry( part, height, _flatten, makeRoof, _color, context );
     }
 
-
     return true;
 }
 
-namespace 
-{
-    struct EnableVBO : public osg::NodeVisitor 
-    {
-        EnableVBO() : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ) { }
-
-        void accept( osg::Geode& geode )
-        {
-            for( unsigned i=0; i<geode.getNumDrawables(); ++i )
-            {
-                osg::Geometry* geom = geode.getDrawable(i)->asGeometry();
-                if ( geom )
-                {
-                    geom->setUseVertexBufferObjects( true );
-                }
-            }
-            traverse( geode );
-        }
-    };
-}
-
 osg::Node*
 ExtrudeGeometryFilter::push( FeatureList& input, const FilterContext& context )
 {
     reset();
 
-    bool ok = true;
+    // size the batch buffers up front (up to the batch limit) so they don't reallocate
+    // while we extrude. Walls take 4 verts per segment, roofs one per point.
+    unsigned numPoints = 0;
     for( FeatureList::iterator i = input.begin(); i != input.end(); i++ )
-        pushFeature( i->get(), context );
-
-    // BREAKS if you use VBOs - make sure they're disabled
-    osgUtil::Optimizer optimizer;
-    optimizer.optimize( _geode.get(), osgUtil::Optimizer::MERGE_GEOMETRY );
+    {
+        if ( i->get()->getGeometry() )
+            numPoints += i->get()->getGeometry()->getTotalPointCount();
+    }
+    _wallVertsHint = 4 * numPoints;
+    _roofVertsHint = numPoints;
 
-    //optimizer.optimize( _geode.get(), osgUtil::Optimizer::INDEX_MESH );
+    for( FeatureList::iterator i = input.begin(); i != input.end(); i++ )
+        pushFeature( i->get(), context );
 
-    //TODO: figure out whether this helps
-    //optimizer.optimize( _geode, osgUtil::Optimizer::VERTEX_PRETRANSFORM | osgUtil::Optimizer::VERTEX_POSTTRANSFORM );
-    
-    // activate the VBOs after optimization
-    EnableVBO visitor;
-    _geode->accept( visitor );
+    // the geode now holds a drawable per state set (more if a batch filled up), with
+    // VBOs already enabled.
+    _batches.clear();
 
     return _geode.release();
 }
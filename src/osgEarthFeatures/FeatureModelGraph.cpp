@@ -295,7 +295,7 @@ FeatureModelGraph::buildSubTiles(unsigned            nextLevelIndex,
             bool blacklisted = false;
             {
                 Threading::ScopedReadLock sharedLock( _blacklistMutex );
-                blacklisted = _blacklist.find( uri ) != _blacklist.end();
+                blacklisted = _blacklist.find( TileKeyID(nextLevelIndex, u, v) ) != _blacklist.end();
             }
 
             if ( !blacklisted )
@@ -448,7 +448,7 @@ FeatureModelGraph::load( unsigned levelIndex, unsigned tileX, unsigned tileY, co
     if ( result->getNumChildren() == 0 )
     {
         Threading::ScopedWriteLock exclusiveLock( _blacklistMutex );
-        _blacklist.insert( uri );
+        _blacklist.insert( TileKeyID(levelIndex, tileX, tileY) );
 
         OE_DEBUG << LC << "Blacklisting: " << uri << std::endl;
     }